@@ -0,0 +1,72 @@
+// Benchmarks moving and rotating the placeables of a large number of entities with the per-object math bindings
+// versus the bulk math functions (math.ReadPositions, math.RotateFloat3s, math.WritePositions etc.), f.ex.
+// server --headless --run jsmodules/apitest/bulk_math_benchmark.js
+
+var numEntities = 5000;
+var numIterations = 10;
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+
+function Benchmark(description, func)
+{
+    var start = frame.WallClockTime();
+    for(var i = 0; i < numIterations; ++i)
+        func();
+    var elapsed = frame.WallClockTime() - start;
+    print(description + ": " + (elapsed * 1000 / numIterations).toFixed(3) + " ms per pass over " + numEntities + " entities.");
+}
+
+if (benchmarkScene)
+{
+    var entities = [];
+    benchmarkScene.BeginBatch();
+    for(var i = 0; i < numEntities; ++i)
+    {
+        var entity = benchmarkScene.CreateEntity(0, ["EC_Placeable"], 2);
+        var t = entity.placeable.transform;
+        t.pos.x = i % 100;
+        t.pos.z = Math.floor(i / 100);
+        entity.placeable.transform = t;
+        entities.push(entity);
+    }
+    benchmarkScene.EndBatch();
+
+    var offset = new float3(0.1, 0, 0);
+    var rotation = Quat.RotateY(0.01);
+
+    Benchmark("Per-object translate", function()
+    {
+        for(var i = 0; i < entities.length; ++i)
+        {
+            var t = entities[i].placeable.transform;
+            t.pos = t.pos.Add(offset);
+            entities[i].placeable.transform = t;
+        }
+    });
+    Benchmark("Bulk translate", function()
+    {
+        var positions = math.ReadPositions(entities);
+        math.WritePositions(entities, math.TranslateFloat3s(positions, offset));
+    });
+
+    Benchmark("Per-object rotate around origin", function()
+    {
+        for(var i = 0; i < entities.length; ++i)
+        {
+            var t = entities[i].placeable.transform;
+            t.pos = rotation.Mul(t.pos);
+            entities[i].placeable.transform = t;
+        }
+    });
+    Benchmark("Bulk rotate around origin", function()
+    {
+        var positions = math.ReadPositions(entities);
+        math.WritePositions(entities, math.RotateFloat3s(rotation, positions));
+    });
+
+    benchmarkScene.BeginBatch();
+    for(var i = 0; i < entities.length; ++i)
+        benchmarkScene.RemoveEntity(entities[i].id, 2);
+    benchmarkScene.EndBatch();
+}
+else
+    print("bulk_math_benchmark.js: Server scene not found.");
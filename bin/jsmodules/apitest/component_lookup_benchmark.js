@@ -0,0 +1,41 @@
+// Benchmarks component lookups by type name, by type ID and by type name and component name on an entity with many components.
+// Run f.ex. with
+// server --headless --run jsmodules/apitest/component_lookup_benchmark.js
+
+var numLookups = 200000;
+var numDynamicComponents = 16;
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+
+function Benchmark(description, func)
+{
+    var start = frame.WallClockTime();
+    for(var i = 0; i < numLookups; ++i)
+        func(i);
+    var elapsed = frame.WallClockTime() - start;
+    print(description + ": " + numLookups + " lookups in " + elapsed.toFixed(3) + " s, " +
+        (elapsed * 1000000 / numLookups).toFixed(3) + " us per lookup.");
+}
+
+if (benchmarkScene)
+{
+    var componentTypes = ["EC_Name", "EC_Placeable", "EC_Mesh", "EC_Light", "EC_RigidBody", "EC_Sound"];
+    var entity = benchmarkScene.CreateEntity(0, componentTypes, 2);
+    for(var i = 0; i < numDynamicComponents; ++i)
+        entity.GetOrCreateComponent("EC_DynamicComponent", "Dynamic" + i, 2);
+    print("Entity has " + (componentTypes.length + numDynamicComponents) + " components.");
+
+    Benchmark("First type (EC_Name)", function(i) { return entity.GetComponent("EC_Name"); });
+    Benchmark("Late type (EC_Sound)", function(i) { return entity.GetComponent("EC_Sound"); });
+    Benchmark("Missing type (EC_Script)", function(i) { return entity.GetComponent("EC_Script"); });
+    // EC_Sound type ID, served by the hash lookup that GetComponent<T>() uses from C++
+    var soundTypeId = 6;
+    Benchmark("Late type by type ID (EC_Sound)", function(i) { return entity.GetComponent(soundTypeId); });
+    Benchmark("Type and name (EC_DynamicComponent)", function(i)
+    {
+        return entity.GetComponent("EC_DynamicComponent", "Dynamic" + (i % numDynamicComponents));
+    });
+
+    benchmarkScene.RemoveEntity(entity.id, 2);
+}
+else
+    print("component_lookup_benchmark.js: Server scene not found.");
@@ -0,0 +1,106 @@
+// Benchmarks the server frame time and memory use with a large number of moving, parented placeables.
+// Run on a headless server with and without the Ogre scene graph and compare the results, f.ex.
+// server --headless --run jsmodules/apitest/headless_transform_benchmark.js
+// server --headless --norender --run jsmodules/apitest/headless_transform_benchmark.js
+
+engine.ImportExtension("qt.core");
+
+var numChains = 5000;
+var chainLength = 4;
+var numFrames = 300;
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+
+var roots = [];
+var leaves = [];
+var ids = [];
+var framesLeft = numFrames;
+var startTime = 0;
+var rssBefore = "";
+
+// Returns the resident set size of the process as reported by the OS, or "n/a" if not available.
+function ResidentSetSize()
+{
+    var file = new QFile("/proc/self/status");
+    if (!file.open(QIODevice.ReadOnly | QIODevice.Text))
+        return "n/a";
+    var lines = file.readAll().toString().split("\n");
+    file.close();
+    for(var i = 0; i < lines.length; ++i)
+        if (lines[i].indexOf("VmRSS:") == 0)
+            return lines[i].substring(6).trim();
+    return "n/a";
+}
+
+function CreateEntities()
+{
+    benchmarkScene.BeginBatch();
+    for(var i = 0; i < numChains; ++i)
+    {
+        var parent = null;
+        for(var j = 0; j < chainLength; ++j)
+        {
+            var entity = benchmarkScene.CreateEntity(0, ["EC_Placeable"], 2);
+            var t = entity.placeable.transform;
+            if (parent)
+            {
+                t.pos.y = 1;
+                var parentRef = entity.placeable.parentRef;
+                parentRef.ref = parent;
+                entity.placeable.parentRef = parentRef;
+            }
+            else
+            {
+                t.pos.x = i % 100;
+                t.pos.z = Math.floor(i / 100);
+                roots.push(entity);
+            }
+            t.rot.y = 10;
+            entity.placeable.transform = t;
+            ids.push(entity.id);
+            parent = entity;
+        }
+        leaves.push(parent);
+    }
+    benchmarkScene.EndBatch();
+}
+
+function OnFrameUpdated(frameTime)
+{
+    if (framesLeft == numFrames)
+        startTime = frame.WallClockTime();
+
+    // Move the roots and read back the world positions of the leaves, like server-side game logic would
+    var sum = 0;
+    for(var i = 0; i < roots.length; ++i)
+    {
+        var t = roots[i].placeable.transform;
+        t.rot.y += 1;
+        roots[i].placeable.transform = t;
+    }
+    for(var i = 0; i < leaves.length; ++i)
+        sum += leaves[i].placeable.WorldPosition().y;
+
+    if (--framesLeft > 0)
+        return;
+
+    var elapsed = frame.WallClockTime() - startTime;
+    frame.Updated.disconnect(OnFrameUpdated);
+    print((framework.HasCommandLineParameter("--norender") ? "Without" : "With") +
+        " Ogre scene graph: " + ids.length + " placeables, " + (1000 * elapsed / numFrames).toFixed(3) + " ms per frame, RSS " +
+        rssBefore + " before and " + ResidentSetSize() + " after creating the entities.");
+
+    for(var i = 0; i < ids.length; ++i)
+        benchmarkScene.RemoveEntity(ids[i], 2);
+    roots = [];
+    leaves = [];
+    ids = [];
+}
+
+if (benchmarkScene)
+{
+    rssBefore = ResidentSetSize();
+    CreateEntities();
+    frame.Updated.connect(OnFrameUpdated);
+}
+else
+    print("headless_transform_benchmark.js: Server scene not found.");
@@ -0,0 +1,59 @@
+// Benchmarks creating a large number of entities one by one versus inside a scene batch (Scene.BeginBatch/EndBatch).
+// Run on a server, with a client connected to see the sync cost as well, f.ex.
+// server --headless --run jsmodules/apitest/scene_batch_benchmark.js
+
+var numEntities = 50000;
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+
+var signalCount = 0;
+function CountSignal()
+{
+    ++signalCount;
+}
+
+function CreateEntities(useBatch)
+{
+    var ids = [];
+    signalCount = 0;
+    var start = frame.WallClockTime();
+    if (useBatch)
+        benchmarkScene.BeginBatch();
+    for(var i = 0; i < numEntities; ++i)
+    {
+        var entity = benchmarkScene.CreateEntity(0, ["EC_Name", "EC_Placeable"], 2);
+        entity.name = "BatchBenchmark" + i;
+        var t = entity.placeable.transform;
+        t.pos.x = i % 256;
+        t.pos.z = Math.floor(i / 256);
+        entity.placeable.transform = t;
+        // Signal the creation now, as the scene would otherwise do at the end of the frame
+        benchmarkScene.EmitEntityCreated(entity, 2);
+        ids.push(entity.id);
+    }
+    if (useBatch)
+        benchmarkScene.EndBatch();
+    var elapsed = frame.WallClockTime() - start;
+    print((useBatch ? "Batched:   " : "Unbatched: ") + numEntities + " entities created in " + elapsed.toFixed(3) +
+        " s, " + signalCount + " scene signals emitted.");
+
+    for(var i = 0; i < ids.length; ++i)
+        benchmarkScene.RemoveEntity(ids[i], 2);
+}
+
+if (benchmarkScene)
+{
+    benchmarkScene.EntityCreated.connect(CountSignal);
+    benchmarkScene.EntitiesCreated.connect(CountSignal);
+    benchmarkScene.ComponentAdded.connect(CountSignal);
+    benchmarkScene.AttributeChanged.connect(CountSignal);
+
+    CreateEntities(false);
+    CreateEntities(true);
+
+    benchmarkScene.EntityCreated.disconnect(CountSignal);
+    benchmarkScene.EntitiesCreated.disconnect(CountSignal);
+    benchmarkScene.ComponentAdded.disconnect(CountSignal);
+    benchmarkScene.AttributeChanged.disconnect(CountSignal);
+}
+else
+    print("scene_batch_benchmark.js: Server scene not found.");
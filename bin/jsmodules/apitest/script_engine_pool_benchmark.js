@@ -0,0 +1,51 @@
+// Benchmarks loading a scene with a large number of scripted entities. Run once with and once without the
+// --scriptenginepool command line parameter and compare the times printed here and the memory use of the process, f.ex.
+// server --headless --storage jsmodules/apitest/ --run jsmodules/apitest/script_engine_pool_benchmark.js --scriptenginepool 4
+
+var numEntities = 2000;
+var entityScriptRef = "local://script_engine_pool_entity.js";
+var evaluatedName = "ScriptPoolBenchmarkEvaluated";
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+var entityIds = [];
+var start = 0;
+
+function CheckEvaluated()
+{
+    var numEvaluated = 0;
+    for(var i = 0; i < entityIds.length; ++i)
+    {
+        var entity = benchmarkScene.GetEntity(entityIds[i]);
+        if (entity && entity.name == evaluatedName)
+            ++numEvaluated;
+    }
+    if (numEvaluated < entityIds.length)
+        return;
+
+    frame.Updated.disconnect(CheckEvaluated);
+    print(numEntities + " entity scripts created and evaluated in " + (frame.WallClockTime() - start).toFixed(3) + " s.");
+
+    start = frame.WallClockTime();
+    benchmarkScene.BeginBatch();
+    for(var i = 0; i < entityIds.length; ++i)
+        benchmarkScene.RemoveEntity(entityIds[i], 2);
+    benchmarkScene.EndBatch();
+    print(numEntities + " entity scripts unloaded in " + (frame.WallClockTime() - start).toFixed(3) + " s.");
+}
+
+if (benchmarkScene)
+{
+    start = frame.WallClockTime();
+    benchmarkScene.BeginBatch();
+    for(var i = 0; i < numEntities; ++i)
+    {
+        var entity = benchmarkScene.CreateEntity(0, ["EC_Name", "EC_Script"], 2);
+        entity.script.runOnLoad = true;
+        entity.script.scriptRef = new AssetReferenceList([entityScriptRef]);
+        entityIds.push(entity.id);
+    }
+    benchmarkScene.EndBatch();
+    // The script assets load asynchronously, wait until all scripts have been evaluated
+    frame.Updated.connect(CheckEvaluated);
+}
+else
+    print("script_engine_pool_benchmark.js: Server scene not found.");
@@ -0,0 +1,4 @@
+// Entity script used by script_engine_pool_benchmark.js. Marks its entity as evaluated.
+
+var evaluatedName = "ScriptPoolBenchmarkEvaluated";
+me.name = evaluatedName;
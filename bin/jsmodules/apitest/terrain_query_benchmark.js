@@ -0,0 +1,70 @@
+// Benchmarks terrain height queries of a large number of points with the per-point EC_Terrain functions
+// versus the batch query (GetHeights), and terrain raycasts. Works also without rendering, f.ex.
+// server --headless --norender --run jsmodules/apitest/terrain_query_benchmark.js
+
+var numPoints = 5000;
+var numIterations = 10;
+var terrainPatches = 16;
+var benchmarkScene = framework.Scene().GetScene("TundraServer");
+
+function Benchmark(description, func)
+{
+    var start = frame.WallClockTime();
+    for(var i = 0; i < numIterations; ++i)
+        func();
+    var elapsed = frame.WallClockTime() - start;
+    print(description + ": " + (elapsed * 1000 / numIterations).toFixed(3) + " ms per pass over " + numPoints + " points.");
+}
+
+if (benchmarkScene)
+{
+    var entity = benchmarkScene.CreateEntity(0, ["EC_Placeable", "EC_Terrain"], 2);
+    var terrain = entity.terrain;
+    terrain.xPatches = terrainPatches;
+    terrain.yPatches = terrainPatches;
+    var size = terrainPatches * 16;
+    for(var y = 0; y < size; ++y)
+        for(var x = 0; x < size; ++x)
+            terrain.SetPointHeight(x, y, 10 * Math.sin(x * 0.05) * Math.cos(y * 0.07));
+    terrain.RegenerateDirtyTerrainPatches();
+
+    var points = [];
+    var xz = [];
+    for(var i = 0; i < numPoints; ++i)
+    {
+        var p = new float3(Math.random() * (size - 1), 0, Math.random() * (size - 1));
+        points.push(p);
+        xz.push(p.x, p.z);
+    }
+
+    var sum = 0;
+    Benchmark("Per-point GetPointOnMap", function()
+    {
+        for(var i = 0; i < points.length; ++i)
+            sum += terrain.GetPointOnMap(points[i]).y;
+    });
+    Benchmark("Batch GetHeights", function()
+    {
+        var heights = terrain.GetHeights(xz);
+        for(var i = 0; i < heights.length; ++i)
+            sum += heights[i];
+    });
+    Benchmark("Batch GetNormals", function()
+    {
+        var normals = terrain.GetNormals(xz);
+        sum += normals.length;
+    });
+    Benchmark("Raycast", function()
+    {
+        for(var i = 0; i < points.length; ++i)
+        {
+            var origin = new float3(points[i].x, 50, points[i].z);
+            var direction = new float3(0.5, -1, 0.3).Normalized();
+            sum += terrain.Raycast(new Ray(origin, direction));
+        }
+    });
+
+    benchmarkScene.RemoveEntity(entity.id, 2);
+}
+else
+    print("terrain_query_benchmark.js: Server scene not found.");
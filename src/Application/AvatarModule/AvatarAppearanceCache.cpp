@@ -0,0 +1,210 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AvatarAppearanceCache.h"
+#include "AssetAPI.h"
+#include "IAsset.h"
+#include "LoggingFunctions.h"
+
+#include <Ogre.h>
+#include <QString>
+
+#include "MemoryLeakCheck.h"
+
+/// Removes the triangles that use any of the given vertices from the index buffer of a submesh, in one pass.
+template<typename Index>
+static size_t RemoveTriangles(Index *indices, size_t indexCount, const std::set<uint> &verticesToHide)
+{
+    size_t dst = 0;
+    for(size_t src = 0; src + 2 < indexCount; src += 3)
+    {
+        if (verticesToHide.find(indices[src]) != verticesToHide.end() ||
+            verticesToHide.find(indices[src+1]) != verticesToHide.end() ||
+            verticesToHide.find(indices[src+2]) != verticesToHide.end())
+            continue;
+        if (dst != src)
+        {
+            indices[dst] = indices[src];
+            indices[dst+1] = indices[src+1];
+            indices[dst+2] = indices[src+2];
+        }
+        dst += 3;
+    }
+    return dst;
+}
+
+static void HideVertices(Ogre::Mesh *mesh, const std::set<uint> &verticesToHide)
+{
+    // Under current system, it seems vertices should only be hidden from first submesh
+    if (!mesh || !mesh->getNumSubMeshes())
+        return;
+    Ogre::SubMesh *submesh = mesh->getSubMesh(0);
+    Ogre::IndexData *data = submesh ? submesh->indexData : 0;
+    if (!data)
+        return;
+    Ogre::HardwareIndexBufferSharedPtr ibuf = data->indexBuffer;
+    if (ibuf.isNull())
+        return;
+
+    void *indices = ibuf->lock(data->indexStart * ibuf->getIndexSize(), data->indexCount * ibuf->getIndexSize(), Ogre::HardwareBuffer::HBL_NORMAL);
+    if (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT)
+        data->indexCount = RemoveTriangles(static_cast<u32 *>(indices), data->indexCount, verticesToHide);
+    else
+        data->indexCount = RemoveTriangles(static_cast<u16 *>(indices), data->indexCount, verticesToHide);
+    ibuf->unlock();
+}
+
+AvatarAppearanceCache::AvatarAppearanceCache(AssetAPI *assetAPI) :
+    assetAPI_(assetAPI),
+    nextId_(0)
+{
+}
+
+AvatarAppearanceCache::~AvatarAppearanceCache()
+{
+    if (!Ogre::MeshManager::getSingletonPtr())
+        return;
+    for(std::map<std::string, CachedMesh>::iterator iter = meshes_.begin(); iter != meshes_.end(); ++iter)
+    {
+        try
+        {
+            Ogre::MeshManager::getSingleton().remove(iter->first);
+        }
+        catch(...) {}
+    }
+}
+
+std::string AvatarAppearanceCache::AcquireMesh(const std::string &meshName, const std::string &skeletonName, const std::set<uint> &verticesToHide)
+{
+    std::string key = meshName + "|" + skeletonName + "|";
+    for(std::set<uint>::const_iterator iter = verticesToHide.begin(); iter != verticesToHide.end(); ++iter)
+        key += QString::number(*iter).toStdString() + ",";
+
+    std::map<std::string, std::string>::iterator existing = keys_.find(key);
+    if (existing != keys_.end())
+    {
+        ++meshes_[existing->second].refCount;
+        return existing->second;
+    }
+
+    Ogre::MeshManager &meshMgr = Ogre::MeshManager::getSingleton();
+    Ogre::MeshPtr mesh = meshMgr.getByName(AssetAPI::SanitateAssetRef(meshName));
+    if (mesh.isNull())
+    {
+        // For local meshes, mesh will not get automatically loaded until used in an entity. Load now if necessary
+        try
+        {
+            meshMgr.load(meshName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+            mesh = meshMgr.getByName(meshName);
+        }
+        catch(Ogre::Exception &e)
+        {
+            LogError("AvatarAppearanceCache::AcquireMesh: Could not load mesh " + meshName + ": " + std::string(e.what()));
+            return std::string();
+        }
+    }
+    if (mesh.isNull())
+        return std::string();
+
+    Ogre::SkeletonPtr skeleton;
+    if (!skeletonName.empty())
+    {
+        skeleton = Ogre::SkeletonManager::getSingleton().getByName(AssetAPI::SanitateAssetRef(skeletonName));
+        if (skeleton.isNull())
+        {
+            LogError("AvatarAppearanceCache::AcquireMesh: Could not set skeleton " + skeletonName + " to mesh " + meshName + ": not found");
+            return std::string();
+        }
+    }
+
+    std::string composedName = "AvatarAppearanceCache_mesh_" + QString::number(nextId_++).toStdString();
+    try
+    {
+        Ogre::MeshPtr composed = mesh->clone(composedName);
+        composed->setAutoBuildEdgeLists(false);
+        if (!skeleton.isNull())
+            composed->_notifySkeleton(skeleton);
+        HideVertices(composed.get(), verticesToHide);
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogError("AvatarAppearanceCache::AcquireMesh: Could not compose mesh " + meshName + ": " + std::string(e.what()));
+        try
+        {
+            meshMgr.remove(composedName);
+        }
+        catch(...) {}
+        return std::string();
+    }
+
+    CachedMesh &cached = meshes_[composedName];
+    cached.key = key;
+    cached.meshName = meshName;
+    cached.skeletonName = skeletonName;
+    cached.refCount = 1;
+    keys_[key] = composedName;
+    TrackAsset(meshName);
+    TrackAsset(skeletonName);
+    return composedName;
+}
+
+void AvatarAppearanceCache::ReleaseMesh(const std::string &composedName)
+{
+    std::map<std::string, CachedMesh>::iterator iter = meshes_.find(composedName);
+    if (iter == meshes_.end())
+        return;
+    if (--iter->second.refCount > 0)
+        return;
+
+    // An evicted mesh no longer has a key; a new mesh may have been composed with the same key since
+    if (!iter->second.key.empty())
+        keys_.erase(iter->second.key);
+    meshes_.erase(iter);
+    // Entities still using the mesh keep it alive until they are destroyed.
+    try
+    {
+        Ogre::MeshManager::getSingleton().remove(composedName);
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogWarning("AvatarAppearanceCache::ReleaseMesh: Could not remove mesh " + composedName + ": " + std::string(e.what()));
+    }
+}
+
+void AvatarAppearanceCache::TrackAsset(const std::string &assetName)
+{
+    if (!assetAPI_ || assetName.empty())
+        return;
+    AssetPtr asset = assetAPI_->GetAsset(QString::fromStdString(assetName));
+    if (!asset)
+        return;
+    connect(asset.get(), SIGNAL(Unloaded(IAsset *)), this, SLOT(OnAssetUnloaded(IAsset *)), Qt::UniqueConnection);
+    connect(asset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnAssetLoaded(AssetPtr)), Qt::UniqueConnection);
+}
+
+void AvatarAppearanceCache::OnAssetUnloaded(IAsset *asset)
+{
+    if (asset)
+        Evict(asset->Name());
+}
+
+void AvatarAppearanceCache::OnAssetLoaded(AssetPtr asset)
+{
+    if (asset)
+        Evict(asset->Name());
+}
+
+void AvatarAppearanceCache::Evict(const QString &assetName)
+{
+    const std::string name = assetName.toStdString();
+    for(std::map<std::string, CachedMesh>::iterator iter = meshes_.begin(); iter != meshes_.end(); ++iter)
+    {
+        CachedMesh &cached = iter->second;
+        if (cached.key.empty() || (cached.meshName != name && cached.skeletonName != name))
+            continue;
+        keys_.erase(cached.key);
+        cached.key.clear();
+    }
+}
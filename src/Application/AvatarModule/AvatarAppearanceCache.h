@@ -0,0 +1,81 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "AssetFwd.h"
+
+#include <QObject>
+
+#include <map>
+#include <set>
+#include <string>
+
+class AssetAPI;
+
+/// Shares the composed body meshes of avatars with identical appearances.
+/** Attachments that hide vertices of the avatar body need a copy of the body mesh with those triangles removed from its index buffer.
+    The copies are keyed by the body mesh, skeleton and hidden vertices of the avatar description, so that all avatars with the same
+    appearance use one copy, instead of each avatar cloning the mesh and rewriting its index buffer.
+    The copies are reference counted and removed from the Ogre mesh manager when the last avatar releases them.
+    When the body mesh or skeleton asset of a copy is unloaded or reloaded, the copy is evicted, so that the avatars built after
+    that compose a new copy from the current data. The avatars still using the evicted copy keep it until they release it.
+    Owned by AvatarModule. */
+class AvatarAppearanceCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AvatarAppearanceCache(AssetAPI *assetAPI);
+    ~AvatarAppearanceCache();
+
+    /// Returns the name of the Ogre mesh composed of the given body mesh, skeleton and hidden vertices, creating it if necessary.
+    /** Each successful call must be paired with a ReleaseMesh call.
+        @param meshName Ogre resource name of the body mesh.
+        @param skeletonName Ogre resource name of the skeleton to set to the mesh, or empty to keep the skeleton of the mesh.
+        @param verticesToHide Vertices whose triangles are removed from the first submesh.
+        @return The composed mesh name, or an empty string if the mesh or the skeleton is not loaded. */
+    std::string AcquireMesh(const std::string &meshName, const std::string &skeletonName, const std::set<uint> &verticesToHide);
+
+    /// Releases a mesh returned by AcquireMesh. The mesh is removed when it is no longer used by any avatar.
+    void ReleaseMesh(const std::string &composedName);
+
+    /// Returns the number of composed meshes in the cache.
+    size_t NumMeshes() const { return meshes_.size(); }
+
+private slots:
+    /// Evicts the meshes composed of an unloaded asset.
+    void OnAssetUnloaded(IAsset *asset);
+    /// Evicts the meshes composed of a reloaded asset.
+    void OnAssetLoaded(AssetPtr asset);
+
+private:
+    struct CachedMesh
+    {
+        CachedMesh() : refCount(0) {}
+
+        /// Key of the mesh in keys_, or empty if the mesh has been evicted
+        std::string key;
+        /// Name of the body mesh asset the mesh is composed of
+        std::string meshName;
+        /// Name of the skeleton asset set to the mesh, or empty
+        std::string skeletonName;
+        /// Number of avatars using the mesh
+        int refCount;
+    };
+
+    /// Tracks the unloads and reloads of an asset the composed meshes depend on.
+    void TrackAsset(const std::string &assetName);
+
+    /// Removes the composed meshes of an asset from the keys, so that they are no longer handed out.
+    void Evict(const QString &assetName);
+
+    AssetAPI *assetAPI_;
+
+    /// Composed meshes by Ogre mesh name
+    std::map<std::string, CachedMesh> meshes_;
+    /// Composed mesh names by appearance key
+    std::map<std::string, std::string> keys_;
+    /// Counter for unique mesh names
+    uint nextId_;
+};
@@ -11,16 +11,21 @@
 #include "AvatarDescAsset.h"
 #include "ConsoleAPI.h"
 #include "IComponentFactory.h"
+#include "Profiler.h"
 
 #include "EC_Avatar.h"
+#include "AvatarAppearanceCache.h"
 
-AvatarModule::AvatarModule() : IModule("Avatar")
+AvatarModule::AvatarModule() :
+    IModule("Avatar"),
+    maxBuildStepsPerFrame(8)
 {
 }
 
 AvatarModule::~AvatarModule()
 {
     SAFE_DELETE(avatarEditor);
+    appearanceCache.reset();
 }
 
 void AvatarModule::Load()
@@ -34,12 +39,47 @@ void AvatarModule::Load()
 
 void AvatarModule::Initialize()
 {
+    if (!framework_->IsHeadless())
+        appearanceCache = boost::shared_ptr<AvatarAppearanceCache>(new AvatarAppearanceCache(framework_->Asset()));
+    if (framework_->HasCommandLineParameter("--avatarbuildsteps"))
+    {
+        bool ok;
+        int steps = framework_->CommandLineParameters("--avatarbuildsteps")[0].toInt(&ok);
+        if (ok && steps >= 0)
+            maxBuildStepsPerFrame = steps;
+    }
+
     avatarEditor = new AvatarEditor(this);
     framework_->Console()->RegisterCommand("editavatar",
         "Edits the avatar in a specific entity. Usage: editavatar(entityname)",
         this, SLOT(EditAvatar(const QString &)));
 }
 
+void AvatarModule::Update(f64 frametime)
+{
+    if (buildQueue.empty())
+        return;
+
+    PROFILE(AvatarModule_BuildAppearances);
+
+    // Finish one avatar at a time, so that the avatars appear complete instead of all of them being half-built for a while.
+    int steps = 0;
+    while(!buildQueue.empty() && (maxBuildStepsPerFrame == 0 || steps < maxBuildStepsPerFrame))
+    {
+        EC_Avatar *avatar = buildQueue.front();
+        if (!avatar || avatar->BuildAppearanceStep())
+            buildQueue.pop_front();
+        if (avatar)
+            ++steps;
+    }
+}
+
+void AvatarModule::QueueAppearanceBuild(EC_Avatar *avatar)
+{
+    if (avatar)
+        buildQueue.push_back(QPointer<EC_Avatar>(avatar));
+}
+
 AvatarEditor* AvatarModule::GetAvatarEditor() const
 {
     return avatarEditor.data();
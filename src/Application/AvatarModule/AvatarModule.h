@@ -6,8 +6,12 @@
 #include "AvatarModuleApi.h"
 
 #include <QPointer>
+#include <boost/shared_ptr.hpp>
+#include <list>
 
 class AvatarEditor;
+class AvatarAppearanceCache;
+class EC_Avatar;
 
 class AV_MODULE_API AvatarModule : public IModule
 {
@@ -19,6 +23,13 @@ public:
 
     void Load();
     void Initialize();
+    void Update(f64 frametime);
+
+    /// Queues an avatar to build its appearance over the next frames, see EC_Avatar::BuildAppearanceStep.
+    void QueueAppearanceBuild(EC_Avatar *avatar);
+
+    /// Returns the cache of composed avatar meshes shared between identical avatars.
+    boost::shared_ptr<AvatarAppearanceCache> AppearanceCache() const { return appearanceCache; }
 
 public slots:
     AvatarEditor* GetAvatarEditor() const;
@@ -28,4 +39,12 @@ public slots:
 
 private:
     QPointer<AvatarEditor> avatarEditor;
+
+    boost::shared_ptr<AvatarAppearanceCache> appearanceCache;
+
+    /// Avatars waiting to build their appearance, in order. The front avatar is built first.
+    std::list<QPointer<EC_Avatar> > buildQueue;
+
+    /// Maximum number of appearance build steps per frame, or 0 for no limit.
+    int maxBuildStepsPerFrame;
 };
@@ -4,6 +4,8 @@
 #define OGRE_INTEROP
 #include "DebugOperatorNew.h"
 #include "EC_Avatar.h"
+#include "AvatarModule.h"
+#include "AvatarAppearanceCache.h"
 #include "EC_Mesh.h"
 #include "EC_AnimationController.h"
 #include "EC_Placeable.h"
@@ -23,7 +25,6 @@
 void ApplyBoneModifier(Entity* entity, const BoneModifier& modifier, float value);
 void ResetBones(Entity* entity);
 Ogre::Bone* GetAvatarBone(Entity* entity, const std::string& bone_name);
-void HideVertices(Ogre::Entity*, std::set<uint> vertices_to_hide);
 void GetInitialDerivedBonePosition(Ogre::Node* bone, Ogre::Vector3& position);
 
 // Regrettable magic value
@@ -31,7 +32,8 @@ static const float FIXED_HEIGHT_OFFSET = -0.87f;
 
 EC_Avatar::EC_Avatar(Scene* scene) :
     IComponent(scene),
-    appearanceRef(this, "Appearance ref", AssetReference("", "Avatar"))
+    appearanceRef(this, "Appearance ref", AssetReference("", "Avatar")),
+    buildStep_(-1)
 {
     connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)),
         this, SLOT(OnAttributeUpdated(IAttribute*)));
@@ -43,6 +45,7 @@ EC_Avatar::EC_Avatar(Scene* scene) :
 
 EC_Avatar::~EC_Avatar()
 {
+    ReleaseComposedMesh();
 }
 
 void EC_Avatar::OnAvatarAppearanceFailed(IAssetTransfer* transfer, QString reason)
@@ -119,14 +122,100 @@ void EC_Avatar::SetupAppearance()
     if (!desc->mesh_.length())
         return;
     
-    // Setup appearance
-    SetupMeshAndMaterials();
-    SetupDynamicAppearance();
-    SetupAttachments();
+    AvatarModule *avatarModule = framework->GetModule<AvatarModule>();
+    if (!avatarModule)
+    {
+        buildStep_ = 0;
+        while(!BuildAppearanceStep()) {}
+        return;
+    }
+
+    // Restart the build. If already queued, the avatar keeps its place in the queue
+    bool wasQueued = buildStep_ >= 0;
+    buildStep_ = 0;
+    if (!mesh->GetEntity())
+        ShowPlaceholder();
+    if (!wasQueued)
+        avatarModule->QueueAppearanceBuild(this);
+}
+
+bool EC_Avatar::BuildAppearanceStep()
+{
+    if (buildStep_ < 0)
+        return true;
+
+    PROFILE(Avatar_BuildAppearanceStep);
+
+    Entity* entity = ParentEntity();
+    AvatarDescAssetPtr desc = AvatarDesc();
+    EC_Mesh* mesh = entity ? entity->GetComponent<EC_Mesh>().get() : 0;
+    if (!desc || !mesh || !desc->mesh_.length())
+    {
+        buildStep_ = -1;
+        return true;
+    }
+
+    const uint numAttachments = desc->attachments_.size();
+    const int step = buildStep_++;
+    if (step == 0)
+    {
+        SetupMeshAndMaterials();
+        if (!numAttachments)
+            mesh->RemoveAllAttachments();
+    }
+    else if (step <= (int)numAttachments)
+    {
+        if (step == 1)
+            mesh->RemoveAllAttachments();
+        SetupAttachment(step - 1);
+    }
+    else
+    {
+        // Morphs are applied last, so that they reach the attachments as well
+        buildStep_ = -1;
+        SetupDynamicAppearance();
+        return true;
+    }
+    return false;
+}
+
+void EC_Avatar::ShowPlaceholder()
+{
+    Entity* entity = ParentEntity();
+    EC_Mesh* mesh = entity ? entity->GetComponent<EC_Mesh>().get() : 0;
+    if (!mesh)
+        return;
+
+    // Ogre's built-in cube is 100 units wide, scale it to approximately the avatar size. The adjustment node is scaled directly
+    // instead of through the mesh transform attribute, so that the placeholder is local and the authored transform is kept.
+    // Setting the avatar mesh reapplies the attribute to the node.
+    if (mesh->SetMesh("Prefab_Cube"))
+    {
+        Ogre::SceneNode *adjustmentNode = mesh->GetAdjustmentSceneNode();
+        if (adjustmentNode)
+        {
+            adjustmentNode->setPosition(Ogre::Vector3::ZERO);
+            adjustmentNode->setScale(0.005f, 0.018f, 0.005f);
+        }
+    }
+}
+
+void EC_Avatar::ReleaseComposedMesh()
+{
+    if (composedMesh_.empty())
+        return;
+    boost::shared_ptr<AvatarAppearanceCache> cache = appearanceCache_.lock();
+    if (cache)
+        cache->ReleaseMesh(composedMesh_);
+    composedMesh_.clear();
 }
 
 void EC_Avatar::SetupDynamicAppearance()
 {
+    // If the appearance is being built, the dynamic appearance will be set up as the last step
+    if (buildStep_ >= 0)
+        return;
+
     Entity* entity = ParentEntity();
     AvatarDescAssetPtr desc = AvatarDesc();
     if ((!desc) || (!entity))
@@ -217,33 +306,41 @@ void EC_Avatar::SetupMeshAndMaterials()
     if (!mesh)
         return;
     
-    // Mesh needs to be cloned if there are attachments which need to hide vertices
-    bool need_mesh_clone = false;
-    
+    // Attachments may hide vertices of the body mesh
     const std::vector<AvatarAttachment>& attachments = desc->attachments_;
     std::set<uint> vertices_to_hide;
     for (uint i = 0; i < attachments.size(); ++i)
+        for (uint j = 0; j < attachments[i].vertices_to_hide_.size(); ++j)
+            vertices_to_hide.insert(attachments[i].vertices_to_hide_[j]);
+    
+    QString meshName = LookupAsset(desc->mesh_);
+    QString skeletonName = desc->skeleton_.length() ? LookupAsset(desc->skeleton_) : QString();
+    
+    // If vertices need to be hidden, use a composed body mesh shared by all avatars with the same appearance.
+    // The previous composed mesh is released only after acquiring the new one, so that it is reused if the key did not change
+    std::string oldComposedMesh = composedMesh_;
+    boost::shared_ptr<AvatarAppearanceCache> oldCache = appearanceCache_.lock();
+    composedMesh_.clear();
+    if (vertices_to_hide.size())
     {
-        if (attachments[i].vertices_to_hide_.size())
+        AvatarModule *avatarModule = framework->GetModule<AvatarModule>();
+        boost::shared_ptr<AvatarAppearanceCache> cache = avatarModule ? avatarModule->AppearanceCache() : boost::shared_ptr<AvatarAppearanceCache>();
+        if (cache)
         {
-            need_mesh_clone = true;
-            for (uint j = 0; j < attachments[i].vertices_to_hide_.size(); ++j)
-                vertices_to_hide.insert(attachments[i].vertices_to_hide_[j]);
+            composedMesh_ = cache->AcquireMesh(meshName.toStdString(), skeletonName.toStdString(), vertices_to_hide);
+            appearanceCache_ = cache;
         }
     }
     
-    QString meshName = LookupAsset(desc->mesh_);
-    
-    if (desc->skeleton_.length())
-    {
-        QString skeletonName = LookupAsset(desc->skeleton_);
-        mesh->SetMeshWithSkeleton(meshName.toStdString(), skeletonName.toStdString(), need_mesh_clone);
-    }
+    if (!composedMesh_.empty())
+        mesh->SetMesh(QString::fromStdString(composedMesh_));
+    else if (!skeletonName.isEmpty())
+        mesh->SetMeshWithSkeleton(meshName.toStdString(), skeletonName.toStdString());
     else
-        mesh->SetMesh(meshName, need_mesh_clone);
+        mesh->SetMesh(meshName);
     
-    if (need_mesh_clone)
-        HideVertices(mesh->GetEntity(), vertices_to_hide);
+    if (!oldComposedMesh.empty() && oldCache)
+        oldCache->ReleaseMesh(oldComposedMesh);
     
     for (uint i = 0; i < desc->materials_.size(); ++i)
         mesh->SetMaterial(i, LookupAsset(desc->materials_[i]));
@@ -254,7 +351,7 @@ void EC_Avatar::SetupMeshAndMaterials()
     mesh->castShadows.Set(true, AttributeChange::Default);
 }
 
-void EC_Avatar::SetupAttachments()
+void EC_Avatar::SetupAttachment(uint i)
 {
     Entity* entity = ParentEntity();
     AvatarDescAssetPtr desc = AvatarDesc();
@@ -264,21 +361,18 @@ void EC_Avatar::SetupAttachments()
     if (!mesh)
         return;
     
-    mesh->RemoveAllAttachments();
-    
     const std::vector<AvatarAttachment>& attachments = desc->attachments_;
+    if (i >= attachments.size())
+        return;
     
-    for (uint i = 0; i < attachments.size(); ++i)
-    {
-        // Setup attachment meshes
-        mesh->SetAttachmentMesh(i, LookupAsset(attachments[i].mesh_).toStdString(), attachments[i].bone_name_, attachments[i].link_skeleton_);
-        // Setup attachment mesh materials
-        for (uint j = 0; j < attachments[i].materials_.size(); ++j)
-            mesh->SetAttachmentMaterial(i, j, LookupAsset(attachments[i].materials_[j]).toStdString());
-        mesh->SetAttachmentPosition(i, attachments[i].transform_.position_);
-        mesh->SetAttachmentOrientation(i, attachments[i].transform_.orientation_);
-        mesh->SetAttachmentScale(i, attachments[i].transform_.scale_);
-    }
+    // Setup attachment mesh
+    mesh->SetAttachmentMesh(i, LookupAsset(attachments[i].mesh_).toStdString(), attachments[i].bone_name_, attachments[i].link_skeleton_);
+    // Setup attachment mesh materials
+    for (uint j = 0; j < attachments[i].materials_.size(); ++j)
+        mesh->SetAttachmentMaterial(i, j, LookupAsset(attachments[i].materials_[j]).toStdString());
+    mesh->SetAttachmentPosition(i, attachments[i].transform_.position_);
+    mesh->SetAttachmentOrientation(i, attachments[i].transform_.orientation_);
+    mesh->SetAttachmentScale(i, attachments[i].transform_.scale_);
 }
 
 void EC_Avatar::SetupMorphs()
@@ -532,71 +626,3 @@ Ogre::Bone* GetAvatarBone(Entity* entity, const std::string& bone_name)
         return 0;
     return skeleton->getBone(bone_name);
 }
-
-void HideVertices(Ogre::Entity* entity, std::set<uint> vertices_to_hide)
-{
-    if (!entity)
-        return;
-    Ogre::MeshPtr mesh = entity->getMesh();
-    if (mesh.isNull())
-        return;
-    if (!mesh->getNumSubMeshes())
-        return;
-    for (uint m = 0; m < 1; ++m)
-    {
-        // Under current system, it seems vertices should only be hidden from first submesh
-        Ogre::SubMesh *submesh = mesh->getSubMesh(m);
-        if (!submesh)
-            return;
-        Ogre::IndexData *data = submesh->indexData;
-        if (!data)
-            return;
-        Ogre::HardwareIndexBufferSharedPtr ibuf = data->indexBuffer;
-        if (ibuf.isNull())
-            return;
-
-        unsigned long* lIdx = static_cast<unsigned long*>(ibuf->lock(Ogre::HardwareBuffer::HBL_NORMAL));
-        unsigned short* pIdx = reinterpret_cast<unsigned short*>(lIdx);
-        bool use32bitindexes = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
-
-        for (uint n = 0; n < data->indexCount; n += 3)
-        {
-            if (!use32bitindexes)
-            {
-                if (vertices_to_hide.find(pIdx[n]) != vertices_to_hide.end() ||
-                    vertices_to_hide.find(pIdx[n+1]) != vertices_to_hide.end() ||
-                    vertices_to_hide.find(pIdx[n+2]) != vertices_to_hide.end())
-                {
-                    if (n + 3 < data->indexCount)
-                    {
-                        for (size_t i = n ; i<data->indexCount-3 ; ++i)
-                        {
-                            pIdx[i] = pIdx[i+3];
-                        }
-                    }
-                    data->indexCount -= 3;
-                    n -= 3;
-                }
-            }
-            else
-            {
-                if (vertices_to_hide.find(lIdx[n]) != vertices_to_hide.end() ||
-                    vertices_to_hide.find(lIdx[n+1]) != vertices_to_hide.end() ||
-                    vertices_to_hide.find(lIdx[n+2]) != vertices_to_hide.end())
-                {
-                    if (n + 3 < data->indexCount)
-                    {
-                        for (size_t i = n ; i<data->indexCount-3 ; ++i)
-                        {
-                            lIdx[i] = lIdx[i+3];
-                        }
-                    }
-                    data->indexCount -= 3;
-                    n -= 3;
-                }
-            }
-        }
-        ibuf->unlock();
-    }
-}
-
@@ -7,8 +7,11 @@
 #include "AvatarModuleApi.h"
 #include "AssetFwd.h"
 
+#include <string>
+
 struct BoneModifier;
 class AvatarDescAsset;
+class AvatarAppearanceCache;
 typedef boost::shared_ptr<AvatarDescAsset> AvatarDescAssetPtr;
 
 /// Avatar component.
@@ -28,6 +31,10 @@ typedef boost::shared_ptr<AvatarDescAsset> AvatarDescAssetPtr;
     <div>Asset id for the avatar appearance file that will be used to generate the visible avatar.</div>
     </ul>
 
+    The appearance is built in steps (the body mesh, each attachment, and the morphs and bone modifiers) within the per-frame budget
+    of AvatarModule, see the --avatarbuildsteps command line parameter. Until then, an avatar without a previous appearance is shown
+    as a placeholder box. Avatars with the same body mesh, skeleton and hidden vertices share one composed body mesh.
+
     <b>Exposes the following scriptable functions:</b>
     <ul>
     </ul>
@@ -54,8 +61,12 @@ public:
     Q_PROPERTY(AssetReference appearanceRef READ getappearanceRef WRITE setappearanceRef);
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, appearanceRef);
 
+    /// Performs the next step of building the appearance. Called by AvatarModule within its per-frame budget.
+    /** @return True if the appearance is complete, false if more steps remain. */
+    bool BuildAppearanceStep();
+
 public slots:
-    /// Refresh appearance completely
+    /// Refresh appearance completely. The appearance is built over the next frames.
     void SetupAppearance();
     /// Refresh dynamic parts of the appearance (morphs, bone modifiers)
     void SetupDynamicAppearance();
@@ -81,8 +92,12 @@ private:
     void SetupMorphs();
     /// Set bone modifiers to values in avatar desc asset
     void SetupBoneModifiers();
-    /// Rebuild attachment meshes
-    void SetupAttachments();
+    /// Rebuild one attachment mesh
+    void SetupAttachment(uint index);
+    /// Show a placeholder box until the mesh has been built
+    void ShowPlaceholder();
+    /// Release the composed body mesh from the appearance cache, if used
+    void ReleaseComposedMesh();
     /// Lookup absolute asset reference
     QString LookupAsset(const QString& ref);
 
@@ -90,4 +105,10 @@ private:
     AssetRefListenerPtr avatarAssetListener_;
     /// Last set avatar asset
     boost::weak_ptr<AvatarDescAsset> avatarAsset_;
+    /// Next appearance build step, or -1 if not building. 0 is the body mesh, 1..N the attachments, and N+1 the dynamic appearance
+    int buildStep_;
+    /// Name of the composed body mesh from the appearance cache, or empty if the body mesh is used as is
+    std::string composedMesh_;
+    /// Cache the composed body mesh is from
+    boost::weak_ptr<AvatarAppearanceCache> appearanceCache_;
 };
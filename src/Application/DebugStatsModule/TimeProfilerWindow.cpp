@@ -2153,13 +2153,15 @@ void TimeProfilerWindow::PopulateBulletStats()
     if (!scene)
         return;
     boost::shared_ptr<Physics::PhysicsWorld> physics = scene->GetWorld<Physics::PhysicsWorld>();
-    const std::set<std::pair<btCollisionObject*, btCollisionObject*> > &collisions = physics->PreviousFrameCollisions();
+    const std::vector<Physics::CollisionReport> &collisions = physics->PreviousFrameCollisions();
 
     treeBulletStats->clear();
-    for(std::set<std::pair<btCollisionObject*, btCollisionObject*> >::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
+    for(std::vector<Physics::CollisionReport>::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
     {
-        btCollisionObject* objectA = iter->first;
-        btCollisionObject* objectB = iter->second;
+        btCollisionObject* objectA = iter->objects.first;
+        btCollisionObject* objectB = iter->objects.second;
+        if (!objectA || !objectB)
+            continue;
         EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
         EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
         if (!bodyA || !bodyB)
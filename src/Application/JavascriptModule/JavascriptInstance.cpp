@@ -13,10 +13,14 @@
 #include "ScriptMetaTypeDefines.h"
 #include "ScriptCoreTypeDefines.h"
 #include "EC_Script.h"
+#include "Entity.h"
+#include "Scene.h"
+#include "SceneAPI.h"
 #include "ScriptAsset.h"
 #include "AssetAPI.h"
 #include "IAssetStorage.h"
 #include "LoggingFunctions.h"
+#include "ScriptBudgetAgent.h"
 
 #include <QFile>
 #include <sstream>
@@ -32,6 +36,7 @@ Q_DECLARE_METATYPE(QScriptClass*)
 
 JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     sourceFile(fileName),
     module_(module),
     evaluated(false)
@@ -42,6 +47,7 @@ JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule
 
 JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
     evaluated(false)
 {
@@ -53,8 +59,9 @@ JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModul
     Load();
 }
 
-JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module) :
+JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module, bool sharedEngine) :
     engine_(0),
+    sharedEngine_(sharedEngine),
     module_(module),
     evaluated(false)
 {
@@ -95,14 +102,10 @@ void JavascriptInstance::Load()
     // Determine based on code origin whether it can be trusted with system access or not
     if (useAssetAPI)
     {
-        trusted_ = true;
         for(unsigned i = 0; i < scriptRefs_.size(); ++i)
-        {
-            AssetStoragePtr storage = scriptRefs_[i]->GetAssetStorage();
-            if (!storage)
+            if (!scriptRefs_[i]->GetAssetStorage())
                 LogError("Error: Script asset \"" + scriptRefs_[i]->Name() + "\" does not have a source asset storage!");
-            trusted_ = trusted_ && storage && storage->Trusted();
-        }
+        trusted_ = SourcesTrusted();
     }
     else // Local file: always trusted.
     {
@@ -112,16 +115,21 @@ void JavascriptInstance::Load()
         // the client to load a script into local cache, he could use this code path to automatically load that unsafe script from cache, and make it trusted. -jj.
     }
 
-    // Check the validity of the syntax in the input.
+    // Check the validity of the syntax in the input. Script assets have checked their syntax already on load.
     for (unsigned i = 0; i < numScripts; ++i)
     {
-        QString scriptSourceFilename = (useAssetAPI ? scriptRefs_[i]->Name() : sourceFile);
-        QString &scriptContent = (useAssetAPI ? scriptRefs_[i]->scriptContent : program_);
+        if (useAssetAPI)
+        {
+            if (!scriptRefs_[i]->syntaxValid)
+                LogError("Syntax error in script " + scriptRefs_[i]->Name() + "," + QString::number(scriptRefs_[i]->syntaxErrorLine) +
+                    ": " + scriptRefs_[i]->syntaxError);
+            continue;
+        }
 
-        QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(scriptContent);
+        QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(program_);
         if (syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
         {
-            LogError("Syntax error in script " + scriptSourceFilename + "," + QString::number(syntaxResult.errorLineNumber()) +
+            LogError("Syntax error in script " + sourceFile + "," + QString::number(syntaxResult.errorLineNumber()) +
                 ": " + syntaxResult.errorMessage());
 
             // Delete our loaded script content (if any exists).
@@ -130,6 +138,18 @@ void JavascriptInstance::Load()
     }
 }
 
+bool JavascriptInstance::SourcesTrusted() const
+{
+    // Local files are always trusted
+    for(unsigned i = 0; i < scriptRefs_.size(); ++i)
+    {
+        AssetStoragePtr storage = scriptRefs_[i]->GetAssetStorage();
+        if (!storage || !storage->Trusted())
+            return false;
+    }
+    return true;
+}
+
 QString JavascriptInstance::LoadScript(const QString &fileName)
 {
     QString filename = fileName.trimmed();
@@ -205,10 +225,10 @@ void JavascriptInstance::Run()
     
     for (unsigned i = 0; i < numScripts; ++i)
     {
-        QString scriptSourceFilename = (useAssets ? scriptRefs_[i]->Name() : sourceFile);
-        QString &scriptContent = (useAssets ? scriptRefs_[i]->scriptContent : program_);
+        // Script assets share their compiled program between the instances
+        QScriptProgram program = (useAssets ? scriptRefs_[i]->program : QScriptProgram(program_, sourceFile));
 
-        QScriptValue result = engine_->evaluate(scriptContent, scriptSourceFilename);
+        QScriptValue result = Evaluate(program);
         CheckAndPrintException("In run/evaluate: ", result);
     }
     
@@ -230,7 +250,44 @@ void JavascriptInstance::RegisterService(QObject *serviceObject, const QString &
     }
 
     QScriptValue scriptValue = engine_->newQObject(serviceObject);
-    engine_->globalObject().setProperty(name, scriptValue);
+    GlobalObject().setProperty(name, scriptValue);
+}
+
+QString JavascriptInstance::ScriptName() const
+{
+    QStringList names;
+    if (!sourceFile.isEmpty())
+        names << sourceFile;
+    for(unsigned i = 0; i < scriptRefs_.size(); ++i)
+        names << scriptRefs_[i]->Name();
+
+    QString name = names.join(", ");
+    IComponent *owner = owner_.lock().get();
+    if (owner && owner->ParentEntity())
+        name += " in entity " + QString::number(owner->ParentEntity()->Id()) + " \"" + owner->ParentEntity()->Name() + "\"";
+    return name;
+}
+
+QScriptValue JavascriptInstance::GlobalObject() const
+{
+    if (!engine_)
+        return QScriptValue();
+    return sharedEngine_ ? scope_ : engine_->globalObject();
+}
+
+QScriptValue JavascriptInstance::Evaluate(const QScriptProgram &program)
+{
+    if (!sharedEngine_)
+        return engine_->evaluate(program);
+
+    // Evaluate as the body of a function whose activation object is the scope object, so that the variable and function
+    // declarations of the script go to the scope object instead of the global object of the shared engine.
+    QScriptContext *context = engine_->pushContext();
+    context->setActivationObject(scope_);
+    context->setThisObject(scope_);
+    QScriptValue result = engine_->evaluate(program);
+    engine_->popContext();
+    return result;
 }
 
 void JavascriptInstance::IncludeFile(const QString &path)
@@ -262,15 +319,16 @@ void JavascriptInstance::IncludeFile(const QString &path)
     context->setActivationObject(context->parentContext()->activationObject());
     context->setThisObject(context->parentContext()->thisObject());
 
-    QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(script);
-    if(syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
+    // The included files are syntax-checked and compiled once per content, as many scripts tend to include the same files
+    QString syntaxError;
+    QScriptProgram program = module_->IncludeProgram(script, path, syntaxError);
+    if (program.isNull())
     {
-        LogError("JavascriptInstance::IncludeFile: Syntax error in " + path + ". " + syntaxResult.errorMessage() +
-            " In line:" + QString::number(syntaxResult.errorLineNumber()));
+        LogError("JavascriptInstance::IncludeFile: Syntax error in " + path + ". " + syntaxError);
         return;
     }
 
-    QScriptValue result = engine_->evaluate(script);
+    QScriptValue result = engine_->evaluate(program);
 
     includedFiles.push_back(path);
     
@@ -348,17 +406,30 @@ void JavascriptInstance::CreateEngine()
 {
     if (engine_)
         DeleteEngine();
-    engine_ = new QScriptEngine;
-    connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
+
+    if (sharedEngine_)
+    {
+        // The types have already been exposed to the shared engine when the module created it
+        engine_ = module_->AcquireSharedEngine(SourcesTrusted());
+        scope_ = engine_->newObject();
+        // The scope refers back to this instance, so that the signal connections can be attributed to the script that made them
+        scope_.setData(engine_->newQObject(this));
+    }
+    else
+    {
+        engine_ = new QScriptEngine;
+        connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
 //#ifndef QT_NO_SCRIPTTOOLS
-//    debugger_ = new QScriptEngineDebugger();
-//    debugger.attachTo(engine_);
-////  debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
+//        debugger_ = new QScriptEngineDebugger();
+//        debugger.attachTo(engine_);
+////      debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
 //#endif
 
-    ExposeQtMetaTypes(engine_);
-    ExposeCoreTypes(engine_);
-    ExposeCoreApiMetaTypes(engine_);
+        ExposeQtMetaTypes(engine_);
+        ExposeCoreTypes(engine_);
+        ExposeCoreApiMetaTypes(engine_);
+        module_->InstallBudgetAgent(engine_, this);
+    }
 
     EC_Script *ec = dynamic_cast<EC_Script *>(owner_.lock().get());
     module_->PrepareScriptInstance(this, ec);
@@ -371,7 +442,9 @@ void JavascriptInstance::DeleteEngine()
         return;
 
     program_ = "";
-    engine_->abortEvaluation();
+    // A shared engine may be evaluating another script
+    if (!sharedEngine_)
+        engine_->abortEvaluation();
 
     // As a convention, we call a function 'OnScriptDestroyed' for each JS script
     // so that they can clean up their data before the script is removed from the object,
@@ -379,17 +452,93 @@ void JavascriptInstance::DeleteEngine()
     
     emit ScriptUnloading();
     
-    QScriptValue destructor = engine_->globalObject().property("OnScriptDestroyed");
+    QScriptValue destructor = GlobalObject().property("OnScriptDestroyed");
     if (!destructor.isUndefined())
     {
         QScriptValue result = destructor.call();
         CheckAndPrintException("In script destructor: ", result);
     }
     
-    SAFE_DELETE(engine_);
+    // Commit the scene batches the script left in progress. In a shared engine, the scene tells the scripts apart by the
+    // instance set as the data of their scope object
+    SceneMap &scenes = module_->GetFramework()->Scene()->Scenes();
+    for(SceneMap::iterator i = scenes.begin(); i != scenes.end(); ++i)
+    {
+        int numEnded = i->second->EndScriptBatches(engine_, sharedEngine_ ? this : 0);
+        if (numEnded > 0)
+            LogWarning("JavascriptInstance: Script " + ScriptName() + " was unloaded with " + QString::number(numEnded) +
+                " batch(es) in progress in scene \"" + i->first + "\", committing.");
+    }
+    
+    if (sharedEngine_)
+    {
+        // The shared engine outlives the script, so the handlers of the script would otherwise keep being called
+        DisconnectSignals();
+        // The budget agent of the shared engine keeps the statistics of each script separately
+        ScriptBudgetAgent *budgetAgent = dynamic_cast<ScriptBudgetAgent *>(engine_->agent());
+        if (budgetAgent)
+            budgetAgent->ForgetInstance(this);
+        scope_ = QScriptValue();
+        module_->ReleaseSharedEngine(engine_);
+        engine_ = 0;
+    }
+    else
+        SAFE_DELETE(engine_);
     //SAFE_DELETE(debugger_);
 }
 
+void JavascriptInstance::TrackSignalConnections(QScriptEngine *engine)
+{
+    // The signals of QObjects get their connect function from the function prototype
+    QScriptValue functionPrototype = engine->globalObject().property("Function").property("prototype");
+    QScriptValue connect = engine->newFunction(ConnectAndTrack);
+    connect.setData(functionPrototype.property("connect"));
+    functionPrototype.setProperty("connect", connect, QScriptValue::SkipInEnumeration);
+}
+
+QScriptValue JavascriptInstance::ConnectAndTrack(QScriptContext *context, QScriptEngine *engine)
+{
+    QScriptValue arguments = engine->newArray(context->argumentCount());
+    for(int i = 0; i < context->argumentCount(); ++i)
+        arguments.setProperty(i, context->argument(i));
+
+    QScriptValue result = context->callee().data().call(context->thisObject(), arguments);
+    if (engine->hasUncaughtException())
+        return result;
+
+    // The functions of a script have the scope object of the script in their scope chain
+    for(QScriptContext *caller = context->parentContext(); caller; caller = caller->parentContext())
+    {
+        QScriptValueList scopes = caller->scopeChain();
+        for(int i = 0; i < scopes.size(); ++i)
+        {
+            JavascriptInstance *instance = qobject_cast<JavascriptInstance *>(scopes[i].data().toQObject());
+            if (instance && instance->engine_ == engine)
+            {
+                SignalConnection connection;
+                connection.signal = context->thisObject();
+                connection.arguments = arguments;
+                instance->connections_.push_back(connection);
+                return result;
+            }
+        }
+    }
+    return result;
+}
+
+void JavascriptInstance::DisconnectSignals()
+{
+    for(size_t i = 0; i < connections_.size(); ++i)
+    {
+        QScriptValue disconnect = connections_[i].signal.property("disconnect");
+        disconnect.call(connections_[i].signal, connections_[i].arguments);
+        // Fails if the script has already disconnected the signal itself
+        if (engine_->hasUncaughtException())
+            engine_->clearExceptions();
+    }
+    connections_.clear();
+}
+
 void JavascriptInstance::OnSignalHandlerException(const QScriptValue& exception)
 {
     LogError(exception.toString());
@@ -12,6 +12,9 @@
 #include "AssetFwd.h"
 #include "JavascriptFwd.h"
 
+#include <QScriptValue>
+#include <QScriptProgram>
+
 //#include <QtScript>
 //#ifndef QT_NO_SCRIPTTOOLS
 //#include <QScriptEngineDebugger>
@@ -37,8 +40,11 @@ public:
 
     /// Creates script engine for this script instance and loads the script but doesn't run it yet.
     /** @param scriptRefs Script asset references.
-        @param module Javascript module. */
-    JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module);
+        @param module Javascript module.
+        @param sharedEngine Whether to run the script in a shared engine from the engine pool of the module instead of a
+            dedicated engine. The script then gets its own scope object, which holds its variables, functions and services.
+            Assignments to undeclared variables still go to the global object of the shared engine. */
+    JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module, bool sharedEngine = false);
 
     /// Destroys script engine created for this script instance.
     virtual ~JavascriptInstance();
@@ -58,6 +64,16 @@ public:
     //void SetPrototype(QScriptable *prototype, );
     QScriptEngine* Engine() const { return engine_; }
 
+    /// Returns the names of the scripts of this instance, and the owner entity if any, for diagnostics.
+    QString ScriptName() const;
+
+    /// Returns whether the script runs in a shared engine.
+    bool HasSharedEngine() const { return sharedEngine_; }
+
+    /// Returns the object that holds the global variables, functions and services of this script.
+    /** This is the scope object of the script for shared engines and the global object of the engine otherwise. */
+    QScriptValue GlobalObject() const;
+
     /// Sets owner (EC_Script) component.
     /** @param owner Owner component. */
     void SetOwner(const ComponentPtr &owner) { owner_ = owner; }
@@ -65,9 +81,15 @@ public:
     /// Return owner component
     ComponentWeakPtr Owner() const { return owner_; }
 
+    /// Makes a shared engine record the signal connections made by each of its scripts.
+    /** The connections of a script are disconnected when the script unloads, as the engine itself is not deleted then.
+        Called by JavascriptModule when it creates a shared engine. */
+    static void TrackSignalConnections(QScriptEngine *engine);
+
 public slots:
     /// Loads a given script in engine. This function can be used to create a property as you could include js-files.
     /** Multiple inclusion of same file is prevented. (by using simple string compare)
+        The compiled programs of the included files are cached by content in JavascriptModule.
         @param path is relative path from bin/ to file. Example jsmodules/apitest/myscript.js */
     void IncludeFile(const QString &file);
 
@@ -96,7 +118,29 @@ private:
 
     QString LoadScript(const QString &fileName);
 
+    /// Returns whether all the script sources come from trusted storages.
+    bool SourcesTrusted() const;
+
+    /// Evaluates a script program in the scope of this script.
+    QScriptValue Evaluate(const QScriptProgram &program);
+
+    /// Connect function of the signals of shared engines. Connects the signal and records the connection to the script that made it.
+    static QScriptValue ConnectAndTrack(QScriptContext *context, QScriptEngine *engine);
+
+    /// Disconnects the signal connections made by the script in a shared engine.
+    void DisconnectSignals();
+
+    /// Signal connection made by the script in a shared engine.
+    struct SignalConnection
+    {
+        QScriptValue signal; ///< The connected signal.
+        QScriptValue arguments; ///< Arguments of the connect call, i.e. the handler function and optionally its this object.
+    };
+
     QScriptEngine *engine_; ///< Qt script engine.
+    bool sharedEngine_; ///< Is engine_ a shared engine from the engine pool of the module.
+    QScriptValue scope_; ///< Scope object of the script for shared engines.
+    std::vector<SignalConnection> connections_; ///< Signal connections made by the script in a shared engine.
 
     // The script content for a JavascriptInstance is loaded either using the Asset API or 
     // using an absolute path name from the local file system.
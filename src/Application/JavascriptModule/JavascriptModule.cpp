@@ -11,6 +11,7 @@
 #include "JavascriptModule.h"
 #include "ScriptMetaTypeDefines.h"
 #include "JavascriptInstance.h"
+#include "ScriptBudgetAgent.h"
 #include "ScriptCoreTypeDefines.h"
 #include "Profiler.h"
 #include "Application.h"
@@ -36,17 +37,28 @@
 
 #include <QtScript>
 #include <QDomElement>
+#include <QCryptographicHash>
+
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
 JavascriptModule::JavascriptModule() :
     IModule("Javascript"),
-    engine(new QScriptEngine(this))
+    engine(new QScriptEngine(this)),
+    maxSharedEngines_(0),
+    scriptBudgetEnabled_(false),
+    scriptFrameBudget_(0.0),
+    scriptHardLimit_(0.0),
+    lastBudgetWarningTime_(0.0)
 {
 }
 
 JavascriptModule::~JavascriptModule()
 {
+    for(size_t i = 0; i < sharedEngines_.size(); ++i)
+        delete sharedEngines_[i].engine;
+    sharedEngines_.clear();
     SAFE_DELETE(engine);
 }
 
@@ -64,6 +76,26 @@ void JavascriptModule::Initialize()
 
     RegisterCoreMetaTypes();
 
+    if (framework_->HasCommandLineParameter("--scriptenginepool"))
+    {
+        QStringList poolSize = framework_->CommandLineParameters("--scriptenginepool");
+        maxSharedEngines_ = poolSize.isEmpty() ? 4 : std::max(poolSize.first().toInt(), 1);
+        LogInfo("JavascriptModule: Running EC_Script instances in up to " + QString::number(maxSharedEngines_) + " shared script engines per trust level.");
+    }
+
+    if (framework_->HasCommandLineParameter("--scriptbudget") || framework_->HasCommandLineParameter("--scripthardlimit"))
+    {
+        scriptBudgetEnabled_ = true;
+        QStringList frameBudget = framework_->CommandLineParameters("--scriptbudget");
+        QStringList hardLimit = framework_->CommandLineParameters("--scripthardlimit");
+        // Each parameter enables only its own check; runs are aborted only if the hard limit has been asked for explicitly
+        if (framework_->HasCommandLineParameter("--scriptbudget"))
+            scriptFrameBudget_ = frameBudget.isEmpty() ? 0.005 : frameBudget.first().toDouble() / 1000.0;
+        if (framework_->HasCommandLineParameter("--scripthardlimit"))
+            scriptHardLimit_ = hardLimit.isEmpty() ? 1.0 : hardLimit.first().toDouble() / 1000.0;
+        connect(framework_->Frame(), SIGNAL(PostFrameUpdate(float)), SLOT(OnPostFrameUpdate(float)));
+    }
+
     framework_->Console()->RegisterCommand(
         "JsExec", "Execute given code in the embedded Javascript interpreter. Usage: JsExec(mycodestring)",
         this, SLOT(RunString(const QString &)));
@@ -76,6 +108,15 @@ void JavascriptModule::Initialize()
         "JsReloadScripts", "Reloads and re-executes startup scripts.",
         this, SLOT(LoadStartupScripts()));
 
+    framework_->Console()->RegisterCommand(
+        "JsBudget", "Sets the per-frame CPU time budget and the hard limit of a single run of each script, in milliseconds. "
+        "A hard limit of 0 never aborts. Requires the --scriptbudget or --scripthardlimit command line parameter. Usage: JsBudget(frameBudgetMs,hardLimitMs)",
+        this, SLOT(ConsoleSetScriptBudget(const QStringList &)));
+
+    framework_->Console()->RegisterCommand(
+        "JsTopScripts", "Prints the scripts that have used the most CPU time. Usage: JsTopScripts(count)",
+        this, SLOT(ConsoleTopScripts(const QStringList &)));
+
     // Initialize startup scripts
     LoadStartupScripts();
 
@@ -148,7 +189,7 @@ void JavascriptModule::ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& ne
 
     if (newScripts[0]->Name().endsWith(".js")) // We're positively using QtScript.
     {
-        JavascriptInstance *jsInstance = new JavascriptInstance(newScripts, this);
+        JavascriptInstance *jsInstance = new JavascriptInstance(newScripts, this, IsEnginePoolEnabled());
         ComponentPtr comp;
         try
         {
@@ -332,7 +373,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -346,7 +387,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     const QString& appAndClassName = instance->className.Get();
-    QScriptValue constructor = appEngine->globalObject().property(className);
+    QScriptValue constructor = globalObject.property(className);
     QScriptValue object;
     if (constructor.isFunction())
     {
@@ -386,8 +427,7 @@ void JavascriptModule::RemoveScriptObject(EC_Script* instance)
     if (!jsInstance || !jsInstance->IsEvaluated())
         return;
     
-    QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -463,7 +503,7 @@ void JavascriptModule::RemoveScriptObjects(JavascriptInstance* jsInstance)
     if (!appEngine)
         return;
     
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
     
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -533,6 +573,8 @@ QStringList JavascriptModule::ParseStartupScriptConfig()
 void JavascriptModule::LoadStartupScripts()
 {
     UnloadStartupScripts();
+    // Forget the programs of included files that may have been edited since
+    includePrograms_.clear();
     
     std::string path = Application::InstallationDirectory().toStdString() + "jsmodules/startup";
     std::vector<std::string> scripts;
@@ -618,19 +660,15 @@ void JavascriptModule::UnloadStartupScripts()
     startupScripts_.clear();
 }
 
-void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
+void JavascriptModule::ConnectScriptEngineCreatedHandlers()
 {
     static std::set<QObject*> checked;
     
-    // Register framework's dynamic properties (service objects) and the framework itself to the script engine
     QList<QByteArray> properties = framework_->dynamicPropertyNames();
     for(QList<QByteArray>::size_type i = 0; i < properties.size(); ++i)
     {
-        QString name = properties[i];
-        QObject* serviceobject = framework_->property(name.toStdString().c_str()).value<QObject*>();
-        instance->RegisterService(serviceobject, name);
-        
-        if (checked.find(serviceobject) == checked.end())
+        QObject* serviceobject = framework_->property(properties[i]).value<QObject*>();
+        if (serviceobject && checked.find(serviceobject) == checked.end())
         {
             // Check if the service object has an OnScriptEngineCreated() slot, and give it a chance to perform further actions
             const QMetaObject* meta = serviceobject->metaObject();
@@ -640,6 +678,225 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
             checked.insert(serviceobject);
         }
     }
+}
+
+QScriptEngine *JavascriptModule::AcquireSharedEngine(bool trusted)
+{
+    // Pick the least used engine of the trust level, unless the pool still has room for a new one
+    int numEngines = 0;
+    SharedEngine *leastUsed = 0;
+    for(size_t i = 0; i < sharedEngines_.size(); ++i)
+        if (sharedEngines_[i].trusted == trusted)
+        {
+            ++numEngines;
+            if (!leastUsed || sharedEngines_[i].numInstances < leastUsed->numInstances)
+                leastUsed = &sharedEngines_[i];
+        }
+
+    if (leastUsed && numEngines >= maxSharedEngines_)
+    {
+        ++leastUsed->numInstances;
+        return leastUsed->engine;
+    }
+
+    PROFILE(JSModule_CreateSharedEngine);
+    SharedEngine shared;
+    shared.engine = new QScriptEngine;
+    shared.trusted = trusted;
+    shared.numInstances = 1;
+    connect(shared.engine, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSharedEngineSignalHandlerException(const QScriptValue &)));
+    ExposeQtMetaTypes(shared.engine);
+    ExposeCoreTypes(shared.engine);
+    ExposeCoreApiMetaTypes(shared.engine);
+    JavascriptInstance::TrackSignalConnections(shared.engine);
+    InstallBudgetAgent(shared.engine, 0);
+    sharedEngines_.push_back(shared);
+
+    ConnectScriptEngineCreatedHandlers();
+    emit ScriptEngineCreated(shared.engine);
+    return shared.engine;
+}
+
+void JavascriptModule::ReleaseSharedEngine(QScriptEngine *engine)
+{
+    for(size_t i = 0; i < sharedEngines_.size(); ++i)
+        if (sharedEngines_[i].engine == engine)
+        {
+            // The instances disconnect their own signal connections when they unload
+            if (--sharedEngines_[i].numInstances <= 0)
+            {
+                delete sharedEngines_[i].engine;
+                sharedEngines_.erase(sharedEngines_.begin() + i);
+            }
+            return;
+        }
+}
+
+QScriptProgram JavascriptModule::IncludeProgram(const QString &content, const QString &fileName, QString &syntaxError)
+{
+    QByteArray hash = QCryptographicHash::hash(QByteArray((const char *)content.constData(), content.size() * sizeof(QChar)), QCryptographicHash::Sha1);
+    QHash<QByteArray, QScriptProgram>::const_iterator i = includePrograms_.find(hash);
+    if (i != includePrograms_.end())
+        return i.value();
+
+    // Programs with syntax errors are not cached, so that the error is reported on each include
+    QScriptSyntaxCheckResult syntaxResult = QScriptEngine::checkSyntax(content);
+    if (syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
+    {
+        syntaxError = syntaxResult.errorMessage() + " In line:" + QString::number(syntaxResult.errorLineNumber());
+        return QScriptProgram();
+    }
+
+    QScriptProgram program(content, fileName);
+    includePrograms_.insert(hash, program);
+    return program;
+}
+
+void JavascriptModule::InstallBudgetAgent(QScriptEngine *engine, JavascriptInstance *instance)
+{
+    if (!scriptBudgetEnabled_ || !engine)
+        return;
+
+    // The engine takes ownership of the agent
+    ScriptBudgetAgent *agent = new ScriptBudgetAgent(engine, this, instance);
+    agent->SetHardLimit(scriptHardLimit_);
+    if (!instance)
+        agent->SetName("Shared script engine " + QString::number(sharedEngines_.size()));
+}
+
+void JavascriptModule::RegisterBudgetAgent(ScriptBudgetAgent *agent)
+{
+    budgetAgents_.push_back(agent);
+}
+
+void JavascriptModule::UnregisterBudgetAgent(ScriptBudgetAgent *agent)
+{
+    budgetAgents_.erase(std::remove(budgetAgents_.begin(), budgetAgents_.end(), agent), budgetAgents_.end());
+}
+
+/// Orders script statistics by descending total time.
+static bool TotalTimeGreater(const ScriptBudgetStats &a, const ScriptBudgetStats &b)
+{
+    return a.totalTime > b.totalTime;
+}
+
+std::vector<ScriptBudgetStats> JavascriptModule::TopScripts(size_t count) const
+{
+    std::vector<ScriptBudgetStats> stats;
+    for(size_t i = 0; i < budgetAgents_.size(); ++i)
+    {
+        std::vector<ScriptBudgetStats> agentStats = budgetAgents_[i]->Stats();
+        stats.insert(stats.end(), agentStats.begin(), agentStats.end());
+    }
+    std::sort(stats.begin(), stats.end(), TotalTimeGreater);
+    if (stats.size() > count)
+        stats.resize(count);
+    return stats;
+}
+
+void JavascriptModule::OnPostFrameUpdate(float /*frametime*/)
+{
+    PROFILE(JSModule_ScriptBudget);
+
+    QStringList overBudget;
+    std::vector<JavascriptInstance *> aborted;
+    for(size_t i = 0; i < budgetAgents_.size(); ++i)
+    {
+        ScriptBudgetAgent *agent = budgetAgents_[i];
+        overBudget << agent->EndFrame(scriptFrameBudget_);
+        std::vector<JavascriptInstance *> agentAborted = agent->TakeAbortedInstances();
+        for(size_t j = 0; j < agentAborted.size(); ++j)
+        {
+            // A run of a shared engine that could not be attributed to a script is aborted, but nothing can be suspended
+            QString name = agentAborted[j] ? agentAborted[j]->ScriptName() : agent->Name();
+            LogError("JavascriptModule: " + name + " exceeded the hard limit of " + QString::number(scriptHardLimit_ * 1000.0) +
+                " ms and was aborted.");
+            if (agentAborted[j])
+                aborted.push_back(agentAborted[j]);
+        }
+    }
+
+    // Log the budget overruns at most every few seconds to not flood the log
+    double now = framework_->Frame()->WallClockTime();
+    if (!overBudget.isEmpty() && now - lastBudgetWarningTime_ >= 5.0)
+    {
+        LogWarning("JavascriptModule: " + QString::number(overBudget.size()) + " script(s) exceeded the frame budget of " +
+            QString::number(scriptFrameBudget_ * 1000.0) + " ms: " + overBudget.join(", "));
+        lastBudgetWarningTime_ = now;
+    }
+
+    // Suspend the aborted instances. Unloading deletes their own engines and budget agents, or drops their statistics from
+    // the budget agent of a shared engine, and disconnects their signal handlers
+    for(size_t i = 0; i < aborted.size(); ++i)
+    {
+        LogError("JavascriptModule: Suspending " + aborted[i]->ScriptName() + ".");
+        aborted[i]->Unload();
+    }
+}
+
+void JavascriptModule::ConsoleSetScriptBudget(const QStringList &params)
+{
+    if (!scriptBudgetEnabled_)
+    {
+        LogError("Script budgeting is disabled. Start with the --scriptbudget or --scripthardlimit command line parameter to enable it.");
+        return;
+    }
+    if (params.size() < 1)
+    {
+        LogError("Usage: JsBudget(frameBudgetMs,hardLimitMs)");
+        return;
+    }
+
+    scriptFrameBudget_ = std::max(params[0].toDouble(), 0.0) / 1000.0;
+    if (params.size() >= 2)
+    {
+        scriptHardLimit_ = std::max(params[1].toDouble(), 0.0) / 1000.0;
+        for(size_t i = 0; i < budgetAgents_.size(); ++i)
+            budgetAgents_[i]->SetHardLimit(scriptHardLimit_);
+    }
+}
+
+void JavascriptModule::ConsoleTopScripts(const QStringList &params)
+{
+    if (!scriptBudgetEnabled_)
+    {
+        LogError("Script budgeting is disabled. Start with the --scriptbudget or --scripthardlimit command line parameter to enable it.");
+        return;
+    }
+
+    int count = params.size() >= 1 ? std::max(params[0].toInt(), 1) : 10;
+    std::vector<ScriptBudgetStats> stats = TopScripts(count);
+    ConsoleAPI *c = framework_->Console();
+    c->Print("Total ms / Last frame ms / Max run ms / Runs / Over budget / Aborted / Script");
+    for(size_t i = 0; i < stats.size(); ++i)
+        c->Print(QString::number(stats[i].totalTime * 1000.0, 'f', 2) + " / " + QString::number(stats[i].frameTime * 1000.0, 'f', 3) + " / " +
+            QString::number(stats[i].maxRunTime * 1000.0, 'f', 3) + " / " + QString::number(stats[i].numRuns) + " / " +
+            QString::number(stats[i].numOverruns) + " / " + QString::number(stats[i].numAborts) + " / " + stats[i].name);
+}
+
+void JavascriptModule::OnSharedEngineSignalHandlerException(const QScriptValue& exception)
+{
+    QScriptEngine *sharedEngine = exception.engine();
+    LogError(exception.toString());
+    if (!sharedEngine)
+        return;
+    foreach(const QString &error, sharedEngine->uncaughtExceptionBacktrace())
+        LogError(error);
+    LogError("Line " + QString::number(sharedEngine->uncaughtExceptionLineNumber()) + ".");
+}
+
+void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
+{
+    ConnectScriptEngineCreatedHandlers();
+
+    // Register framework's dynamic properties (service objects) and the framework itself to the script engine
+    QList<QByteArray> properties = framework_->dynamicPropertyNames();
+    for(QList<QByteArray>::size_type i = 0; i < properties.size(); ++i)
+    {
+        QString name = properties[i];
+        QObject* serviceobject = framework_->property(name.toStdString().c_str()).value<QObject*>();
+        instance->RegisterService(serviceobject, name);
+    }
 
     instance->RegisterService(framework_, "framework");
     instance->RegisterService(instance, "engine");
@@ -654,7 +911,9 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
         instance->RegisterService(comp->ParentEntity()->ParentScene(), "scene");
     }
 
-    emit ScriptEngineCreated(instance->Engine());
+    // Shared engines are announced once when they are created
+    if (!instance->HasSharedEngine())
+        emit ScriptEngineCreated(instance->Engine());
 }
 
 extern "C"
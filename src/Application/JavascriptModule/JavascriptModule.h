@@ -14,8 +14,12 @@
 #include "JavascriptFwd.h"
 
 #include <QVariant>
+#include <QHash>
+#include <QScriptProgram>
 
 class JavascriptInstance;
+class ScriptBudgetAgent;
+struct ScriptBudgetStats;
 
 /// Enables Javascript execution and scripting by using QtScript.
 class JavascriptModule : public IModule
@@ -36,6 +40,45 @@ public:
         @param comp Script component, null by default. */
     void PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp = 0);
 
+    /// Returns whether EC_Script instances run in shared engines from the engine pool. Enabled with the --scriptenginepool command line parameter.
+    bool IsEnginePoolEnabled() const { return maxSharedEngines_ > 0; }
+
+    /// Returns the least used shared engine of the engine pool, creating a new engine if the pool is not full yet.
+    /** The Qt meta types, the core types and the core API meta types are exposed to each shared engine once when it is created.
+        Trusted and untrusted scripts never share an engine, as trusted scripts can import extensions into the global object.
+        @param trusted Whether the script that will run in the engine is trusted. */
+    QScriptEngine *AcquireSharedEngine(bool trusted);
+
+    /// Releases a shared engine acquired with AcquireSharedEngine. The engine is deleted when no script uses it anymore.
+    void ReleaseSharedEngine(QScriptEngine *engine);
+
+    /// Returns the compiled program of an included script file.
+    /** The programs are cached by the hash of the script content, so each distinct included file is syntax-checked and compiled only once.
+        @param content Script code
+        @param fileName File name of the script, used in the backtraces of the program
+        @param syntaxError [out] Error message if the code has syntax errors
+        @return The program, or a null program if the code has syntax errors */
+    QScriptProgram IncludeProgram(const QString &content, const QString &fileName, QString &syntaxError);
+
+    /// Returns whether the CPU time of the scripts is accounted. Enabled with the --scriptbudget and --scripthardlimit command line parameters.
+    /** Budgeting installs an agent to each script engine, which disables the JIT compiler of the engine and so slows down script execution. */
+    bool IsScriptBudgetEnabled() const { return scriptBudgetEnabled_; }
+
+    /// Installs a budget agent to a script engine, if script budgeting is enabled.
+    /** @param engine Script engine
+        @param instance Script instance that owns the engine, or null for shared engines */
+    void InstallBudgetAgent(QScriptEngine *engine, JavascriptInstance *instance);
+
+    /// Registers a budget agent. Called by ScriptBudgetAgent.
+    void RegisterBudgetAgent(ScriptBudgetAgent *agent);
+
+    /// Unregisters a budget agent. Called by ScriptBudgetAgent.
+    void UnregisterBudgetAgent(ScriptBudgetAgent *agent);
+
+    /// Returns the CPU time statistics of the scripts that have used the most time in total, in descending order.
+    /** @param count Maximum number of scripts to return */
+    std::vector<ScriptBudgetStats> TopScripts(size_t count) const;
+
 public slots:
     /// Executes js file.
     void RunScript(const QString &scriptFilename);
@@ -75,9 +118,45 @@ private:
     /// Remove script class instances for all EC_Scripts depending on this script application
     void RemoveScriptObjects(JavascriptInstance* jsInstance);
 
+    /// Connects the service objects that have an OnScriptEngineCreated() slot to the ScriptEngineCreated signal.
+    void ConnectScriptEngineCreatedHandlers();
+
     /// Default engine for console & commandline script execution
     QScriptEngine *engine;
 
+    /// Shared script engine of the engine pool.
+    struct SharedEngine
+    {
+        QScriptEngine *engine;
+        bool trusted;
+        int numInstances; ///< Number of script instances running in the engine
+    };
+
+    /// Shared script engines.
+    std::vector<SharedEngine> sharedEngines_;
+
+    /// Maximum number of shared engines per trust level, or 0 if the engine pool is disabled.
+    int maxSharedEngines_;
+
+    /// Compiled programs of included script files, by the SHA-1 hash of their content.
+    QHash<QByteArray, QScriptProgram> includePrograms_;
+
+    /// Is script budgeting enabled.
+    bool scriptBudgetEnabled_;
+
+    /// Per-frame CPU time budget of each script instance in seconds, 0 for no budget. Exceeding the budget is logged.
+    double scriptFrameBudget_;
+
+    /// Time a single script run may take in seconds, 0 for no limit. Runs exceeding the limit are aborted and their instances unloaded.
+    /// Set only by the --scripthardlimit command line parameter or the JsBudget console command.
+    double scriptHardLimit_;
+
+    /// Wall clock time of the last budget overrun warning.
+    double lastBudgetWarningTime_;
+
+    /// Budget agents of all script engines.
+    std::vector<ScriptBudgetAgent *> budgetAgents_;
+
     /// Engines for executing startup (possibly persistent) scripts
     std::vector<JavascriptInstance *> startupScripts_;
 
@@ -93,4 +172,14 @@ private slots:
     void ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& newScripts);
     void ScriptAppNameChanged(const QString& newAppName);
     void ScriptClassNameChanged(const QString& newClassName);
+    void OnSharedEngineSignalHandlerException(const QScriptValue& exception);
+
+    /// Ends the budget frame of the script engines and suspends the script instances whose runs were aborted.
+    void OnPostFrameUpdate(float frametime);
+
+    /// Sets the script budget from the console. Usage: JsBudget(frameBudgetMs,hardLimitMs)
+    void ConsoleSetScriptBudget(const QStringList &params);
+
+    /// Prints the scripts that have used the most CPU time. Usage: JsTopScripts(count)
+    void ConsoleTopScripts(const QStringList &params);
 };
@@ -0,0 +1,167 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptBudgetAgent.cpp
+ *  @brief  Script engine agent that accounts the CPU time spent in scripts and aborts runaway scripts.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptBudgetAgent.h"
+#include "JavascriptModule.h"
+#include "JavascriptInstance.h"
+
+#include <QScriptEngine>
+#include <QScriptContext>
+
+#include "MemoryLeakCheck.h"
+
+/// Number of position changes between the clock samples of the hard limit check.
+static const uint cPositionChangesPerSample = 64;
+
+ScriptBudgetAgent::ScriptBudgetAgent(QScriptEngine *engine, JavascriptModule *module, JavascriptInstance *instance) :
+    QScriptEngineAgent(engine),
+    module_(module),
+    instance_(instance),
+    runInstance_(0),
+    hardLimitTicks_(0),
+    runStart_(0),
+    depth_(0),
+    numPositionChanges_(0),
+    abortingRun_(false)
+{
+    // An instance with its own engine is listed in the statistics even before its first run
+    if (instance_)
+        accounts_[instance_];
+    engine->setAgent(this);
+    module_->RegisterBudgetAgent(this);
+}
+
+ScriptBudgetAgent::~ScriptBudgetAgent()
+{
+    module_->UnregisterBudgetAgent(this);
+}
+
+void ScriptBudgetAgent::functionEntry(qint64 /*scriptId*/)
+{
+    if (depth_++ == 0)
+    {
+        runStart_ = GetCurrentClockTime();
+        runInstance_ = instance_ ? instance_ : ActiveInstance();
+        abortingRun_ = false;
+    }
+}
+
+void ScriptBudgetAgent::functionExit(qint64 /*scriptId*/, const QScriptValue & /*returnValue*/)
+{
+    if (depth_ > 0 && --depth_ == 0)
+        EndRun(GetCurrentClockTime());
+}
+
+void ScriptBudgetAgent::positionChange(qint64 /*scriptId*/, int /*lineNumber*/, int /*columnNumber*/)
+{
+    if (!hardLimitTicks_ || depth_ == 0 || abortingRun_ || ++numPositionChanges_ % cPositionChangesPerSample != 0)
+        return;
+
+    if (GetCurrentClockTime() - runStart_ > hardLimitTicks_)
+    {
+        // The run ends as the abort unwinds the script stack
+        Account &account = accounts_[runInstance_];
+        account.aborted = true;
+        ++account.stats.numAborts;
+        abortingRun_ = true;
+        engine()->abortEvaluation();
+    }
+}
+
+void ScriptBudgetAgent::SetHardLimit(double seconds)
+{
+    hardLimitTicks_ = seconds > 0.0 ? (tick_t)(seconds * GetCurrentClockFreq()) : 0;
+}
+
+JavascriptInstance *ScriptBudgetAgent::ActiveInstance() const
+{
+    // The scope object of a script refers back to its instance, see JavascriptInstance::CreateEngine
+    for(QScriptContext *context = engine()->currentContext(); context; context = context->parentContext())
+    {
+        QScriptValueList scopes = context->scopeChain();
+        for(int i = 0; i < scopes.size(); ++i)
+        {
+            JavascriptInstance *instance = qobject_cast<JavascriptInstance *>(scopes[i].data().toQObject());
+            if (instance)
+                return instance;
+        }
+    }
+    return 0;
+}
+
+void ScriptBudgetAgent::EndRun(tick_t now)
+{
+    double runTime = (double)(now - runStart_) / GetCurrentClockFreq();
+    Account &account = accounts_[runInstance_];
+    account.frameTime += runTime;
+    account.stats.totalTime += runTime;
+    if (runTime > account.stats.maxRunTime)
+        account.stats.maxRunTime = runTime;
+    ++account.stats.numRuns;
+}
+
+QStringList ScriptBudgetAgent::EndFrame(double frameBudget)
+{
+    // No script runs between frames. If a run is still open, its exit was not reported (f.ex. due to an abort), so close it here
+    if (depth_ > 0)
+    {
+        depth_ = 0;
+        EndRun(GetCurrentClockTime());
+    }
+
+    QStringList overBudget;
+    for(AccountMap::iterator i = accounts_.begin(); i != accounts_.end(); ++i)
+    {
+        Account &account = i->second;
+        account.stats.frameTime = account.frameTime;
+        account.frameTime = 0.0;
+        if (frameBudget > 0.0 && account.stats.frameTime > frameBudget)
+        {
+            ++account.stats.numOverruns;
+            overBudget << AccountName(i->first);
+        }
+    }
+    return overBudget;
+}
+
+std::vector<ScriptBudgetStats> ScriptBudgetAgent::Stats() const
+{
+    std::vector<ScriptBudgetStats> stats;
+    for(AccountMap::const_iterator i = accounts_.begin(); i != accounts_.end(); ++i)
+    {
+        stats.push_back(i->second.stats);
+        stats.back().name = AccountName(i->first);
+    }
+    return stats;
+}
+
+std::vector<JavascriptInstance *> ScriptBudgetAgent::TakeAbortedInstances()
+{
+    std::vector<JavascriptInstance *> aborted;
+    for(AccountMap::iterator i = accounts_.begin(); i != accounts_.end(); ++i)
+        if (i->second.aborted)
+        {
+            i->second.aborted = false;
+            aborted.push_back(i->first);
+        }
+    return aborted;
+}
+
+void ScriptBudgetAgent::ForgetInstance(JavascriptInstance *instance)
+{
+    accounts_.erase(instance);
+    if (runInstance_ == instance)
+        runInstance_ = 0;
+}
+
+QString ScriptBudgetAgent::AccountName(JavascriptInstance *instance) const
+{
+    return instance ? instance->ScriptName() : name_;
+}
@@ -0,0 +1,122 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptBudgetAgent.h
+ *  @brief  Script engine agent that accounts the CPU time spent in scripts and aborts runaway scripts.
+ */
+
+#pragma once
+
+#include "HighPerfClock.h"
+#include "JavascriptFwd.h"
+
+#include <QScriptEngineAgent>
+#include <QStringList>
+
+#include <map>
+#include <vector>
+
+/// CPU time statistics of one script instance.
+struct ScriptBudgetStats
+{
+    ScriptBudgetStats() : frameTime(0.0), totalTime(0.0), maxRunTime(0.0), numRuns(0), numOverruns(0), numAborts(0) {}
+
+    /// Name of the script instance, or of the shared engine for runs that could not be attributed to a script
+    QString name;
+    /// Time spent in the scripts during the last frame, in seconds
+    double frameTime;
+    /// Total time spent in the scripts, in seconds
+    double totalTime;
+    /// Longest single run of the scripts, in seconds
+    double maxRunTime;
+    /// Number of runs, ie. calls from C++ into the scripts
+    uint numRuns;
+    /// Number of frames in which the scripts exceeded the per-frame budget
+    uint numOverruns;
+    /// Number of runs aborted for exceeding the hard limit
+    uint numAborts;
+};
+
+/// Script engine agent that accounts the CPU time spent in the scripts of an engine and aborts runs that exceed the hard limit.
+/** A run starts when C++ code calls into the engine, f.ex. to evaluate a script or to invoke a script signal handler, and ends
+    when the call returns. Only the function entries and exits are timed; the clock is sampled on position changes only to
+    detect runs that exceed the hard limit.
+    Each run is accounted to a script instance. In a shared engine, the run belongs to the instance whose scope object is in the
+    scope chain of the entered function: the activation object of the evaluated script, or the closure scope of a signal handler.
+    The agents are created by JavascriptModule when script budgeting is enabled, and owned by their engines.
+    JavascriptModule closes the frame of each agent at the end of each frame and suspends the instances whose runs were aborted. */
+class ScriptBudgetAgent : public QScriptEngineAgent
+{
+public:
+    /// Creates the agent and installs it to the engine.
+    /** @param engine Script engine
+        @param module Javascript module, which keeps track of the agents
+        @param instance Script instance that owns the engine, or null for shared engines */
+    ScriptBudgetAgent(QScriptEngine *engine, JavascriptModule *module, JavascriptInstance *instance);
+    ~ScriptBudgetAgent();
+
+    /// QScriptEngineAgent override.
+    void functionEntry(qint64 scriptId);
+
+    /// QScriptEngineAgent override.
+    void functionExit(qint64 scriptId, const QScriptValue &returnValue);
+
+    /// QScriptEngineAgent override.
+    void positionChange(qint64 scriptId, int lineNumber, int columnNumber);
+
+    /// Sets the time a single run may take before it is aborted.
+    /** @param seconds Hard limit in seconds, or 0 to never abort */
+    void SetHardLimit(double seconds);
+
+    /// Ends the current frame: moves the frame times to the statistics and counts a budget overrun for each script whose frame time exceeded the budget.
+    /** @param frameBudget Per-frame budget in seconds, or 0 for no budget
+        @return Names of the scripts that exceeded the budget */
+    QStringList EndFrame(double frameBudget);
+
+    /// Returns the statistics of the scripts of the engine, one entry per script instance.
+    std::vector<ScriptBudgetStats> Stats() const;
+
+    /// Sets the name reported for the runs of a shared engine that could not be attributed to a script instance.
+    void SetName(const QString &name) { name_ = name; }
+
+    /// Returns the name reported for the runs of a shared engine that could not be attributed to a script instance.
+    QString Name() const { return name_; }
+
+    /// Returns the instances whose runs were aborted for exceeding the hard limit since the last call, and clears them.
+    /** A null instance stands for an aborted run of a shared engine that could not be attributed to a script instance. */
+    std::vector<JavascriptInstance *> TakeAbortedInstances();
+
+    /// Drops the statistics of a script instance that is unloading from a shared engine.
+    void ForgetInstance(JavascriptInstance *instance);
+
+private:
+    /// Budget bookkeeping of one script instance.
+    struct Account
+    {
+        Account() : frameTime(0.0), aborted(false) {}
+        ScriptBudgetStats stats;
+        double frameTime; ///< Time spent in the current frame, in seconds
+        bool aborted; ///< Has a run been aborted since the last TakeAbortedInstances()
+    };
+    typedef std::map<JavascriptInstance *, Account> AccountMap;
+
+    /// Returns the script instance whose scope object is in the scope chain of the current context of a shared engine, or null if none.
+    JavascriptInstance *ActiveInstance() const;
+
+    /// Ends the current run and accounts its time.
+    void EndRun(tick_t now);
+
+    /// Returns the name of the script instance, or of the engine for a null instance.
+    QString AccountName(JavascriptInstance *instance) const;
+
+    JavascriptModule *module_;
+    JavascriptInstance *instance_;
+    QString name_;
+    AccountMap accounts_;
+    JavascriptInstance *runInstance_; ///< Script instance the current run is accounted to
+    tick_t hardLimitTicks_; ///< Hard limit in clock ticks, 0 for no limit
+    tick_t runStart_; ///< Clock time at the start of the current run
+    int depth_; ///< Function nesting depth, 0 when no run is in progress
+    uint numPositionChanges_; ///< Counts position changes for sampling the clock
+    bool abortingRun_; ///< Has the current run been aborted
+};
@@ -0,0 +1,288 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+/** The per-object math bindings wrap each float3 or Quat as a script object and marshal the arguments of every call,
+    which dominates the time of scripts that process thousands of values. The bulk functions below instead take and return
+    flat script arrays of numbers, f.ex. [x0, y0, z0, x1, y1, z1, ...] for float3s, and process the whole array with a single
+    call from the script. The read and write functions move the placeable transforms of a list of entities in and out of such arrays.
+
+    Layouts: float3s have 3 numbers per value, Quats 4 (x, y, z, w), and Transforms 9 (pos, rot in degrees, scale). */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptBulkMath.h"
+#include "QtScriptBindingsHelpers.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+/// Reads a script array of numbers.
+static void ReadFloats(const QScriptValue &array, std::vector<float> &dest)
+{
+    quint32 length = array.property("length").toUInt32();
+    dest.resize(length);
+    for(quint32 i = 0; i < length; ++i)
+        dest[i] = (float)array.property(i).toNumber();
+}
+
+/// Creates a script array of numbers.
+static QScriptValue NewFloatArray(QScriptEngine *engine, const std::vector<float> &src)
+{
+    QScriptValue array = engine->newArray((uint)src.size());
+    for(quint32 i = 0; i < (quint32)src.size(); ++i)
+        array.setProperty(i, QScriptValue((qsreal)src[i]));
+    return array;
+}
+
+/// Returns the transform attribute of the placeable of an entity, or null if the value is not an entity with a placeable.
+static Attribute<Transform> *PlaceableTransform(const QScriptValue &entityValue)
+{
+    Entity *entity = qobject_cast<Entity *>(entityValue.toQObject());
+    if (!entity)
+        return 0;
+    ComponentPtr placeable = entity->GetComponent("EC_Placeable");
+    return placeable ? dynamic_cast<Attribute<Transform> *>(placeable->GetAttribute("Transform")) : 0;
+}
+
+/// Reads the placeable transforms of a script array of entities. Entities without a placeable get the identity transform.
+static void ReadTransforms(const QScriptValue &entities, std::vector<Transform> &dest)
+{
+    quint32 length = entities.property("length").toUInt32();
+    dest.resize(length);
+    for(quint32 i = 0; i < length; ++i)
+    {
+        Attribute<Transform> *attr = PlaceableTransform(entities.property(i));
+        dest[i] = attr ? attr->Get() : Transform();
+    }
+}
+
+/// Returns the attribute change type passed as an optional argument.
+static AttributeChange::Type ChangeArgument(QScriptContext *context, int index)
+{
+    return context->argumentCount() > index ? (AttributeChange::Type)context->argument(index).toInt32() : AttributeChange::Default;
+}
+
+static QScriptValue math_ReadPositions(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 1)
+        return context->throwError(QScriptContext::SyntaxError, "ReadPositions(entities): missing argument.");
+    std::vector<Transform> transforms;
+    ReadTransforms(context->argument(0), transforms);
+    std::vector<float> ret(transforms.size() * 3);
+    for(size_t i = 0; i < transforms.size(); ++i)
+    {
+        ret[i*3] = transforms[i].pos.x;
+        ret[i*3+1] = transforms[i].pos.y;
+        ret[i*3+2] = transforms[i].pos.z;
+    }
+    return NewFloatArray(engine, ret);
+}
+
+static QScriptValue math_ReadOrientations(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 1)
+        return context->throwError(QScriptContext::SyntaxError, "ReadOrientations(entities): missing argument.");
+    std::vector<Transform> transforms;
+    ReadTransforms(context->argument(0), transforms);
+    std::vector<float> ret(transforms.size() * 4);
+    for(size_t i = 0; i < transforms.size(); ++i)
+    {
+        Quat q = transforms[i].Orientation();
+        ret[i*4] = q.x;
+        ret[i*4+1] = q.y;
+        ret[i*4+2] = q.z;
+        ret[i*4+3] = q.w;
+    }
+    return NewFloatArray(engine, ret);
+}
+
+static QScriptValue math_ReadTransforms(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 1)
+        return context->throwError(QScriptContext::SyntaxError, "ReadTransforms(entities): missing argument.");
+    std::vector<Transform> transforms;
+    ReadTransforms(context->argument(0), transforms);
+    std::vector<float> ret(transforms.size() * 9);
+    for(size_t i = 0; i < transforms.size(); ++i)
+    {
+        const Transform &t = transforms[i];
+        float *dest = &ret[i*9];
+        dest[0] = t.pos.x; dest[1] = t.pos.y; dest[2] = t.pos.z;
+        dest[3] = t.rot.x; dest[4] = t.rot.y; dest[5] = t.rot.z;
+        dest[6] = t.scale.x; dest[7] = t.scale.y; dest[8] = t.scale.z;
+    }
+    return NewFloatArray(engine, ret);
+}
+
+static QScriptValue math_WritePositions(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 2)
+        return context->throwError(QScriptContext::SyntaxError, "WritePositions(entities, positions, change): missing arguments.");
+    QScriptValue entities = context->argument(0);
+    std::vector<float> positions;
+    ReadFloats(context->argument(1), positions);
+    AttributeChange::Type change = ChangeArgument(context, 2);
+
+    quint32 length = std::min(entities.property("length").toUInt32(), (quint32)(positions.size() / 3));
+    for(quint32 i = 0; i < length; ++i)
+    {
+        Attribute<Transform> *attr = PlaceableTransform(entities.property(i));
+        if (!attr)
+            continue;
+        Transform t = attr->Get();
+        t.pos = float3(positions[i*3], positions[i*3+1], positions[i*3+2]);
+        attr->Set(t, change);
+    }
+    return QScriptValue();
+}
+
+static QScriptValue math_WriteTransforms(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() < 2)
+        return context->throwError(QScriptContext::SyntaxError, "WriteTransforms(entities, transforms, change): missing arguments.");
+    QScriptValue entities = context->argument(0);
+    std::vector<float> transforms;
+    ReadFloats(context->argument(1), transforms);
+    AttributeChange::Type change = ChangeArgument(context, 2);
+
+    quint32 length = std::min(entities.property("length").toUInt32(), (quint32)(transforms.size() / 9));
+    for(quint32 i = 0; i < length; ++i)
+    {
+        Attribute<Transform> *attr = PlaceableTransform(entities.property(i));
+        if (!attr)
+            continue;
+        const float *src = &transforms[i*9];
+        attr->Set(Transform(float3(src[0], src[1], src[2]), float3(src[3], src[4], src[5]), float3(src[6], src[7], src[8])), change);
+    }
+    return QScriptValue();
+}
+
+static QScriptValue math_TranslateFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "TranslateFloat3s(float3s, offset): invalid number of arguments.");
+    std::vector<float> values;
+    ReadFloats(context->argument(0), values);
+    float3 offset = qscriptvalue_cast<float3>(context->argument(1));
+    for(size_t i = 0; i + 2 < values.size(); i += 3)
+    {
+        values[i] += offset.x;
+        values[i+1] += offset.y;
+        values[i+2] += offset.z;
+    }
+    return NewFloatArray(engine, values);
+}
+
+static QScriptValue math_ScaleFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "ScaleFloat3s(float3s, scalar): invalid number of arguments.");
+    std::vector<float> values;
+    ReadFloats(context->argument(0), values);
+    float scalar = (float)context->argument(1).toNumber();
+    for(size_t i = 0; i < values.size(); ++i)
+        values[i] *= scalar;
+    return NewFloatArray(engine, values);
+}
+
+static QScriptValue math_TransformFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "TransformFloat3s(float3x4, float3s): invalid number of arguments.");
+    float3x4 m = qscriptvalue_cast<float3x4>(context->argument(0));
+    std::vector<float> values;
+    ReadFloats(context->argument(1), values);
+    for(size_t i = 0; i + 2 < values.size(); i += 3)
+    {
+        float3 v = m.TransformPos(float3(values[i], values[i+1], values[i+2]));
+        values[i] = v.x;
+        values[i+1] = v.y;
+        values[i+2] = v.z;
+    }
+    return NewFloatArray(engine, values);
+}
+
+static QScriptValue math_RotateFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "RotateFloat3s(Quat, float3s): invalid number of arguments.");
+    // Rotating with the matrix is cheaper than with the quaternion when there are many vectors
+    float3x3 m = qscriptvalue_cast<Quat>(context->argument(0)).ToFloat3x3();
+    std::vector<float> values;
+    ReadFloats(context->argument(1), values);
+    for(size_t i = 0; i + 2 < values.size(); i += 3)
+    {
+        float3 v = m * float3(values[i], values[i+1], values[i+2]);
+        values[i] = v.x;
+        values[i+1] = v.y;
+        values[i+2] = v.z;
+    }
+    return NewFloatArray(engine, values);
+}
+
+static QScriptValue math_MulQuats(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "MulQuats(Quat, quats): invalid number of arguments.");
+    Quat lhs = qscriptvalue_cast<Quat>(context->argument(0));
+    std::vector<float> values;
+    ReadFloats(context->argument(1), values);
+    for(size_t i = 0; i + 3 < values.size(); i += 4)
+    {
+        Quat q = lhs * Quat(values[i], values[i+1], values[i+2], values[i+3]);
+        values[i] = q.x;
+        values[i+1] = q.y;
+        values[i+2] = q.z;
+        values[i+3] = q.w;
+    }
+    return NewFloatArray(engine, values);
+}
+
+static QScriptValue math_LerpFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 3)
+        return context->throwError(QScriptContext::SyntaxError, "LerpFloat3s(from, to, t): invalid number of arguments.");
+    std::vector<float> from, to;
+    ReadFloats(context->argument(0), from);
+    ReadFloats(context->argument(1), to);
+    float t = (float)context->argument(2).toNumber();
+    from.resize(std::min(from.size(), to.size()));
+    for(size_t i = 0; i < from.size(); ++i)
+        from[i] += (to[i] - from[i]) * t;
+    return NewFloatArray(engine, from);
+}
+
+static QScriptValue math_DistancesFloat3s(QScriptContext *context, QScriptEngine *engine)
+{
+    if (context->argumentCount() != 2)
+        return context->throwError(QScriptContext::SyntaxError, "DistancesFloat3s(float3s, point): invalid number of arguments.");
+    std::vector<float> values;
+    ReadFloats(context->argument(0), values);
+    float3 point = qscriptvalue_cast<float3>(context->argument(1));
+    std::vector<float> ret(values.size() / 3);
+    for(size_t i = 0; i < ret.size(); ++i)
+        ret[i] = float3(values[i*3], values[i*3+1], values[i*3+2]).Distance(point);
+    return NewFloatArray(engine, ret);
+}
+
+void ExposeBulkMath(QScriptEngine *engine, QScriptValue &mathNamespace)
+{
+    const QScriptValue::PropertyFlags flags = QScriptValue::Undeletable | QScriptValue::ReadOnly;
+    mathNamespace.setProperty("ReadPositions", engine->newFunction(math_ReadPositions, 1), flags);
+    mathNamespace.setProperty("ReadOrientations", engine->newFunction(math_ReadOrientations, 1), flags);
+    mathNamespace.setProperty("ReadTransforms", engine->newFunction(math_ReadTransforms, 1), flags);
+    mathNamespace.setProperty("WritePositions", engine->newFunction(math_WritePositions, 3), flags);
+    mathNamespace.setProperty("WriteTransforms", engine->newFunction(math_WriteTransforms, 3), flags);
+    mathNamespace.setProperty("TranslateFloat3s", engine->newFunction(math_TranslateFloat3s, 2), flags);
+    mathNamespace.setProperty("ScaleFloat3s", engine->newFunction(math_ScaleFloat3s, 2), flags);
+    mathNamespace.setProperty("TransformFloat3s", engine->newFunction(math_TransformFloat3s, 2), flags);
+    mathNamespace.setProperty("RotateFloat3s", engine->newFunction(math_RotateFloat3s, 2), flags);
+    mathNamespace.setProperty("MulQuats", engine->newFunction(math_MulQuats, 2), flags);
+    mathNamespace.setProperty("LerpFloat3s", engine->newFunction(math_LerpFloat3s, 3), flags);
+    mathNamespace.setProperty("DistancesFloat3s", engine->newFunction(math_DistancesFloat3s, 2), flags);
+}
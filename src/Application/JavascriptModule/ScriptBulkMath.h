@@ -0,0 +1,9 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+class QScriptEngine;
+class QScriptValue;
+
+/// Adds the bulk math functions, which operate on flat arrays of float3, Quat and Transform values, to the math namespace object.
+void ExposeBulkMath(QScriptEngine *engine, QScriptValue &mathNamespace);
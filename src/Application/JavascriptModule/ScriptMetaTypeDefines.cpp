@@ -9,6 +9,7 @@
 #include "DebugOperatorNew.h"
 
 #include "ScriptMetaTypeDefines.h"
+#include "ScriptBulkMath.h"
 
 #include "SceneAPI.h"
 #include "ChangeRequest.h"
@@ -258,6 +259,7 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
     QScriptValue mathNamespace = engine->newObject();
     mathNamespace.setProperty("SetMathBreakOnAssume", engine->newFunction(math_SetMathBreakOnAssume, 1), QScriptValue::Undeletable | QScriptValue::ReadOnly);
     mathNamespace.setProperty("MathBreakOnAssume", engine->newFunction(math_SetMathBreakOnAssume, 0), QScriptValue::Undeletable | QScriptValue::ReadOnly);
+    ExposeBulkMath(engine, mathNamespace);
     engine->globalObject().setProperty("math", mathNamespace);
 
     // Input metatypes.
@@ -354,6 +356,8 @@ void ExposeCoreApiMetaTypes(QScriptEngine *engine)
     qRegisterMetaType<SoundChannel::SoundState>("SoundChannel::SoundState");
     qRegisterMetaType<SoundChannel::SoundType>("SoundType");
     qRegisterMetaType<SoundChannel::SoundType>("SoundChannel::SoundType");
+    qRegisterMetaType<SoundChannel::StreamingMode>("StreamingMode");
+    qRegisterMetaType<SoundChannel::StreamingMode>("SoundChannel::StreamingMode");
 
     // Renderer metatypes
     qScriptRegisterQObjectMetaType<RaycastResult*>(engine);
@@ -23,6 +23,8 @@
 #include <alc.h>
 #endif
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 using namespace std;
@@ -39,7 +41,12 @@ public:
         captureDevice(0),
         captureSampleSize(0),
         nextChannelId(0),
-        masterGain(0.0f)
+        masterGain(0.0f),
+        streamingThreshold(0),
+        maxRealVoices(0),
+        audibilityThreshold(0.0f),
+        numRealVoices(0),
+        numVirtualVoices(0)
     {
     }
 
@@ -67,8 +74,49 @@ public:
     float masterGain;
     /// Master gain for individual sound types
     std::map<SoundChannel::SoundType, float> soundMasterGain;
+    /// Size in bytes above which Ogg Vorbis assets are only streamed, 0 to decode all
+    uint streamingThreshold;
+    /// Maximum number of channels with an OpenAL source, 0 for no limit
+    uint maxRealVoices;
+    /// Audibility below which channels are made virtual
+    float audibilityThreshold;
+    /// Number of real voices in the last update
+    uint numRealVoices;
+    /// Number of virtual voices in the last update
+    uint numVirtualVoices;
+
+    /// Non-stopped channel competing for an OpenAL source
+    struct Voice
+    {
+        SoundChannel *channel;
+        int priority;
+        float audibility;
+        bool forceReal;
+        bool real;
+
+        /// Sorts the voices into the order in which they get a source
+        bool operator <(const Voice &rhs) const
+        {
+            if (forceReal != rhs.forceReal)
+                return forceReal;
+            if (priority != rhs.priority)
+                return priority > rhs.priority;
+            return audibility > rhs.audibility;
+        }
+    };
+    /// Voices of the current update. Kept as a member to avoid reallocating each frame
+    std::vector<Voice> voices;
 };
 
+/// Default size above which Ogg Vorbis assets are only streamed, roughly a minute of 128 kbps audio
+static const uint DEFAULT_STREAMING_THRESHOLD = 1024 * 1024;
+/// Default maximum number of channels with an OpenAL source. Many OpenAL implementations provide 32 sources at minimum
+static const uint DEFAULT_MAX_REAL_VOICES = 32;
+/// Default audibility below which channels are made virtual, -60 dB
+static const float DEFAULT_AUDIBILITY_THRESHOLD = 0.001f;
+/// Audibility bonus of the channels that already have a source, to keep the channels near the limit or the threshold from switching every frame
+static const float VOICE_HYSTERESIS = 1.25f;
+
 AudioAPI::AudioAPI(Framework *fw, AssetAPI *assetAPI_)
 :impl(new AudioApiImpl),
 assetAPI(assetAPI_)
@@ -93,6 +141,42 @@ assetAPI(assetAPI_)
     if (audioDevice.size() > 1)
         LogWarning("Specified multiple --audiodevice parameters. Using \"" + device + "\".");
     Initialize(device);
+
+    impl->streamingThreshold = DEFAULT_STREAMING_THRESHOLD;
+    QStringList streamThreshold = fw->CommandLineParameters("--audiostreamthreshold");
+    if (!streamThreshold.isEmpty())
+    {
+        bool ok = false;
+        uint kilobytes = streamThreshold.back().toUInt(&ok);
+        if (ok)
+            impl->streamingThreshold = kilobytes * 1024;
+        else
+            LogWarning("Invalid --audiostreamthreshold parameter \"" + streamThreshold.back() + "\". Using the default.");
+    }
+
+    impl->maxRealVoices = DEFAULT_MAX_REAL_VOICES;
+    QStringList maxVoices = fw->CommandLineParameters("--audiomaxvoices");
+    if (!maxVoices.isEmpty())
+    {
+        bool ok = false;
+        uint voices = maxVoices.back().toUInt(&ok);
+        if (ok)
+            impl->maxRealVoices = voices;
+        else
+            LogWarning("Invalid --audiomaxvoices parameter \"" + maxVoices.back() + "\". Using the default.");
+    }
+
+    impl->audibilityThreshold = DEFAULT_AUDIBILITY_THRESHOLD;
+    QStringList threshold = fw->CommandLineParameters("--audiothreshold");
+    if (!threshold.isEmpty())
+    {
+        bool ok = false;
+        float value = threshold.back().toFloat(&ok);
+        if (ok && value >= 0.0f)
+            impl->audibilityThreshold = value;
+        else
+            LogWarning("Invalid --audiothreshold parameter \"" + threshold.back() + "\". Using the default.");
+    }
         
     // Set default master gains for sound types
     /*
@@ -244,11 +328,16 @@ void AudioAPI::Update(f64 frametime)
     ALfloat orient[] = {front.x, front.y, front.z, up.x, up.y, up.z};
     alListenerfv(AL_ORIENTATION, orient);
     
-    // Update channel attenuations, check which have stopped
+    // Update channel attenuations, then decide which channels get a source
+    for(SoundChannelMap::iterator i = impl->channels.begin(); i != impl->channels.end(); ++i)
+        i->second->UpdateAttenuation(impl->listenerPosition);
+    AssignVoices();
+
+    // Update channels, check which have stopped
     SoundChannelMap::iterator i = impl->channels.begin();
     while(i != impl->channels.end())
     {
-        i->second->Update(impl->listenerPosition);
+        i->second->Update(frametime);
         if (i->second->GetState() == SoundChannel::Stopped)
         {
             channelsToDelete.push_back(i);
@@ -263,6 +352,47 @@ void AudioAPI::Update(f64 frametime)
  //   mutex.unlock();
 }
 
+void AudioAPI::AssignVoices()
+{
+    PROFILE(AudioAPI_AssignVoices);
+
+    std::vector<AudioApiImpl::Voice> &voices = impl->voices;
+    voices.clear();
+    for(SoundChannelMap::iterator i = impl->channels.begin(); i != impl->channels.end(); ++i)
+    {
+        SoundChannel *channel = i->second.get();
+        if (channel->GetState() == SoundChannel::Stopped)
+            continue;
+        AudioApiImpl::Voice voice;
+        voice.channel = channel;
+        voice.priority = channel->GetPriority();
+        voice.audibility = channel->GetAudibility();
+        if (!channel->IsVirtual())
+            voice.audibility *= VOICE_HYSTERESIS;
+        voice.forceReal = !channel->CanVirtualize();
+        voices.push_back(voice);
+    }
+    std::sort(voices.begin(), voices.end());
+
+    uint numReal = 0;
+    for(uint i = 0; i < voices.size(); ++i)
+    {
+        AudioApiImpl::Voice &voice = voices[i];
+        voice.real = voice.forceReal || ((impl->maxRealVoices == 0 || numReal < impl->maxRealVoices) &&
+            voice.audibility >= impl->audibilityThreshold);
+        if (voice.real)
+            ++numReal;
+        else // Release the sources of the channels made virtual before the channels made real need them
+            voice.channel->SetVirtual(true);
+    }
+    for(uint i = 0; i < voices.size(); ++i)
+        if (voices[i].real)
+            voices[i].channel->SetVirtual(false);
+
+    impl->numRealVoices = numReal;
+    impl->numVirtualVoices = voices.size() - numReal;
+}
+
 bool AudioAPI::IsInitialized() const
 { 
     return impl && impl->initialized;
@@ -282,7 +412,7 @@ void AudioAPI::SetListener(const float3 &position, const Quat &orientation)
 #undef PlaySound
 #endif
 
-SoundChannelPtr AudioAPI::PlaySound(AssetPtr audioAsset, SoundChannel::SoundType type, SoundChannelPtr channel)
+SoundChannelPtr AudioAPI::PlaySound(AssetPtr audioAsset, SoundChannel::SoundType type, SoundChannelPtr channel, SoundChannel::StreamingMode streaming)
 {
     if (!impl || !impl->initialized)
         return SoundChannelPtr();
@@ -296,12 +426,12 @@ SoundChannelPtr AudioAPI::PlaySound(AssetPtr audioAsset, SoundChannel::SoundType
 
     channel->SetMasterGain(impl->soundMasterGain[type] * impl->masterGain);
     channel->SetPositional(false);
-    channel->Play(boost::dynamic_pointer_cast<AudioAsset>(audioAsset));
+    StartPlayback(channel, boost::dynamic_pointer_cast<AudioAsset>(audioAsset), streaming);
 
     return channel;
 }
 
-SoundChannelPtr AudioAPI::PlaySound3D(const float3 &position, AssetPtr audioAsset, SoundChannel::SoundType type, SoundChannelPtr channel)
+SoundChannelPtr AudioAPI::PlaySound3D(const float3 &position, AssetPtr audioAsset, SoundChannel::SoundType type, SoundChannelPtr channel, SoundChannel::StreamingMode streaming)
 {
     if (!impl || !impl->initialized)
         return SoundChannelPtr();
@@ -316,11 +446,30 @@ SoundChannelPtr AudioAPI::PlaySound3D(const float3 &position, AssetPtr audioAsse
     channel->SetMasterGain(impl->soundMasterGain[type] * impl->masterGain);
     channel->SetPositional(true);
     channel->SetPosition(position);
-    channel->Play(boost::dynamic_pointer_cast<AudioAsset>(audioAsset));
+    StartPlayback(channel, boost::dynamic_pointer_cast<AudioAsset>(audioAsset), streaming);
 
     return channel;
 }
 
+void AudioAPI::StartPlayback(SoundChannelPtr channel, AudioAssetPtr audioAsset, SoundChannel::StreamingMode streaming)
+{
+    bool stream = audioAsset && audioAsset->IsStreamable() &&
+        (streaming == SoundChannel::StreamAlways || (streaming == SoundChannel::StreamAuto && !audioAsset->GetHandle()));
+    if (stream)
+    {
+        channel->PlayStream(audioAsset);
+        return;
+    }
+
+    // An asset that was too large to be decoded when loaded must be decoded now
+    if (audioAsset && !audioAsset->GetHandle() && audioAsset->IsStreamable())
+    {
+        PROFILE(AudioAPI_DecodeStreamableAsset);
+        audioAsset->DecodeToBuffer();
+    }
+    channel->Play(audioAsset);
+}
+
 SoundChannelPtr AudioAPI::PlaySoundBuffer(const SoundBuffer &buffer, SoundChannel::SoundType type, SoundChannelPtr channel)
 {
     if (!impl->initialized)
@@ -389,6 +538,49 @@ sound_id_t AudioAPI::GetNextSoundChannelID()
     return impl->nextChannelId;
 }
 
+void AudioAPI::SetStreamingThreshold(uint bytes)
+{
+    if (impl)
+        impl->streamingThreshold = bytes;
+}
+
+uint AudioAPI::StreamingThreshold() const
+{
+    return impl ? impl->streamingThreshold : 0;
+}
+
+void AudioAPI::SetMaxRealVoices(uint maxVoices)
+{
+    if (impl)
+        impl->maxRealVoices = maxVoices;
+}
+
+uint AudioAPI::MaxRealVoices() const
+{
+    return impl ? impl->maxRealVoices : 0;
+}
+
+void AudioAPI::SetAudibilityThreshold(float threshold)
+{
+    if (impl)
+        impl->audibilityThreshold = std::max(threshold, 0.0f);
+}
+
+float AudioAPI::AudibilityThreshold() const
+{
+    return impl ? impl->audibilityThreshold : 0.0f;
+}
+
+uint AudioAPI::NumRealVoices() const
+{
+    return impl ? impl->numRealVoices : 0;
+}
+
+uint AudioAPI::NumVirtualVoices() const
+{
+    return impl ? impl->numVirtualVoices : 0;
+}
+
 void AudioAPI::SetMasterGain(float masterGain)
 {
     impl->masterGain = masterGain;
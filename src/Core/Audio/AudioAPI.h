@@ -64,16 +64,20 @@ public slots:
     /** @param name Sound file name or asset id
         @param local If true, name is interpreted as filename. Otherwise asset id
         @param existingChannel Channel id. If non-zero, and is a valid channel, will use that channel instead of making a new one.
+        @param streaming Whether to play back the asset as a stream
         @return nonzero channel id, if successful (in case of loading from asset, actual sound may start later) */
-    SoundChannelPtr PlaySound(AssetPtr audioAsset, SoundChannel::SoundType type = SoundChannel::Triggered, SoundChannelPtr existingChannel = SoundChannelPtr());
+    SoundChannelPtr PlaySound(AssetPtr audioAsset, SoundChannel::SoundType type = SoundChannel::Triggered, SoundChannelPtr existingChannel = SoundChannelPtr(),
+        SoundChannel::StreamingMode streaming = SoundChannel::StreamAuto);
 
     /// Plays positional sound. Returns sound id to adjust parameters
     /** @param name Sound file name or asset id
         @param local If true, name is interpreted as filename. Otherwise asset id
         @param position Position of sound
         @param existingChannel Channel id. If non-zero, and is a valid channel, will use that channel instead of making a new one.
+        @param streaming Whether to play back the asset as a stream
         @return nonzero channel id, if successful (in case of loading from asset, actual sound may start later) */
-    SoundChannelPtr PlaySound3D(const float3 &position, AssetPtr audioAsset, SoundChannel::SoundType type = SoundChannel::Triggered, SoundChannelPtr existingChannel = SoundChannelPtr());
+    SoundChannelPtr PlaySound3D(const float3 &position, AssetPtr audioAsset, SoundChannel::SoundType type = SoundChannel::Triggered, SoundChannelPtr existingChannel = SoundChannelPtr(),
+        SoundChannel::StreamingMode streaming = SoundChannel::StreamAuto);
 
     /// Buffers sound data into a non-positional channel
     /** Note: use the returned channel id for continuing to feed the sound stream.
@@ -106,6 +110,37 @@ public slots:
 
     AudioAssetPtr CreateAudioAssetFromSoundBuffer(const SoundBuffer &buffer);
 
+    /// Sets the size above which Ogg Vorbis assets are not decoded when loaded, but only streamed.
+    /** Affects the assets loaded after the call.
+        @param bytes Size of the .ogg file in bytes, or 0 to decode all assets when loaded */
+    void SetStreamingThreshold(uint bytes);
+
+    /// Returns the size above which Ogg Vorbis assets are not decoded when loaded, but only streamed. 0 if all assets are decoded.
+    uint StreamingThreshold() const;
+
+    /// Sets the maximum number of channels that play with an OpenAL source.
+    /** The channels beyond the limit are virtual: their playback position advances, but they are not mixed.
+        Each update, the sources are assigned to the channels by priority and then by audibility.
+        Channels in buffered mode always get a source, and may exceed the limit.
+        @param maxVoices Maximum number of real voices, or 0 for no limit */
+    void SetMaxRealVoices(uint maxVoices);
+
+    /// Returns the maximum number of channels that play with an OpenAL source, or 0 for no limit.
+    uint MaxRealVoices() const;
+
+    /// Sets the audibility below which channels are made virtual.
+    /** @param threshold Final gain of the channel, see SoundChannel::GetAudibility(), or 0 to keep all channels within the voice limit real */
+    void SetAudibilityThreshold(float threshold);
+
+    /// Returns the audibility below which channels are made virtual.
+    float AudibilityThreshold() const;
+
+    /// Returns the number of channels that played with an OpenAL source in the last update.
+    uint NumRealVoices() const;
+
+    /// Returns the number of virtual channels in the last update.
+    uint NumVirtualVoices() const;
+
 public:
     
     /// Open sound recording device & start recording
@@ -144,6 +179,12 @@ private:
     
     /// Reapply master gain to all existing channels
     void ApplyMasterGain();
+
+    /// Start playing an audio asset on a channel, either as a stream or from the decoded buffer
+    void StartPlayback(SoundChannelPtr channel, AudioAssetPtr audioAsset, SoundChannel::StreamingMode streaming);
+
+    /// Decides which of the non-stopped channels get an OpenAL source and which are virtual
+    void AssignVoices();
     
     AssetAPI *assetAPI;
 
@@ -8,8 +8,11 @@
 #include "LoggingFunctions.h"
 #include "WavLoader.h"
 #include "OggVorbisLoader.h"
+#include "AudioAPI.h"
+#include "Framework.h"
 
 #include <QString>
+#include <algorithm>
 
 #ifndef Q_WS_MAC
 #include <AL/al.h>
@@ -20,7 +23,7 @@
 #endif
 
 AudioAsset::AudioAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:IAsset(owner, type_, name_), handle(0)
+:IAsset(owner, type_, name_), handle(0), length(0.0f)
 {
 }
 
@@ -30,17 +33,25 @@ AudioAsset::~AudioAsset()
 }
 
 void AudioAsset::DoUnload()
+{
+    DeleteBuffer();
+    encodedData.reset();
+}
+
+void AudioAsset::DeleteBuffer()
 {
     if (handle)
     {
         alDeleteBuffers(1, &handle);
         handle = 0;
     }
+    length = 0.0f;
 }
 
 bool AudioAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bool allowAsynchronous)
 {
     bool loadResult = false;
+    encodedData.reset();
     if (WavLoader::IdentifyWavFileInMemory(data, numBytes) && this->Name().endsWith(".wav", Qt::CaseInsensitive)) // Detect whether this file is Wav data or not.
     {
         loadResult = LoadFromWavFileInMemory(data, numBytes);
@@ -49,7 +60,10 @@ bool AudioAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bool
     }
     else if (this->Name().endsWith(".ogg", Qt::CaseInsensitive))
     {
-        loadResult = LoadFromOggVorbisFileInMemory(data, numBytes);
+        // Large files are only streamed, so don't spend the time and memory to decode them now
+        AudioAPI *audio = assetAPI->GetFramework()->Audio();
+        bool decode = !audio || audio->StreamingThreshold() == 0 || numBytes < audio->StreamingThreshold();
+        loadResult = LoadFromOggVorbisFileInMemory(data, numBytes, decode);
         if (loadResult)
             assetAPI->AssetLoadCompleted(Name());
     }
@@ -69,10 +83,36 @@ bool AudioAsset::LoadFromWavFileInMemory(const u8 *data, size_t numBytes)
     return LoadFromRawPCMWavData(&buf.data[0], buf.data.size(), buf.stereo, buf.is16Bit, buf.frequency);
 }
 
-bool AudioAsset::LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes)
+bool AudioAsset::LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes, bool decode)
+{
+    if (!data || numBytes == 0)
+    {
+        LogError("Null data passed in AudioAsset::LoadFromOggVorbisFileInMemory!");
+        return false;
+    }
+
+    DoUnload();
+    encodedData = boost::shared_ptr<std::vector<u8> >(new std::vector<u8>(data, data + numBytes));
+    if (!decode)
+        return true;
+
+    if (!DecodeToBuffer())
+    {
+        encodedData.reset();
+        return false;
+    }
+    return true;
+}
+
+bool AudioAsset::DecodeToBuffer()
 {
+    if (handle)
+        return true;
+    if (!IsStreamable())
+        return false;
+
     SoundBuffer buf;
-    bool success = OggVorbisLoader::LoadOggVorbisFileToSoundBuffer(data, numBytes, buf);
+    bool success = OggVorbisLoader::LoadOggVorbisFileToSoundBuffer(&(*encodedData)[0], encodedData->size(), buf);
     if (!success || buf.data.size() == 0)
         return false;
 
@@ -82,7 +122,7 @@ bool AudioAsset::LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes)
 bool AudioAsset::LoadFromRawPCMWavData(const u8 *data, size_t numBytes, bool stereo, bool is16Bit, int frequency)
 {
     // Clean up the previous OpenAL audio buffer handle, if old data existed.
-    DoUnload();
+    DeleteBuffer();
 
     if (!data || numBytes == 0)
     {
@@ -110,9 +150,11 @@ bool AudioAsset::LoadFromRawPCMWavData(const u8 *data, size_t numBytes, bool ste
         if (!errorString)
             errorString = unknownError;
         LogError("Could not set OpenAL sound buffer data: OpenAL error number " + QString::number(error) + ": " + errorString);
-        DoUnload();
+        DeleteBuffer();
         return false;
     }
+
+    length = (float)numBytes / ((stereo ? 2 : 1) * (is16Bit ? 2 : 1) * std::max(frequency, 1));
     return true;
 }
 
@@ -143,5 +185,5 @@ bool AudioAsset::CreateBuffer()
 
 bool AudioAsset::IsLoaded() const
 {
-    return handle != 0;
+    return handle != 0 || IsStreamable();
 }
@@ -9,6 +9,8 @@
 #include "SoundBuffer.h"
 
 /// Stores raw decoded audio data ready for playback.
+/** Ogg Vorbis assets also keep their encoded data so that they can be played back as streams. Ogg Vorbis files larger than
+    AudioAPI::StreamingThreshold() are not decoded when loaded, but only streamed, see OggVorbisStream. */
 class AUDIO_API AudioAsset : public IAsset
 {
     Q_OBJECT;
@@ -25,7 +27,8 @@ public:
     bool LoadFromWavFileInMemory(const u8 *data, size_t numBytes);
 
     /// Loads this audio asset from the given .ogg file in memory.
-    bool LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes);
+    /** @param decode If false, the data is only kept for streaming, and not decoded to an OpenAL buffer. */
+    bool LoadFromOggVorbisFileInMemory(const u8 *data, size_t numBytes, bool decode = true);
 
     /// Loads this audio asset from the given raw PCM WAV data.
     /// @param data Contains the source data. This data is copied to internal AudioAsset memory, and does not need
@@ -43,13 +46,35 @@ public:
     /// Returns true on success, false otherwise.
     bool CreateBuffer();
 
+    /// Decodes the kept Ogg Vorbis data of a streamable asset to the OpenAL buffer, if not done yet.
+    /// Returns true on success, false otherwise.
+    bool DecodeToBuffer();
+
     ALuint GetHandle() const { return handle; }
 
+    /// Returns the length of the decoded sound in seconds, or 0 if the sound has not been decoded.
+    float Length() const { return length; }
+
+    /// Returns whether this asset has encoded Ogg Vorbis data that can be played back as a stream.
+    bool IsStreamable() const { return encodedData && !encodedData->empty(); }
+
+    /// Returns the encoded Ogg Vorbis data for streaming, or null if this asset is not streamable.
+    boost::shared_ptr<std::vector<u8> > EncodedData() const { return encodedData; }
+
     bool IsLoaded() const;
 
 private:
+    /// Deletes the OpenAL buffer, but keeps the encoded data.
+    void DeleteBuffer();
+
+    /// Encoded Ogg Vorbis file data, shared with the streams playing this asset. Null for other formats.
+    boost::shared_ptr<std::vector<u8> > encodedData;
+
     /// The actual sound data is stored in an OpenAL internal audio buffer. This handle specifies the buffer.
     /// If == 0, then this AudioAsset is unloaded.
     ALuint handle;
+
+    /// Length of the decoded sound in seconds.
+    float length;
 };
 
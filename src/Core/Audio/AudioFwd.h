@@ -22,6 +22,9 @@ class AudioAsset;
 typedef boost::shared_ptr<AudioAsset> AudioAssetPtr;
 typedef boost::weak_ptr<AudioAsset> AudioAssetWeakPtr;
 
+class OggVorbisStream;
+typedef boost::shared_ptr<OggVorbisStream> OggVorbisStreamPtr;
+
 // We don't want to include the OpenAL headers here directly (<AL/al.h>, <AL/alc.h>). Pulled the necessary declarations here directly.
 /** unsigned 32-bit integer */
 typedef unsigned int ALuint;
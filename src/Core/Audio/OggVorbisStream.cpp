@@ -0,0 +1,248 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "DebugOperatorNew.h"
+#include <QList>
+#include <boost/bind.hpp>
+#include "MemoryLeakCheck.h"
+#include "OggVorbisStream.h"
+#include "LoggingFunctions.h"
+
+#include <vorbis/vorbisfile.h>
+#include <algorithm>
+
+/// Encoded Ogg Vorbis data read by libvorbisfile through the ov_callbacks.
+struct OggVorbisStreamSource
+{
+    boost::shared_ptr<std::vector<u8> > data;
+    size_t position;
+};
+
+namespace
+{
+
+size_t OggStreamReadCallback(void *ptr, size_t size, size_t nmemb, void *datasource)
+{
+    OggVorbisStreamSource *source = (OggVorbisStreamSource *)datasource;
+    const std::vector<u8> &data = *source->data;
+    size_t numBytes = std::min(size * nmemb, data.size() - source->position);
+    if (numBytes)
+    {
+        memcpy(ptr, &data[source->position], numBytes);
+        source->position += numBytes;
+    }
+    return numBytes;
+}
+
+int OggStreamSeekCallback(void *datasource, ogg_int64_t offset, int whence)
+{
+    OggVorbisStreamSource *source = (OggVorbisStreamSource *)datasource;
+    ogg_int64_t newPosition = (ogg_int64_t)source->position;
+    switch(whence)
+    {
+    case SEEK_SET: newPosition = offset; break;
+    case SEEK_CUR: newPosition += offset; break;
+    case SEEK_END: newPosition = (ogg_int64_t)source->data->size() + offset; break;
+    }
+    if (newPosition < 0 || newPosition > (ogg_int64_t)source->data->size())
+        return -1;
+    source->position = (size_t)newPosition;
+    return 0;
+}
+
+long OggStreamTellCallback(void *datasource)
+{
+    OggVorbisStreamSource *source = (OggVorbisStreamSource *)datasource;
+    return (long)source->position;
+}
+
+} // ~unnamed namespace
+
+OggVorbisStream::OggVorbisStream(const boost::shared_ptr<std::vector<u8> > &encodedData, bool looped) :
+    source_(new OggVorbisStreamSource),
+    file_(0),
+    valid_(false),
+    frequency_(0),
+    stereo_(false),
+    length_(0.0),
+    seekTime_(-1.0),
+    generation_(0),
+    looped_(looped),
+    endReached_(true),
+    quit_(false)
+{
+    source_->data = encodedData;
+    source_->position = 0;
+    if (!encodedData || encodedData->empty())
+    {
+        LogError("OggVorbisStream: Null input data passed in");
+        return;
+    }
+
+    ov_callbacks cb;
+    cb.read_func = &OggStreamReadCallback;
+    cb.seek_func = &OggStreamSeekCallback;
+    cb.tell_func = &OggStreamTellCallback;
+    cb.close_func = 0;
+
+    file_ = new OggVorbis_File;
+    if (ov_open_callbacks(source_, file_, 0, 0, cb) < 0)
+    {
+        LogError("OggVorbisStream: Not ogg vorbis format");
+        delete file_;
+        file_ = 0;
+        return;
+    }
+
+    vorbis_info *vi = ov_info(file_, -1);
+    if (!vi)
+    {
+        LogError("OggVorbisStream: No ogg vorbis stream info");
+        ov_clear(file_);
+        delete file_;
+        file_ = 0;
+        return;
+    }
+    if (vi->channels != 1 && vi->channels != 2)
+        LogWarning("Warning: Streamed Ogg Vorbis data contains an unsupported number of channels: " + QString::number(vi->channels));
+
+    frequency_ = vi->rate;
+    stereo_ = (vi->channels > 1);
+    length_ = std::max(ov_time_total(file_, -1), 0.0);
+    valid_ = true;
+    endReached_ = false;
+
+    thread_ = boost::thread(boost::bind(&OggVorbisStream::ThreadMain, this));
+}
+
+OggVorbisStream::~OggVorbisStream()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        quit_ = true;
+    }
+    wakeup_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+
+    if (file_)
+    {
+        ov_clear(file_);
+        delete file_;
+    }
+    delete source_;
+}
+
+void OggVorbisStream::SetLooped(bool looped)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        looped_ = looped;
+        // If the end was already reached, the decoder wraps around on its next read
+        if (looped && valid_)
+            endReached_ = false;
+    }
+    wakeup_.notify_one();
+}
+
+void OggVorbisStream::Seek(double seconds)
+{
+    if (!valid_)
+        return;
+
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        seekTime_ = std::min(std::max(seconds, 0.0), length_);
+        ++generation_;
+        blocks_.clear();
+        endReached_ = false;
+    }
+    wakeup_.notify_one();
+}
+
+bool OggVorbisStream::TakeBlock(std::vector<u8> &dst, double &startTime)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (blocks_.empty())
+            return false;
+        dst.swap(blocks_.front().data);
+        startTime = blocks_.front().startTime;
+        blocks_.pop_front();
+    }
+    // There is room for one more block now
+    wakeup_.notify_one();
+    return true;
+}
+
+bool OggVorbisStream::IsFinished() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return endReached_ && blocks_.empty();
+}
+
+void OggVorbisStream::ThreadMain()
+{
+    std::vector<u8> data;
+    for(;;)
+    {
+        double seekTime;
+        uint generation;
+        bool looped;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while(!quit_ && seekTime_ < 0.0 && (endReached_ || blocks_.size() >= MaxQueuedBlocks))
+                wakeup_.wait(lock);
+            if (quit_)
+                return;
+            seekTime = seekTime_;
+            seekTime_ = -1.0;
+            generation = generation_;
+            looped = looped_;
+        }
+
+        if (seekTime >= 0.0 && ov_time_seek(file_, seekTime) != 0)
+            LogWarning("OggVorbisStream: Failed to seek to " + QString::number(seekTime) + " seconds");
+
+        double startTime = ov_time_tell(file_);
+        data.resize(BlockSize);
+        uint numBytes = 0;
+        bool end = false;
+        bool wrapped = false;
+        while(numBytes < BlockSize)
+        {
+            int bitstream;
+            long ret = ov_read(file_, (char*)&data[numBytes], BlockSize - numBytes, 0, 2, 1, &bitstream);
+            if (ret == OV_HOLE)
+                continue; // Interruption in the data, decoding can continue
+            if (ret > 0)
+            {
+                numBytes += ret;
+                wrapped = false;
+                continue;
+            }
+            // End of stream or an unrecoverable error. Wrap around once if looped; a second consecutive wrap means
+            // the stream yields no data at all.
+            if (ret == 0 && looped && !wrapped && ov_pcm_seek(file_, 0) == 0)
+            {
+                wrapped = true;
+                continue;
+            }
+            end = true;
+            break;
+        }
+        data.resize(numBytes);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        // If a seek was requested meanwhile, the block is stale
+        if (generation != generation_)
+            continue;
+        if (numBytes > 0)
+        {
+            blocks_.push_back(Block());
+            blocks_.back().data.swap(data);
+            blocks_.back().startTime = startTime;
+        }
+        if (end)
+            endReached_ = true;
+    }
+}
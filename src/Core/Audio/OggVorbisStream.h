@@ -0,0 +1,101 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include <vector>
+#include <list>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "CoreTypes.h"
+#include "AudioApiExports.h"
+#include "AudioFwd.h"
+
+struct OggVorbis_File;
+struct OggVorbisStreamSource;
+
+/// Decodes an Ogg Vorbis file in memory into raw PCM WAV blocks on a background decoder thread.
+/** The decoder thread stays at most MaxQueuedBlocks blocks ahead of the consumer. The consumer, normally a streaming
+    SoundChannel, takes the decoded blocks with TakeBlock() from the main thread and uploads them to its OpenAL buffers,
+    so that no OpenAL calls are made from the decoder thread.
+    The encoded file data is shared with the AudioAsset it came from, so the asset may be unloaded while the stream plays. */
+class AUDIO_API OggVorbisStream
+{
+public:
+    /// Size of one decoded block, in bytes.
+    static const uint BlockSize = 65536;
+    /// Maximum number of decoded blocks the decoder thread keeps queued.
+    static const uint MaxQueuedBlocks = 4;
+
+    /// Opens the stream and starts the decoder thread.
+    /** @param encodedData Contents of the .ogg file
+        @param looped If true, decoding wraps around to the start of the stream at the end */
+    OggVorbisStream(const boost::shared_ptr<std::vector<u8> > &encodedData, bool looped);
+
+    /// Stops the decoder thread.
+    ~OggVorbisStream();
+
+    /// Returns whether the stream header was read successfully. If false, the stream produces no data.
+    bool IsValid() const { return valid_; }
+
+    /// Returns the number of samples per second.
+    int Frequency() const { return frequency_; }
+
+    /// Returns whether the decoded data is stereo (true) or mono (false). The data is always 16 bits per sample.
+    bool IsStereo() const { return stereo_; }
+
+    /// Returns the length of the stream in seconds.
+    double Length() const { return length_; }
+
+    /// Sets whether decoding wraps around to the start of the stream at the end.
+    void SetLooped(bool looped);
+
+    /// Discards the decoded blocks and restarts decoding from the given time.
+    /** @param seconds Time from the start of the stream. Clamped to the stream length */
+    void Seek(double seconds);
+
+    /// Takes the next decoded block, if one is available.
+    /** @param dst [out] Receives the raw PCM WAV data of the block
+        @param startTime [out] Receives the time of the start of the block from the start of the stream, in seconds
+        @return True if a block was returned, false if none has been decoded yet or the end of the stream was reached */
+    bool TakeBlock(std::vector<u8> &dst, double &startTime);
+
+    /// Returns true if the end of a non-looped stream was reached and all decoded blocks have been taken.
+    bool IsFinished() const;
+
+private:
+    struct Block
+    {
+        std::vector<u8> data;
+        double startTime;
+    };
+
+    /// Decoder thread entry point.
+    void ThreadMain();
+
+    /// Encoded data and read position for libvorbisfile.
+    OggVorbisStreamSource *source_;
+    /// Only accessed by the decoder thread after construction.
+    OggVorbis_File *file_;
+    bool valid_;
+    int frequency_;
+    bool stereo_;
+    double length_;
+
+    boost::thread thread_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable wakeup_;
+    /// Decoded blocks. Protected by mutex_
+    std::list<Block> blocks_;
+    /// Pending seek time, or negative if no seek is pending. Protected by mutex_
+    double seekTime_;
+    /// Incremented on each seek so that the decoder thread can discard a block decoded before the seek. Protected by mutex_
+    uint generation_;
+    /// Protected by mutex_
+    bool looped_;
+    /// Set when the decoder reached the end of a non-looped stream. Protected by mutex_
+    bool endReached_;
+    /// Set when the decoder thread should exit. Protected by mutex_
+    bool quit_;
+};
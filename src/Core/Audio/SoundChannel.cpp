@@ -5,8 +5,12 @@
 #include <QList>
 #include "MemoryLeakCheck.h"
 #include "SoundChannel.h"
+#include "OggVorbisStream.h"
 #include "LoggingFunctions.h"
 
+#include <cmath>
+#include <algorithm>
+
 #ifndef Q_WS_MAC
 #include <AL/al.h>
 #include <AL/alc.h>
@@ -19,6 +23,8 @@ static const float MINIMUM_ROLLOFF = 0.1f;
 static const float DEFAULT_ROLLOFF = 2.0f;
 static const float DEFAULT_INNER_RADIUS = 1.0f;
 static const float DEFAULT_OUTER_RADIUS = 50.0f;
+/// Number of OpenAL buffers in the ring of a streaming channel
+static const uint NUM_STREAM_BUFFERS = OggVorbisStream::MaxQueuedBlocks;
 
 SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type) :
     type_(type),
@@ -34,6 +40,10 @@ SoundChannel::SoundChannel(sound_id_t channelId_, SoundType type) :
     positional_(false),
     looped_(false),
     buffered_mode_(false),
+    virtual_(false),
+    virtual_position_(0.0),
+    resume_position_(0.0f),
+    priority_(0),
     state_(Stopped),
     channelId(channelId_)
 { 
@@ -44,10 +54,24 @@ SoundChannel::~SoundChannel()
     DeleteSource();
 }
 
-void SoundChannel::Update(const float3& listener_pos)
-{   
+void SoundChannel::UpdateAttenuation(const float3& listener_pos)
+{
     CalculateAttenuation(listener_pos);
     SetAttenuatedGain();
+}
+
+void SoundChannel::Update(f64 frametime)
+{   
+    if (virtual_)
+    {
+        UpdateVirtual(frametime);
+        return;
+    }
+    if (stream_)
+    {
+        UpdateStream();
+        return;
+    }
     QueueBuffers();
     UnqueueBuffers();
     
@@ -87,6 +111,161 @@ void SoundChannel::Play(AudioAssetPtr audioAsset)
     buffered_mode_ = false;
 }
 
+void SoundChannel::PlayStream(AudioAssetPtr audioAsset)
+{
+    // Stop any previously buffered sound
+    Stop();
+
+    if (!audioAsset || !audioAsset->IsStreamable())
+        return;
+
+    stream_ = OggVorbisStreamPtr(new OggVorbisStream(audioAsset->EncodedData(), looped_));
+    if (!stream_->IsValid())
+    {
+        LogError("Could not start streaming " + audioAsset->Name());
+        stream_.reset();
+        return;
+    }
+    stream_asset_ = audioAsset;
+
+    // Looping is done by the stream decoder, OpenAL would loop the buffer queue
+    if (handle_)
+        alSourcei(handle_, AL_LOOPING, AL_FALSE);
+
+    // Start actual playback once the first data has been decoded
+    state_ = Pending;
+    buffered_mode_ = false;
+}
+
+void SoundChannel::Seek(float seconds)
+{
+    if (stream_)
+    {
+        // Drop the queued data, the buffers are refilled from the new position on the next updates
+        if (handle_)
+        {
+            alSourceStop(handle_);
+            alSourcei(handle_, AL_BUFFER, 0);
+        }
+        free_stream_buffers_ = stream_buffers_;
+        stream_queue_times_.clear();
+        stream_->Seek(seconds);
+        if (!virtual_)
+            state_ = Pending;
+    }
+    else if (handle_)
+        alSourcef(handle_, AL_SEC_OFFSET, seconds);
+    if (virtual_)
+        virtual_position_ = std::max(seconds, 0.0f);
+}
+
+void SoundChannel::SetVirtual(bool enable)
+{
+    if (enable == virtual_ || (enable && !CanVirtualize()))
+        return;
+
+    if (enable)
+    {
+        // Remember where the sound was, then release the source and its buffer queue
+        virtual_position_ = GetPlaybackPosition();
+        if (handle_)
+        {
+            alSourceStop(handle_);
+            alSourcei(handle_, AL_BUFFER, 0);
+            alDeleteSources(1, &handle_);
+            handle_ = 0;
+        }
+        free_stream_buffers_ = stream_buffers_;
+        stream_queue_times_.clear();
+        virtual_ = true;
+        return;
+    }
+
+    virtual_ = false;
+    if (state_ == Stopped)
+        return;
+
+    // Resume from the position the sound would have reached. A new source is created on the next update
+    if (stream_)
+    {
+        stream_->Seek(virtual_position_);
+        state_ = Pending;
+    }
+    else if (playing_sounds_.size() > 0)
+    {
+        pending_sounds_.push_front(playing_sounds_.front());
+        playing_sounds_.clear();
+        resume_position_ = (float)virtual_position_;
+        state_ = Pending;
+    }
+}
+
+float SoundChannel::GetAudibility() const
+{
+    return positional_ ? master_gain_ * gain_ * attenuation_ : master_gain_ * gain_;
+}
+
+float SoundChannel::GetPlaybackPosition() const
+{
+    if (virtual_)
+        return (float)virtual_position_;
+    if (!handle_)
+        return 0.0f;
+
+    ALfloat offset = 0.0f;
+    alGetSourcef(handle_, AL_SEC_OFFSET, &offset);
+    // The offset of a streaming source is relative to the first buffer still in the queue
+    if (stream_ && stream_queue_times_.size() > 0)
+        return (float)stream_queue_times_.front() + offset;
+    return offset;
+}
+
+float SoundChannel::GetSoundLength() const
+{
+    if (stream_)
+        return (float)stream_->Length();
+    if (playing_sounds_.size() > 0 && playing_sounds_.front())
+        return playing_sounds_.front()->Length();
+    return 0.0f;
+}
+
+void SoundChannel::UpdateVirtual(f64 frametime)
+{
+    // Start virtual playback once the sound data is ready
+    if (state_ == Pending)
+    {
+        if (!stream_)
+        {
+            AudioAssetPtr sound = pending_sounds_.size() > 0 ? pending_sounds_.front() : AudioAssetPtr();
+            if (!sound)
+            {
+                Stop();
+                return;
+            }
+            if (!sound->GetHandle())
+                return;
+            pending_sounds_.clear();
+            playing_sounds_.clear();
+            playing_sounds_.push_back(sound);
+            virtual_position_ = resume_position_;
+            resume_position_ = 0.0f;
+        }
+        state_ = Playing;
+    }
+    if (state_ != Playing)
+        return;
+
+    virtual_position_ += frametime * pitch_;
+    float length = GetSoundLength();
+    if (length > 0.0f && virtual_position_ >= length)
+    {
+        if (looped_)
+            virtual_position_ = fmod(virtual_position_, (f64)length);
+        else
+            Stop();
+    }
+}
+
 void SoundChannel::AddBuffer(AudioAssetPtr buffer)
 {
     pending_sounds_.push_back(buffer);
@@ -112,7 +291,7 @@ bool SoundChannel::CreateSource()
     }   
     
     alSourcef(handle_, AL_PITCH, pitch_);
-    alSourcei(handle_, AL_LOOPING, looped_ ? AL_TRUE : AL_FALSE);
+    alSourcei(handle_, AL_LOOPING, (looped_ && !stream_) ? AL_TRUE : AL_FALSE);
     // No matter whether sound is positional or not, we use own attenuation, so OpenAL rolloff is 0
     alSourcef(handle_, AL_ROLLOFF_FACTOR, 0.0);
     
@@ -144,12 +323,17 @@ void SoundChannel::Stop()
     
     pending_sounds_.clear();
     playing_sounds_.clear();
+    DeleteStream();
+    virtual_position_ = 0.0;
+    resume_position_ = 0.0f;
     
     state_ = Stopped;
 }
 
 QString SoundChannel::GetSoundName() const
 {   
+    if (stream_asset_)
+        return stream_asset_->Name();
     AudioAssetPtr asset = playing_sounds_.size() > 0 ? playing_sounds_.front() : AudioAssetPtr();
     if (asset)
         return asset->Name();
@@ -181,8 +365,10 @@ void SoundChannel::SetLooped(bool enable)
         enable = false;
     
     looped_ = enable;
+    if (stream_)
+        stream_->SetLooped(looped_);
     if (handle_)
-        alSourcei(handle_, AL_LOOPING, looped_ ? AL_TRUE : AL_FALSE);
+        alSourcei(handle_, AL_LOOPING, (looped_ && !stream_) ? AL_TRUE : AL_FALSE);
 }
 
 void SoundChannel::SetPitch(float pitch)
@@ -347,6 +533,12 @@ void SoundChannel::QueueBuffers()
         alGetSourcei(handle_, AL_SOURCE_STATE, &playing);
         if (playing != AL_PLAYING)
             alSourcePlay(handle_);
+        // Continue from where the sound was when the channel was virtual
+        if (resume_position_ > 0.0f)
+        {
+            alSourcef(handle_, AL_SEC_OFFSET, resume_position_);
+            resume_position_ = 0.0f;
+        }
         state_ = Playing;
     }
 }
@@ -377,3 +569,82 @@ void SoundChannel::UnqueueBuffers()
         }
     }
 }
+
+void SoundChannel::UpdateStream()
+{
+    if (!handle_ && !CreateSource())
+    {
+        Stop();
+        return;
+    }
+
+    if (stream_buffers_.empty())
+    {
+        alGetError();
+        stream_buffers_.resize(NUM_STREAM_BUFFERS);
+        alGenBuffers(NUM_STREAM_BUFFERS, &stream_buffers_[0]);
+        if (alGetError() != AL_NONE)
+        {
+            LogError("Could not create OpenAL stream buffers");
+            stream_buffers_.clear();
+            Stop();
+            return;
+        }
+        free_stream_buffers_ = stream_buffers_;
+    }
+
+    // Reclaim the buffers the source has finished playing
+    ALint processed = 0;
+    alGetSourcei(handle_, AL_BUFFERS_PROCESSED, &processed);
+    while(processed-- > 0)
+    {
+        ALuint buffer = 0;
+        alSourceUnqueueBuffers(handle_, 1, &buffer);
+        if (buffer)
+            free_stream_buffers_.push_back(buffer);
+        if (stream_queue_times_.size() > 0)
+            stream_queue_times_.pop_front();
+    }
+
+    // Refill them with the blocks the decoder thread has finished
+    ALenum format = stream_->IsStereo() ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16;
+    double startTime;
+    while(!free_stream_buffers_.empty() && stream_->TakeBlock(stream_block_, startTime))
+    {
+        ALuint buffer = free_stream_buffers_.back();
+        alBufferData(buffer, format, &stream_block_[0], stream_block_.size(), stream_->Frequency());
+        alSourceQueueBuffers(handle_, 1, &buffer);
+        free_stream_buffers_.pop_back();
+        stream_queue_times_.push_back(startTime);
+    }
+
+    ALint queued = 0;
+    alGetSourcei(handle_, AL_BUFFERS_QUEUED, &queued);
+    if (queued > 0)
+    {
+        // Start playback, or restart it if the decoder did not keep up and the source ran out of data
+        ALint playing;
+        alGetSourcei(handle_, AL_SOURCE_STATE, &playing);
+        if (playing != AL_PLAYING)
+            alSourcePlay(handle_);
+        state_ = Playing;
+    }
+    else if (stream_->IsFinished())
+        Stop();
+    else
+        state_ = Pending;
+}
+
+void SoundChannel::DeleteStream()
+{
+    stream_.reset();
+    stream_asset_.reset();
+    if (stream_buffers_.size())
+    {
+        alDeleteBuffers(stream_buffers_.size(), &stream_buffers_[0]);
+        stream_buffers_.clear();
+    }
+    free_stream_buffers_.clear();
+    stream_block_.clear();
+    stream_queue_times_.clear();
+}
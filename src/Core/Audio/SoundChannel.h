@@ -14,6 +14,7 @@ class AUDIO_API SoundChannel : public QObject, public boost::enable_shared_from_
     Q_OBJECT;
     Q_ENUMS(SoundState)
     Q_ENUMS(SoundType)
+    Q_ENUMS(StreamingMode)
 
 public:
     /// States of sound channels
@@ -32,6 +33,14 @@ public:
         Voice
     };
 
+    /// Whether to play back audio assets as streams, see AudioAsset::IsStreamable()
+    enum StreamingMode
+    {
+        StreamAuto = 0, ///< Stream the assets that were too large to be decoded when loaded
+        StreamAlways, ///< Stream all streamable assets
+        StreamNever ///< Decode streamable assets fully before playing them
+    };
+
     SoundChannel(sound_id_t channelId, SoundType type);
 
     ~SoundChannel();
@@ -45,6 +54,18 @@ public:
         dispose of the channel. */ 
     void AddBuffer(AudioAssetPtr buffer);
 //    void AddBuffer(const SoundBuffer &buffer);
+
+    /// Start playing the encoded data of a streamable audio asset as a stream.
+    /** The data is decoded on a background thread into a small ring of OpenAL buffers, which are refilled on each update.
+        @param audioAsset Audio asset. Must be streamable, see AudioAsset::IsStreamable() */
+    void PlayStream(AudioAssetPtr audioAsset);
+
+    /// Moves the playback position.
+    /** @param seconds Time from the start of the sound */
+    void Seek(float seconds);
+
+    /// Returns whether the channel is playing a stream.
+    bool IsStreaming() const { return stream_ != 0; }
     
     /// Adjusts positional status of channel
     /** @param id Channel id
@@ -77,8 +98,27 @@ public:
     void SetRange(float inner_radius, float outer_radius, float rolloff);
     /// Stop.
     void Stop();
-    /// Per-frame update with new listener position
-    void Update(const float3& listener_pos);
+    /// Per-frame update of the distance attenuation with new listener position. Called before Update().
+    void UpdateAttenuation(const float3& listener_pos);
+    /// Per-frame update
+    /** @param frametime Time elapsed since the last update, in seconds. Advances the playback position of a virtual channel */
+    void Update(f64 frametime);
+    /// Releases the OpenAL source and continues to advance the playback position without it, or reacquires a source
+    /// and resumes playback at the position the sound would have reached.
+    /** Channels in buffered mode can not be made virtual. */
+    void SetVirtual(bool enable);
+    /// Returns whether the channel is virtual, ie. playing without an OpenAL source.
+    bool IsVirtual() const { return virtual_; }
+    /// Returns whether the channel may be made virtual.
+    bool CanVirtualize() const { return !buffered_mode_; }
+    /// Returns the final gain of the channel: gain * master gain * distance attenuation for positional channels.
+    float GetAudibility() const;
+    /// Sets priority for getting an OpenAL source. Channels with higher priority get a source before more audible channels with lower priority.
+    void SetPriority(int priority) { priority_ = priority; }
+    /// Returns priority for getting an OpenAL source.
+    int GetPriority() const { return priority_; }
+    /// Returns the playback position from the start of the sound, in seconds.
+    float GetPlaybackPosition() const;
     /// Return current state of channel.
     SoundState GetState() const { return state_; }
     /// Return name/id of sound that's playing, empty if nothing playing
@@ -100,6 +140,14 @@ private:
     void QueueBuffers();
     /// Remove processed buffers
     void UnqueueBuffers();
+    /// Refill the processed stream buffers with decoded data and keep the stream playing
+    void UpdateStream();
+    /// Advance the playback position of a virtual channel and stop it when a non-looped sound ends
+    void UpdateVirtual(f64 frametime);
+    /// Return length of the sound in seconds, or 0 if not known yet
+    float GetSoundLength() const;
+    /// Stop the stream decoder and delete the stream buffers. The source must not have the stream buffers queued
+    void DeleteStream();
     /// Create OpenAL source if one does not exist yet
     bool CreateSource();
     /// Delete OpenAL source
@@ -119,6 +167,18 @@ private:
     std::list<AudioAssetPtr> pending_sounds_;
     /// Currently playing sound buffers
     std::vector<AudioAssetPtr> playing_sounds_;
+    /// Stream decoder, if playing a stream
+    OggVorbisStreamPtr stream_;
+    /// Asset of the stream
+    AudioAssetPtr stream_asset_;
+    /// OpenAL buffers of the stream
+    std::vector<ALuint> stream_buffers_;
+    /// Stream buffers not queued to the source
+    std::vector<ALuint> free_stream_buffers_;
+    /// Decoded stream data being uploaded
+    std::vector<u8> stream_block_;
+    /// Stream times of the start of the buffers queued to the source, in queue order
+    std::list<double> stream_queue_times_;
     /// Pitch
     float pitch_;
     /// Gain
@@ -139,6 +199,14 @@ private:
     bool positional_;
     /// Buffered operation flag. Will never report as stopped, unless explicitly stopped
     bool buffered_mode_;
+    /// Virtual flag. A virtual channel has no OpenAL source
+    bool virtual_;
+    /// Playback position of a virtual channel, in seconds
+    f64 virtual_position_;
+    /// Position to resume playback from when the sound is queued again after being virtual, in seconds
+    float resume_position_;
+    /// Priority for getting an OpenAL source
+    int priority_;
     /// Position
     float3 position_;
     /// State 
@@ -11,6 +11,7 @@
 #include "ConsoleAPI.h"
 #include "ConsoleWidget.h"
 #include "ShellInputThread.h"
+#include "LogWriter.h"
 #include "Application.h"
 #include "Profiler.h"
 #include "Framework.h"
@@ -22,21 +23,23 @@
 
 #include <stdlib.h>
 
-#include <QFile>
-#include <QTextStream>
-
 #include "MemoryLeakCheck.h"
 
 ConsoleAPI::ConsoleAPI(Framework *fw) :
     QObject(fw),
     framework(fw),
-    enabledLogChannels(LogLevelErrorWarnInfo),
-    logFile(0),
-    logFileText(0)
+    enabledLogChannels(LogLevelErrorWarnInfo)
 {
     if (!fw->IsHeadless())
         consoleWidget = new ConsoleWidget(framework);
 
+    logWriter = boost::shared_ptr<LogWriter>(new LogWriter(consoleWidget != 0));
+    if (fw->HasCommandLineParameter("--logjson"))
+        logWriter->SetJsonOutput(true);
+    QStringList logRate = fw->CommandLineParameters("--lograte");
+    if (logRate.size() >= 1)
+        logWriter->SetRateLimit(logRate[logRate.size()-1].toInt());
+
     inputContext = framework->Input()->RegisterInputContext("Console", 100);
     inputContext->SetTakeKeyboardEventsOverQt(true);
     connect(inputContext.get(), SIGNAL(KeyEventReceived(KeyEvent *)), SLOT(HandleKeyEvent(KeyEvent *)));
@@ -72,8 +75,7 @@ void ConsoleAPI::Reset()
     inputContext.reset();
     SAFE_DELETE(consoleWidget);
     shellInputThread.reset();
-    SAFE_DELETE(logFileText);
-    SAFE_DELETE(logFile);
+    logWriter.reset();
 }
 
 QVariant ConsoleCommand::Invoke(const QStringList &params)
@@ -168,33 +170,10 @@ void ConsoleAPI::ExecuteCommand(const QString &command)
 
 void ConsoleAPI::Print(const QString &message)
 {
-    if (consoleWidget)
-        consoleWidget->PrintToConsole(message);
-    ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
-    if (!message.endsWith("\n"))
-    {
-        printf("%s\n", message.toStdString().c_str());
-        if (logFileText)
-        {
-            (*logFileText) << message << "\n";
-            /// \note If we want to guarantee that each message gets to the log even in the presence of a crash, we must flush()
-            /// after each write. Tested that on Windows 7, if you kill the process using Ctrl-C on command line, or from 
-            /// task manager, the log will not contain all the text, so this is required for correctness.
-            /// But this flush() after each message also causes a *serious* performance drawback.
-            /// One way to try avoiding this issue is to move to using C API for file writing, and at atexit() and other crash 
-            /// handlers, close the file handle gracefully.
-            logFileText->flush(); 
-        }
-    }
-    else
-    {
-        printf("%s", message.toStdString().c_str());
-        if (logFileText)
-        {
-            (*logFileText) << message;
-            logFileText->flush(); // See comment about flush() above.
-        }
-    }
+    if (logWriter)
+        logWriter->Write(0, message);
+    else ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
+        printf(message.endsWith("\n") ? "%s" : "%s\n", message.toStdString().c_str());
 }
 
 void ConsoleAPI::ListCommands()
@@ -206,6 +185,13 @@ void ConsoleAPI::ListCommands()
 
 void ConsoleAPI::ClearLog()
 {
+    // Write the pending output first, so that it is not printed after the clear.
+    if (logWriter)
+    {
+        logWriter->Flush();
+        std::vector<QString> lines;
+        logWriter->TakeConsoleLines(lines);
+    }
     if (consoleWidget)
         consoleWidget->ClearLog();
 #ifdef _WINDOWS
@@ -233,34 +219,46 @@ void ConsoleAPI::SetLogFile(const QString &wildCardFilename)
 {
     QString filename = Application::ParseWildCardFilename(wildCardFilename);
     
+    if (!logWriter)
+        return;
+
     // An empty log file closes the log output writing.
     if (filename.isEmpty())
     {
-        SAFE_DELETE(logFileText);
-        SAFE_DELETE(logFile);
+        logWriter->SetLogFile("");
         return;
     }
-    logFile = new QFile(filename);
-    bool isOpen = logFile->open(QIODevice::WriteOnly | QIODevice::Text);
-    if (!isOpen)
-    {
+    if (!logWriter->SetLogFile(filename))
         LogError("Failed to open file \"" + filename + "\" for logging! (parsed from string \"" + wildCardFilename + "\")");
-        SAFE_DELETE(logFile);
-    }
     else
-    {
         printf("Opened logging file \"%s\".\n", filename.toStdString().c_str());
-        logFileText = new QTextStream(logFile);
-    }
 }
 
 void ConsoleAPI::Update(f64 frametime)
 {
     PROFILE(ConsoleAPI_Update);
 
+    // The SIGINT and SIGTERM handler only sets a flag, the shutdown happens here on the main thread.
+    if (LogWriter::TakeTerminationRequest())
+    {
+        LogInfo("Termination signal received, exiting.");
+        framework->Exit();
+    }
+
     std::string input = shellInputThread->GetLine();
     if (input.length() > 0)
         ExecuteCommand(input.c_str());
+
+    // Show the output written since the last frame in the console widget.
+    if (logWriter && consoleWidget)
+    {
+        std::vector<QString> lines;
+        uint numDiscarded = logWriter->TakeConsoleLines(lines);
+        if (numDiscarded > 0)
+            consoleWidget->PrintToConsole("(" + QString::number(numDiscarded) + " lines not shown)");
+        for(size_t i = 0; i < lines.size(); ++i)
+            consoleWidget->PrintToConsole(lines[i]);
+    }
 }
 
 void ConsoleAPI::ToggleConsole()
@@ -307,7 +305,10 @@ void ConsoleAPI::Log(u32 logChannel, const QString &message)
     if (!IsLogChannelEnabled(logChannel))
         return;
 
-    Print(message);
+    if (logWriter)
+        logWriter->Write(logChannel, message);
+    else
+        Print(message);
 }
 
 void ConsoleAPI::SetEnabledLogChannels(u32 newChannels)
@@ -15,12 +15,11 @@
 #include <QObject>
 #include <QMap>
 
-class QFile;
-class QTextStream;
 class Framework;
 
 class ConsoleWidget;
 class ShellInputThread;
+class LogWriter;
 
 /// Represents a registered console command.
 class ConsoleCommand : public QObject
@@ -113,7 +112,8 @@ public slots:
     void ExecuteCommand(const QString &command);
 
     /// Prints a message to the console widget's log and stdout.
-    /** @param message The text message to print. */
+    /** The message is written on the log writer thread, and shown in the console widget on the next Update.
+        @param message The text message to print. */
     void Print(const QString &message);
 
     /// Lists all console commands and their descriptions to the log.
@@ -164,9 +164,8 @@ private:
     boost::shared_ptr<ShellInputThread> shellInputThread;
     /// Stores the set of currently active log channels.
     u32 enabledLogChannels;
-    /// Points to the currently open text file for logging.
-    QFile *logFile;
-    QTextStream *logFileText;
+    /// Writes the console and log output to stdout and the log file.
+    boost::shared_ptr<LogWriter> logWriter;
 
 private slots:
     void HandleKeyEvent(KeyEvent *e);
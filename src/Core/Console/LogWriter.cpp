@@ -0,0 +1,565 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "LogWriter.h"
+#include "LoggingFunctions.h"
+
+#include <QFile>
+#include <QDateTime>
+
+#include <boost/bind.hpp>
+#include <signal.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+/// Maximum number of messages written per batch, so that the console lines and Flush are not held up by a flood of messages
+static const uint cBatchSize = 4096;
+
+#ifdef WIN32
+static const int cFatalSignals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGILL };
+#else
+static const int cFatalSignals[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL };
+#endif
+static const int cNumFatalSignals = sizeof(cFatalSignals) / sizeof(cFatalSignals[0]);
+static const int cTerminationSignals[] = { SIGINT, SIGTERM };
+static const int cNumTerminationSignals = sizeof(cTerminationSignals) / sizeof(cTerminationSignals[0]);
+
+/// Signal handlers replaced by LogWriter, restored on destruction
+#ifdef WIN32
+static void (*previousHandlers[cNumFatalSignals + cNumTerminationSignals])(int);
+#else
+static struct sigaction previousActions[cNumFatalSignals + cNumTerminationSignals];
+#endif
+
+LogWriter *LogWriter::instance = 0;
+volatile sig_atomic_t LogWriter::terminationRequested = 0;
+
+/// Installs a signal handler that is reset to the default action when the signal is delivered, so that the handler can re-raise
+/// the signal, and a second SIGINT ends the process even if the orderly shutdown hangs.
+static void InstallSignalHandler(int signal_, void (*handler)(int), int index)
+{
+#ifdef WIN32
+    // Windows resets the handler to the default on delivery as well
+    previousHandlers[index] = signal(signal_, handler);
+#else
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND;
+    sigaction(signal_, &action, &previousActions[index]);
+#endif
+}
+
+static void RestoreSignalHandler(int signal_, int index)
+{
+#ifdef WIN32
+    signal(signal_, previousHandlers[index] != SIG_ERR ? previousHandlers[index] : SIG_DFL);
+#else
+    sigaction(signal_, &previousActions[index], 0);
+#endif
+}
+
+/// Writes all of a buffer to a file descriptor. Async-signal-safe.
+static void WriteAll(int fd, const char *data, size_t size)
+{
+    while(size > 0)
+    {
+#ifdef WIN32
+        int written = _write(fd, data, (unsigned int)size);
+#else
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+#endif
+        if (written <= 0)
+            return;
+        data += written;
+        size -= written;
+    }
+}
+
+/// Sleeps for a while. Async-signal-safe.
+static void SleepMilliseconds(int ms)
+{
+#ifdef WIN32
+    Sleep(ms);
+#else
+    poll(0, 0, ms);
+#endif
+}
+
+/// Returns a message as written to stdout.
+static std::string LineText(const QString &message)
+{
+    std::string text = message.toStdString();
+    ///\todo Temporary hack which appends line ending in case it's not there (output of console commands in headless mode)
+    if (text.empty() || text[text.size()-1] != '\n')
+        text += '\n';
+    return text;
+}
+
+/// Returns the level name of a log channel for the JSON output.
+static const char *LevelName(u32 logChannel)
+{
+    if ((logChannel & LogChannelError) != 0) return "error";
+    if ((logChannel & LogChannelWarning) != 0) return "warning";
+    if ((logChannel & LogChannelDebug) != 0) return "debug";
+    return "info";
+}
+
+/// Returns a string as a quoted, UTF-8 encoded JSON string.
+static std::string JsonString(const QString &str)
+{
+    QByteArray utf8 = str.toUtf8();
+    std::string out;
+    out.reserve(utf8.size() + 2);
+    out += '"';
+    for(int i = 0; i < utf8.size(); ++i)
+    {
+        unsigned char c = (unsigned char)utf8[i];
+        switch(c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20)
+            {
+                char escaped[8];
+                sprintf(escaped, "\\u%04x", (uint)c);
+                out += escaped;
+            }
+            else
+                out += (char)c;
+            break;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+/// Returns a log message as a JSON line, without the channel prefix and the line ending of the message.
+static std::string JsonLine(u32 logChannel, const QString &message, const QDateTime &time)
+{
+    QString text = message;
+    if ((logChannel & LogChannelError) != 0 && text.startsWith("Error: "))
+        text.remove(0, 7);
+    else if ((logChannel & LogChannelWarning) != 0 && text.startsWith("Warning: "))
+        text.remove(0, 9);
+    else if ((logChannel & LogChannelDebug) != 0 && text.startsWith("Debug: "))
+        text.remove(0, 7);
+    while(text.endsWith('\n') || text.endsWith('\r'))
+        text.chop(1);
+
+    QDateTime timestamp = time.isValid() ? time : QDateTime::currentDateTime();
+    return "{\"time\":\"" + timestamp.toString("yyyy-MM-ddThh:mm:ss.zzz").toStdString() + "\",\"level\":\"" + LevelName(logChannel) +
+        "\",\"message\":" + JsonString(text) + "}\n";
+}
+
+LogWriter::LogWriter(bool collectConsoleLines_) :
+    head(0),
+    tail(0),
+    numQueued(0),
+    numDroppedFull(0),
+    numEnqueued(0),
+    numConsumed(0),
+    quit(false),
+    logFile(0),
+    consuming(0),
+    logFd(-1),
+    stdoutFd(fileno(stdout)),
+    numDiscardedConsoleLines(0),
+    collectConsoleLines(collectConsoleLines_),
+    jsonOutput(false),
+    rateLimit(0),
+    stdoutChannel(0),
+    lastChannel(0),
+    numRepeats(0),
+    repeatStartTime(0),
+    rateStartTime(0),
+    rateLines(0),
+    numDroppedRate(0)
+{
+    // The queue always contains a consumed stub node, so that the producers never touch the tail.
+    Node *stub = new Node;
+    head = stub;
+    tail = stub;
+
+    instance = this;
+    for(int i = 0; i < cNumFatalSignals; ++i)
+        InstallSignalHandler(cFatalSignals[i], &LogWriter::HandleFatalSignal, i);
+    for(int i = 0; i < cNumTerminationSignals; ++i)
+        InstallSignalHandler(cTerminationSignals[i], &LogWriter::HandleTerminationSignal, cNumFatalSignals + i);
+
+    writerThread = boost::thread(boost::bind(&LogWriter::ThreadMain, this));
+}
+
+LogWriter::~LogWriter()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        quit = true;
+    }
+    messagesAvailable.notify_all();
+    writerThread.join();
+
+    {
+        boost::mutex::scoped_lock lock(consumerLock);
+        while(WriteQueued(true)) ;
+    }
+
+    for(int i = 0; i < cNumFatalSignals; ++i)
+        RestoreSignalHandler(cFatalSignals[i], i);
+    for(int i = 0; i < cNumTerminationSignals; ++i)
+        RestoreSignalHandler(cTerminationSignals[i], cNumFatalSignals + i);
+    if (instance == this)
+        instance = 0;
+
+    logFd = -1;
+    if (logFile)
+        fclose(logFile);
+    delete tail;
+}
+
+void LogWriter::Write(u32 logChannel, const QString &message)
+{
+    if (numQueued.fetchAndAddRelaxed(1) >= cMaxQueuedMessages)
+    {
+        numQueued.fetchAndAddRelaxed(-1);
+        numDroppedFull.ref();
+        return;
+    }
+
+    // The message is formatted here, so that the fatal signal handler can write the queued messages without formatting them
+    Node *node = new Node;
+    node->logChannel = logChannel;
+    node->message = message;
+    node->text = LineText(message);
+    if (jsonOutput)
+        node->fileText = JsonLine(logChannel, message, QDateTime::currentDateTime());
+
+    // Swap the node in as the new head, then link the previous head to it. The consumer stops at the link until it is made.
+    Node *prev = head.fetchAndStoreOrdered(node);
+    prev->next.fetchAndStoreRelease(node);
+    numEnqueued.ref();
+
+    messagesAvailable.notify_one();
+}
+
+bool LogWriter::Pop(Node &dst)
+{
+    Node *next = tail->next.fetchAndAddAcquire(0);
+    if (!next)
+        return false;
+
+    dst.logChannel = next->logChannel;
+    dst.message = next->message;
+    dst.text.swap(next->text);
+    dst.fileText.swap(next->fileText);
+    next->message = QString();
+    // The popped node becomes the new stub.
+    delete tail;
+    tail = next;
+    numQueued.deref();
+    return true;
+}
+
+void LogWriter::Flush()
+{
+    const uint target = (uint)numEnqueued.fetchAndAddOrdered(0);
+    boost::mutex::scoped_lock lock(mutex);
+    while((int)(numConsumed - target) < 0 && !quit)
+    {
+        messagesAvailable.notify_one();
+        messagesWritten.timed_wait(lock, boost::posix_time::milliseconds(10));
+    }
+}
+
+bool LogWriter::SetLogFile(const QString &filename)
+{
+    FILE *newFile = 0;
+    if (!filename.isEmpty())
+    {
+        newFile = fopen(QFile::encodeName(filename).constData(), "w");
+        if (!newFile)
+            return false;
+    }
+
+    // Write the messages queued so far to the previous file.
+    Flush();
+
+    FILE *oldFile = 0;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        oldFile = logFile;
+        logFile = newFile;
+        logFd = newFile ? fileno(newFile) : -1;
+    }
+    if (oldFile)
+        fclose(oldFile);
+    return true;
+}
+
+uint LogWriter::TakeConsoleLines(std::vector<QString> &dst)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    uint numDiscarded = numDiscardedConsoleLines;
+    numDiscardedConsoleLines = 0;
+    if (dst.empty())
+        dst.swap(consoleLines);
+    else
+    {
+        dst.insert(dst.end(), consoleLines.begin(), consoleLines.end());
+        consoleLines.clear();
+    }
+    return numDiscarded;
+}
+
+void LogWriter::ThreadMain()
+{
+    for(;;)
+    {
+        bool moreQueued = false;
+        {
+            boost::mutex::scoped_lock lock(consumerLock);
+            moreQueued = WriteQueued(false);
+        }
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (quit)
+            return;
+        // A notify may be missed between the write and the wait, which delays the next batch by at most the wait time.
+        if (!moreQueued)
+            messagesAvailable.timed_wait(lock, boost::posix_time::milliseconds(100));
+    }
+}
+
+bool LogWriter::WriteQueued(bool final)
+{
+    // Once the fatal signal handler has taken the queue, it is never released
+    if (!consuming.testAndSetAcquire(0, 1))
+        return false;
+
+    Node node;
+    uint count = 0;
+    bool moreQueued = false;
+    while(Pop(node))
+    {
+        Process(node);
+        if (++count >= cBatchSize)
+        {
+            moreQueued = true;
+            break;
+        }
+    }
+
+    const tick_t now = GetCurrentClockTime();
+    const tick_t freq = GetCurrentClockFreq();
+    // A message that keeps repeating gets its repeat count written once a second.
+    if (numRepeats > 0 && (final || now - repeatStartTime >= freq))
+        WriteRepeats();
+
+    int numFull = numDroppedFull.fetchAndStoreRelaxed(0);
+    if (numFull > 0)
+        Output(LogChannelWarning, "Warning: " + QString::number(numFull) + " log messages dropped, the log output could not keep up.\n");
+    if (numDroppedRate > 0 && (final || now - rateStartTime >= freq))
+    {
+        Output(LogChannelWarning, "Warning: " + QString::number(numDroppedRate) + " log messages dropped by the limit of " +
+            QString::number(rateLimit) + " lines per second.\n");
+        numDroppedRate = 0;
+    }
+
+    FlushStdout();
+
+    boost::mutex::scoped_lock lock(mutex);
+    if (logFile && !fileBuffer.empty())
+    {
+        fwrite(fileBuffer.data(), 1, fileBuffer.size(), logFile);
+        fflush(logFile);
+    }
+    fileBuffer.clear();
+
+    if (!newConsoleLines.empty())
+    {
+        consoleLines.insert(consoleLines.end(), newConsoleLines.begin(), newConsoleLines.end());
+        newConsoleLines.clear();
+        if (consoleLines.size() > cMaxConsoleLines)
+        {
+            size_t numDiscarded = consoleLines.size() - cMaxConsoleLines;
+            consoleLines.erase(consoleLines.begin(), consoleLines.begin() + numDiscarded);
+            numDiscardedConsoleLines += (uint)numDiscarded;
+        }
+    }
+
+    numConsumed += count;
+    messagesWritten.notify_all();
+    consuming.fetchAndStoreRelease(0);
+    return moreQueued;
+}
+
+void LogWriter::Process(const Node &node)
+{
+    const u32 logChannel = node.logChannel;
+    const QString &message = node.message;
+    const tick_t now = GetCurrentClockTime();
+    if (logChannel == lastChannel && message == lastMessage && !message.isEmpty())
+    {
+        if (numRepeats++ == 0)
+            repeatStartTime = now;
+        return;
+    }
+    WriteRepeats();
+    lastChannel = logChannel;
+    lastMessage = message;
+
+    const int limit = rateLimit;
+    if (limit > 0)
+    {
+        if (now - rateStartTime >= GetCurrentClockFreq())
+        {
+            if (numDroppedRate > 0)
+            {
+                Output(LogChannelWarning, "Warning: " + QString::number(numDroppedRate) + " log messages dropped by the limit of " +
+                    QString::number(limit) + " lines per second.\n");
+                numDroppedRate = 0;
+            }
+            rateStartTime = now;
+            rateLines = 0;
+        }
+        if (rateLines >= limit)
+        {
+            ++numDroppedRate;
+            return;
+        }
+        ++rateLines;
+    }
+
+    Output(logChannel, message, node.text, node.fileText);
+}
+
+void LogWriter::WriteRepeats()
+{
+    if (numRepeats == 0)
+        return;
+    QString message = "Last message repeated " + QString::number(numRepeats) + (numRepeats == 1 ? " time.\n" : " times.\n");
+    if ((lastChannel & LogChannelError) != 0)
+        message = "Error: " + message;
+    else if ((lastChannel & LogChannelWarning) != 0)
+        message = "Warning: " + message;
+    numRepeats = 0;
+    Output(lastChannel, message);
+}
+
+void LogWriter::Output(u32 logChannel, const QString &message)
+{
+    Output(logChannel, message, LineText(message), std::string());
+}
+
+void LogWriter::Output(u32 logChannel, const QString &message, const std::string &text, const std::string &fileText)
+{
+#ifdef WIN32
+    // Errors and warnings are highlighted, so write the buffered text of the previous channel first.
+    if (logChannel != stdoutChannel)
+        FlushStdout();
+#endif
+    stdoutChannel = logChannel;
+    stdoutBuffer += text;
+
+    if (!jsonOutput)
+        fileBuffer += text;
+    else if (!fileText.empty())
+        fileBuffer += fileText;
+    else
+        fileBuffer += JsonLine(logChannel, message, QDateTime());
+
+    if (collectConsoleLines)
+        newConsoleLines.push_back(message);
+}
+
+void LogWriter::FlushStdout()
+{
+    if (stdoutBuffer.empty())
+        return;
+
+    // On Windows, highlight errors and warnings.
+#ifdef WIN32
+    if ((stdoutChannel & LogChannelError) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
+    else if ((stdoutChannel & LogChannelWarning) != 0) SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+#endif
+    fwrite(stdoutBuffer.data(), 1, stdoutBuffer.size(), stdout);
+    fflush(stdout);
+    // Restore the text color to normal.
+#ifdef WIN32
+    if ((stdoutChannel & (LogChannelError | LogChannelWarning)) != 0)
+        SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+#endif
+    stdoutBuffer.clear();
+}
+
+void LogWriter::WriteOnCrash()
+{
+    // Take the queue from the writer thread. If it is writing, give it a moment to finish the batch. If the crash happened on the
+    // thread that is writing, the queue can not be taken.
+    bool taken = false;
+    for(int i = 0; i < 100 && !taken; ++i)
+    {
+        taken = consuming.testAndSetAcquire(0, 1);
+        if (!taken)
+            SleepMilliseconds(10);
+    }
+    if (!taken)
+        return;
+
+    // The consumer buffers are empty between batches, so only the queued messages remain. They are written as they are, without
+    // the repeat detection and the rate limit. The nodes are not freed, as the heap may be corrupt.
+    const int fd = logFd;
+    for(Node *node = tail->next.fetchAndAddAcquire(0); node; node = node->next.fetchAndAddAcquire(0))
+    {
+        const std::string &text = node->text;
+        const std::string &fileText = node->fileText;
+        WriteAll(stdoutFd, text.data(), text.size());
+        if (fd >= 0)
+        {
+            if (fileText.empty())
+                WriteAll(fd, text.data(), text.size());
+            else
+                WriteAll(fd, fileText.data(), fileText.size());
+        }
+    }
+}
+
+void LogWriter::HandleFatalSignal(int signal_)
+{
+    if (instance)
+        instance->WriteOnCrash();
+    // The handler has been reset to the default action, which ends the process when the handler returns.
+    raise(signal_);
+}
+
+void LogWriter::HandleTerminationSignal(int /*signal*/)
+{
+    terminationRequested = 1;
+}
+
+bool LogWriter::TakeTerminationRequest()
+{
+    if (!terminationRequested)
+        return false;
+    terminationRequested = 0;
+    return true;
+}
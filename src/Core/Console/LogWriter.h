@@ -0,0 +1,171 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <QString>
+#include <QAtomicPointer>
+#include <QAtomicInt>
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <stdio.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+/// Writes the console and log output to stdout and the log file on a background thread.
+/** Messages are queued to a lock-free multiple producer, single consumer queue, so that printing costs the calling thread only
+    formatting the message to bytes and a memory allocation. The writer thread writes the queued messages in batches and flushes
+    the outputs once per batch.
+    Consecutive repeats of a message are written once, followed by a repeat count. Optionally, the number of lines written per
+    second is limited, and the excess messages are counted as dropped. If the writer thread falls behind by cMaxQueuedMessages,
+    new messages are dropped as well.
+    On fatal signals (SIGSEGV, SIGBUS, SIGABRT, SIGFPE and SIGILL), the signal handler writes the preformatted bytes of the queued
+    messages with write(2) only, and re-raises the signal with the default action. On SIGINT and SIGTERM, the handler only sets a flag;
+    ConsoleAPI then exits the framework on the main thread, and the queue is written as the writer is destroyed.
+    Owned by ConsoleAPI. */
+class LogWriter
+{
+public:
+    /// Maximum number of messages waiting to be written. Messages beyond this are dropped.
+    static const int cMaxQueuedMessages = 100000;
+
+    /// Starts the writer thread and installs the signal handlers.
+    /** @param collectConsoleLines Whether to keep the written lines for TakeConsoleLines. */
+    explicit LogWriter(bool collectConsoleLines);
+    /// Writes the queued messages and stops the writer thread.
+    ~LogWriter();
+
+    /// Queues a message. Can be called from any thread.
+    /** @param logChannel The LogChannel of the message, or 0 for console output.
+        @param message The message. A line ending is appended if it does not end with one. */
+    void Write(u32 logChannel, const QString &message);
+
+    /// Blocks until the messages queued before the call have been written.
+    void Flush();
+
+    /// Opens a log file, closing the previous one.
+    /** @param filename The file to write, or empty to stop writing to a file.
+        @return False if the file could not be opened. */
+    bool SetLogFile(const QString &filename);
+
+    /// Sets whether the log file is written as JSON lines, one object with time, level and message fields per message.
+    void SetJsonOutput(bool enabled) { jsonOutput = enabled; }
+
+    /// Sets the maximum number of lines written per second, or 0 for unlimited.
+    void SetRateLimit(int linesPerSecond) { rateLimit = linesPerSecond > 0 ? linesPerSecond : 0; }
+
+    /// Moves the lines written since the last call to dst, for showing in the console widget.
+    /** At most cMaxConsoleLines lines are kept between the calls.
+        @return The number of older lines discarded since the last call. */
+    uint TakeConsoleLines(std::vector<QString> &dst);
+
+    /// Maximum number of lines kept for TakeConsoleLines
+    static const uint cMaxConsoleLines = 1000;
+
+    /// Returns whether SIGINT or SIGTERM has been received since the last call. Called on the main thread to shut down in order.
+    static bool TakeTerminationRequest();
+
+private:
+    struct Node
+    {
+        Node() : next(0), logChannel(0) {}
+
+        QAtomicPointer<Node> next;
+        u32 logChannel;
+        QString message;
+        /// The message as written to stdout, with a line ending
+        std::string text;
+        /// The message as written to the log file if it differs from text, ie. the JSON line if written as JSON
+        std::string fileText;
+    };
+
+    /// Writer thread entry point.
+    void ThreadMain();
+    /// Writes a batch of queued messages. The caller must hold consumerLock. Does nothing if the fatal signal handler is writing.
+    /** @param final Whether to also write the pending repeat count of the last message.
+        @return True if more messages are queued. */
+    bool WriteQueued(bool final);
+    /// Takes the oldest message from the queue, or returns false if the queue is empty. Single consumer only.
+    bool Pop(Node &dst);
+    /// Handles one message, applying the repeat detection and the rate limit.
+    void Process(const Node &node);
+    /// Writes the pending repeat count of the last message, if any.
+    void WriteRepeats();
+    /// Adds one preformatted message to the output buffers.
+    void Output(u32 logChannel, const QString &message, const std::string &text, const std::string &fileText);
+    /// Formats one message of the writer itself to the output buffers.
+    void Output(u32 logChannel, const QString &message);
+    /// Writes the stdout buffer, highlighting errors and warnings on Windows.
+    void FlushStdout();
+    /// Writes the preformatted bytes of the queued messages from the fatal signal handler. Async-signal-safe.
+    void WriteOnCrash();
+
+    static void HandleFatalSignal(int signal);
+    static void HandleTerminationSignal(int signal);
+
+    /// Queue head, where the producers add messages
+    QAtomicPointer<Node> head;
+    /// Queue tail, a consumed node whose next node is the oldest message. Only accessed by the consumer
+    Node *tail;
+    /// Number of queued messages
+    QAtomicInt numQueued;
+    /// Number of messages dropped because the queue was full
+    QAtomicInt numDroppedFull;
+    /// Number of messages queued since the start
+    QAtomicInt numEnqueued;
+
+    boost::thread writerThread;
+    /// Held while consuming the queue and writing the outputs
+    boost::mutex consumerLock;
+    /// Set while the queue is being consumed, by WriteQueued or by the fatal signal handler, which can not use consumerLock
+    QAtomicInt consuming;
+    /// Protects the state shared with the writer thread below, and logFile
+    boost::mutex mutex;
+    boost::condition_variable messagesAvailable;
+    boost::condition_variable messagesWritten;
+    /// Number of messages consumed from the queue. Protected by mutex
+    uint numConsumed;
+    /// Set when the writer thread should exit. Protected by mutex
+    bool quit;
+    /// Log file, or null. Protected by mutex
+    FILE *logFile;
+    /// File descriptor of logFile, or -1, for the fatal signal handler
+    volatile int logFd;
+    /// File descriptor of stdout, for the fatal signal handler
+    int stdoutFd;
+    /// Lines for the console widget. Protected by mutex
+    std::vector<QString> consoleLines;
+    /// Number of lines discarded from consoleLines. Protected by mutex
+    uint numDiscardedConsoleLines;
+
+    const bool collectConsoleLines;
+    volatile bool jsonOutput;
+    volatile int rateLimit;
+
+    // The following are only accessed by the consumer.
+    std::string stdoutBuffer;
+    u32 stdoutChannel;
+    std::string fileBuffer;
+    std::vector<QString> newConsoleLines;
+    /// Last message, for detecting repeats
+    QString lastMessage;
+    u32 lastChannel;
+    /// Number of unwritten repeats of the last message
+    uint numRepeats;
+    tick_t repeatStartTime;
+    /// Start of the current rate limit second, and the lines written during it
+    tick_t rateStartTime;
+    int rateLines;
+    /// Messages dropped by the rate limit, not yet reported
+    uint numDroppedRate;
+
+    /// The writer whose queue is written on fatal signals
+    static LogWriter *instance;
+    /// Set by the SIGINT and SIGTERM handler
+    static volatile sig_atomic_t terminationRequested;
+};
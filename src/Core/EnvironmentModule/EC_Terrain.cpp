@@ -24,8 +24,18 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "FrameAPI.h"
+#include "Math/float3x3.h"
+#include "Math/float4x4.h"
 #include <Ogre.h>
+#include <QFile>
 #include <utility>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define EC_TERRAIN_SSE
+#include <xmmintrin.h>
+#endif
 
 #include "MemoryLeakCheck.h"
 
@@ -41,6 +51,9 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     heightMap(this, "Heightmap"),
     uScale(this, "Tex. U scale"),
     vScale(this, "Tex. V scale"),
+    lodScreenError(this, "LOD screen error"),
+    lastBuildGeneration(0),
+    lodUpdateTimer(0.f),
     patchWidth(1),
     patchHeight(1),
     rootNode(0)
@@ -56,6 +69,7 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     MakePatchFlat(0, 0, 0.f);
     uScale.Set(0.13f, AttributeChange::Disconnected);
     vScale.Set(0.13f, AttributeChange::Disconnected);
+    lodScreenError.Set(0.02f, AttributeChange::Disconnected);
     material.Set(AssetReference("local://RexTerrainPCF.material"), AttributeChange::Disconnected);
 
     heightMapAsset = boost::shared_ptr<AssetRefListener>(new AssetRefListener);
@@ -64,6 +78,8 @@ EC_Terrain::EC_Terrain(Scene* scene) :
 
 EC_Terrain::~EC_Terrain()
 {
+    // Stop the worker threads before the patches they refer to go away
+    patchBuilder.reset();
     Destroy();
 }
 
@@ -81,6 +97,8 @@ void EC_Terrain::UpdateSignals()
         connect(parent, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(AttachTerrainRootNode()), Qt::UniqueConnection);
         connect(parent, SIGNAL(ComponentRemoved(IComponent*, AttributeChange::Type)), this, SLOT(AttachTerrainRootNode()), Qt::UniqueConnection); // The Attach function also handles detaches.
     }
+    if (ViewEnabled() && !world_.expired())
+        connect(GetFramework()->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)), Qt::UniqueConnection);
 }
 
 void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
@@ -89,6 +107,7 @@ void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
     patch.heightData.clear();
     patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
     patch.patch_geometry_dirty = true;
+    heightPyramid.clear();
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
@@ -102,8 +121,8 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
 {
     PROFILE(EC_Terrain_ResizeTerrain);
 
-    const int maxPatchSize = 32;
-    // Do an artificial limit to a preset N patches per side. (This limit is way too large already for the current terrain vertex LOD management.)
+    const int maxPatchSize = 256;
+    // Do an artificial limit to a preset N patches per side.
     newPatchWidth = max(1, min(maxPatchSize, newPatchWidth));
     newPatchHeight = max(1, min(maxPatchSize, newPatchHeight));
 
@@ -133,7 +152,8 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
     for(int y = 0; y < min(patchHeight, newPatchHeight); ++y)
         for(int x = 0; x < min(patchWidth, newPatchWidth); ++x)
             newPatches[y * newPatchWidth + x] = GetPatch(x, y);
-    patches = newPatches;
+    patches.swap(newPatches);
+    heightPyramid.clear();
     int oldPatchWidth = patchWidth;
     int oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
@@ -184,7 +204,7 @@ void EC_Terrain::OnAttributeUpdated(IAttribute *attribute)
         std::map<QString, QString> args = ParseAssetRefArgs(heightMap.Get().ref, &refBody);
         heightMapAsset->HandleAssetRefChange(framework->Asset(), refBody);
     }
-    else if (attribute->Name() == uScale.Name() || attribute->Name() == vScale.Name())
+    else if (attribute->Name() == uScale.Name() || attribute->Name() == vScale.Name() || attribute->Name() == lodScreenError.Name())
     {
         // Re-do all the geometry on the GPU.
         DirtyAllTerrainPatches();
@@ -262,6 +282,7 @@ void EC_Terrain::DestroyPatch(int x, int y)
     Ogre::SceneManager *sceneMgr = world_.lock()->GetSceneManager();
     
     EC_Terrain::Patch &patch = GetPatch(x, y);
+    patch.buildGeneration = 0; // Discard any geometry still being generated for the patch.
 
     if (patch.node)
     {
@@ -328,6 +349,7 @@ void EC_Terrain::SetPointHeight(int x, int y, float height)
         return; // Out of bounds signals are silently ignored.
 
     GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    heightPyramid.clear();
 }
 
 namespace
@@ -349,37 +371,39 @@ namespace
     }
 }
 
-float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
+float3x4 EC_Terrain::WorldTransform() const
 {
-    if (!rootNode)
+    if (rootNode)
     {
-        LogError("GetPointOnMap called before rootNode initialized, returning zeros");
-        return float3(0, 0, 0);
+        float4x4 worldTM = GetWorldTransform(rootNode);
+        return worldTM.Float3x4Part();
     }
-    Ogre::Matrix4 worldTM = GetWorldTransform(rootNode);
+
+    // No Ogre scene node: compose the same transform as UpdateRootNodeTransform and the parent placeable give to the root node.
+    const Transform &tm = nodeTransformation.Get();
+    float3x3 rot = float3x3::RotateX(DegToRad(tm.rot.x)) * float3x3::RotateY(DegToRad(tm.rot.y)) * float3x3::RotateZ(DegToRad(tm.rot.z));
+    float3x4 localTM = float3x4::Translate(tm.pos) * float3x4(rot) * float3x4::Scale(tm.scale);
+    Entity *parent = ParentEntity();
+    boost::shared_ptr<EC_Placeable> placeable = parent ? parent->GetComponent<EC_Placeable>() : boost::shared_ptr<EC_Placeable>();
+    return placeable ? placeable->LocalToWorld() * localTM : localTM;
+}
+
+float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
+{
+    float3x4 worldTM = WorldTransform();
 
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
-    Ogre::Matrix4 inv = worldTM.inverse(); // world->local
-    Ogre::Vector4 local = inv * Ogre::Vector4(point.x, point.y, point.z, 1.f);
+    float3 local = worldTM.Inverted().MulPos(point); // world->local
     local.y = GetInterpolatedHeightValue(local.x, local.z);
-    Ogre::Vector4 world = worldTM * local;
-    return float3(world.x, world.y, world.z);
+    return worldTM.MulPos(local);
 }
 
 float3 EC_Terrain::GetPointOnMapLocal(const float3 &point) const
 {
-    if (!rootNode)
-    {
-        LogError("GetPointOnMapLocal called before rootNode initialized, returning zeros");
-        return float3(0, 0, 0);
-    }
-    Ogre::Matrix4 worldTM = GetWorldTransform(rootNode);
-
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
-    Ogre::Matrix4 inv = worldTM.inverse(); // world->local
-    Ogre::Vector4 local = inv * Ogre::Vector4(point.x, point.y, point.z, 1.f);
+    float3 local = WorldTransform().Inverted().MulPos(point); // world->local
     local.y = GetInterpolatedHeightValue(local.x, local.z);
-    return float3(local.x, local.y, local.z);
+    return local;
 }
 
 float EC_Terrain::GetDistanceToTerrain(const float3 &point) const
@@ -427,6 +451,399 @@ float EC_Terrain::GetInterpolatedHeightValue(float x, float y) const
     return h1 * (1.f - u - v) + h2 * u + h3 * v;
 }
 
+void EC_Terrain::GetInterpolatedHeights(const float *x, const float *y, int count, float *heights, float *normals) const
+{
+    PROFILE(EC_Terrain_GetInterpolatedHeights);
+
+    const int maxX = VerticesWidth() - 1;
+    const int maxY = VerticesHeight() - 1;
+    if (maxX < 0 || maxY < 0 || patches.empty())
+    {
+        std::fill(heights, heights + count, 0.f);
+        if (normals)
+            for(int i = 0; i < count; ++i)
+            {
+                normals[i*3] = 0.f;
+                normals[i*3+1] = 1.f;
+                normals[i*3+2] = 0.f;
+            }
+        return;
+    }
+
+    int i = 0;
+#ifdef EC_TERRAIN_SSE
+    // Four points at a time. The heights of the cell corners are fetched per point, the clamping, triangle selection,
+    // interpolation and normals are computed four-wide.
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 xMax = _mm_set1_ps((float)maxX);
+    const __m128 yMax = _mm_set1_ps((float)maxY);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 px = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x + i), zero), xMax);
+        __m128 py = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(y + i), zero), yMax);
+        float cx[4], cy[4], fx[4], fy[4], h00[4], h10[4], h01[4], h11[4];
+        _mm_storeu_ps(cx, px);
+        _mm_storeu_ps(cy, py);
+        for(int j = 0; j < 4; ++j)
+        {
+            int x0 = (int)cx[j]; // The coordinates are non-negative, so truncation equals floor.
+            int y0 = (int)cy[j];
+            int x1 = min(x0 + 1, maxX);
+            int y1 = min(y0 + 1, maxY);
+            fx[j] = (float)x0;
+            fy[j] = (float)y0;
+            h00[j] = HeightAt(x0, y0);
+            h10[j] = HeightAt(x1, y0);
+            h01[j] = HeightAt(x0, y1);
+            h11[j] = HeightAt(x1, y1);
+        }
+        __m128 u = _mm_sub_ps(px, _mm_loadu_ps(fx));
+        __m128 v = _mm_sub_ps(py, _mm_loadu_ps(fy));
+        __m128 a = _mm_loadu_ps(h00);
+        __m128 b = _mm_loadu_ps(h10);
+        __m128 c = _mm_loadu_ps(h01);
+        __m128 d = _mm_loadu_ps(h11);
+        // The cells are split along the diagonal from (x0,y1) to (x1,y0), see GetInterpolatedHeightValue.
+        __m128 upper = _mm_cmpge_ps(_mm_add_ps(u, v), one);
+        __m128 lowerHeight = _mm_add_ps(a, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, a), u), _mm_mul_ps(_mm_sub_ps(c, a), v)));
+        __m128 upperHeight = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(c, d), _mm_sub_ps(one, u)), _mm_mul_ps(_mm_sub_ps(b, d), _mm_sub_ps(one, v))));
+        _mm_storeu_ps(heights + i, _mm_or_ps(_mm_and_ps(upper, upperHeight), _mm_andnot_ps(upper, lowerHeight)));
+
+        if (normals)
+        {
+            __m128 nx = _mm_or_ps(_mm_and_ps(upper, _mm_sub_ps(c, d)), _mm_andnot_ps(upper, _mm_sub_ps(a, b)));
+            __m128 nz = _mm_or_ps(_mm_and_ps(upper, _mm_sub_ps(b, d)), _mm_andnot_ps(upper, _mm_sub_ps(a, c)));
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(nz, nz)))));
+            float n[3][4];
+            _mm_storeu_ps(n[0], _mm_mul_ps(nx, invLength));
+            _mm_storeu_ps(n[1], invLength);
+            _mm_storeu_ps(n[2], _mm_mul_ps(nz, invLength));
+            for(int j = 0; j < 4; ++j)
+            {
+                normals[(i+j)*3] = n[0][j];
+                normals[(i+j)*3+1] = n[1][j];
+                normals[(i+j)*3+2] = n[2][j];
+            }
+        }
+    }
+#endif
+
+    for(; i < count; ++i)
+    {
+        float px = clamp(x[i], 0.f, (float)maxX);
+        float py = clamp(y[i], 0.f, (float)maxY);
+        int x0 = (int)px;
+        int y0 = (int)py;
+        int x1 = min(x0 + 1, maxX);
+        int y1 = min(y0 + 1, maxY);
+        float u = px - x0;
+        float v = py - y0;
+        float a = HeightAt(x0, y0);
+        float b = HeightAt(x1, y0);
+        float c = HeightAt(x0, y1);
+        float d = HeightAt(x1, y1);
+        float3 normal;
+        if (u + v >= 1.f)
+        {
+            heights[i] = d + (c - d) * (1.f - u) + (b - d) * (1.f - v);
+            normal = float3(c - d, 1.f, b - d);
+        }
+        else
+        {
+            heights[i] = a + (b - a) * u + (c - a) * v;
+            normal = float3(a - b, 1.f, a - c);
+        }
+        if (normals)
+        {
+            normal.Normalize();
+            normals[i*3] = normal.x;
+            normals[i*3+1] = normal.y;
+            normals[i*3+2] = normal.z;
+        }
+    }
+}
+
+/// Reads the local map coordinates of world space points given as a flat [x0, z0, x1, z1, ...] script array.
+static void ReadMapCoordinates(const QVariantList &xz, const float3x4 &worldToLocal, std::vector<float> &x, std::vector<float> &y)
+{
+    const int count = xz.size() / 2;
+    x.resize(count);
+    y.resize(count);
+    for(int i = 0; i < count; ++i)
+    {
+        float3 local = worldToLocal.MulPos(float3(xz[i*2].toFloat(), 0.f, xz[i*2+1].toFloat()));
+        x[i] = local.x;
+        y[i] = local.z;
+    }
+}
+
+QVariantList EC_Terrain::GetHeights(const QVariantList &xz) const
+{
+    const float3x4 worldTM = WorldTransform();
+    std::vector<float> x, y;
+    ReadMapCoordinates(xz, worldTM.Inverted(), x, y);
+    std::vector<float> heights(x.size());
+    if (!x.empty())
+        GetInterpolatedHeights(&x[0], &y[0], (int)x.size(), &heights[0]);
+
+    QVariantList ret;
+    ret.reserve((int)heights.size());
+    for(size_t i = 0; i < heights.size(); ++i)
+        ret.push_back(worldTM.MulPos(float3(x[i], heights[i], y[i])).y);
+    return ret;
+}
+
+QVariantList EC_Terrain::GetNormals(const QVariantList &xz) const
+{
+    const float3x4 worldTM = WorldTransform();
+    std::vector<float> x, y;
+    ReadMapCoordinates(xz, worldTM.Inverted(), x, y);
+    std::vector<float> heights(x.size());
+    std::vector<float> normals(x.size() * 3);
+    if (!x.empty())
+        GetInterpolatedHeights(&x[0], &y[0], (int)x.size(), &heights[0], &normals[0]);
+
+    // Normals transform by the inverse transpose, so that they stay perpendicular to the surface also under non-uniform scale.
+    const float3x4 normalTM = worldTM.InverseTransposed();
+    QVariantList ret;
+    ret.reserve((int)normals.size());
+    for(size_t i = 0; i < x.size(); ++i)
+    {
+        float3 n = normalTM.MulDir(float3(normals[i*3], normals[i*3+1], normals[i*3+2])).Normalized();
+        ret.push_back(n.x);
+        ret.push_back(n.y);
+        ret.push_back(n.z);
+    }
+    return ret;
+}
+
+float EC_Terrain::Raycast(const Ray &ray, float maxDistance) const
+{
+    // The distance is measured in multiples of the direction, which is unit length in world space, so the local space distance
+    // along the transformed ray equals the world space distance.
+    const float3x4 worldToLocal = WorldTransform().Inverted();
+    float distance;
+    if (RaycastLocal(worldToLocal.MulPos(ray.pos), worldToLocal.MulDir(ray.dir), maxDistance, distance))
+        return distance;
+    return -1.f;
+}
+
+/// Intersects a ray with the slab box [minX, maxX] x [minY, maxY] x [minZ, maxZ], clipping the ray parameter interval [tMin, tMax].
+static bool ClipRayToBox(const float3 &origin, const float3 &direction, const float3 &boxMin, const float3 &boxMax, float &tMin, float &tMax)
+{
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        if (direction[axis] == 0.f)
+        {
+            if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis])
+                return false;
+            continue;
+        }
+        float invDir = 1.f / direction[axis];
+        float t0 = (boxMin[axis] - origin[axis]) * invDir;
+        float t1 = (boxMax[axis] - origin[axis]) * invDir;
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tMin = max(tMin, t0);
+        tMax = min(tMax, t1);
+        if (tMin > tMax)
+            return false;
+    }
+    return true;
+}
+
+/// Intersects a ray with a triangle (Moller-Trumbore), from both sides. Returns the ray parameter of the hit, or a negative value if none.
+static float RayTriangle(const float3 &origin, const float3 &direction, const float3 &a, const float3 &b, const float3 &c)
+{
+    float3 e1 = b - a;
+    float3 e2 = c - a;
+    float3 p = direction.Cross(e2);
+    float det = e1.Dot(p);
+    if (det == 0.f)
+        return -1.f;
+    float invDet = 1.f / det;
+    float3 s = origin - a;
+    float u = s.Dot(p) * invDet;
+    if (u < 0.f || u > 1.f)
+        return -1.f;
+    float3 q = s.Cross(e1);
+    float v = direction.Dot(q) * invDet;
+    if (v < 0.f || u + v > 1.f)
+        return -1.f;
+    return e2.Dot(q) * invDet;
+}
+
+bool EC_Terrain::RaycastLocal(const float3 &origin, const float3 &direction, float maxDistance, float &distance) const
+{
+    if (VerticesWidth() < 2 || VerticesHeight() < 2 || direction.IsZero())
+        return false;
+
+    PROFILE(EC_Terrain_RaycastLocal);
+
+    UpdateHeightPyramid();
+    const int top = (int)heightPyramid.size() - 1;
+    return RaycastPyramidNode(top, 0, 0, origin, direction, 0.f, maxDistance, distance);
+}
+
+void EC_Terrain::UpdateHeightPyramid() const
+{
+    if (!heightPyramid.empty())
+        return;
+
+    PROFILE(EC_Terrain_UpdateHeightPyramid);
+
+    const int maxX = VerticesWidth() - 1;
+    const int maxY = VerticesHeight() - 1;
+
+    HeightPyramidLevel base;
+    base.width = patchWidth;
+    base.height = patchHeight;
+    base.minHeight.resize(patchWidth * patchHeight, std::numeric_limits<float>::max());
+    base.maxHeight.resize(patchWidth * patchHeight, -std::numeric_limits<float>::max());
+    for(int py = 0; py < patchHeight; ++py)
+        for(int px = 0; px < patchWidth; ++px)
+        {
+            if (GetPatch(px, py).heightData.empty())
+                continue; // Not loaded; the empty bounds make raycasts skip the patch.
+            float &minH = base.minHeight[py * patchWidth + px];
+            float &maxH = base.maxHeight[py * patchWidth + px];
+            // Include the seam vertices, which belong to the next patches but are part of the cells of this patch.
+            for(int y = py * cPatchSize; y <= min((py + 1) * cPatchSize, maxY); ++y)
+                for(int x = px * cPatchSize; x <= min((px + 1) * cPatchSize, maxX); ++x)
+                {
+                    float h = HeightAt(x, y);
+                    minH = min(minH, h);
+                    maxH = max(maxH, h);
+                }
+        }
+    heightPyramid.push_back(base);
+
+    while(heightPyramid.back().width > 1 || heightPyramid.back().height > 1)
+    {
+        const HeightPyramidLevel &prev = heightPyramid.back();
+        HeightPyramidLevel level;
+        level.width = (prev.width + 1) / 2;
+        level.height = (prev.height + 1) / 2;
+        level.minHeight.resize(level.width * level.height, std::numeric_limits<float>::max());
+        level.maxHeight.resize(level.width * level.height, -std::numeric_limits<float>::max());
+        for(int y = 0; y < prev.height; ++y)
+            for(int x = 0; x < prev.width; ++x)
+            {
+                int i = (y / 2) * level.width + x / 2;
+                level.minHeight[i] = min(level.minHeight[i], prev.minHeight[y * prev.width + x]);
+                level.maxHeight[i] = max(level.maxHeight[i], prev.maxHeight[y * prev.width + x]);
+            }
+        heightPyramid.push_back(level);
+    }
+}
+
+bool EC_Terrain::RaycastPyramidNode(int level, int nodeX, int nodeY, const float3 &origin, const float3 &direction, float tMin, float tMax, float &distance) const
+{
+    const HeightPyramidLevel &node = heightPyramid[level];
+    const int i = nodeY * node.width + nodeX;
+    if (node.minHeight[i] > node.maxHeight[i])
+        return false; // No loaded patches under this node.
+
+    const int nodeSize = cPatchSize << level;
+    const float3 boxMin((float)(nodeX * nodeSize), node.minHeight[i], (float)(nodeY * nodeSize));
+    const float3 boxMax((float)min((nodeX + 1) * nodeSize, VerticesWidth() - 1), node.maxHeight[i], (float)min((nodeY + 1) * nodeSize, VerticesHeight() - 1));
+    if (!ClipRayToBox(origin, direction, boxMin, boxMax, tMin, tMax))
+        return false;
+
+    if (level == 0)
+        return RaycastPatchCells(nodeX, nodeY, origin, direction, tMin, tMax, distance);
+
+    // Visit the children nearest first, and stop once the nearest hit so far is closer than the next child.
+    const HeightPyramidLevel &children = heightPyramid[level - 1];
+    const int childSize = nodeSize / 2;
+    std::pair<float, int> order[4];
+    int numChildren = 0;
+    for(int cy = nodeY * 2; cy < min(nodeY * 2 + 2, children.height); ++cy)
+        for(int cx = nodeX * 2; cx < min(nodeX * 2 + 2, children.width); ++cx)
+        {
+            const int c = cy * children.width + cx;
+            float childMin = tMin;
+            float childMax = tMax;
+            const float3 childBoxMin((float)(cx * childSize), children.minHeight[c], (float)(cy * childSize));
+            const float3 childBoxMax((float)min((cx + 1) * childSize, VerticesWidth() - 1), children.maxHeight[c], (float)min((cy + 1) * childSize, VerticesHeight() - 1));
+            if (children.minHeight[c] <= children.maxHeight[c] && ClipRayToBox(origin, direction, childBoxMin, childBoxMax, childMin, childMax))
+                order[numChildren++] = std::make_pair(childMin, c);
+        }
+    std::sort(order, order + numChildren);
+
+    bool hit = false;
+    for(int j = 0; j < numChildren && order[j].first <= tMax; ++j)
+    {
+        float childDistance;
+        if (RaycastPyramidNode(level - 1, order[j].second % children.width, order[j].second / children.width, origin, direction, tMin, tMax, childDistance))
+        {
+            hit = true;
+            distance = childDistance;
+            tMax = childDistance;
+        }
+    }
+    return hit;
+}
+
+bool EC_Terrain::RaycastPatchCells(int patchX, int patchY, const float3 &origin, const float3 &direction, float tMin, float tMax, float &distance) const
+{
+    // The cells of the patch, including the seam cells to the next patches.
+    const int cellX0 = patchX * cPatchSize;
+    const int cellY0 = patchY * cPatchSize;
+    const int cellX1 = min((patchX + 1) * cPatchSize, VerticesWidth() - 1) - 1;
+    const int cellY1 = min((patchY + 1) * cPatchSize, VerticesHeight() - 1) - 1;
+
+    // Walk the cells the ray passes over, in order (2D DDA on the map plane).
+    const float3 start = origin + direction * tMin;
+    int cx = clamp((int)floor(start.x), cellX0, cellX1);
+    int cy = clamp((int)floor(start.z), cellY0, cellY1);
+    const int stepX = direction.x > 0.f ? 1 : -1;
+    const int stepY = direction.z > 0.f ? 1 : -1;
+    const float tDeltaX = direction.x != 0.f ? Abs(1.f / direction.x) : FLOAT_INF;
+    const float tDeltaY = direction.z != 0.f ? Abs(1.f / direction.z) : FLOAT_INF;
+    float tNextX = direction.x != 0.f ? ((direction.x > 0.f ? cx + 1 : cx) - origin.x) / direction.x : FLOAT_INF;
+    float tNextY = direction.z != 0.f ? ((direction.z > 0.f ? cy + 1 : cy) - origin.z) / direction.z : FLOAT_INF;
+
+    for(;;)
+    {
+        // The two triangles of the cell, split along the diagonal from (x0,y1) to (x1,y0) like GetInterpolatedHeightValue.
+        const float3 a((float)cx, HeightAt(cx, cy), (float)cy);
+        const float3 b((float)(cx + 1), HeightAt(cx + 1, cy), (float)cy);
+        const float3 c((float)cx, HeightAt(cx, cy + 1), (float)(cy + 1));
+        const float3 d((float)(cx + 1), HeightAt(cx + 1, cy + 1), (float)(cy + 1));
+        float t = FLOAT_INF;
+        float t1 = RayTriangle(origin, direction, a, b, c);
+        if (t1 >= tMin && t1 <= tMax)
+            t = t1;
+        float t2 = RayTriangle(origin, direction, d, c, b);
+        if (t2 >= tMin && t2 <= tMax)
+            t = min(t, t2);
+        if (t != FLOAT_INF)
+        {
+            distance = t;
+            return true;
+        }
+
+        if (tNextX < tNextY)
+        {
+            if (tNextX > tMax)
+                return false;
+            cx += stepX;
+            tNextX += tDeltaX;
+        }
+        else
+        {
+            if (tNextY > tMax)
+                return false;
+            cy += stepY;
+            tNextY += tDeltaY;
+        }
+        if (cx < cellX0 || cx > cellX1 || cy < cellY0 || cy > cellY1)
+            return false;
+    }
+}
+
 float3 EC_Terrain::GetTerrainRotationAngles(float x, float y, float z, const float3& direction) const
 {
     ///\todo Delete this function and provide a proper replacement which returns local coordinate frames
@@ -558,8 +975,7 @@ float3 EC_Terrain::GetPlaneNormal(float x, float y) const
     // h1 to h3 are the three terrain height points in local coordinate space.
     float3 normal = (h3-h2).Cross(h3-h1);
 
-    float4x4 worldTM = GetWorldTransform(rootNode);
-    return worldTM.MulDir(normal).Normalized();
+    return WorldTransform().MulDir(normal).Normalized();
 }
 
 float3 EC_Terrain::GetInterpolatedNormal(float x, float y) const
@@ -571,8 +987,7 @@ float3 EC_Terrain::GetInterpolatedNormal(float x, float y) const
     // h1 to h3 are the three terrain height points in local coordinate space.
     float3 normal = (1.f - u - v) * n1 + u * n2 + v * n3;
 
-    float4x4 worldTM = GetWorldTransform(rootNode);
-    return worldTM.MulDir(normal).Normalized();
+    return WorldTransform().MulDir(normal).Normalized();
 }
 
 float3 EC_Terrain::CalculateNormal(int x, int y, int xinside, int yinside) const
@@ -646,17 +1061,29 @@ bool EC_Terrain::LoadFromFile(QString filename)
 {
     filename = filename.trimmed();
 
-    std::vector<u8> file;
-    LoadFileToVector(filename.toStdString().c_str(), file);
-
-    if (file.size() > 0)
+    // Map the file to memory, so that the height data is copied to the patches straight from the file pages
+    // instead of first reading the whole file to a temporary buffer.
+    bool success = false;
+    QFile file(filename);
+    uchar *data = 0;
+    if (file.open(QIODevice::ReadOnly) && file.size() > 0)
+        data = file.map(0, file.size());
+    if (data)
+    {
+        success = LoadFromDataInMemory((const char *)data, (size_t)file.size());
+        file.unmap(data);
+    }
+    else
     {
-        bool success = LoadFromDataInMemory((const char *)&file[0], file.size());
-        if (success)
-            currentHeightmapAssetSource = filename;
-        return success;
+        std::vector<u8> fileData;
+        LoadFileToVector(filename.toStdString().c_str(), fileData);
+        if (fileData.size() > 0)
+            success = LoadFromDataInMemory((const char *)&fileData[0], fileData.size());
     }
-    return false;
+
+    if (success)
+        currentHeightmapAssetSource = filename;
+    return success;
 }
 
 bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
@@ -694,7 +1121,8 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
     Destroy();
 
-    patches = newPatches;
+    patches.swap(newPatches);
+    heightPyramid.clear();
     patchWidth = xPatches;
     patchHeight = yPatches;
 
@@ -1215,30 +1643,87 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-/// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
-/// patch if the associated Ogre resources already exist.
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
+void EC_Terrain::QueuePatchBuild(int patchX, int patchY)
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    if (!ViewEnabled())
+        return;
+    if (world_.expired())
+        return;
+    if (!patchBuilder)
+        patchBuilder = boost::shared_ptr<TerrainPatchBuilder>(new TerrainPatchBuilder());
 
     EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
 
-    if (!ViewEnabled())
+    const int cGridSize = TerrainPatchBuilder::cGridSize;
+    TerrainPatchBuilder::Job job;
+    job.patchX = patchX;
+    job.patchY = patchY;
+    job.heights.resize(cGridSize * cGridSize);
+    // Copy the heights of the patch, its seams and a one-vertex border for the normals. GetPoint clamps to the terrain edges.
+    patch.minHeight = std::numeric_limits<float>::max();
+    patch.maxHeight = -std::numeric_limits<float>::max();
+    for(int y = 0; y < cGridSize; ++y)
+        for(int x = 0; x < cGridSize; ++x)
+        {
+            float height = GetPoint(patchX * cPatchSize + x - 1, patchY * cPatchSize + y - 1);
+            job.heights[y * cGridSize + x] = height;
+            if (x >= 1 && y >= 1 && x <= cPatchSize + 1 && y <= cPatchSize + 1)
+            {
+                patch.minHeight = min(patch.minHeight, height);
+                patch.maxHeight = max(patch.maxHeight, height);
+            }
+        }
+    job.lastColumn = (patchX + 1 >= patchWidth);
+    job.lastRow = (patchY + 1 >= patchHeight);
+    job.verticesWidth = VerticesWidth();
+    job.verticesHeight = VerticesHeight();
+    job.uScale = uScale.Get();
+    job.vScale = vScale.Get();
+    job.skirts = lodScreenError.Get() > 0.f;
+    if (!job.skirts)
+        patch.lodLevel = 0;
+    else if (!patch.entity)
+    {
+        // Start new patches directly at their level of detail instead of building them twice.
+        Ogre::Camera *camera = world_.lock()->LodCamera();
+        if (camera && rootNode)
+            patch.lodLevel = LodLevelForScreenSize(OgreWorld::ScreenSize(camera, PatchBoundingSphere(patch)));
+    }
+    job.lodLevel = patch.lodLevel;
+
+    // Stamp the job so that the results of any earlier builds of this patch get discarded.
+    if (++lastBuildGeneration == 0)
+        ++lastBuildGeneration;
+    job.generation = lastBuildGeneration;
+    patch.buildGeneration = job.generation;
+    patch.patch_geometry_dirty = false;
+
+    patchBuilder->Build(job);
+}
+
+void EC_Terrain::UploadPatchGeometry(const TerrainPatchBuilder::Result &result)
+{
+    PROFILE(EC_Terrain_UploadPatchGeometry);
+
+    if (result.patchX >= patchWidth || result.patchY >= patchHeight || result.patchX < 0 || result.patchY < 0)
         return;
+    EC_Terrain::Patch &patch = GetPatch(result.patchX, result.patchY);
+    if (result.generation != patch.buildGeneration || result.indices.empty())
+        return; // The patch has been regenerated, resized or destroyed since.
+
     if (world_.expired())
         return;
     OgreWorldPtr world = world_.lock();
     Ogre::SceneManager *sceneMgr = world->GetSceneManager();
 
     Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
     if (!node)
     {
         CreateOgreTerrainPatchNode(node, patch.x, patch.y);
         patch.node = node;
     }
-    assert(node);
+    if (!node)
+        return;
 
     Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
     if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
@@ -1247,97 +1732,24 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
     Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
     manual->setCastShadows(false);
 
+    const int cVertexSize = TerrainPatchBuilder::cVertexSize;
+    const size_t numVertices = result.vertices.size() / cVertexSize;
     manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
+    manual->estimateVertexCount(numVertices);
+    manual->estimateIndexCount(result.indices.size());
     manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
 
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, 0.f, patch.y * patchSpacingY);
-// Opensim:    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
-
-    int curIndex = 0;
-
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
-
-    const float uScale = this->uScale.Get();
-    const float vScale = this->vScale.Get();
-
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
-        {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
-
-            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
-            // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-            pos.x = vertexSpacingX * x;
-            pos.z = vertexSpacingY * y;
-// Opensim:             pos.x = vertexSpacingX * x;
-// Opensim              pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
-            {
-                thisPatch = &patch;
-
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex);
-
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+1);
-                }
-            }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
-            }
-            else if (x == cPatchVertexWidth)
-            {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
-            }
-            else // (y == patchHeight)
-            {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
-            }
-
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
-
-            manual->position(pos);
-            manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
-
-            // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-// Opensim:             manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
-
-            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
-
-            ++curIndex;
-        }
+    // The vertices are already in the patch node space, see TerrainPatchBuilder::Result.
+    for(size_t i = 0; i < numVertices; ++i)
+    {
+        const float *v = &result.vertices[i * cVertexSize];
+        manual->position(v[0], v[1], v[2]);
+        manual->normal(v[3], v[4], v[5]);
+        manual->textureCoord(v[6], v[7]);
+        manual->textureCoord(v[8], v[9]);
+    }
+    for(size_t i = 0; i < result.indices.size(); ++i)
+        manual->index(result.indices[i]);
 
     manual->end();
 
@@ -1375,8 +1787,92 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
     node->detachAllObjects();
     // Now attach the new built terrain mesh.
     node->attachObject(patch.entity);
+}
 
-    patch.patch_geometry_dirty = false;
+Ogre::Sphere EC_Terrain::PatchBoundingSphere(const Patch &patch) const
+{
+    const float halfSize = cPatchSize * 0.5f;
+    const float halfHeight = (patch.maxHeight - patch.minHeight) * 0.5f;
+    Ogre::Vector3 center(patch.x * cPatchSize + halfSize, patch.minHeight + halfHeight, patch.y * cPatchSize + halfSize);
+    float radius = Ogre::Math::Sqrt(2.f * halfSize * halfSize + halfHeight * halfHeight);
+    if (rootNode)
+    {
+        center = rootNode->_getFullTransform() * center;
+        const Ogre::Vector3 &scale = rootNode->_getDerivedScale();
+        radius *= max(max(Ogre::Math::Abs(scale.x), Ogre::Math::Abs(scale.y)), Ogre::Math::Abs(scale.z));
+    }
+    return Ogre::Sphere(center, radius);
+}
+
+int EC_Terrain::LodLevelForScreenSize(float screenSize) const
+{
+    // The projected vertex spacing of a patch at level k is roughly screenSize * 2^k / cPatchSize.
+    const float maxError = lodScreenError.Get();
+    int level = 0;
+    while(level < cMaxLodLevel && screenSize * (1 << (level + 1)) <= maxError * cPatchSize)
+        ++level;
+    return level;
+}
+
+void EC_Terrain::UpdatePatchLodLevels()
+{
+    if (lodScreenError.Get() <= 0.f || world_.expired() || !rootNode)
+        return;
+    Ogre::Camera *camera = world_.lock()->LodCamera();
+    if (!camera)
+        return;
+
+    PROFILE(EC_Terrain_UpdatePatchLodLevels);
+
+    // Hysteresis: only coarsen a patch once it is clearly smaller on screen, so that patches at a level boundary don't flip back and forth.
+    const float cCoarsenFactor = 1.25f;
+    for(int y = 0; y < patchHeight; ++y)
+        for(int x = 0; x < patchWidth; ++x)
+        {
+            EC_Terrain::Patch &patch = GetPatch(x, y);
+            if (!patch.buildGeneration || patch.patch_geometry_dirty)
+                continue; // Not built, or waiting for RegenerateDirtyTerrainPatches
+            float screenSize = OgreWorld::ScreenSize(camera, PatchBoundingSphere(patch));
+            int level = LodLevelForScreenSize(screenSize);
+            if (level > patch.lodLevel)
+                level = max(patch.lodLevel, LodLevelForScreenSize(screenSize * cCoarsenFactor));
+            if (level != patch.lodLevel)
+            {
+                patch.lodLevel = level;
+                QueuePatchBuild(x, y);
+            }
+        }
+}
+
+void EC_Terrain::OnUpdated(float frameTime)
+{
+    if (!patchBuilder)
+        return;
+
+    PROFILE(EC_Terrain_OnUpdated);
+
+    patchBuilder->TakeResults(builtPatches);
+    if (!builtPatches.empty())
+    {
+        // Spread the uploads over several frames, so that loading a large terrain does not stall the rendering.
+        for(int i = 0; i < cMaxPatchUploadsPerFrame && !builtPatches.empty(); ++i)
+        {
+            UploadPatchGeometry(builtPatches.front());
+            builtPatches.pop_front();
+        }
+
+        // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
+        // we need to hide all newly created geometry.
+        AttachTerrainRootNode();
+    }
+
+    lodUpdateTimer -= frameTime;
+    if (lodUpdateTimer <= 0.f)
+    {
+        const float cLodUpdateInterval = 0.25f;
+        lodUpdateTimer = cLodUpdateInterval;
+        UpdatePatchLodLevels();
+    }
 }
 
 void EC_Terrain::CreateRootNode()
@@ -1462,12 +1958,16 @@ void EC_Terrain::DirtyAllTerrainPatches()
 {
     for(size_t i = 0; i < patches.size(); ++i)
         patches[i].patch_geometry_dirty = true;
+    heightPyramid.clear();
 }
 
 void EC_Terrain::RegenerateDirtyTerrainPatches()
 {
     PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
 
+    // The patch heights may also have been edited directly.
+    heightPyramid.clear();
+
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
         {
@@ -1498,12 +1998,10 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
             }
 
             if (neighborsLoaded)
-                GenerateTerrainGeometryForOnePatch(x, y);
+                QueuePatchBuild(x, y);
         }
-    
-    // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
-    // we need to hide all newly created geometry.
-    AttachTerrainRootNode();
+
+    // The geometry is generated in the background and attached to the scene in OnUpdated.
 
     ///\todo If this terrain only exists for physics heightfield purposes, don't create GPU resources for it at all.
 
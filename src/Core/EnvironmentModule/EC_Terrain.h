@@ -5,13 +5,16 @@
 #include "EnvironmentModuleApi.h"
 #include "IComponent.h"
 #include "Math/float3.h"
+#include "Math/float3x4.h"
+#include "Math/Ray.h"
 #include "Transform.h"
 #include "AssetReference.h"
 #include "AssetFwd.h"
 #include "AssetRefListener.h"
 #include "OgreModuleFwd.h"
+#include "TerrainPatchBuilder.h"
 
-namespace Ogre { class Matrix4; }
+namespace Ogre { class Matrix4; class Sphere; }
 
 /// Adds a heightmap-based terrain to the scene.
 /**
@@ -35,8 +38,14 @@ Registered by Environment::EnvironmentModule.
 <div>The number of patches to generate in the terrain in the vertical direction, in the range [0, 256].</div>
 <li>QString: material
 <div>Specifies the material to use when rendering the terrain.</div> 
+<li>float: lodScreenError
+<div>The largest allowed on-screen vertex spacing of a terrain patch, as a fraction of the view height. Patches far enough from the camera
+are rendered with every 2nd, 4th, 8th or 16th vertex, and skirts along the patch edges hide the cracks between patches of different detail.
+0 renders all patches at full detail.</div>
 </ul>
 
+The patch geometry is generated on worker threads and uploaded to Ogre on the main thread over the following frames.
+
 Note that the way the textures are used depends completely on the material. For example, the default height-based terrain material "Rex/TerrainPCF"
 only uses the texture channels 0-3, and blends between those based on the terrain height values.
 
@@ -78,21 +87,28 @@ public:
     Q_PROPERTY(AssetReference heightMap READ getheightMap WRITE setheightMap);
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, heightMap);
 
+    Q_PROPERTY(float lodScreenError READ getlodScreenError WRITE setlodScreenError);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodScreenError);
+
     /// Returns the minimum and maximum extents of terrain heights.
     void GetTerrainHeightRange(float &minHeight, float &maxHeight) const;
 
     /// Each patch is a square containing this many vertices per side.
-    static const int cPatchSize = 16;
+    static const int cPatchSize = TerrainPatchBuilder::cPatchSize;
+
+    /// The coarsest patch level of detail, which renders every (1 << cMaxLodLevel)th vertex.
+    static const int cMaxLodLevel = 4;
 
     /// Describes a single patch that is present in the scene.
     /** A patch can be in one of the following three states:
         - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
         - heightmap data loaded. The heightData vector contains the heightmap data, but the visible GPU vertex data itself has not been generated yet, due to the neighbors
           of this patch not being present yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
-        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
+        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources.
+        The GPU data is generated in the background, so a patch may keep its old geometry for a few frames after it has been regenerated. */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true), lodLevel(0), buildGeneration(0), minHeight(0.f), maxHeight(0.f) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         int x;
@@ -118,6 +134,16 @@ public:
         /// in yet.
         bool patch_geometry_dirty;
 
+        /// Level of detail of the GPU geometry, or of the geometry being generated.
+        int lodLevel;
+
+        /// Identifies the latest geometry generation request, so that the results of older requests are discarded. 0 if none.
+        uint buildGeneration;
+
+        /// Height range of the patch when its geometry was last generated, for the level of detail selection.
+        float minHeight;
+        float maxHeight;
+
         /// Call only when you've checked that this patch has been loaded in.
         float GetHeightValue(int x, int y) const { return heightData[y*cPatchSize+x]; }
     };
@@ -151,6 +177,23 @@ public:
 
     float3 CalculateNormal(int mapX, int mapY) const { return CalculateNormal( (int) mapX / cPatchSize, (int) mapY / cPatchSize, mapX % cPatchSize, mapY % cPatchSize); }
 
+    /// Computes the interpolated heights, and optionally the triangle plane normals, at a batch of map coordinates in local space.
+    /** Gives the same heights as GetInterpolatedHeightValue, four points at a time with SSE when available.
+        Coordinates outside the map are clamped to the map edges. Does not need any Ogre resources.
+        @param x Map X coordinates of the points, count values.
+        @param y Map Y coordinates of the points, count values.
+        @param heights [out] Receives count heights.
+        @param normals [out] If not null, receives 3*count floats: the local space plane normals of the triangles under the points. */
+    void GetInterpolatedHeights(const float *x, const float *y, int count, float *heights, float *normals = 0) const;
+
+    /// Casts a ray against the heightfield in local space.
+    /** Skips the empty parts of the terrain using a min/max height pyramid over the patches, and marches the cells of the patches
+        whose bounds the ray hits. Does not need any Ogre resources.
+        @param direction Ray direction. Need not be normalized; the distance is measured in multiples of it.
+        @param distance [out] Distance to the hit point along the ray, if hit.
+        @return True if the ray hits the terrain within maxDistance. */
+    bool RaycastLocal(const float3 &origin, const float3 &direction, float maxDistance, float &distance) const;
+
 public slots:
     /// Returns true if the given patch exists, i.e. whether the given coordinates are within the current terrain patch dimensions.
     /** This function does not tell whether the data for the patch is actually loaded on the CPU or the GPU. */
@@ -226,6 +269,26 @@ public slots:
     /// The normal is returned in *world* space.
     float3 GetInterpolatedNormal(float x, float y) const;
 
+    /// Returns the local->world transform of the terrain.
+    /** Uses the Ogre scene node if there is one, and otherwise the transform of the parent placeable, so this works also on servers
+        without rendering. */
+    float3x4 WorldTransform() const;
+
+    /// Returns the world space terrain heights at a batch of world space points.
+    /** The terrain is assumed not to be tilted, ie. the heights are measured along the local up axis of the terrain through the points.
+        @param xz World X and Z coordinates of the points, [x0, z0, x1, z1, ...].
+        @return The world Y coordinates of the terrain surface at the points. */
+    QVariantList GetHeights(const QVariantList &xz) const;
+
+    /// Returns the world space triangle plane normals of the terrain at a batch of world space points.
+    /** @param xz World X and Z coordinates of the points, [x0, z0, x1, z1, ...].
+        @return The normals, [x0, y0, z0, x1, y1, z1, ...]. */
+    QVariantList GetNormals(const QVariantList &xz) const;
+
+    /// Casts a world space ray against the terrain. Does not need any Ogre resources.
+    /** @return The distance to the hit point along the ray, or -1 if the ray does not hit the terrain within maxDistance. */
+    float Raycast(const Ray &ray, float maxDistance = FLOAT_INF) const;
+
     /// Helper function, which returns for given world coordinate point terrain rotation in Euler angles. 
     /// @note This assumes that "mesh" which is rotation for terrain is searched is orginally authored to look -y - axis.
     /// \todo This function will be deleted.
@@ -326,6 +389,8 @@ public slots:
     /// Marks all terrain patches dirty.
     void DirtyAllTerrainPatches();
 
+    /// Regenerates the geometry of the dirty patches. Call this also after editing Patch::heightData directly, so that the
+    /// raycasts see the new heights.
     void RegenerateDirtyTerrainPatches();
 
     /// Returns the minimum height value in the whole terrain.
@@ -344,6 +409,9 @@ private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
 
+    /// Uploads the generated patch geometry and updates the patch levels of detail.
+    void OnUpdated(float frameTime);
+
     /// Emitted when some of the attributes has been changed.
     void OnAttributeUpdated(IAttribute *attribute);
 
@@ -377,7 +445,64 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(int index, const char *textureName);
 
-    void GenerateTerrainGeometryForOnePatch(int patchX, int patchY);
+    /// Queues the geometry of the given patch for generation at its current level of detail. The neighbors of the patch must be loaded.
+    void QueuePatchBuild(int patchX, int patchY);
+
+    /// Creates the Ogre mesh of a patch from generated geometry, replacing the old one. Stale results are ignored.
+    void UploadPatchGeometry(const TerrainPatchBuilder::Result &result);
+
+    /// Returns the world space bounding sphere of a patch, from the height range of its last generated geometry.
+    Ogre::Sphere PatchBoundingSphere(const Patch &patch) const;
+
+    /// Returns the level of detail for a patch of the given screen size, see OgreWorld::ScreenSize.
+    int LodLevelForScreenSize(float screenSize) const;
+
+    /// Selects the level of detail of each patch by its screen size, and queues the patches whose level changed for regeneration.
+    void UpdatePatchLodLevels();
+
+    /// Maximum number of generated patches uploaded to Ogre per frame
+    static const int cMaxPatchUploadsPerFrame = 64;
+
+    /// Height bounds of the terrain at one level of the raycast pyramid.
+    struct HeightPyramidLevel
+    {
+        int width;
+        int height;
+        std::vector<float> minHeight;
+        std::vector<float> maxHeight;
+    };
+
+    /// Builds the min/max height pyramid, if it has been invalidated.
+    void UpdateHeightPyramid() const;
+
+    /// Raycasts the terrain under one pyramid node, nearest children first. See RaycastLocal.
+    bool RaycastPyramidNode(int level, int nodeX, int nodeY, const float3 &origin, const float3 &direction, float tMin, float tMax, float &distance) const;
+
+    /// Raycasts the cells of one patch by walking them along the ray. See RaycastLocal.
+    bool RaycastPatchCells(int patchX, int patchY, const float3 &origin, const float3 &direction, float tMin, float tMax, float &distance) const;
+
+    /// Returns the height at the given vertex, or 0 if its patch is not loaded. Does not clamp.
+    float HeightAt(int x, int y) const
+    {
+        const Patch &patch = patches[(y / cPatchSize) * patchWidth + x / cPatchSize];
+        return patch.heightData.empty() ? 0.f : patch.heightData[(y % cPatchSize) * cPatchSize + x % cPatchSize];
+    }
+
+    /// Min/max heights for raycasts. Level 0 has a node per patch, including its seams to the next patches, and each following level
+    /// merges 2x2 nodes. Empty if invalidated by a height change, rebuilt on demand.
+    mutable std::vector<HeightPyramidLevel> heightPyramid;
+
+    /// Generates the patch geometry in the background. Null if the terrain is not rendered.
+    boost::shared_ptr<TerrainPatchBuilder> patchBuilder;
+
+    /// Generated patches waiting for upload.
+    std::list<TerrainPatchBuilder::Result> builtPatches;
+
+    /// Source of the patch build generations.
+    uint lastBuildGeneration;
+
+    /// Time until the next level of detail update.
+    float lodUpdateTimer;
 
     boost::shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -0,0 +1,233 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TerrainPatchBuilder.h"
+#include "Math/float3.h"
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+/// Returns the vertex coordinates sampled along one patch axis at the given step.
+/** The last column or row of the terrain has no seam to a next patch, so it ends at cPatchSize-1 instead of cPatchSize. */
+static void SampleCoordinates(int step, bool last, std::vector<int> &dst)
+{
+    for(int c = 0; c < TerrainPatchBuilder::cPatchSize; c += step)
+        dst.push_back(c);
+    int end = last ? TerrainPatchBuilder::cPatchSize - 1 : TerrainPatchBuilder::cPatchSize;
+    if (end > dst.back())
+        dst.push_back(end);
+}
+
+/// Returns the height of a vertex relative to the patch corner, in the range [-1, cPatchSize+1].
+static inline float Height(const TerrainPatchBuilder::Job &job, int x, int y)
+{
+    return job.heights[(y + 1) * TerrainPatchBuilder::cGridSize + x + 1];
+}
+
+static void AddVertex(const TerrainPatchBuilder::Job &job, int x, int y, std::vector<float> &dst)
+{
+    const int mapX = job.patchX * TerrainPatchBuilder::cPatchSize + x;
+    const int mapY = job.patchY * TerrainPatchBuilder::cPatchSize + y;
+
+    // Same as EC_Terrain::CalculateNormal. The heights outside the terrain are clamped to the edge.
+    float xSlope = Height(job, x - 1, y) - Height(job, x + 1, y);
+    if (mapX <= 0 || mapX >= job.verticesWidth)
+        xSlope *= 2;
+    float ySlope = Height(job, x, y - 1) - Height(job, x, y + 1);
+    if (mapY <= 0 || mapY >= job.verticesHeight)
+        ySlope *= 2;
+    float3 normal = float3(xSlope, 2.f, ySlope).Normalized();
+
+    // Heightmap X & Y correspond to X & Z in the patch node space, while height is Y
+    dst.push_back((float)x);
+    dst.push_back(Height(job, x, y));
+    dst.push_back((float)y);
+    dst.push_back(normal.x);
+    dst.push_back(normal.y);
+    dst.push_back(normal.z);
+    // The UV set 0 contains the diffuse texture UV map, a planar mapping with the specified UV scale.
+    dst.push_back(mapX * job.uScale);
+    dst.push_back(mapY * job.vScale);
+    // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+    dst.push_back((float)mapX / (job.verticesWidth - 1));
+    dst.push_back((float)mapY / (job.verticesHeight - 1));
+}
+
+/// Adds a skirt hanging down from the given edge vertices. The edge must be traversed counterclockwise when seen from above.
+static void AddSkirt(const std::vector<u32> &edge, float depth, TerrainPatchBuilder::Result &result)
+{
+    const int cVertexSize = TerrainPatchBuilder::cVertexSize;
+    const u32 firstSkirtVertex = (u32)(result.vertices.size() / cVertexSize);
+    for(size_t i = 0; i < edge.size(); ++i)
+    {
+        float vertex[TerrainPatchBuilder::cVertexSize];
+        std::copy(result.vertices.begin() + edge[i] * cVertexSize, result.vertices.begin() + (edge[i] + 1) * cVertexSize, vertex);
+        vertex[1] -= depth;
+        result.vertices.insert(result.vertices.end(), vertex, vertex + cVertexSize);
+    }
+    for(u32 i = 0; i + 1 < (u32)edge.size(); ++i)
+    {
+        const u32 skirt = firstSkirtVertex + i;
+        result.indices.push_back(edge[i]);
+        result.indices.push_back(edge[i+1]);
+        result.indices.push_back(skirt);
+
+        result.indices.push_back(edge[i+1]);
+        result.indices.push_back(skirt + 1);
+        result.indices.push_back(skirt);
+    }
+}
+
+/// Moves a job without copying its heights.
+static void MoveJob(TerrainPatchBuilder::Job &src, TerrainPatchBuilder::Job &dst)
+{
+    std::vector<float> heights;
+    heights.swap(src.heights);
+    dst = src;
+    dst.heights.swap(heights);
+}
+
+/// Moves a result without copying its geometry.
+static void MoveResult(TerrainPatchBuilder::Result &src, TerrainPatchBuilder::Result &dst)
+{
+    std::vector<float> vertices;
+    std::vector<u32> indices;
+    vertices.swap(src.vertices);
+    indices.swap(src.indices);
+    dst = src;
+    dst.vertices.swap(vertices);
+    dst.indices.swap(indices);
+}
+
+TerrainPatchBuilder::TerrainPatchBuilder() :
+    quit_(false)
+{
+    // Leave one core for the main thread
+    int numThreads = std::max((int)boost::thread::hardware_concurrency() - 1, 1);
+    for(int i = 0; i < numThreads; ++i)
+        workers_.create_thread(boost::bind(&TerrainPatchBuilder::ThreadMain, this));
+}
+
+TerrainPatchBuilder::~TerrainPatchBuilder()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        quit_ = true;
+        jobs_.clear();
+    }
+    jobAvailable_.notify_all();
+    workers_.join_all();
+}
+
+void TerrainPatchBuilder::Build(Job &job)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        jobs_.push_back(Job());
+        MoveJob(job, jobs_.back());
+    }
+    jobAvailable_.notify_one();
+}
+
+void TerrainPatchBuilder::TakeResults(std::list<Result> &dst)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    dst.splice(dst.end(), results_);
+}
+
+void TerrainPatchBuilder::ThreadMain()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while(jobs_.empty() && !quit_)
+                jobAvailable_.wait(lock);
+            if (quit_)
+                return;
+            MoveJob(jobs_.front(), job);
+            jobs_.pop_front();
+        }
+
+        Result result;
+        BuildPatch(job, result);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        results_.push_back(Result());
+        MoveResult(result, results_.back());
+    }
+}
+
+void TerrainPatchBuilder::BuildPatch(const Job &job, Result &result)
+{
+    result.patchX = job.patchX;
+    result.patchY = job.patchY;
+    result.lodLevel = job.lodLevel;
+    result.generation = job.generation;
+    result.vertices.clear();
+    result.indices.clear();
+    if ((int)job.heights.size() < cGridSize * cGridSize)
+        return;
+
+    std::vector<int> columns;
+    std::vector<int> rows;
+    SampleCoordinates(1 << job.lodLevel, job.lastColumn, columns);
+    SampleCoordinates(1 << job.lodLevel, job.lastRow, rows);
+    const u32 numColumns = (u32)columns.size();
+    const u32 numRows = (u32)rows.size();
+
+    result.vertices.reserve((numColumns + 2) * (numRows + 2) * cVertexSize);
+    for(u32 y = 0; y < numRows; ++y)
+        for(u32 x = 0; x < numColumns; ++x)
+            AddVertex(job, columns[x], rows[y], result.vertices);
+
+    result.indices.reserve(((numColumns - 1) * (numRows - 1) + 2 * (numColumns + numRows)) * 6);
+    for(u32 y = 0; y + 1 < numRows; ++y)
+        for(u32 x = 0; x + 1 < numColumns; ++x)
+        {
+            // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+            const u32 i = y * numColumns + x;
+            result.indices.push_back(i + numColumns);
+            result.indices.push_back(i + 1);
+            result.indices.push_back(i);
+
+            result.indices.push_back(i + numColumns);
+            result.indices.push_back(i + numColumns + 1);
+            result.indices.push_back(i + 1);
+        }
+
+    if (!job.skirts)
+        return;
+
+    // The skirts must reach below the neighbor patch edges at any level of detail, so hang them by the height range of the patch
+    float minHeight = Height(job, 0, 0);
+    float maxHeight = minHeight;
+    for(int y = 0; y <= cPatchSize; ++y)
+        for(int x = 0; x <= cPatchSize; ++x)
+        {
+            minHeight = std::min(minHeight, Height(job, x, y));
+            maxHeight = std::max(maxHeight, Height(job, x, y));
+        }
+    const float depth = maxHeight - minHeight + 1.f;
+
+    std::vector<u32> edge;
+    for(u32 x = 0; x < numColumns; ++x)
+        edge.push_back(x);
+    AddSkirt(edge, depth, result);
+    edge.clear();
+    for(u32 y = 0; y < numRows; ++y)
+        edge.push_back(y * numColumns + numColumns - 1);
+    AddSkirt(edge, depth, result);
+    edge.clear();
+    for(u32 x = numColumns; x > 0; --x)
+        edge.push_back((numRows - 1) * numColumns + x - 1);
+    AddSkirt(edge, depth, result);
+    edge.clear();
+    for(u32 y = numRows; y > 0; --y)
+        edge.push_back((y - 1) * numColumns);
+    AddSkirt(edge, depth, result);
+}
@@ -0,0 +1,100 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <list>
+#include <vector>
+
+/// Generates the vertex and index data of EC_Terrain patches on worker threads.
+/** The worker threads only read the heights copied into each job, so the terrain may be edited while patches are being built.
+    The results are taken and uploaded to Ogre meshes on the main thread by EC_Terrain. */
+class TerrainPatchBuilder
+{
+public:
+    /// Number of vertices per patch side. Equals EC_Terrain::cPatchSize.
+    static const int cPatchSize = 16;
+
+    /// Number of height samples per side of Job::heights: the patch vertices, the seam to the next patches,
+    /// and a one-vertex border for the normals.
+    static const int cGridSize = cPatchSize + 3;
+
+    /// Number of floats per vertex in Result::vertices: position, normal, diffuse UV and blend mask UV.
+    static const int cVertexSize = 10;
+
+    /// Patch to build
+    struct Job
+    {
+        Job() : patchX(0), patchY(0), lodLevel(0), generation(0), lastColumn(false), lastRow(false),
+            verticesWidth(0), verticesHeight(0), uScale(1.f), vScale(1.f), skirts(false) {}
+
+        int patchX;
+        int patchY;
+        /// Level of detail. The patch is sampled at every (1 << lodLevel)th vertex
+        int lodLevel;
+        /// Build generation of the patch, returned in the result to detect stale results
+        uint generation;
+        /// Heights of the vertices from -1 to cPatchSize+1 relative to the patch corner, cGridSize*cGridSize values.
+        /// Vertices outside the terrain are clamped to the terrain edge.
+        std::vector<float> heights;
+        /// Is the patch at the last column of the terrain, ie. has no seam to a next patch in the X direction
+        bool lastColumn;
+        /// Is the patch at the last row of the terrain, ie. has no seam to a next patch in the Y direction
+        bool lastRow;
+        /// Number of vertices in the whole terrain in the X direction
+        int verticesWidth;
+        /// Number of vertices in the whole terrain in the Y direction
+        int verticesHeight;
+        /// Diffuse texture UV scale
+        float uScale;
+        float vScale;
+        /// Whether to generate skirts along the patch edges, to hide the cracks between patches of different level of detail
+        bool skirts;
+    };
+
+    /// Built patch
+    struct Result
+    {
+        int patchX;
+        int patchY;
+        int lodLevel;
+        uint generation;
+        /// Interleaved vertex data, cVertexSize floats per vertex
+        std::vector<float> vertices;
+        /// Triangle list indices
+        std::vector<u32> indices;
+    };
+
+    /// Starts the worker threads.
+    TerrainPatchBuilder();
+
+    /// Stops the worker threads. Jobs not yet started are discarded.
+    ~TerrainPatchBuilder();
+
+    /// Queues a patch for building. The heights of the job are moved into the queue.
+    void Build(Job &job);
+
+    /// Moves the results of the jobs finished since the last call to the end of dst.
+    void TakeResults(std::list<Result> &dst);
+
+    /// Builds a patch in the calling thread.
+    static void BuildPatch(const Job &job, Result &result);
+
+private:
+    /// Worker thread entry point.
+    void ThreadMain();
+
+    boost::thread_group workers_;
+    boost::mutex mutex_;
+    boost::condition_variable jobAvailable_;
+    /// Queued jobs. Protected by mutex_
+    std::list<Job> jobs_;
+    /// Finished results. Protected by mutex_
+    std::list<Result> results_;
+    /// Set when the worker threads should exit. Protected by mutex_
+    bool quit_;
+};
@@ -10,8 +10,14 @@
 #include <QSettings>
 #include <QString>
 #include <QDir>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QCryptographicHash>
+#include <QThread>
 #include <QDebug>
 
+#include <boost/bind.hpp>
+
 QString ConfigAPI::FILE_FRAMEWORK = "tundra";
 QString ConfigAPI::SECTION_FRAMEWORK = "framework";
 QString ConfigAPI::SECTION_SERVER = "server";
@@ -21,8 +27,29 @@ QString ConfigAPI::SECTION_UI = "ui";
 
 ConfigAPI::ConfigAPI(Framework *framework) :
     QObject(framework),
-    framework_(framework)
+    framework_(framework),
+    writeScheduled_(false),
+    watcher_(new QFileSystemWatcher(this)),
+    quit_(false)
 {
+    writeTimer_.setSingleShot(true);
+    connect(&writeTimer_, SIGNAL(timeout()), SLOT(QueueWrites()));
+    connect(watcher_, SIGNAL(fileChanged(const QString &)), SLOT(HandleFileChanged(const QString &)));
+}
+
+ConfigAPI::~ConfigAPI()
+{
+    writeTimer_.stop();
+    QueueWrites();
+    if (writer_.joinable())
+    {
+        {
+            boost::mutex::scoped_lock lock(writeMutex_);
+            quit_ = true;
+        }
+        writeAvailable_.notify_all();
+        writer_.join();
+    }
 }
 
 void ConfigAPI::PrepareDataFolder(QString configFolder)
@@ -57,6 +84,18 @@ QString ConfigAPI::GetFilePath(const QString &file) const
 
 void ConfigAPI::PrepareString(QString &str) const
 {
+    // Most strings are already prepared, so check for that first without allocating.
+    const int length = str.length();
+    bool prepared = true;
+    for(int i = 0; i < length && prepared; ++i)
+    {
+        const QChar c = str.at(i);
+        if (c.isUpper() || c == ' ' || c == '=' || c == '/' || ((i == 0 || i == length-1) && c.isSpace()))
+            prepared = false;
+    }
+    if (prepared)
+        return;
+
     if (!str.isEmpty())
     {
         str = str.trimmed().toLower();  // Remove spaces from start/end, force to lower case
@@ -98,10 +137,11 @@ bool ConfigAPI::HasValue(QString file, QString section, QString key) const
     PrepareString(section);
     PrepareString(key);
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
+    boost::mutex::scoped_lock lock(filesMutex_);
+    ConfigFile &config = GetConfigFile(GetFilePath(file));
     if (!section.isEmpty())
         key = section + "/" + key;
-    return config.allKeys().contains(key) == true;
+    return config.values.contains(key);
 }
 
 QVariant ConfigAPI::Get(const ConfigData &data) const
@@ -139,11 +179,10 @@ QVariant ConfigAPI::Get(QString file, QString section, QString key, const QVaria
     PrepareString(section);
     PrepareString(key);
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (section.isEmpty())
-        return config.value(key, defaultValue);
-    else
-        return config.value(section + "/" + key, defaultValue);
+    boost::mutex::scoped_lock lock(filesMutex_);
+    ConfigFile &config = GetConfigFile(GetFilePath(file));
+    QHash<QString, QVariant>::const_iterator iter = config.values.find(section.isEmpty() ? key : section + "/" + key);
+    return iter != config.values.end() ? iter.value() : defaultValue;
 }
 
 void ConfigAPI::Set(const ConfigData &data)
@@ -178,12 +217,164 @@ void ConfigAPI::Set(QString file, QString section, QString key, const QVariant &
     PrepareString(section);
     PrepareString(key);
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (!config.isWritable())
+    boost::mutex::scoped_lock lock(filesMutex_);
+    ConfigFile &config = GetConfigFile(GetFilePath(file));
+    if (!section.isEmpty())
+        key = section + "/" + key;
+    config.values[key] = value;
+    config.changedValues[key] = value;
+    if (!writeScheduled_)
+    {
+        writeScheduled_ = true;
+        // The timer can only be started on the main thread.
+        if (QThread::currentThread() == thread())
+            writeTimer_.start(cWriteDelay);
+        else
+            QMetaObject::invokeMethod(&writeTimer_, "start", Qt::QueuedConnection, Q_ARG(int, cWriteDelay));
+    }
+}
+
+void ConfigAPI::Flush()
+{
+    // If called on another thread, the timer fires later and finds nothing to write.
+    if (QThread::currentThread() == thread())
+        writeTimer_.stop();
+    QueueWrites();
+
+    boost::mutex::scoped_lock lock(writeMutex_);
+    while(!writeJobs_.empty() || !writingFile_.isEmpty())
+        writesDone_.wait(lock);
+}
+
+ConfigAPI::ConfigFile &ConfigAPI::GetConfigFile(const QString &filePath) const
+{
+    QHash<QString, ConfigFile>::iterator iter = files_.find(filePath);
+    if (iter != files_.end())
+        return iter.value();
+
+    ConfigFile &file = files_[filePath];
+    ReadFile(filePath, file);
+    return file;
+}
+
+void ConfigAPI::ReadFile(const QString &filePath, ConfigFile &file) const
+{
+    FileStamp stamp = ReadFileStamp(filePath);
+    {
+        boost::mutex::scoped_lock lock(writeMutex_);
+        stamps_[filePath] = stamp;
+    }
+
+    file.values.clear();
+    QSettings config(filePath, QSettings::IniFormat);
+    foreach(const QString &key, config.allKeys())
+        file.values[key] = config.value(key);
+    // The values not yet written override the values in the file.
+    for(QHash<QString, QVariant>::const_iterator iter = file.changedValues.begin(); iter != file.changedValues.end(); ++iter)
+        file.values[iter.key()] = iter.value();
+
+    // The watcher is only used on the main thread. Files first read on other threads are added when the main thread reads them again.
+    if (QThread::currentThread() == thread() && QFile::exists(filePath) && !watcher_->files().contains(filePath))
+        watcher_->addPath(filePath);
+}
+
+ConfigAPI::FileStamp ConfigAPI::ReadFileStamp(const QString &filePath)
+{
+    FileStamp stamp;
+    QFile file(filePath);
+    if (file.open(QIODevice::ReadOnly))
+    {
+        QByteArray contents = file.readAll();
+        stamp.size = contents.size();
+        stamp.hash = QCryptographicHash::hash(contents, QCryptographicHash::Md5);
+    }
+    return stamp;
+}
+
+void ConfigAPI::QueueWrites()
+{
+    std::list<WriteJob> jobs;
+    boost::mutex::scoped_lock lock(filesMutex_);
+    writeScheduled_ = false;
+    for(QHash<QString, ConfigFile>::iterator iter = files_.begin(); iter != files_.end(); ++iter)
+    {
+        if (iter.value().changedValues.isEmpty())
+            continue;
+        jobs.push_back(WriteJob());
+        jobs.back().filePath = iter.key();
+        jobs.back().values = iter.value().changedValues;
+        iter.value().changedValues.clear();
+    }
+    if (jobs.empty())
         return;
-    if (section.isEmpty())
-        config.setValue(key, value);
-    else
-        config.setValue(section + "/" + key, value);
-    config.sync();
+
+    // The jobs are queued before releasing filesMutex_, so that HandleFileChanged does not read a file with its changes in between.
+    {
+        boost::mutex::scoped_lock writeLock(writeMutex_);
+        writeJobs_.splice(writeJobs_.end(), jobs);
+        if (!writer_.joinable())
+            writer_ = boost::thread(boost::bind(&ConfigAPI::WriterMain, this));
+    }
+    writeAvailable_.notify_one();
+}
+
+void ConfigAPI::WriterMain()
+{
+    boost::mutex::scoped_lock lock(writeMutex_);
+    for(;;)
+    {
+        while(writeJobs_.empty() && !quit_)
+            writeAvailable_.wait(lock);
+        if (writeJobs_.empty())
+            return;
+
+        WriteJob job = writeJobs_.front();
+        writeJobs_.pop_front();
+        writingFile_ = job.filePath;
+        lock.unlock();
+
+        QSettings config(job.filePath, QSettings::IniFormat);
+        if (config.isWritable())
+        {
+            for(QHash<QString, QVariant>::const_iterator iter = job.values.begin(); iter != job.values.end(); ++iter)
+                config.setValue(iter.key(), iter.value());
+            config.sync();
+        }
+        else
+            LogWarning("ConfigAPI: Could not write config file \"" + job.filePath + "\".");
+        FileStamp stamp = ReadFileStamp(job.filePath);
+
+        lock.lock();
+        stamps_[job.filePath] = stamp;
+        writingFile_.clear();
+        writesDone_.notify_all();
+    }
+}
+
+void ConfigAPI::HandleFileChanged(const QString &filePath)
+{
+    // Editors may replace the file, which removes it from the watcher.
+    if (QFile::exists(filePath) && !watcher_->files().contains(filePath))
+        watcher_->addPath(filePath);
+
+    boost::mutex::scoped_lock filesLock(filesMutex_);
+    QHash<QString, ConfigFile>::iterator iter = files_.find(filePath);
+    if (iter == files_.end())
+        return;
+
+    {
+        // Skip the changes made by the writer thread. A change by another program while a write is in progress is merged to
+        // the file by QSettings, but not read to memory.
+        boost::mutex::scoped_lock lock(writeMutex_);
+        if (writingFile_ == filePath)
+            return;
+        for(std::list<WriteJob>::const_iterator job = writeJobs_.begin(); job != writeJobs_.end(); ++job)
+            if (job->filePath == filePath)
+                return;
+        if (stamps_.value(filePath) == ReadFileStamp(filePath))
+            return;
+    }
+
+    LogInfo("ConfigAPI: Config file \"" + filePath + "\" was changed, reading it again.");
+    ReadFile(filePath, iter.value());
 }
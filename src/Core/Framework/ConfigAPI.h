@@ -5,7 +5,16 @@
 #include <QObject>
 #include <QVariant>
 #include <QString>
+#include <QHash>
+#include <QByteArray>
+#include <QTimer>
 
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <list>
+
+class QFileSystemWatcher;
 class Framework;
 
 /// Config info. A reusable config info for conviance so you can do less typin when dealing with constantly same config file/sections. QObject for script usage.
@@ -73,6 +82,11 @@ public slots:
 
     @note All file, key and section parameters are case insensitive. This means all of them are transformed to 
     lower case before any accessing files. "MyKey" will get and set you same value as "mykey".
+
+    The config files are parsed once, on first access, and kept in memory, so Get and HasValue are hash lookups.
+    Set changes the value in memory at once, and the changed values are written to the file in the background at most
+    cWriteDelay milliseconds later, so that many Set calls in a row write the file once. When a config file is changed
+    by another program, it is parsed again, keeping the values not yet written. The API can be used from any thread.
 */
 
 class ConfigAPI : public QObject
@@ -87,7 +101,13 @@ public:
     static QString SECTION_CLIENT;
     static QString SECTION_RENDERING;
     static QString SECTION_UI;
-    
+
+    /// Time in milliseconds from the first changed value to writing the changed values to the file.
+    static const int cWriteDelay = 1000;
+
+    /// Writes the changed values to the files.
+    ~ConfigAPI();
+
 public slots:
     /// Returns if a key is available in the config.
     /// @param data ConfigData. Filled ConfigData object.
@@ -149,6 +169,9 @@ public slots:
     /// @return QString. Absolute path to config storage folder.
     QString GetConfigFolder() const { return configFolder_; }
 
+    /// Writes the changed values to the files now, and waits until they have been written.
+    void Flush();
+
 private slots:
     /// Get absolute file path for file. Guarantees that it ends with .ini.
     QString GetFilePath(const QString &file) const;
@@ -156,7 +179,54 @@ private slots:
     /// Prepare string for config usage. Removes spaces from end and start, replaces mid string spaces with '_' and forces to lower case.
     void PrepareString(QString &str) const;
 
+    /// Queues the changed values of all files for writing.
+    void QueueWrites();
+
+    /// Parses a config file again when it has been changed by another program.
+    void HandleFileChanged(const QString &filePath);
+
 private:
+    /// Config file kept in memory.
+    struct ConfigFile
+    {
+        /// Values by "section/key", or by key for values outside sections
+        QHash<QString, QVariant> values;
+        /// Values changed since the last write
+        QHash<QString, QVariant> changedValues;
+    };
+
+    /// Changed values to write to a file
+    struct WriteJob
+    {
+        QString filePath;
+        QHash<QString, QVariant> values;
+    };
+
+    /// Size and content hash of a config file, for telling apart the changes made by other programs.
+    /** The modification time is not used, as it has a resolution of a second on many file systems. */
+    struct FileStamp
+    {
+        FileStamp() : size(-1) {}
+        /// File size, or -1 if the file does not exist
+        qint64 size;
+        /// MD5 hash of the file contents
+        QByteArray hash;
+
+        bool operator ==(const FileStamp &rhs) const { return size == rhs.size && hash == rhs.hash; }
+    };
+
+    /// Returns the config file at an absolute path, parsing it if it is not in memory yet. The caller must hold filesMutex_.
+    ConfigFile &GetConfigFile(const QString &filePath) const;
+
+    /// Reads the values of a config file. The caller must hold filesMutex_.
+    void ReadFile(const QString &filePath, ConfigFile &file) const;
+
+    /// Returns the size and content hash of a file.
+    static FileStamp ReadFileStamp(const QString &filePath);
+
+    /// Writer thread entry point.
+    void WriterMain();
+
     Q_DISABLE_COPY(ConfigAPI)
     friend class Framework;
 
@@ -174,4 +244,28 @@ private:
     /// Absolute path to the folder where to store the config files.
     QString configFolder_;
 
+    /// Protects files_ and writeScheduled_. Taken before writeMutex_ when both are held.
+    mutable boost::mutex filesMutex_;
+    /// Config files in memory by absolute path. Protected by filesMutex_
+    mutable QHash<QString, ConfigFile> files_;
+    /// Set when writeTimer_ has been started for the changed values. Protected by filesMutex_
+    bool writeScheduled_;
+    /// Watches the config files in memory for changes by other programs.
+    QFileSystemWatcher *watcher_;
+    /// Started by the first changed value, writes the changed values when it fires. Only accessed on the main thread.
+    QTimer writeTimer_;
+
+    boost::thread writer_;
+    mutable boost::mutex writeMutex_;
+    boost::condition_variable writeAvailable_;
+    boost::condition_variable writesDone_;
+    /// Queued writes. Protected by writeMutex_
+    std::list<WriteJob> writeJobs_;
+    /// File being written, or empty. Protected by writeMutex_
+    QString writingFile_;
+    /// Stamps of the files after they were last read or written by ConfigAPI. Protected by writeMutex_
+    mutable QHash<QString, FileStamp> stamps_;
+    /// Set when the writer thread should exit. Protected by writeMutex_
+    bool quit_;
+
 };
@@ -130,6 +130,14 @@ Framework::Framework(int argc, char** argv) :
     cmdLineDescs.commands["--protocol"] = "Start server with the specified protocol. Options: '--protocol tcp' and '--protocol udp'. Defaults to tcp if no protocol is spesified."; // KristalliProtocolModule
     cmdLineDescs.commands["--fpslimit"] = "Specifies the fps cap to use in rendering. Default: 60. Pass in 0 to disable"; // OgreRenderingModule
     cmdLineDescs.commands["--run"] = "Run script on startup"; // JavaScriptModule
+    cmdLineDescs.commands["--scriptenginepool"] = "Runs EC_Script instances in a pool of shared script engines, each script in its own scope, instead of one engine per script. Optionally specifies the number of engines per trust level, f.ex. '--scriptenginepool 8'. Default: 4. Scripts should disconnect their signal handlers in OnScriptDestroyed"; // JavaScriptModule
+    cmdLineDescs.commands["--scriptbudget"] = "Accounts the CPU time of each script and warns about scripts that exceed the given per-frame budget in milliseconds, f.ex. '--scriptbudget 5'. Default: 5. Use the JsTopScripts console command to list the scripts using the most time. Note: installs an agent to each script engine, which disables the script JIT compiler"; // JavaScriptModule
+    cmdLineDescs.commands["--scripthardlimit"] = "Aborts and unloads scripts whose single run exceeds the given time in milliseconds. Default: 1000. Runs are never aborted without this parameter. Note: installs an agent to each script engine, which disables the script JIT compiler"; // JavaScriptModule
+    cmdLineDescs.commands["--audiostreamthreshold"] = "Specifies the size in kilobytes above which Ogg Vorbis audio assets are streamed instead of being decoded when loaded, f.ex. '--audiostreamthreshold 512'. Default: 1024. Pass in 0 to decode all assets"; // AudioAPI
+    cmdLineDescs.commands["--audiomaxvoices"] = "Specifies the maximum number of sounds played back with an OpenAL source. The least audible sounds beyond the limit are tracked virtually without being mixed. Default: 32. Pass in 0 for no limit"; // AudioAPI
+    cmdLineDescs.commands["--audiothreshold"] = "Specifies the final gain below which sounds are tracked virtually without being mixed. Default: 0.001. Pass in 0 to mix all sounds within the voice limit"; // AudioAPI
+    cmdLineDescs.commands["--meshbatchcellsize"] = "Specifies the edge length in world units of the cells that EC_Mesh components with static batching enabled are merged into. Default: 100"; // OgreRenderingModule
+    cmdLineDescs.commands["--norender"] = "With --headless, creates no Ogre scene for the scenes, so that the scene graph is never updated. EC_Placeable world transforms are computed by a lightweight transform hierarchy instead. Components that need Ogre, f.ex. EC_Mesh, do nothing"; // OgreRenderingModule
     cmdLineDescs.commands["--file"] = "Load scene on startup. Accepts absolute and relative paths, local:// and http:// are accepted and fetched via the AssetAPI."; // TundraLogicModule & AssetModule
     cmdLineDescs.commands["--storage"] = "Adds the given directory as a local storage directory on startup"; // AssetModule
     cmdLineDescs.commands["--config"] = "Specifies the startup configration file to use. Multiple config files are supported, f.ex. '--config plugins.xml --config MyCustomAddons.xml"; // Framework
@@ -141,8 +149,11 @@ Framework::Framework(int argc, char** argv) :
     cmdLineDescs.commands["--clear-asset-cache"] = "At the start of Tundra, remove all data and metadata files from asset cache.";
     cmdLineDescs.commands["--loglevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'";
     cmdLineDescs.commands["--logfile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt";
+    cmdLineDescs.commands["--logjson"] = "Writes the log file as JSON lines, one object with 'time', 'level' and 'message' fields per message";
+    cmdLineDescs.commands["--lograte"] = "Specifies the maximum number of log lines written per second. The number of dropped lines is reported. Default: 0 (no limit)";
     cmdLineDescs.commands["--physicsrate"] = "Specifies the number of physics simulation steps per second. Default: 60"; // PhysicsModule
     cmdLineDescs.commands["--physicsmaxsteps"] = "Specifies the maximum number of physics simulation steps in one frame to limit CPU usage. If the limit would be exceeded, physics will appear to slow down. Default: 6"; // PhysicsModule
+    cmdLineDescs.commands["--avatarbuildsteps"] = "Specifies the maximum number of avatar appearance build steps (the body mesh, each attachment, and the morphs and bone modifiers) performed in one frame. Avatars waiting for their turn are shown as placeholders. Default: 8. Pass in 0 for no limit"; // AvatarModule
     
     if (HasCommandLineParameter("--help"))
     {
@@ -220,6 +231,8 @@ Framework::~Framework()
 #endif
     SAFE_DELETE(profilerQObj);
 
+    // Writes the pending config changes, so delete before the console to still see the possible errors.
+    SAFE_DELETE(config);
     SAFE_DELETE(console);
     SAFE_DELETE(scene);
     SAFE_DELETE(frame);
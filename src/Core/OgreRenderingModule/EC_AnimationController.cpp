@@ -7,6 +7,8 @@
 #include "Entity.h"
 #include "FrameAPI.h"
 #include "OgreRenderingModule.h"
+#include "OgreWorld.h"
+#include "Scene.h"
 #include "CoreStringUtils.h"
 #include "Profiler.h"
 
@@ -18,11 +20,24 @@
 
 using namespace OgreRenderer;
 
+/// Interval in seconds between the steps of frozen animations
+static const float cFrozenUpdateInterval = 0.5f;
+
 EC_AnimationController::EC_AnimationController(Scene* scene) :
     IComponent(scene),
     animationState(this, "Animation state", ""),
-    mesh(0)
-{
+    lodReducedSize(this, "LOD reduced rate size", 0.1f),
+    lodReducedInterval(this, "LOD reduced rate interval", 4),
+    lodFrozenSize(this, "LOD frozen size", 0.02f),
+    lodCullOffscreen(this, "LOD cull offscreen", true),
+    mesh(0),
+    pending_time_(0.0f),
+    skipped_frames_(0),
+    last_lod_(LOD_FULL)
+{
+    if (scene)
+        world_ = scene->GetWorld<OgreWorld>();
+
     ResetState();
     
     QObject::connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)));
@@ -35,7 +50,20 @@ EC_AnimationController::~EC_AnimationController()
 
 void EC_AnimationController::SetMeshEntity(EC_Mesh *new_mesh)
 {
+    if (mesh == new_mesh)
+        return;
+    if (mesh)
+        disconnect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshAboutToBeDestroyed()));
+    OnMeshAboutToBeDestroyed();
     mesh = new_mesh;
+    if (mesh)
+        connect(mesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnMeshAboutToBeDestroyed()));
+}
+
+void EC_AnimationController::OnMeshAboutToBeDestroyed()
+{
+    for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
+        i->second.animstate_ = 0;
 }
 
 QStringList EC_AnimationController::GetAvailableAnimations()
@@ -73,15 +101,44 @@ void EC_AnimationController::Update(float frametime)
     Ogre::Entity* entity = GetEntity();
     if (!entity) 
         return;
+    if (animations_.empty())
+    {
+        pending_time_ = 0.0f;
+        return;
+    }
     
     PROFILE(EC_AnimationController_Update);
+    
+    // Step the animations of small or offscreen meshes less often, with the time accumulated meanwhile.
+    // Skipping the step also skips the skeleton update of Ogre, as the animation states stay unchanged.
+    pending_time_ += frametime;
+    LodLevel lod = GetLodLevel(entity);
+    bool skip = false;
+    if (lod == LOD_REDUCED)
+        skip = ++skipped_frames_ < lodReducedInterval.Get();
+    else if (lod == LOD_FROZEN || lod == LOD_OFFSCREEN)
+        skip = pending_time_ < cFrozenUpdateInterval;
+    // Catch up immediately when the level of detail rises, f.ex. when the mesh comes into view
+    if (lod < last_lod_)
+        skip = false;
+    last_lod_ = lod;
+    
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        world->CountAnimationLod(lod, skip);
+    if (skip)
+        return;
+    
+    frametime = pending_time_;
+    pending_time_ = 0.0f;
+    skipped_frames_ = 0;
 
     std::vector<QString> erase_list;
     
     // Loop through all animations & update them as necessary
     for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
     {
-        Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+        Ogre::AnimationState* animstate = GetCachedAnimationState(entity, i);
         if (!animstate)
             continue;
             
@@ -234,7 +291,7 @@ void EC_AnimationController::Update(float frametime)
         // Loop through all high priority animations & update the lowpriority-blendmask based on their active tracks
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = GetCachedAnimationState(entity, i);
             if (!animstate)
                 continue;            
             // Create blend mask if animstate doesn't have it yet
@@ -269,7 +326,7 @@ void EC_AnimationController::Update(float frametime)
         // Now set the calculated blendmask on low-priority animations
         for(AnimationMap::iterator i = animations_.begin(); i != animations_.end(); ++i)
         {
-            Ogre::AnimationState* animstate = GetAnimationState(entity, i->first);
+            Ogre::AnimationState* animstate = GetCachedAnimationState(entity, i);
             if (!animstate)
                 continue;    
             if (i->second.high_priority_ == false)
@@ -330,6 +387,36 @@ Ogre::AnimationState* EC_AnimationController::GetAnimationState(Ogre::Entity* en
     return OgreAnimStateSetFindNoCase(entity->getAllAnimationStates(), name);
 }
 
+Ogre::AnimationState* EC_AnimationController::GetCachedAnimationState(Ogre::Entity* entity, AnimationMap::iterator animation)
+{
+    if (!animation->second.animstate_)
+        animation->second.animstate_ = GetAnimationState(entity, animation->first);
+    return animation->second.animstate_;
+}
+
+EC_AnimationController::LodLevel EC_AnimationController::GetLodLevel(Ogre::Entity* entity)
+{
+    OgreWorldPtr world = world_.lock();
+    Ogre::Camera* camera = world ? world->LodCamera() : 0;
+    if (!camera)
+        return LOD_FULL;
+    
+    if (lodCullOffscreen.Get() && (!entity->isInScene() || !entity->isVisible() || !camera->isVisible(entity->getWorldBoundingBox(true))))
+        return LOD_OFFSCREEN;
+    
+    float frozenSize = lodFrozenSize.Get();
+    float reducedSize = lodReducedSize.Get();
+    if (frozenSize <= 0.0f && reducedSize <= 0.0f)
+        return LOD_FULL;
+    
+    float screenSize = OgreWorld::ScreenSize(camera, entity->getWorldBoundingSphere(true));
+    if (screenSize < frozenSize)
+        return LOD_FROZEN;
+    if (screenSize < reducedSize)
+        return LOD_REDUCED;
+    return LOD_FULL;
+}
+
 bool EC_AnimationController::EnableExclusiveAnimation(const QString& name, bool looped, float fadein, float fadeout, bool high_priority)
 {
     // Disable all other active animations
@@ -366,6 +453,7 @@ bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, f
         i->second.num_repeats_ = (looped ? 0: 1);
         i->second.fade_period_ = fadein;
         i->second.high_priority_ = high_priority;
+        i->second.animstate_ = animstate;
         // If animation is nonlooped and has already reached end, rewind to beginning
         if ((!looped) && (i->second.speed_factor_ > 0.0f))
         {
@@ -383,6 +471,7 @@ bool EC_AnimationController::EnableAnimation(const QString& name, bool looped, f
     newanim.num_repeats_ = (looped ? 0: 1); // if looped, repeat 0 times (loop indefinetly) otherwise repeat one time.
     newanim.fade_period_ = fadein;
     newanim.high_priority_ = high_priority;
+    newanim.animstate_ = animstate;
 
     animations_[name] = newanim;
 
@@ -35,7 +35,18 @@ Registered by OgreRenderer::OgreRenderingModule.
 <div>Action execution type that is used for the Entity Actions.</div>
 <li>bool: modifiersEnabled.
 <div>Whether modifiers are checked for in the key events. Default true.</div>
+<li>float: lodReducedSize.
+<div>Screen size, as a fraction of the viewport height, below which the animations are stepped only every lodReducedInterval frames. 0 disables. Default 0.1.</div>
+<li>int: lodReducedInterval.
+<div>Number of frames between animation steps when the mesh is smaller than lodReducedSize. Default 4.</div>
+<li>float: lodFrozenSize.
+<div>Screen size, as a fraction of the viewport height, below which the animations are frozen. 0 disables. Default 0.02.</div>
+<li>bool: lodCullOffscreen.
+<div>Whether the animations are frozen when the mesh is outside the view of the active camera or hidden. Default true.</div>
 </ul>
+Frozen animations are still stepped twice a second with the accumulated time, so that their fades and AnimationFinished signals proceed.
+The skipped time is always applied on the next step, so the animations stay in sync regardless of the level of detail.
+Without an active camera, f.ex. when headless, the animations are stepped every frame.
 
 <b>Exposes the following scriptable functions:</b>
 <ul>
@@ -142,6 +153,31 @@ public:
      */
     Q_PROPERTY(QString animationState READ getanimationState WRITE setanimationState);
     DEFINE_QPROPERTY_ATTRIBUTE(QString, animationState);
+
+    /// Screen size, as a fraction of the viewport height, below which the animations are stepped only every lodReducedInterval frames. 0 disables.
+    Q_PROPERTY(float lodReducedSize READ getlodReducedSize WRITE setlodReducedSize);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodReducedSize);
+
+    /// Number of frames between animation steps when the mesh is smaller than lodReducedSize.
+    Q_PROPERTY(int lodReducedInterval READ getlodReducedInterval WRITE setlodReducedInterval);
+    DEFINE_QPROPERTY_ATTRIBUTE(int, lodReducedInterval);
+
+    /// Screen size, as a fraction of the viewport height, below which the animations are frozen. 0 disables.
+    Q_PROPERTY(float lodFrozenSize READ getlodFrozenSize WRITE setlodFrozenSize);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodFrozenSize);
+
+    /// Whether the animations are frozen when the mesh is outside the view of the active camera or hidden.
+    Q_PROPERTY(bool lodCullOffscreen READ getlodCullOffscreen WRITE setlodCullOffscreen);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, lodCullOffscreen);
+
+    /// Enumeration of animation level of detail, from the most to the least detailed
+    enum LodLevel
+    {
+        LOD_FULL = 0, ///< Stepped every frame
+        LOD_REDUCED, ///< Stepped every lodReducedInterval frames
+        LOD_FROZEN, ///< Frozen because of very small screen size
+        LOD_OFFSCREEN ///< Frozen because outside the view or hidden
+    };
         
     /// Enumeration of animation phase
     enum AnimationPhase
@@ -180,6 +216,9 @@ public:
         /// current phase
         AnimationPhase phase_;
 
+        /// Ogre animation state, looked up on first use. Reset when the Ogre entity is destroyed
+        Ogre::AnimationState* animstate_;
+
         Animation() :
             auto_stop_(false),
             fade_period_(0.0),
@@ -188,7 +227,8 @@ public:
             speed_factor_(1.0),
             num_repeats_(0),
             high_priority_(false),
-            phase_(PHASE_STOP)
+            phase_(PHASE_STOP),
+            animstate_(0)
         {
         }
     };
@@ -350,6 +390,8 @@ private slots:
     void UpdateSignals();
     /// Called when component has been removed from the parent entity. Checks if the component removed was the mesh, and autodissociates it.
     void OnComponentRemoved(IComponent* component, AttributeChange::Type change);
+    /// Called when the Ogre entity of the mesh is about to be destroyed. Forgets the cached animation states.
+    void OnMeshAboutToBeDestroyed();
     
 signals:
     /// Emitted when a non-looping animation has finished
@@ -369,6 +411,12 @@ private:
      */
     Ogre::AnimationState* GetAnimationState(Ogre::Entity* entity, const QString& name);
     
+    /// Gets the cached animationstate of an ongoing animation, looking it up from the Ogre entity if not cached yet
+    Ogre::AnimationState* GetCachedAnimationState(Ogre::Entity* entity, AnimationMap::iterator animation);
+    
+    /// Chooses the level of detail of the animations by the screen size and visibility of the Ogre entity
+    LodLevel GetLodLevel(Ogre::Entity* entity);
+    
     /// Resets internal state
     void ResetState();
     
@@ -386,5 +434,17 @@ private:
 
     /// Bone blend mask of low-priority animations
     Ogre::AnimationState::BoneBlendMask lowpriority_mask_;
+
+    /// Ogre world, for the level of detail camera and statistics
+    OgreWorldWeakPtr world_;
+
+    /// Elapsed time not yet stepped because of the level of detail
+    float pending_time_;
+
+    /// Number of frames skipped since the last step
+    int skipped_frames_;
+
+    /// Level of detail of the last frame
+    LodLevel last_lod_;
 };
 
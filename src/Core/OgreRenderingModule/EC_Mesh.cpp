@@ -13,6 +13,8 @@
 #include "OgreConversionUtils.h"
 #include "OgreSkeletonAsset.h"
 #include "OgreMeshAsset.h"
+#include "MeshRaycastBvh.h"
+#include "MeshBatcher.h"
 #include "OgreMaterialAsset.h"
 #include "IAssetTransfer.h"
 #include "AssetAPI.h"
@@ -23,6 +25,8 @@
 
 #include <Ogre.h>
 #include <OgreTagPoint.h>
+#include <algorithm>
+#include <functional>
 
 #include "LoggingFunctions.h"
 
@@ -38,6 +42,8 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     meshMaterial(this, "Mesh materials", AssetReferenceList("OgreMaterial")),
     drawDistance(this, "Draw distance", 0.0f),
     castShadows(this, "Cast shadows", false),
+    staticBatching(this, "Static batching", false),
+    lodScreenSizes(this, "LOD screen sizes", QVariantList()),
     entity_(0),
     attached_(false)
 {
@@ -613,6 +619,9 @@ bool EC_Mesh::SetMaterial(uint index, const std::string& material_name)
     try
     {
         entity_->getSubEntity(index)->setMaterialName(AssetAPI::SanitateAssetRef(material_name));
+        // The static batch has a copy of the old material assignment
+        if (staticBatching.Get())
+            UpdateBatching();
         emit MaterialChanged(index, QString(material_name.c_str()));
     }
     catch(Ogre::Exception& e)
@@ -775,10 +784,13 @@ void EC_Mesh::DetachEntity()
         return;
     
     EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    disconnect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*)));
     Ogre::SceneNode* node = placeable->GetSceneNode();
     adjustment_node_->detachObject(entity_);
     node->removeChild(adjustment_node_);
     attached_ = false;
+    UpdateBatching();
+    UpdateLodTracking();
 }
 
 void EC_Mesh::AttachEntity()
@@ -795,6 +807,23 @@ void EC_Mesh::AttachEntity()
     adjustment_node_->setVisible(placeable->visible.Get());
 
     attached_ = true;
+    connect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*)), Qt::UniqueConnection);
+    UpdateBatching();
+    UpdateLodTracking();
+}
+
+void EC_Mesh::UpdateBatching()
+{
+    OgreWorldPtr world = world_.lock();
+    MeshBatcher* batcher = world ? world->GetMeshBatcher() : 0;
+    if (!batcher)
+        return;
+    
+    EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    if (staticBatching.Get() && attached_ && entity_ && placeable && placeable->visible.Get() && placeable->parentRef.Get().IsEmpty())
+        batcher->AddMesh(this);
+    else
+        batcher->RemoveMesh(this);
 }
 
 Ogre::Mesh* EC_Mesh::PrepareMesh(const std::string& mesh_name, bool clone)
@@ -872,6 +901,7 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
     {
         if(entity_)
             entity_->setRenderingDistance(drawDistance.Get());
+        UpdateBatching();
     }
     else if (attribute == &castShadows)
     {
@@ -886,6 +916,7 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
                     attachment_entities_[i]->setCastShadows(castShadows.Get());
             }
         }
+        UpdateBatching();
     }
     else if (attribute == &nodeTransformation)
     {
@@ -902,6 +933,28 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
             newTransform.scale.z = 0.0000001f;
         
         adjustment_node_->setScale(newTransform.scale);
+        if (staticBatching.Get())
+            UpdateBatching();
+    }
+    else if (attribute == &staticBatching)
+    {
+        UpdateBatching();
+    }
+    else if (attribute == &lodScreenSizes)
+    {
+        lodScreenSizes_.clear();
+        QVariantList sizes = lodScreenSizes.Get();
+        for(int i = 0; i < sizes.size(); ++i)
+        {
+            bool ok = false;
+            float size = sizes[i].toFloat(&ok);
+            if (ok && size > 0.0f)
+                lodScreenSizes_.push_back(size);
+            else
+                LogWarning("EC_Mesh: Ignoring invalid LOD screen size \"" + sizes[i].toString() + "\"");
+        }
+        std::sort(lodScreenSizes_.begin(), lodScreenSizes_.end(), std::greater<float>());
+        UpdateLodTracking();
     }
     else if (attribute == &meshRef)
     {
@@ -942,6 +995,49 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
     }
 }
 
+void EC_Mesh::UpdateLodTracking()
+{
+    OgreWorldPtr world = world_.lock();
+    if (!world)
+        return;
+    
+    if (!lodScreenSizes_.empty() && attached_ && entity_)
+        world->StartLodTracking(this);
+    else
+    {
+        world->StopLodTracking(this);
+        // Return to the LOD selection of Ogre
+        if (entity_)
+            entity_->setMeshLodBias(1.0f);
+    }
+}
+
+void EC_Mesh::SelectLodLevel(float screenSize)
+{
+    if (!entity_)
+        return;
+    Ogre::ushort numLevels = entity_->getMesh()->getNumLodLevels();
+    if (numLevels <= 1)
+        return;
+    
+    Ogre::ushort level = 0;
+    while(level < lodScreenSizes_.size() && screenSize < lodScreenSizes_[level])
+        ++level;
+    if (level >= numLevels)
+        level = numLevels - 1;
+    // Equal maximum and minimum detail indices force the level
+    entity_->setMeshLodBias(1.0f, level, level);
+}
+
+void EC_Mesh::OnPlaceableAttributeChanged(IAttribute *attribute)
+{
+    if (!staticBatching.Get())
+        return;
+    EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    if (placeable && (attribute == &placeable->transform || attribute == &placeable->visible || attribute == &placeable->parentRef))
+        UpdateBatching();
+}
+
 void EC_Mesh::OnComponentRemoved(IComponent* component, AttributeChange::Type change)
 {
     if (component == placeable_.get())
@@ -1362,6 +1458,35 @@ bool EC_Mesh::Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance,
     Ogre::MeshPtr mesh = meshEntity->getMesh();
     bool useSoftwareBlendingVertices = meshEntity->hasSkeleton();
     
+    // Meshes that do not deform are raycast using a cached CPU-side BVH, instead of testing all triangles in the hardware buffers
+    MeshRaycastBvhPtr bvh;
+    if (!useSoftwareBlendingVertices && !meshEntity->hasVertexAnimation())
+        bvh = MeshRaycastBvh::ForMesh(mesh.get());
+    if (bvh)
+    {
+        MeshRaycastHit hit;
+        if (!bvh->Raycast(localRay, hit))
+            return false;
+        
+        float3 worldHitPoint = localToWorld.TransformPos(localRay.pos + hit.t * localRay.dir);
+        if (subMeshIndex)
+            *subMeshIndex = hit.subMeshIndex;
+        if (triangleIndex)
+            *triangleIndex = hit.triangleIndex;
+        if (distance)
+            *distance = (worldHitPoint - ray.pos).Length();
+        if (hitPosition)
+            *hitPosition = worldHitPoint;
+        if (uv)
+            *uv = hit.uv;
+        if (normal)
+        {
+            *normal = localToWorld.TransformDir((hit.v1 - hit.v0).Cross(hit.v2 - hit.v0));
+            normal->Normalize();
+        }
+        return true;
+    }
+    
     float closestDistance = -1.0f; // In objectspace
     
     for (unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
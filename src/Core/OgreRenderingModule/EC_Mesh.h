@@ -45,6 +45,12 @@ Registered by OgreRenderer::OgreRenderingModule.
 <div>Distance where the mesh is shown from the camera, 0.0 = draw always (default).</div> 
 <li>bool: castShadows
 <div>Will the mesh cast shadows.</div>
+<li>bool: staticBatching
+<div>Will the mesh be merged with other non-moving meshes into static geometry batches, to render many repeated meshes with few draw calls.
+The mesh is batched once its placeable has stayed unchanged for a second. Skeletally or vertex animated meshes and meshes whose placeable has a parent are not batched.</div>
+<li>QVariantList: lodScreenSizes
+<div>Screen size thresholds for selecting the LOD level of the mesh, as fractions of the viewport height in descending order. When the projected height
+of the mesh is below the first threshold, LOD level 1 is used, below the second, LOD level 2 etc. Empty (default) uses the LOD distances of the mesh asset.</div>
 </ul>
 
 <b>Exposes the following scriptable functions:</b>
@@ -170,6 +176,18 @@ public:
     Q_PROPERTY(bool castShadows READ getcastShadows WRITE setcastShadows);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, castShadows);
 
+    /// Will the mesh be merged with other non-moving meshes into static geometry batches.
+    Q_PROPERTY(bool staticBatching READ getstaticBatching WRITE setstaticBatching);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, staticBatching);
+
+    /// Screen size thresholds for selecting the LOD level of the mesh, as fractions of the viewport height in descending order. Empty (default) uses the LOD distances of the mesh asset.
+    Q_PROPERTY(QVariantList lodScreenSizes READ getlodScreenSizes WRITE setlodScreenSizes);
+    DEFINE_QPROPERTY_ATTRIBUTE(QVariantList, lodScreenSizes);
+
+    /// Forces the LOD level of the mesh according to its screen size and the LOD screen sizes. Called each frame by OgreWorld when LOD screen sizes are set.
+    /** @param screenSize Projected height of the mesh as a fraction of the viewport height */
+    void SelectLodLevel(float screenSize);
+
 public slots:
     /// Automatically finds the placeable from the parent entity and sets it.
     void AutoSetPlaceable();
@@ -427,6 +445,9 @@ private slots:
     /// Called when some of the attributes has been changed.
     void OnAttributeUpdated(IAttribute *attribute);
 
+    /// Called when an attribute of the placeable has been changed. Takes the mesh out of its static batch if it moved.
+    void OnPlaceableAttributeChanged(IAttribute *attribute);
+
     /// Called when component has been removed from the parent entity. Checks if the component removed was the placeable, and autodissociates it.
     void OnComponentRemoved(IComponent* component, AttributeChange::Type change);
 
@@ -455,6 +476,12 @@ private:
     /// detaches entity from placeable
     void DetachEntity();
 
+    /// Adds the mesh to the static mesh batcher of the world, or removes it, according to the staticBatching attribute and the placeable.
+    void UpdateBatching();
+
+    /// Starts or stops LOD level selection by screen size in the world, according to the lodScreenSizes attribute.
+    void UpdateLodTracking();
+
     /// placeable component 
     ComponentPtr placeable_;
 
@@ -489,4 +516,7 @@ private:
     AssetRefListenerPtr skeletonAsset;
 
     std::map<int, QString> pendingMaterialApplies;
+
+    /// LOD screen size thresholds in descending order, parsed from the lodScreenSizes attribute
+    std::vector<float> lodScreenSizes_;
 };
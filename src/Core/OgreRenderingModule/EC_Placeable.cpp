@@ -21,6 +21,7 @@
 
 #include <Ogre.h>
 #include <OgreTagPoint.h>
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
@@ -171,6 +172,7 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     parentPlaceable_(0),
     parentMesh_(0),
     attached_(false),
+    transformNode_(TransformHierarchy::NoNode),
     transform(this, "Transform"),
     drawDebug(this, "Show bounding box", false),
     visible(this, "Visible", true),
@@ -193,6 +195,15 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     }
     transform.SetMetadata(&transAttrData);
 
+    // Cache the world transform in the scene's transform hierarchy, which also stores the transform attribute value
+    if (scene)
+    {
+        hierarchy_ = scene->GetTransformHierarchy();
+        transformNode_ = hierarchy_->CreateNode();
+        transform.BindStorage(&hierarchy_->LocalTransformStorage(transformNode_));
+        hierarchy_->LocalTransformChanged(transformNode_);
+    }
+
     OgreWorldPtr world = world_.lock();
     if (world)
     {
@@ -207,16 +218,40 @@ EC_Placeable::EC_Placeable(Scene* scene) :
 
         connect(this, SIGNAL(ParentEntitySet()), SLOT(RegisterActions()));
     
+        AttachNode();
+    }
+    else if (scene)
+    {
+        // No renderer scene graph, the transform hierarchy is the only source of the world transform
+        connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)),
+            SLOT(HandleAttributeChanged(IAttribute*, AttributeChange::Type)));
+
         AttachNode();
     }
 }
 
 EC_Placeable::~EC_Placeable()
 {
+    TransformHierarchyPtr hierarchy = hierarchy_;
+    // Move the transform value back to the attribute before its storage in the hierarchy is freed
+    if (hierarchy)
+        transform.BindStorage(0);
+    if (!sceneNode_)
+    {
+        if (hierarchy)
+        {
+            emit AboutToBeDestroyed();
+            DetachNode();
+            hierarchy->DestroyNode(transformNode_);
+        }
+        return;
+    }
+
     if (world_.expired())
     {
-        if (sceneNode_)
-            LogError("EC_Placeable: World has expired, skipping uninitialization!");
+        LogError("EC_Placeable: World has expired, skipping uninitialization!");
+        if (hierarchy)
+            hierarchy->DestroyNode(transformNode_);
         return;
     }
     
@@ -239,10 +274,17 @@ EC_Placeable::~EC_Placeable()
         sceneMgr->destroySceneNode(boneAttachmentNode_);
         boneAttachmentNode_ = 0;
     }
+    if (hierarchy)
+        hierarchy->DestroyNode(transformNode_);
 }
 
 void EC_Placeable::AttachNode()
 {
+    if (!sceneNode_ && hierarchy_)
+    {
+        AttachTransformNode();
+        return;
+    }
     if (world_.expired())
     {
         LogError("EC_Placeable::AttachNode: No OgreWorld available to call this function!");
@@ -352,6 +394,9 @@ void EC_Placeable::AttachNode()
                     
                     parentPlaceable_ = parentPlaceable;
                     parentPlaceable_->GetSceneNode()->addChild(sceneNode_);
+                    TransformHierarchyPtr hierarchy = hierarchy_;
+                    if (hierarchy)
+                        hierarchy->SetParent(transformNode_, parentPlaceable_->transformNode_);
                     
                     // Connect to destruction of the placeable to be able to detach gracefully
                     connect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()), Qt::UniqueConnection);
@@ -385,6 +430,11 @@ void EC_Placeable::AttachNode()
 
 void EC_Placeable::DetachNode()
 {
+    if (!sceneNode_ && hierarchy_)
+    {
+        DetachTransformNode();
+        return;
+    }
     if (world_.expired())
     {
         LogError("EC_Placeable::DetachNode: No OgreWorld available to call this function!");
@@ -417,6 +467,9 @@ void EC_Placeable::DetachNode()
             disconnect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()));
             parentPlaceable_->GetSceneNode()->removeChild(sceneNode_);
             parentPlaceable_ = 0;
+            TransformHierarchyPtr hierarchy = hierarchy_;
+            if (hierarchy)
+                hierarchy->SetParent(transformNode_, TransformHierarchy::NoNode);
         }
         else
             root_node->removeChild(sceneNode_);
@@ -429,6 +482,76 @@ void EC_Placeable::DetachNode()
     }
 }
 
+void EC_Placeable::AttachTransformNode()
+{
+    TransformHierarchyPtr hierarchy = hierarchy_;
+    if (!hierarchy)
+        return;
+
+    // If already attached, detach first
+    if (attached_)
+        DetachTransformNode();
+
+    Entity* ownEntity = ParentEntity();
+    Scene* scene = ownEntity ? ownEntity->ParentScene() : 0;
+    if (scene)
+        scene->disconnect(this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)));
+    if (ownEntity)
+        ownEntity->disconnect(this, SLOT(OnComponentAdded(IComponent*, AttributeChange::Type)));
+
+    const EntityReference& parent = parentRef.Get();
+    if (!parent.IsEmpty())
+    {
+        if (!ownEntity || !scene)
+            return;
+
+        Entity* parentEntity = parent.Lookup(scene).get();
+        if (!parentEntity)
+        {
+            // Could not find parent entity. Check for it later, when new entities are created into the scene
+            connect(scene, SIGNAL(EntityCreated(Entity*, AttributeChange::Type)), this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)), Qt::UniqueConnection);
+            return;
+        }
+        // If we refer to self, stay at the root. Without a renderer there are no skeletons, so a parent bone is ignored.
+        if (parentEntity != ownEntity)
+        {
+            EC_Placeable* parentPlaceable = parentEntity->GetComponent<EC_Placeable>().get();
+            if (!parentPlaceable)
+            {
+                // If can't find the placeable component yet, wait for it to be created
+                connect(parentEntity, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(OnComponentAdded(IComponent*, AttributeChange::Type)), Qt::UniqueConnection);
+                return;
+            }
+            if (hierarchy->SetParent(transformNode_, parentPlaceable->transformNode_))
+            {
+                parentPlaceable_ = parentPlaceable;
+                connect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()), Qt::UniqueConnection);
+            }
+            else
+                LogWarning("Cyclic placeable parenting attempt detected! Parenting to the root instead.");
+        }
+    }
+
+    attached_ = true;
+}
+
+void EC_Placeable::DetachTransformNode()
+{
+    if (!attached_)
+        return;
+
+    if (parentPlaceable_)
+    {
+        disconnect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()));
+        parentPlaceable_ = 0;
+    }
+    TransformHierarchyPtr hierarchy = hierarchy_;
+    if (hierarchy)
+        hierarchy->SetParent(transformNode_, TransformHierarchy::NoNode);
+
+    attached_ = false;
+}
+
 void EC_Placeable::Show()
 {
     if (!sceneNode_)
@@ -679,14 +802,8 @@ void EC_Placeable::HandleAttributeChanged(IAttribute* attribute, AttributeChange
     if (attribute == &transform)
     {
         const Transform& trans = transform.Get();
-        if (trans.pos.IsFinite())
-            sceneNode_->setPosition(trans.pos);
-        
         Quat orientation = trans.Orientation();
-
-        if (orientation.IsFinite())
-            sceneNode_->setOrientation(orientation);
-        else
+        if (!orientation.IsFinite())
             ::LogError("EC_Placeable: transform attribute changed, but orientation not valid!");
 
         // Prevent Ogre exception from zero scale
@@ -698,7 +815,18 @@ void EC_Placeable::HandleAttributeChanged(IAttribute* attribute, AttributeChange
         if (scale.z < 0.0000001f)
             scale.z = 0.0000001f;
 
-        sceneNode_->setScale(scale);
+        if (sceneNode_)
+        {
+            if (trans.pos.IsFinite())
+                sceneNode_->setPosition(trans.pos);
+            if (orientation.IsFinite())
+                sceneNode_->setOrientation(orientation);
+            sceneNode_->setScale(scale);
+        }
+
+        // The value is already in the hierarchy's storage, so only mark it changed
+        if (hierarchy_)
+            hierarchy_->LocalTransformChanged(transformNode_);
     }
     else if (attribute == &drawDebug)
     {
@@ -880,11 +1008,17 @@ void EC_Placeable::SetWorldTransform(const Quat &orientation, const float3 &pos,
 
 float3 EC_Placeable::WorldPosition() const
 {
+    TransformHierarchyPtr hierarchy = CachedTransformHierarchy();
+    if (hierarchy)
+        return hierarchy->WorldPosition(transformNode_);
     return LocalToWorld().TranslatePart();
 }
 
 Quat EC_Placeable::WorldOrientation() const
 {
+    TransformHierarchyPtr hierarchy = CachedTransformHierarchy();
+    if (hierarchy)
+        return hierarchy->WorldOrientation(transformNode_);
     float3 translate;
     Quat rotate;
     float3 scale;
@@ -894,6 +1028,9 @@ Quat EC_Placeable::WorldOrientation() const
 
 float3 EC_Placeable::WorldScale() const
 {
+    TransformHierarchyPtr hierarchy = CachedTransformHierarchy();
+    if (hierarchy)
+        return hierarchy->WorldScale(transformNode_);
     float3 translate;
     Quat rotate;
     float3 scale;
@@ -917,11 +1054,28 @@ float3 EC_Placeable::Scale() const
 }
 
 float3x4 EC_Placeable::LocalToWorld() const
+{
+    TransformHierarchyPtr hierarchy = CachedTransformHierarchy();
+    if (hierarchy)
+        return hierarchy->WorldTransform(transformNode_);
+    return SceneNodeLocalToWorld();
+}
+
+float3x4 EC_Placeable::SceneNodeLocalToWorld() const
 {
     if (sceneNode_)
         return float4x4(sceneNode_->_getFullTransform()).Float3x4Part();
-    else
-        return float3x4::identity;
+    return float3x4::identity;
+}
+
+TransformHierarchyPtr EC_Placeable::CachedTransformHierarchy() const
+{
+    // Bones are animated by Ogre, so a placeable attached to one directly or through its parents is read from the scene node
+    if (sceneNode_)
+        for(const EC_Placeable *p = this; p; p = p->parentPlaceable_)
+            if (p->parentBone_)
+                return TransformHierarchyPtr();
+    return hierarchy_;
 }
 
 float3x4 EC_Placeable::WorldToLocal() const
@@ -7,6 +7,7 @@
 #include "EntityReference.h"
 #include "OgreModuleApi.h"
 #include "OgreModuleFwd.h"
+#include "TransformHierarchy.h"
 #include "Transform.h"
 #include "Math/float3.h"
 #include "Math/MathFwd.h"
@@ -57,6 +58,12 @@ Does not emit any actions.
 
 <b>Doesn't depend on any components</b>.
 
+The world transform queries are answered from the TransformHierarchy of the scene, which caches the world transforms
+without forcing Ogre scene node updates. The value of the transform attribute is stored in the hierarchy, contiguously with
+the transforms of the other placeables of the scene. Placeables attached to a bone, directly or through their parents, are read from
+the scene node. If the scene has no Ogre world, f.ex. on a server run with --headless --norender, the placeable has no
+scene node; a parent bone is then ignored, and the placeable follows the parent entity's placeable.
+
 </table>
 */
 class OGRE_MODULE_API EC_Placeable : public IComponent
@@ -96,7 +103,8 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(QString, parentBone);
 
     /// Returns the Ogre scene node for attaching geometry.
-    /** Do not manipulate the pos/orientation/scale of this node directly, but instead use the Transform property. */
+    /** Do not manipulate the pos/orientation/scale of this node directly, but instead use the Transform property.
+        Null if the scene has no Ogre world. */
     Ogre::SceneNode* GetSceneNode() const { return sceneNode_; }
 
 public slots:
@@ -185,6 +193,9 @@ public slots:
 
     /// Returns the concatenated world transformation of this placeable.
     float3x4 LocalToWorld() const;
+    /// Returns the world transformation of the Ogre scene node of this placeable, bypassing the transform hierarchy of the scene.
+    /// @note Returns identity if there is no scene node, f.ex. on a server run with --headless --norender.
+    float3x4 SceneNodeLocalToWorld() const;
     /// Returns the matrix that transforms objects from world space into the local coordinate space of this placeable.
     float3x4 WorldToLocal() const;
 
@@ -295,6 +306,15 @@ private:
     
     /// detaches scenenode from parent
     void DetachNode();
+
+    /// attaches the transform hierarchy node to the parent placeable's node, when there is no Ogre world
+    void AttachTransformNode();
+
+    /// detaches the transform hierarchy node from the parent placeable's node
+    void DetachTransformNode();
+
+    /// Returns the transform hierarchy if it holds the world transform of this placeable, or null if the scene node must be used.
+    TransformHierarchyPtr CachedTransformHierarchy() const;
     
     /// Ogre world ptr
     OgreWorldWeakPtr world_;
@@ -317,6 +337,13 @@ private:
     /// attached to scene hierarchy-flag
     bool attached_;
 
+    /// Transform hierarchy of the scene, which caches the world transform and stores the value of the transform attribute.
+    /** Held strongly, as the transform attribute is bound to its storage. */
+    TransformHierarchyPtr hierarchy_;
+
+    /// Node in the transform hierarchy, valid if hierarchy_ is set
+    TransformHierarchy::NodeId transformNode_;
+
     friend class BoneAttachmentListener;
     friend class CustomTagPoint;
 };
@@ -0,0 +1,267 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "MeshBatcher.h"
+#include "EC_Mesh.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <Ogre.h>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+const float MeshBatcher::cSettleTime = 1.0f;
+
+bool MeshBatcher::CellKey::operator <(const CellKey &rhs) const
+{
+    if (x != rhs.x) return x < rhs.x;
+    if (y != rhs.y) return y < rhs.y;
+    if (z != rhs.z) return z < rhs.z;
+    if (castShadows != rhs.castShadows) return castShadows < rhs.castShadows;
+    return drawDistance < rhs.drawDistance;
+}
+
+MeshBatcher::MeshBatcher(Ogre::SceneManager *sceneManager, float cellSize) :
+    sceneManager_(sceneManager),
+    cellSize_(cellSize > 0.0f ? cellSize : 100.0f),
+    nextGeometryId_(0)
+{
+}
+
+MeshBatcher::~MeshBatcher()
+{
+    for(std::map<EC_Mesh *, MeshState>::iterator i = meshes_.begin(); i != meshes_.end(); ++i)
+        if (i->second.built && i->first->GetEntity())
+        {
+            i->first->GetEntity()->setVisibilityFlags(i->second.visibilityFlags);
+            i->first->GetEntity()->setCastShadows(i->first->castShadows.Get());
+        }
+    for(std::map<CellKey, Cell>::iterator i = cells_.begin(); i != cells_.end(); ++i)
+        if (i->second.geometry)
+            sceneManager_->destroyStaticGeometry(i->second.geometry);
+}
+
+void MeshBatcher::AddMesh(EC_Mesh *mesh)
+{
+    if (!mesh)
+        return;
+
+    MeshState &state = meshes_[mesh];
+    Unbatch(mesh, state);
+    state.settleTime = cSettleTime;
+    pending_.insert(mesh);
+}
+
+void MeshBatcher::RemoveMesh(EC_Mesh *mesh)
+{
+    std::map<EC_Mesh *, MeshState>::iterator i = meshes_.find(mesh);
+    if (i == meshes_.end())
+        return;
+
+    Unbatch(mesh, i->second);
+    pending_.erase(mesh);
+    meshes_.erase(i);
+}
+
+void MeshBatcher::Unbatch(EC_Mesh *mesh, MeshState &state)
+{
+    if (!state.inCell)
+        return;
+
+    std::map<CellKey, Cell>::iterator cell = cells_.find(state.cell);
+    if (cell != cells_.end())
+        cell->second.meshes.erase(mesh);
+
+    if (state.built)
+    {
+        Ogre::Entity *entity = mesh->GetEntity();
+        if (entity)
+        {
+            entity->setVisibilityFlags(state.visibilityFlags);
+            entity->setCastShadows(mesh->castShadows.Get());
+            batchedEntities_.erase(entity);
+        }
+        // The mesh would render twice until its cell is rebuilt, so rebuild without delay
+        urgentCells_.insert(state.cell);
+    }
+
+    state.inCell = false;
+    state.built = false;
+}
+
+bool MeshBatcher::GetCellKey(EC_Mesh *mesh, CellKey &key) const
+{
+    Ogre::Entity *entity = mesh->GetEntity();
+    Ogre::SceneNode *node = mesh->GetAdjustmentSceneNode();
+    if (!entity || !node || !entity->isInScene() || entity->hasSkeleton() || entity->hasVertexAnimation())
+        return false;
+
+    const Ogre::Vector3 &pos = node->_getDerivedPosition();
+    key.x = (int)floor(pos.x / cellSize_);
+    key.y = (int)floor(pos.y / cellSize_);
+    key.z = (int)floor(pos.z / cellSize_);
+    key.castShadows = mesh->castShadows.Get();
+    key.drawDistance = mesh->drawDistance.Get();
+    return true;
+}
+
+void MeshBatcher::Update(float frameTime)
+{
+    if (pending_.empty() && dirtyCells_.empty() && urgentCells_.empty())
+        return;
+
+    PROFILE(MeshBatcher_Update);
+
+    for(std::set<EC_Mesh *>::iterator i = pending_.begin(); i != pending_.end();)
+    {
+        EC_Mesh *mesh = *i;
+        MeshState &state = meshes_[mesh];
+        state.settleTime -= frameTime;
+        if (state.settleTime > 0.0f)
+        {
+            ++i;
+            continue;
+        }
+
+        pending_.erase(i++);
+        // A mesh that can not be batched is rendered by its own entity until it changes again
+        CellKey key;
+        if (!GetCellKey(mesh, key))
+            continue;
+        state.inCell = true;
+        state.cell = key;
+        cells_[key].meshes.insert(mesh);
+        dirtyCells_.insert(key);
+    }
+
+    // Rebuild the cells of unbatched meshes without delay, and a limited number of the cells with newly settled meshes
+    while(!urgentCells_.empty())
+    {
+        CellKey key = *urgentCells_.begin();
+        urgentCells_.erase(urgentCells_.begin());
+        dirtyCells_.erase(key);
+        RebuildCell(key);
+    }
+    for(uint i = 0; i < cMaxRebuildsPerFrame && !dirtyCells_.empty(); ++i)
+    {
+        CellKey key = *dirtyCells_.begin();
+        dirtyCells_.erase(dirtyCells_.begin());
+        RebuildCell(key);
+    }
+}
+
+void MeshBatcher::RebuildCell(const CellKey &key)
+{
+    std::map<CellKey, Cell>::iterator i = cells_.find(key);
+    if (i == cells_.end())
+        return;
+    Cell &cell = i->second;
+
+    if (cell.geometry)
+    {
+        sceneManager_->destroyStaticGeometry(cell.geometry);
+        cell.geometry = 0;
+    }
+    cell.numBatchDrawCalls = 0;
+    cell.numMeshDrawCalls = 0;
+
+    if (cell.meshes.empty())
+    {
+        cells_.erase(i);
+        return;
+    }
+
+    PROFILE(MeshBatcher_RebuildCell);
+
+    try
+    {
+        cell.geometry = sceneManager_->createStaticGeometry("MeshBatcher_" + Ogre::StringConverter::toString(nextGeometryId_++));
+        cell.geometry->setRegionDimensions(Ogre::Vector3(cellSize_, cellSize_, cellSize_));
+        cell.geometry->setOrigin(Ogre::Vector3(key.x * cellSize_, key.y * cellSize_, key.z * cellSize_));
+        cell.geometry->setCastShadows(key.castShadows);
+        if (key.drawDistance > 0.0f)
+            cell.geometry->setRenderingDistance(key.drawDistance);
+
+        for(std::set<EC_Mesh *>::iterator j = cell.meshes.begin(); j != cell.meshes.end(); ++j)
+        {
+            Ogre::Entity *entity = (*j)->GetEntity();
+            Ogre::SceneNode *node = (*j)->GetAdjustmentSceneNode();
+            if (entity && node)
+                cell.geometry->addEntity(entity, node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+        }
+        cell.geometry->build();
+    }
+    catch(const Ogre::Exception &e)
+    {
+        LogError("MeshBatcher: Failed to build static geometry: " + QString(e.what()));
+        if (cell.geometry)
+        {
+            sceneManager_->destroyStaticGeometry(cell.geometry);
+            cell.geometry = 0;
+        }
+        // Leave the meshes rendered by their own entities
+        std::set<EC_Mesh *> meshes = cell.meshes;
+        for(std::set<EC_Mesh *>::iterator j = meshes.begin(); j != meshes.end(); ++j)
+            Unbatch(*j, meshes_[*j]);
+        urgentCells_.erase(key);
+        cells_.erase(key);
+        return;
+    }
+
+    // Hide the entities of the meshes that are now rendered by the batch
+    for(std::set<EC_Mesh *>::iterator j = cell.meshes.begin(); j != cell.meshes.end(); ++j)
+    {
+        Ogre::Entity *entity = (*j)->GetEntity();
+        if (!entity)
+            continue;
+        MeshState &state = meshes_[*j];
+        if (!state.built)
+        {
+            state.visibilityFlags = entity->getVisibilityFlags();
+            entity->setVisibilityFlags(0);
+            entity->setCastShadows(false);
+            batchedEntities_.insert(entity);
+            state.built = true;
+        }
+        cell.numMeshDrawCalls += entity->getNumSubEntities();
+    }
+
+    // Count the draw calls of the most detailed LOD level of each region
+    Ogre::StaticGeometry::RegionIterator regions = cell.geometry->getRegionIterator();
+    while(regions.hasMoreElements())
+    {
+        Ogre::StaticGeometry::Region::LODIterator lods = regions.getNext()->getLODIterator();
+        if (!lods.hasMoreElements())
+            continue;
+        Ogre::StaticGeometry::LODBucket::MaterialIterator materials = lods.getNext()->getMaterialIterator();
+        while(materials.hasMoreElements())
+        {
+            Ogre::StaticGeometry::MaterialBucket::GeometryIterator geometries = materials.getNext()->getGeometryIterator();
+            while(geometries.hasMoreElements())
+            {
+                geometries.getNext();
+                ++cell.numBatchDrawCalls;
+            }
+        }
+    }
+}
+
+MeshBatcher::Stats MeshBatcher::GetStats() const
+{
+    Stats stats;
+    stats.numMeshes = meshes_.size();
+    for(std::map<EC_Mesh *, MeshState>::const_iterator i = meshes_.begin(); i != meshes_.end(); ++i)
+        if (i->second.built)
+            ++stats.numBatchedMeshes;
+    for(std::map<CellKey, Cell>::const_iterator i = cells_.begin(); i != cells_.end(); ++i)
+    {
+        if (!i->second.geometry)
+            continue;
+        ++stats.numCells;
+        stats.numBatchDrawCalls += i->second.numBatchDrawCalls;
+        stats.numMeshDrawCalls += i->second.numMeshDrawCalls;
+    }
+    return stats;
+}
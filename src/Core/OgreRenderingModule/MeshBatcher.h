@@ -0,0 +1,145 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <map>
+#include <set>
+
+namespace Ogre
+{
+    class StaticGeometry;
+    class MovableObject;
+}
+
+/// Merges the meshes of non-moving EC_Mesh components into Ogre static geometry batches, to render many repeated meshes with few draw calls.
+/** The batched meshes are grouped into cubic cells by their world position. Each cell is an Ogre::StaticGeometry, which in turn
+    merges the meshes sharing a material into one draw call. Meshes in different cells, or with different shadow casting or
+    draw distance settings, never share a batch, so that a cell can be culled and rebuilt independently of the others.
+
+    A mesh is batched only after it has stayed unchanged for a settling time, and its own Ogre entity keeps rendering until the
+    batch of its cell has been rebuilt with it. When a batched mesh changes, f.ex. its placeable moves or a material is applied,
+    it is taken out of its batch and rendered by its own entity again until it settles. At most a few cells are rebuilt per frame.
+    The Ogre entities of the batched meshes stay in the scene for raycasts and bounding box queries, but are excluded from
+    rendering with a zero visibility mask.
+
+    Static geometry works with any render system, as it needs no shader or hardware instancing support.
+    Skeletally or vertex animated meshes are not batched. Owned by OgreWorld. */
+class OGRE_MODULE_API MeshBatcher
+{
+public:
+    /// Batching statistics
+    struct Stats
+    {
+        Stats() : numMeshes(0), numBatchedMeshes(0), numCells(0), numBatchDrawCalls(0), numMeshDrawCalls(0) {}
+
+        /// Number of meshes added for batching, including the ones waiting to settle
+        uint numMeshes;
+        /// Number of meshes rendered by the batches
+        uint numBatchedMeshes;
+        /// Number of cells with batches
+        uint numCells;
+        /// Number of draw calls of the batches
+        uint numBatchDrawCalls;
+        /// Number of draw calls the batched meshes would take when rendered separately
+        uint numMeshDrawCalls;
+    };
+
+    /// Constructor.
+    /** @param sceneManager Scene manager to create the static geometry to
+        @param cellSize Edge length of the batching cells in world units */
+    MeshBatcher(Ogre::SceneManager *sceneManager, float cellSize);
+
+    /// Destroys the batches, and restores rendering of the batched meshes.
+    ~MeshBatcher();
+
+    /// Adds a mesh for batching, or takes an already added mesh out of its batch after it has changed.
+    /** The mesh is batched once it has stayed unchanged for the settling time. */
+    void AddMesh(EC_Mesh *mesh);
+
+    /// Removes a mesh from batching and restores rendering of its own entity. Must be called before the Ogre entity of the mesh is destroyed.
+    void RemoveMesh(EC_Mesh *mesh);
+
+    /// Returns whether the mesh has been added for batching.
+    bool HasMesh(EC_Mesh *mesh) const { return meshes_.find(mesh) != meshes_.end(); }
+
+    /// Returns whether an Ogre entity is hidden because its mesh is rendered by a batch. Raycasts should treat such entities as visible.
+    bool IsBatchedEntity(const Ogre::MovableObject *object) const { return batchedEntities_.find(object) != batchedEntities_.end(); }
+
+    /// Batches the settled meshes and rebuilds the changed cells. Called each frame by OgreWorld.
+    void Update(float frameTime);
+
+    /// Returns the batching statistics.
+    Stats GetStats() const;
+
+    /// Time in seconds a mesh must stay unchanged before it is batched
+    static const float cSettleTime;
+    /// Maximum number of cells rebuilt per frame
+    static const uint cMaxRebuildsPerFrame = 2;
+
+private:
+    /// Identifies the batch of a mesh
+    struct CellKey
+    {
+        int x, y, z;
+        bool castShadows;
+        float drawDistance;
+
+        bool operator <(const CellKey &rhs) const;
+    };
+
+    struct Cell
+    {
+        Cell() : geometry(0), numBatchDrawCalls(0), numMeshDrawCalls(0) {}
+
+        /// Static geometry of the cell, or null if not built
+        Ogre::StaticGeometry *geometry;
+        /// Meshes in the cell. Not all of them are necessarily in the geometry yet
+        std::set<EC_Mesh *> meshes;
+        uint numBatchDrawCalls;
+        uint numMeshDrawCalls;
+    };
+
+    struct MeshState
+    {
+        MeshState() : inCell(false), built(false), settleTime(0.0f), visibilityFlags(0) {}
+
+        /// Is the mesh in a cell
+        bool inCell;
+        /// Is the mesh in the built geometry of its cell, with its own entity hidden
+        bool built;
+        /// Cell of the mesh, valid if inCell
+        CellKey cell;
+        /// Time left until the mesh is batched
+        float settleTime;
+        /// Original visibility flags of the entity, valid if built
+        u32 visibilityFlags;
+    };
+
+    /// Takes a mesh out of its cell, marks the cell for rebuild, and restores rendering of the entity.
+    void Unbatch(EC_Mesh *mesh, MeshState &state);
+
+    /// Returns the cell key of a mesh, or false if the mesh can not be batched.
+    bool GetCellKey(EC_Mesh *mesh, CellKey &key) const;
+
+    /// Rebuilds the static geometry of a cell. Destroys the cell if it has no meshes.
+    void RebuildCell(const CellKey &key);
+
+    Ogre::SceneManager *sceneManager_;
+    float cellSize_;
+    /// Counter for unique static geometry names
+    uint nextGeometryId_;
+    std::map<EC_Mesh *, MeshState> meshes_;
+    /// Meshes waiting to settle
+    std::set<EC_Mesh *> pending_;
+    std::map<CellKey, Cell> cells_;
+    /// Cells with newly settled meshes, waiting for a rebuild
+    std::set<CellKey> dirtyCells_;
+    /// Entities hidden because their meshes are rendered by the batches
+    std::set<const Ogre::MovableObject *> batchedEntities_;
+    /// Cells that still render an unbatched mesh, rebuilt on the next update
+    std::set<CellKey> urgentCells_;
+};
@@ -0,0 +1,635 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#define OGRE_INTEROP
+#include "DebugOperatorNew.h"
+#include "MeshRaycastBvh.h"
+#include "Math/Ray.h"
+#include "Math/MathFunc.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MESHRAYCASTBVH_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Meshes with fewer triangles than this build their tree immediately instead of on a worker thread
+const size_t cMinTrianglesForThreadedBuild = 4096;
+/// Maximum number of triangles in a leaf, unless the triangles can not be split
+const size_t cMaxLeafTriangles = 8;
+/// Number of bins in the surface area heuristic split search
+const int cNumSplitBins = 16;
+/// Maximum tree depth. Also bounds the traversal stack size
+const int cMaxDepth = 64;
+/// Number of build work items between checks for cancellation
+const unsigned cCancelCheckInterval = 1024;
+
+struct CachedBvh
+{
+    MeshRaycastBvhPtr bvh;
+    /// Ogre resource handle of the mesh when the tree was created. A new handle is assigned whenever a mesh of the same name is recreated
+    Ogre::ResourceHandle handle;
+    /// Ogre resource state count of the mesh when the tree was created, to detect reloads of the same mesh
+    size_t stateCount;
+};
+
+typedef std::map<std::string, CachedBvh> BvhCache;
+
+/// Raycast trees of meshes by mesh name. Only accessed from the main thread
+BvhCache bvhCache;
+
+/// Guards the build queue and the build thread
+boost::mutex buildMutex;
+/// Signaled when trees are queued for building or the build thread should exit
+boost::condition_variable buildCondition;
+/// Trees waiting to be built in the build thread
+std::deque<MeshRaycastBvhPtr> buildQueue;
+/// Thread that builds the trees of large meshes. Started on first use
+boost::thread* buildThread = 0;
+/// Set by MeshRaycastBvh::Shutdown()
+bool buildThreadQuit = false;
+
+/// Triangle bounds used while building
+struct BuildTriangle
+{
+    float3 aabbMin;
+    float3 aabbMax;
+    float3 centroid;
+    int index;
+};
+
+struct BuildItem
+{
+    unsigned node;
+    size_t begin;
+    size_t end;
+    int depth;
+};
+
+float SurfaceArea(const float3& aabbMin, const float3& aabbMax)
+{
+    float3 d = aabbMax - aabbMin;
+    return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/// Returns the entry distance of a ray into a box, or FLOAT_INF if it misses or the box is further than maxT
+float IntersectAabb(const float3& aabbMin, const float3& aabbMax, const float3& origin, const float3& invDir, float maxT)
+{
+    float tx1 = (aabbMin.x - origin.x) * invDir.x, tx2 = (aabbMax.x - origin.x) * invDir.x;
+    float ty1 = (aabbMin.y - origin.y) * invDir.y, ty2 = (aabbMax.y - origin.y) * invDir.y;
+    float tz1 = (aabbMin.z - origin.z) * invDir.z, tz2 = (aabbMax.z - origin.z) * invDir.z;
+    float tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.f));
+    float tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), maxT));
+    return tNear <= tFar ? tNear : FLOAT_INF;
+}
+
+/// Intersects a ray with a front-facing triangle using the Moller-Trumbore algorithm. Returns the hit distance, or a negative value if no hit
+float IntersectTriangle(const float3& origin, const float3& dir, const float3& v0, const float3& e1, const float3& e2, float& u, float& v)
+{
+    float3 p = dir.Cross(e2);
+    float det = e1.Dot(p);
+    // Positive determinant means the triangle faces the ray; also rejects degenerate triangles
+    if (!(det > 0.f))
+        return -1.f;
+    float invDet = 1.f / det;
+    float3 s = origin - v0;
+    u = s.Dot(p) * invDet;
+    if (u < 0.f || u > 1.f)
+        return -1.f;
+    float3 q = s.Cross(e1);
+    v = dir.Dot(q) * invDet;
+    if (v < 0.f || u + v > 1.f)
+        return -1.f;
+    return e2.Dot(q) * invDet;
+}
+
+/// Intersects a ray with the 4 triangles of a packet. Updates closestT, lane, u and v if a closer hit than closestT was found
+bool IntersectPacket(const MeshRaycastBvh::TrianglePacket& packet, const float3& origin, const float3& dir, float& closestT, int& lane, float& u, float& v)
+{
+#ifdef MESHRAYCASTBVH_SSE
+    const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+    const __m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+    const __m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+    const __m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    // p = dir x e2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 mask = _mm_cmpgt_ps(det, zero);
+    if (!_mm_movemask_ps(mask))
+        return false;
+    __m128 invDet = _mm_div_ps(one, det);
+
+    // s = origin - v0
+    __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(packet.v0x));
+    __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(packet.v0y));
+    __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(packet.v0z));
+    __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+
+    // q = s x e1
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+    int hits = _mm_movemask_ps(mask);
+    if (!hits)
+        return false;
+
+    float ts[4], us[4], vs[4];
+    _mm_storeu_ps(ts, t);
+    _mm_storeu_ps(us, uu);
+    _mm_storeu_ps(vs, vv);
+    for(int i = 0; i < 4; ++i)
+        if ((hits & (1 << i)) && ts[i] < closestT)
+        {
+            closestT = ts[i];
+            lane = i;
+            u = us[i];
+            v = vs[i];
+        }
+    return true;
+#else
+    bool hit = false;
+    for(int i = 0; i < 4; ++i)
+    {
+        float lu, lv;
+        float t = IntersectTriangle(origin, dir, float3(packet.v0x[i], packet.v0y[i], packet.v0z[i]),
+            float3(packet.e1x[i], packet.e1y[i], packet.e1z[i]), float3(packet.e2x[i], packet.e2y[i], packet.e2z[i]), lu, lv);
+        if (t >= 0.f && t < closestT)
+        {
+            closestT = t;
+            lane = i;
+            u = lu;
+            v = lv;
+            hit = true;
+        }
+    }
+    return hit;
+#endif
+}
+
+}
+
+MeshRaycastBvhPtr MeshRaycastBvh::ForMesh(Ogre::Mesh* mesh)
+{
+    if (!mesh || mesh->hasSkeleton() || mesh->hasVertexAnimation())
+        return MeshRaycastBvhPtr();
+
+    BvhCache::iterator iter = bvhCache.find(mesh->getName());
+    if (iter != bvhCache.end())
+    {
+        if (iter->second.handle == mesh->getHandle() && iter->second.stateCount == mesh->getStateCount())
+            return iter->second.bvh;
+        iter->second.bvh->Cancel();
+        bvhCache.erase(iter);
+    }
+
+    PROFILE(MeshRaycastBvh_Create);
+    MeshRaycastBvhPtr bvh(new MeshRaycastBvh(mesh));
+    CachedBvh cached;
+    cached.bvh = bvh;
+    cached.handle = mesh->getHandle();
+    cached.stateCount = mesh->getStateCount();
+    bvhCache[mesh->getName()] = cached;
+
+    // Large meshes are built in the background; until then, raycasts fall back to testing all the copied triangles
+    if (bvh->triangles_.size() >= cMinTrianglesForThreadedBuild)
+    {
+        boost::mutex::scoped_lock lock(buildMutex);
+        if (!buildThreadQuit)
+        {
+            if (!buildThread)
+                buildThread = new boost::thread(&MeshRaycastBvh::BuildThread);
+            buildQueue.push_back(bvh);
+            buildCondition.notify_one();
+            return bvh;
+        }
+    }
+    bvh->Build();
+    return bvh;
+}
+
+void MeshRaycastBvh::Forget(Ogre::Mesh* mesh)
+{
+    if (!mesh)
+        return;
+    BvhCache::iterator iter = bvhCache.find(mesh->getName());
+    if (iter != bvhCache.end() && iter->second.handle == mesh->getHandle())
+    {
+        iter->second.bvh->Cancel();
+        bvhCache.erase(iter);
+    }
+}
+
+void MeshRaycastBvh::Shutdown()
+{
+    boost::thread* thread = 0;
+    {
+        boost::mutex::scoped_lock lock(buildMutex);
+        buildThreadQuit = true;
+        buildQueue.clear();
+        std::swap(thread, buildThread);
+        buildCondition.notify_all();
+    }
+
+    for(BvhCache::iterator iter = bvhCache.begin(); iter != bvhCache.end(); ++iter)
+        iter->second.bvh->Cancel();
+    bvhCache.clear();
+
+    if (thread)
+    {
+        thread->join();
+        delete thread;
+    }
+}
+
+void MeshRaycastBvh::BuildThread()
+{
+    for(;;)
+    {
+        MeshRaycastBvhPtr bvh;
+        {
+            boost::mutex::scoped_lock lock(buildMutex);
+            while(buildQueue.empty() && !buildThreadQuit)
+                buildCondition.wait(lock);
+            if (buildThreadQuit)
+                return;
+            bvh = buildQueue.front();
+            buildQueue.pop_front();
+        }
+        bvh->Build();
+    }
+}
+
+void MeshRaycastBvh::Cancel()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    cancelled_ = true;
+}
+
+bool MeshRaycastBvh::IsCancelled() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return cancelled_;
+}
+
+MeshRaycastBvh::MeshRaycastBvh(Ogre::Mesh* mesh) :
+    built_(false),
+    cancelled_(false)
+{
+    for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh* submesh = mesh->getSubMesh(i);
+        Ogre::VertexData* vertexData = submesh->useSharedVertices ? mesh->sharedVertexData : submesh->vertexData;
+        Ogre::IndexData* indexData = submesh->indexData;
+        if (!vertexData || !indexData || indexData->indexCount < 3)
+            continue;
+
+        const Ogre::VertexElement* posElem = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
+        if (!posElem)
+            continue; // No position element, can not raycast
+
+        Ogre::HardwareVertexBufferSharedPtr vbufPos = vertexData->vertexBufferBinding->getBuffer(posElem->getSource());
+        unsigned char* pos = static_cast<unsigned char*>(vbufPos->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+        unsigned posOffset = posElem->getOffset();
+        unsigned posSize = vbufPos->getVertexSize();
+
+        // Texcoord element is not mandatory
+        unsigned char* texCoord = 0;
+        unsigned texOffset = 0;
+        unsigned texSize = 0;
+        Ogre::HardwareVertexBufferSharedPtr vbufTex;
+        const Ogre::VertexElement *texElem = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES);
+        if (texElem)
+        {
+            vbufTex = vertexData->vertexBufferBinding->getBuffer(texElem->getSource());
+            if (vbufTex != vbufPos)
+                texCoord = static_cast<unsigned char*>(vbufTex->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+            else
+                texCoord = pos;
+            texOffset = texElem->getOffset();
+            texSize = vbufTex->getVertexSize();
+        }
+
+        Ogre::HardwareIndexBufferSharedPtr ibuf = indexData->indexBuffer;
+        unsigned long* pLong = static_cast<unsigned long*>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+        unsigned short* pShort = reinterpret_cast<unsigned short*>(pLong);
+        bool use32BitIndices = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
+
+        vertices_.reserve(vertices_.size() + indexData->indexCount);
+        triangles_.reserve(triangles_.size() + indexData->indexCount / 3);
+        for(unsigned j = 0; j < indexData->indexCount - 2; j += 3)
+        {
+            unsigned idx[3];
+            for(int k = 0; k < 3; ++k)
+                idx[k] = use32BitIndices ? ((u32*)pLong)[j+k] : pShort[j+k];
+
+            TriangleInfo info;
+            info.subMeshIndex = i;
+            info.triangleIndex = j;
+            for(int k = 0; k < 3; ++k)
+            {
+                vertices_.push_back(*((Ogre::Vector3*)(pos + posOffset + idx[k] * posSize)));
+                info.uv[k] = texCoord ? float2(*((Ogre::Vector2*)(texCoord + texOffset + idx[k] * texSize))) : float2(0.f, 0.f);
+            }
+            triangles_.push_back(info);
+        }
+
+        vbufPos->unlock();
+        if (!vbufTex.isNull() && vbufTex != vbufPos)
+            vbufTex->unlock();
+        ibuf->unlock();
+    }
+}
+
+bool MeshRaycastBvh::IsBuilt() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return built_;
+}
+
+void MeshRaycastBvh::Build()
+{
+    // Note: may run in the build thread, so do not use the profiler or logging here
+    if (IsCancelled())
+        return;
+
+    std::vector<BuildTriangle> tris(triangles_.size());
+    for(size_t i = 0; i < tris.size(); ++i)
+    {
+        const float3* v = &vertices_[i * 3];
+        tris[i].aabbMin = v[0].Min(v[1]).Min(v[2]);
+        tris[i].aabbMax = v[0].Max(v[1]).Max(v[2]);
+        tris[i].centroid = (tris[i].aabbMin + tris[i].aabbMax) * 0.5f;
+        tris[i].index = (int)i;
+    }
+
+    std::vector<Node> nodes;
+    std::vector<TrianglePacket> packets;
+    nodes.reserve(tris.size() / 2 + 1);
+    packets.reserve(tris.size() / 3 + 1);
+    nodes.push_back(Node());
+
+    std::vector<BuildItem> work;
+    BuildItem root = { 0, 0, tris.size(), 0 };
+    work.push_back(root);
+    unsigned numItems = 0;
+    while(!work.empty())
+    {
+        if (++numItems % cCancelCheckInterval == 0 && IsCancelled())
+            return;
+
+        BuildItem item = work.back();
+        work.pop_back();
+
+        float3 aabbMin = float3(FLOAT_INF, FLOAT_INF, FLOAT_INF), aabbMax = -aabbMin;
+        float3 centroidMin = aabbMin, centroidMax = aabbMax;
+        for(size_t i = item.begin; i < item.end; ++i)
+        {
+            aabbMin = aabbMin.Min(tris[i].aabbMin);
+            aabbMax = aabbMax.Max(tris[i].aabbMax);
+            centroidMin = centroidMin.Min(tris[i].centroid);
+            centroidMax = centroidMax.Max(tris[i].centroid);
+        }
+        nodes[item.node].aabbMin = aabbMin;
+        nodes[item.node].aabbMax = aabbMax;
+
+        size_t count = item.end - item.begin;
+        int axis = (centroidMax - centroidMin).MaxElementIndex();
+        float extent = centroidMax[axis] - centroidMin[axis];
+        size_t mid = item.begin;
+        if (count > cMaxLeafTriangles && extent > 0.f && item.depth < cMaxDepth)
+        {
+            // Find the best split plane along the longest centroid axis with the binned surface area heuristic
+            size_t binCounts[cNumSplitBins] = {};
+            float3 binMin[cNumSplitBins], binMax[cNumSplitBins];
+            for(int b = 0; b < cNumSplitBins; ++b)
+            {
+                binMin[b] = float3(FLOAT_INF, FLOAT_INF, FLOAT_INF);
+                binMax[b] = -binMin[b];
+            }
+            float binScale = cNumSplitBins / extent;
+            for(size_t i = item.begin; i < item.end; ++i)
+            {
+                int b = std::min((int)((tris[i].centroid[axis] - centroidMin[axis]) * binScale), cNumSplitBins - 1);
+                ++binCounts[b];
+                binMin[b] = binMin[b].Min(tris[i].aabbMin);
+                binMax[b] = binMax[b].Max(tris[i].aabbMax);
+            }
+
+            float rightArea[cNumSplitBins];
+            size_t rightCount[cNumSplitBins];
+            float3 accMin = float3(FLOAT_INF, FLOAT_INF, FLOAT_INF), accMax = -accMin;
+            size_t accCount = 0;
+            for(int b = cNumSplitBins - 1; b > 0; --b)
+            {
+                accMin = accMin.Min(binMin[b]);
+                accMax = accMax.Max(binMax[b]);
+                accCount += binCounts[b];
+                rightArea[b] = accCount ? SurfaceArea(accMin, accMax) : 0.f;
+                rightCount[b] = accCount;
+            }
+
+            float bestCost = FLOAT_INF;
+            int bestSplit = -1;
+            accMin = float3(FLOAT_INF, FLOAT_INF, FLOAT_INF);
+            accMax = -accMin;
+            accCount = 0;
+            for(int b = 0; b < cNumSplitBins - 1; ++b)
+            {
+                accMin = accMin.Min(binMin[b]);
+                accMax = accMax.Max(binMax[b]);
+                accCount += binCounts[b];
+                if (!accCount || !rightCount[b+1])
+                    continue;
+                float cost = SurfaceArea(accMin, accMax) * accCount + rightArea[b+1] * rightCount[b+1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+
+            if (bestSplit >= 0)
+            {
+                BuildTriangle* first = &tris[0] + item.begin;
+                BuildTriangle* last = &tris[0] + item.end;
+                BuildTriangle* split = first;
+                for(BuildTriangle* t = first; t != last; ++t)
+                {
+                    int b = std::min((int)((t->centroid[axis] - centroidMin[axis]) * binScale), cNumSplitBins - 1);
+                    if (b <= bestSplit)
+                        std::swap(*t, *split++);
+                }
+                mid = item.begin + (split - first);
+            }
+        }
+
+        if (mid > item.begin && mid < item.end)
+        {
+            Node& node = nodes[item.node];
+            node.first = (unsigned)nodes.size();
+            node.count = 0;
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            BuildItem left = { node.first, item.begin, mid, item.depth + 1 };
+            BuildItem right = { node.first + 1, mid, item.end, item.depth + 1 };
+            work.push_back(left);
+            work.push_back(right);
+        }
+        else
+        {
+            // Leaf: store the triangles in packets of 4. Padding lanes get zero edges, which never hit
+            Node& node = nodes[item.node];
+            node.first = (unsigned)packets.size();
+            node.count = (unsigned)((count + 3) / 4);
+            for(size_t i = item.begin; i < item.end; i += 4)
+            {
+                TrianglePacket packet;
+                memset(&packet, 0, sizeof packet);
+                for(int lane = 0; lane < 4; ++lane)
+                {
+                    packet.triangle[lane] = -1;
+                    if (i + lane >= item.end)
+                        continue;
+                    int index = tris[i + lane].index;
+                    const float3* v = &vertices_[index * 3];
+                    float3 e1 = v[1] - v[0];
+                    float3 e2 = v[2] - v[0];
+                    packet.v0x[lane] = v[0].x; packet.v0y[lane] = v[0].y; packet.v0z[lane] = v[0].z;
+                    packet.e1x[lane] = e1.x; packet.e1y[lane] = e1.y; packet.e1z[lane] = e1.z;
+                    packet.e2x[lane] = e2.x; packet.e2y[lane] = e2.y; packet.e2z[lane] = e2.z;
+                    packet.triangle[lane] = index;
+                }
+                packets.push_back(packet);
+            }
+        }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (cancelled_)
+        return;
+    nodes_.swap(nodes);
+    packets_.swap(packets);
+    built_ = true;
+}
+
+bool MeshRaycastBvh::Raycast(const Ray& ray, MeshRaycastHit& hit) const
+{
+    if (!IsBuilt())
+        return RaycastAll(ray, hit);
+    if (nodes_.empty() || triangles_.empty())
+        return false;
+
+    PROFILE(MeshRaycastBvh_Raycast);
+    const float3 invDir = ray.dir.Recip();
+    float closestT = FLOAT_INF;
+    int closestTriangle = -1;
+    float closestU = 0.f, closestV = 0.f;
+
+    unsigned stack[cMaxDepth * 2 + 2];
+    int stackSize = 0;
+    if (IntersectAabb(nodes_[0].aabbMin, nodes_[0].aabbMax, ray.pos, invDir, closestT) != FLOAT_INF)
+        stack[stackSize++] = 0;
+
+    while(stackSize > 0)
+    {
+        const Node& node = nodes_[stack[--stackSize]];
+        if (node.count)
+        {
+            for(unsigned i = node.first; i < node.first + node.count; ++i)
+            {
+                int lane;
+                float u, v;
+                if (IntersectPacket(packets_[i], ray.pos, ray.dir, closestT, lane, u, v))
+                {
+                    closestTriangle = packets_[i].triangle[lane];
+                    closestU = u;
+                    closestV = v;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first, and skip children further away than the closest hit so far
+        float tLeft = IntersectAabb(nodes_[node.first].aabbMin, nodes_[node.first].aabbMax, ray.pos, invDir, closestT);
+        float tRight = IntersectAabb(nodes_[node.first + 1].aabbMin, nodes_[node.first + 1].aabbMax, ray.pos, invDir, closestT);
+        if (tLeft <= tRight)
+        {
+            if (tRight != FLOAT_INF)
+                stack[stackSize++] = node.first + 1;
+            if (tLeft != FLOAT_INF)
+                stack[stackSize++] = node.first;
+        }
+        else
+        {
+            if (tLeft != FLOAT_INF)
+                stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+        }
+    }
+
+    if (closestTriangle < 0)
+        return false;
+    FillHit(closestTriangle, closestT, closestU, closestV, hit);
+    return true;
+}
+
+bool MeshRaycastBvh::RaycastAll(const Ray& ray, MeshRaycastHit& hit) const
+{
+    PROFILE(MeshRaycastBvh_RaycastAll);
+    float closestT = FLOAT_INF;
+    int closestTriangle = -1;
+    float closestU = 0.f, closestV = 0.f;
+    for(size_t i = 0; i < triangles_.size(); ++i)
+    {
+        const float3* v = &vertices_[i * 3];
+        float u, w;
+        float t = IntersectTriangle(ray.pos, ray.dir, v[0], v[1] - v[0], v[2] - v[0], u, w);
+        if (t >= 0.f && t < closestT)
+        {
+            closestT = t;
+            closestTriangle = (int)i;
+            closestU = u;
+            closestV = w;
+        }
+    }
+
+    if (closestTriangle < 0)
+        return false;
+    FillHit(closestTriangle, closestT, closestU, closestV, hit);
+    return true;
+}
+
+void MeshRaycastBvh::FillHit(int triangle, float t, float u, float v, MeshRaycastHit& hit) const
+{
+    const TriangleInfo& info = triangles_[triangle];
+    hit.t = t;
+    hit.subMeshIndex = info.subMeshIndex;
+    hit.triangleIndex = info.triangleIndex;
+    hit.v0 = vertices_[triangle * 3];
+    hit.v1 = vertices_[triangle * 3 + 1];
+    hit.v2 = vertices_[triangle * 3 + 2];
+    hit.uv = info.uv[0] * (1.f - u - v) + info.uv[1] * u + info.uv[2] * v;
+}
@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "Math/float2.h"
+#include "Math/float3.h"
+#include "Math/MathFwd.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace Ogre
+{
+    class Mesh;
+}
+
+/// Result of a MeshRaycastBvh::Raycast.
+struct MeshRaycastHit
+{
+    /// Distance along the ray, in units of the ray direction
+    float t;
+    /// Submesh index
+    unsigned subMeshIndex;
+    /// Offset of the triangle's first index in the submesh index buffer
+    unsigned triangleIndex;
+    /// Triangle vertices
+    float3 v0, v1, v2;
+    /// Texture coordinate at the hit point. (0,0) if the submesh has no texture coordinates
+    float2 uv;
+};
+
+/// CPU-side bounding volume hierarchy of the triangles of a static Ogre mesh, for fast triangle-level raycasts.
+/** The triangles are copied out of the hardware buffers once. The trees of large meshes are built on a background thread;
+    until the tree is ready, raycasts test the copied triangles one by one.
+    Trees are cached by mesh name, and rebuilt when the mesh is recreated or reloaded; use ForMesh() to get the tree of a mesh. Leaves store triangles in packets of 4,
+    which are tested in parallel using SSE if available. Only front-facing triangles are hit, like in Ogre::Math::intersects. */
+class OGRE_MODULE_API MeshRaycastBvh
+{
+public:
+    /// Returns the cached raycast BVH of a mesh, creating it if necessary.
+    /** Meshes with skeletal or vertex animation are not supported, as their triangles deform; returns null for those. */
+    static boost::shared_ptr<MeshRaycastBvh> ForMesh(Ogre::Mesh* mesh);
+
+    /// Removes the cached raycast BVH of a mesh and cancels its build. Call when the mesh is unloaded or its geometry changes.
+    static void Forget(Ogre::Mesh* mesh);
+
+    /// Cancels the tree builds in progress, waits for the build thread to exit and clears the cache.
+    /** Call before the Ogre meshes are destroyed on shutdown. Trees requested afterwards are built immediately. */
+    static void Shutdown();
+
+    /// Raycasts the mesh in its local space.
+    /** @param ray Local space ray
+        @param hit [out] Closest hit. Not modified if nothing was hit
+        @return True if a triangle was hit */
+    bool Raycast(const Ray& ray, MeshRaycastHit& hit) const;
+
+    /// Returns whether the tree has been built. Until then, raycasts test all triangles.
+    bool IsBuilt() const;
+
+    /// Returns the number of triangles.
+    size_t NumTriangles() const { return triangles_.size(); }
+
+    /// Bounding volume hierarchy node.
+    struct Node
+    {
+        float3 aabbMin;
+        /// First child node for inner nodes, first triangle packet for leaves
+        unsigned first;
+        float3 aabbMax;
+        /// Number of triangle packets for leaves, 0 for inner nodes. The children of inner nodes are at first and first + 1
+        unsigned count;
+    };
+
+    /// Four triangles in structure-of-arrays layout, stored as a vertex and two edges.
+    struct TrianglePacket
+    {
+        float v0x[4], v0y[4], v0z[4];
+        float e1x[4], e1y[4], e1z[4];
+        float e2x[4], e2y[4], e2z[4];
+        /// Triangle indices of the lanes, or -1 for padding
+        int triangle[4];
+    };
+
+private:
+    /// Identifies the source triangle of the mesh.
+    struct TriangleInfo
+    {
+        unsigned subMeshIndex;
+        unsigned triangleIndex;
+        float2 uv[3];
+    };
+
+    /// Copies the triangles out of the mesh.
+    explicit MeshRaycastBvh(Ogre::Mesh* mesh);
+
+    /// Builds the tree. Called in the build thread for large meshes. Returns early if the build is cancelled.
+    void Build();
+
+    /// Makes a build in progress return early, and prevents a queued build from starting.
+    void Cancel();
+
+    /// Returns whether the build has been cancelled.
+    bool IsCancelled() const;
+
+    /// Builds the queued trees until Shutdown() is called.
+    static void BuildThread();
+
+    /// Raycasts all triangles one by one.
+    bool RaycastAll(const Ray& ray, MeshRaycastHit& hit) const;
+
+    /// Fills in the hit data of a triangle.
+    void FillHit(int triangle, float t, float u, float v, MeshRaycastHit& hit) const;
+
+    /// Triangle vertices, 3 per triangle. Immutable after construction
+    std::vector<float3> vertices_;
+    /// Source triangles. Immutable after construction
+    std::vector<TriangleInfo> triangles_;
+
+    /// Guards the publication of the tree from the build thread, and the cancellation
+    mutable boost::mutex mutex_;
+    /// Whether nodes_ and packets_ have been built. Protected by mutex_; nodes_ and packets_ are immutable once this is set
+    bool built_;
+    /// Whether the build has been cancelled. Protected by mutex_
+    bool cancelled_;
+    std::vector<Node> nodes_;
+    std::vector<TrianglePacket> packets_;
+};
+
+typedef boost::shared_ptr<MeshRaycastBvh> MeshRaycastBvhPtr;
@@ -5,6 +5,7 @@
 #include "OgreMeshAsset.h"
 #include "OgreConversionUtils.h"
 #include "OgreRenderingModule.h"
+#include "MeshRaycastBvh.h"
 #include "AssetAPI.h"
 #include "AssetCache.h"
 #include "Profiler.h"
@@ -169,6 +170,7 @@ void OgreMeshAsset::DoUnload()
         return;
 
     std::string meshName = ogreMesh->getName();
+    MeshRaycastBvh::Forget(ogreMesh.get());
     ogreMesh.setNull();
     try
     {
@@ -57,6 +57,7 @@ class EC_Camera;
 class EC_Light;
 class EC_Mesh;
 class EC_Placeable;
+class MeshBatcher;
 
 typedef boost::shared_ptr<OgreWorld> OgreWorldPtr;
 typedef boost::weak_ptr<OgreWorld> OgreWorldWeakPtr;
@@ -21,11 +21,14 @@
 #include "Scene.h"
 #include "RendererSettings.h"
 #include "OgreWorld.h"
+#include "MeshBatcher.h"
 #include "OgreMeshAsset.h"
+#include "MeshRaycastBvh.h"
 #include "OgreParticleAsset.h"
 #include "OgreSkeletonAsset.h"
 #include "OgreMaterialAsset.h"
 #include "TextureAsset.h"
+#include "TextureStreamer.h"
 
 #include "AssetAPI.h"
 #include "AssetCache.h"
@@ -149,6 +152,8 @@ void OgreRenderingModule::Uninitialize()
     // We're shutting down. Force a release of all loaded asset objects from the Asset API so that 
     // no refs to Ogre assets remain - below 'renderer.reset()' is going to delete Ogre::Root.
     framework_->Asset()->ForgetAllAssets();
+    // Cancel the raycast tree builds in progress and join the build thread before the module is unloaded
+    MeshRaycastBvh::Shutdown();
 
     // Clear up the renderer object, so that it will not be left dangling.
     framework_->RegisterRenderer(0);
@@ -157,6 +162,8 @@ void OgreRenderingModule::Uninitialize()
 void OgreRenderingModule::Update(f64 frametime)
 {
     PROFILE(OgreRenderingModule_Update);
+    if (renderer && renderer->GetTextureStreamer())
+        renderer->GetTextureStreamer()->Update(frametime);
 }
 
 void OgreRenderingModule::ShowSettingsWindow()
@@ -187,6 +194,36 @@ void OgreRenderingModule::ConsoleStats()
         c->Print("Best FPS: " + QString::number(stats.bestFPS));
         c->Print("Triangles: " + QString::number(stats.triangleCount));
         c->Print("Batches: " + QString::number(stats.batchCount));
+        c->Print("Texture memory: " + QString::number(Ogre::TextureManager::getSingleton().getMemoryUsage() / (1024 * 1024)) + " MB");
+        if (renderer->GetTextureStreamer())
+        {
+            TextureStreamer::Stats texStats = renderer->GetTextureStreamer()->GetStats();
+            c->Print("Streamed textures: " + QString::number(texStats.numTextures) + ", " + QString::number(texStats.numReduced) +
+                " below full resolution, " + QString::number(texStats.numPending) + " loading; " +
+                QString::number(texStats.residentBytes / (1024 * 1024)) + " MB of " + QString::number(texStats.fullBytes / (1024 * 1024)) +
+                " MB at full resolution, budget " + (texStats.budgetBytes ? QString::number(texStats.budgetBytes / (1024 * 1024)) + " MB" : QString("unlimited")));
+        }
+        for(std::map<Scene*, OgreWorldPtr>::const_iterator i = renderer->ogreWorlds_.begin(); i != renderer->ogreWorlds_.end(); ++i)
+        {
+            AnimationLodStats animStats = i->second->GetAnimationLodStats();
+            uint numAnimated = animStats.numFull + animStats.numReduced + animStats.numFrozen + animStats.numOffscreen;
+            if (numAnimated)
+                c->Print("Animated meshes in scene " + i->first->Name() + ": " + QString::number(animStats.numFull) + " full rate, " +
+                    QString::number(animStats.numReduced) + " reduced rate, " + QString::number(animStats.numFrozen) + " frozen, " +
+                    QString::number(animStats.numOffscreen) + " offscreen; " + QString::number(animStats.numSkipped) + "/" +
+                    QString::number(numAnimated) + " skeleton updates skipped");
+            
+            MeshBatcher *batcher = i->second->GetMeshBatcher();
+            if (!batcher)
+                continue;
+            MeshBatcher::Stats batchStats = batcher->GetStats();
+            if (!batchStats.numMeshes)
+                continue;
+            c->Print("Static mesh batches in scene " + i->first->Name() + ": " + QString::number(batchStats.numBatchedMeshes) + "/" +
+                QString::number(batchStats.numMeshes) + " meshes batched in " + QString::number(batchStats.numCells) + " cells, " +
+                QString::number(batchStats.numBatchDrawCalls) + " draw calls instead of " + QString::number(batchStats.numMeshDrawCalls) +
+                " (" + QString::number((int)batchStats.numMeshDrawCalls - (int)batchStats.numBatchDrawCalls) + " saved)");
+        }
         return;
     }
     else
@@ -202,10 +239,14 @@ void OgreRenderingModule::OnSceneAdded(const QString& name)
         return;
     }
     
-    // Add an OgreWorld to the scene
-    OgreWorldPtr newWorld(new OgreWorld(renderer.get(), scene));
-    renderer->ogreWorlds_[scene.get()] = newWorld;
-    scene->setProperty(OgreWorld::PropertyName(), QVariant::fromValue<QObject*>(newWorld.get()));
+    // Add an OgreWorld to the scene, unless running a headless server without a scene graph.
+    // Without the world, EC_Placeable computes its world transform with the scene's TransformHierarchy.
+    if (!framework_->IsHeadless() || !framework_->HasCommandLineParameter("--norender"))
+    {
+        OgreWorldPtr newWorld(new OgreWorld(renderer.get(), scene));
+        renderer->ogreWorlds_[scene.get()] = newWorld;
+        scene->setProperty(OgreWorld::PropertyName(), QVariant::fromValue<QObject*>(newWorld.get()));
+    }
 }
 
 void OgreRenderingModule::OnSceneRemoved(const QString& name)
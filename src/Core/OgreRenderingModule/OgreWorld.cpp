@@ -10,6 +10,7 @@
 #include "EC_Camera.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
+#include "EC_AnimationController.h"
 #include "Scene.h"
 #include "CompositionHandler.h"
 #include "Profiler.h"
@@ -26,6 +27,7 @@
 #include "Math/Sphere.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "OgreBulletCollisionsDebugLines.h"
+#include "MeshBatcher.h"
 
 #include <Ogre.h>
 
@@ -35,6 +37,9 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     scene_(scene),
     sceneManager_(0),
     rayQuery_(0),
+    meshBatcher_(0),
+    lodCameraFrame_(-1),
+    animationLodFrame_(-1),
     debugLines_(0),
     debugLinesNoDepth_(0)
 {
@@ -55,6 +60,17 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
         
         SetupShadows();
         
+        float cellSize = 100.0f;
+        if (framework_->HasCommandLineParameter("--meshbatchcellsize"))
+        {
+            float size = framework_->CommandLineParameters("--meshbatchcellsize").back().toFloat();
+            if (size > 0.0f)
+                cellSize = size;
+            else
+                LogWarning("OgreWorld: Invalid --meshbatchcellsize value, using the default of " + QString::number(cellSize));
+        }
+        meshBatcher_ = new MeshBatcher(sceneManager_, cellSize);
+        
 #include "DisableMemoryLeakCheck.h"
         debugLines_ = new DebugLines("PhysicsDebug");
         debugLinesNoDepth_ = new DebugLines("PhysicsDebugNoDepth");
@@ -83,6 +99,9 @@ OgreWorld::~OgreWorld()
         SAFE_DELETE(debugLinesNoDepth_);
     }
     
+    // Restore the batched entities before the scene manager and the entities are destroyed
+    SAFE_DELETE(meshBatcher_);
+    
     // Remove all compositors.
     /// \todo This does not work with a proper multiscene approach
     OgreRenderer::CompositionHandler* comp = renderer_->GetCompositionHandler();
@@ -152,7 +171,7 @@ RaycastResult* OgreWorld::RaycastInternal(unsigned layerMask)
             continue;
 
         /// \todo Do we want results for invisible entities?
-        if (!entry.movable->isVisible())
+        if (!entry.movable->isVisible() && !(meshBatcher_ && meshBatcher_->IsBatchedEntity(entry.movable)))
             continue;
         
         const Ogre::Any& any = entry.movable->getUserAny();
@@ -337,6 +356,24 @@ void OgreWorld::StopViewTracking(Entity* entity)
 void OgreWorld::OnUpdated(float timeStep)
 {
     PROFILE(OgreWorld_OnUpdated);
+    if (meshBatcher_)
+        meshBatcher_->Update(timeStep);
+    
+    // Select the LOD levels of the meshes that use screen size thresholds
+    if (!lodMeshes_.empty())
+    {
+        Ogre::Camera* camera = LodCamera();
+        if (camera)
+        {
+            for(std::set<EC_Mesh*>::iterator i = lodMeshes_.begin(); i != lodMeshes_.end(); ++i)
+            {
+                Ogre::Entity* entity = (*i)->GetEntity();
+                if (entity && entity->isVisible())
+                    (*i)->SelectLodLevel(ScreenSize(camera, entity->getWorldBoundingSphere(true)));
+            }
+        }
+    }
+    
     // Do nothing if visibility not being tracked for any entities
     if (visibilityTrackedEntities_.empty())
     {
@@ -509,6 +546,79 @@ void OgreWorld::SetupShadows()
 #endif
 }
 
+Ogre::Camera* OgreWorld::LodCamera()
+{
+    // Look up the camera once per frame, but keep only a weak reference in case the camera is removed during the frame
+    int frameNumber = framework_->Frame()->FrameNumber();
+    if (frameNumber != lodCameraFrame_)
+    {
+        lodCameraFrame_ = frameNumber;
+        EC_Camera* cameraComponent = VerifyCurrentSceneCameraComponent();
+        lodCamera_ = cameraComponent ? cameraComponent->shared_from_this() : ComponentPtr();
+    }
+    
+    ComponentPtr cameraComponent = lodCamera_.lock();
+    return cameraComponent ? checked_static_cast<EC_Camera*>(cameraComponent.get())->GetCamera() : 0;
+}
+
+float OgreWorld::ScreenSize(Ogre::Camera* camera, const Ogre::Sphere& sphere)
+{
+    if (!camera)
+        return 1.0f;
+    
+    if (camera->getProjectionType() == Ogre::PT_ORTHOGRAPHIC)
+        return camera->getOrthoWindowHeight() > 0.0f ? 2.0f * sphere.getRadius() / camera->getOrthoWindowHeight() : 1.0f;
+    
+    float distance = (sphere.getCenter() - camera->getDerivedPosition()).length();
+    float tanHalfFov = Ogre::Math::Tan(camera->getFOVy() * 0.5f);
+    if (distance <= sphere.getRadius() || tanHalfFov <= 0.0f)
+        return 1.0f;
+    return sphere.getRadius() / (distance * tanHalfFov);
+}
+
+void OgreWorld::StartLodTracking(EC_Mesh* mesh)
+{
+    if (mesh)
+        lodMeshes_.insert(mesh);
+}
+
+void OgreWorld::StopLodTracking(EC_Mesh* mesh)
+{
+    lodMeshes_.erase(mesh);
+}
+
+void OgreWorld::CountAnimationLod(int lodLevel, bool skipped)
+{
+    int frameNumber = framework_->Frame()->FrameNumber();
+    if (frameNumber != animationLodFrame_)
+    {
+        lastAnimationLodStats_ = animationLodFrame_ == frameNumber - 1 ? animationLodStats_ : AnimationLodStats();
+        animationLodStats_ = AnimationLodStats();
+        animationLodFrame_ = frameNumber;
+    }
+    
+    switch(lodLevel)
+    {
+    case EC_AnimationController::LOD_FULL: ++animationLodStats_.numFull; break;
+    case EC_AnimationController::LOD_REDUCED: ++animationLodStats_.numReduced; break;
+    case EC_AnimationController::LOD_FROZEN: ++animationLodStats_.numFrozen; break;
+    case EC_AnimationController::LOD_OFFSCREEN: ++animationLodStats_.numOffscreen; break;
+    }
+    if (skipped)
+        ++animationLodStats_.numSkipped;
+}
+
+AnimationLodStats OgreWorld::GetAnimationLodStats()
+{
+    // If no animations were counted during the last frame, there are none
+    int frameNumber = framework_->Frame()->FrameNumber();
+    if (animationLodFrame_ == frameNumber)
+        return lastAnimationLodStats_;
+    else if (animationLodFrame_ == frameNumber - 1)
+        return animationLodStats_;
+    return AnimationLodStats();
+}
+
 Ogre::Camera* OgreWorld::VerifyCurrentSceneCamera() const
 {
     EC_Camera* cameraComponent = VerifyCurrentSceneCameraComponent();
@@ -20,6 +20,28 @@ class Framework;
 class DebugLines;
 class Transform;
 
+namespace Ogre
+{
+    class Sphere;
+}
+
+/// Counts of animated entities by animation level of detail during one frame, see EC_AnimationController.
+struct AnimationLodStats
+{
+    AnimationLodStats() : numFull(0), numReduced(0), numFrozen(0), numOffscreen(0), numSkipped(0) {}
+
+    /// Number of entities animated every frame
+    uint numFull;
+    /// Number of entities animated at a reduced rate because of their small screen size
+    uint numReduced;
+    /// Number of entities with frozen animations because of their very small screen size
+    uint numFrozen;
+    /// Number of entities with frozen animations because they are outside the view or hidden
+    uint numOffscreen;
+    /// Number of entities whose animation update, and skeleton update, was skipped
+    uint numSkipped;
+};
+
 /// Contains the Ogre representation of a scene, ie. the Ogre Scene
 class OGRE_MODULE_API OgreWorld : public QObject, public boost::enable_shared_from_this<OgreWorld>
 {
@@ -90,6 +112,25 @@ public slots:
     Ogre::SceneManager* GetSceneManager() { return sceneManager_; }
     /// Return the parent scene
     ScenePtr GetScene() { return scene_.lock(); }
+    /// Return the static mesh batcher, or null if headless
+    MeshBatcher* GetMeshBatcher() const { return meshBatcher_; }
+    
+    /// Return the Ogre camera of the currently active camera if it is in this scene, for level of detail decisions. Return null if none, f.ex. when headless
+    Ogre::Camera* LodCamera();
+    /// Return the projected height of a world space bounding sphere as a fraction of the viewport height, ie. 1 fills the view vertically
+    static float ScreenSize(Ogre::Camera* camera, const Ogre::Sphere& sphere);
+    
+    /// Start selecting the LOD level of a mesh each frame by its screen size. Called by EC_Mesh when it has LOD screen sizes set
+    void StartLodTracking(EC_Mesh* mesh);
+    /// Stop selecting the LOD level of a mesh
+    void StopLodTracking(EC_Mesh* mesh);
+    
+    /// Count an animated entity in the animation LOD statistics of this frame. Called by EC_AnimationController
+    /** @param lodLevel EC_AnimationController::LodLevel of the entity
+        @param skipped Whether the animation update was skipped this frame */
+    void CountAnimationLod(int lodLevel, bool skipped);
+    /// Return the animation LOD statistics of the last full frame
+    AnimationLodStats GetAnimationLodStats();
 
     // Debugging aids:
     void DebugDrawAABB(const AABB &aabb, float r, float g, float b, bool depthTest = true);
@@ -122,7 +163,7 @@ signals:
     void EntityLeaveView(Entity* entity);
 
 private slots:
-    /// Handle frame update. Used for entity visibility tracking
+    /// Handle frame update. Used for entity visibility tracking, updating the mesh batches and selecting mesh LOD levels
     void OnUpdated(float timeStep);
 
 private:
@@ -168,6 +209,24 @@ private:
     /// Entities being tracked for visibility changes
     std::vector<EntityWeakPtr> visibilityTrackedEntities_;
     
+    /// Static mesh batcher, null if headless
+    MeshBatcher* meshBatcher_;
+    
+    /// Camera component used for level of detail decisions during lodCameraFrame_
+    ComponentWeakPtr lodCamera_;
+    /// Frame number lodCamera_ was looked up on
+    int lodCameraFrame_;
+    
+    /// Meshes with their LOD level selected by screen size
+    std::set<EC_Mesh*> lodMeshes_;
+    
+    /// Animation LOD statistics being accumulated for animationLodFrame_
+    AnimationLodStats animationLodStats_;
+    /// Animation LOD statistics of the last full frame
+    AnimationLodStats lastAnimationLodStats_;
+    /// Frame number animationLodStats_ are accumulated for
+    int animationLodFrame_;
+    
     /// Debug geometry object
     DebugLines* debugLines_;
     /// Debug geometry object, no depth testing
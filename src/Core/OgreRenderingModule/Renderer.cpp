@@ -14,6 +14,7 @@
 #include "UiGraphicsView.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "CompositionHandler.h"
+#include "TextureStreamer.h"
 #include "OgreDefaultHardwareBufferManager.h"
 #include "Scene.h"
 #include "CoreException.h"
@@ -135,7 +136,8 @@ namespace OgreRenderer
         resized_dirty_(0),
         view_distance_(500.0f),
         shadowquality_(Shadows_High),
-        texturequality_(Texture_Normal)
+        texturequality_(Texture_Normal),
+        textureStreamer_(0)
     {
         c_handler_ = new CompositionHandler;
         logListener = new OgreLogListener(framework_->HasCommandLineParameter("--hide_benign_ogre_messages"));
@@ -152,6 +154,8 @@ namespace OgreRenderer
         // Delete all worlds that still exist
         ogreWorlds_.clear();
         
+        SAFE_DELETE(textureStreamer_);
+        
         // Delete the default camera & scene
         if (defaultScene_)
         {
@@ -179,6 +183,11 @@ namespace OgreRenderer
         // Texture quality
         if (!framework_->Config()->HasValue(configData, "texture quality"))
             framework_->Config()->Set(configData, "texture quality", 1);
+        // Texture streaming, and the memory budget of the streamed textures in megabytes
+        if (!framework_->Config()->HasValue(configData, "texture streaming"))
+            framework_->Config()->Set(configData, "texture streaming", true);
+        if (!framework_->Config()->HasValue(configData, "texture budget"))
+            framework_->Config()->Set(configData, "texture budget", 512);
         // Soft shadow
         if (!framework_->Config()->HasValue(configData, "soft shadow"))
             framework_->Config()->Set(configData, "soft shadow", false);
@@ -330,6 +339,11 @@ namespace OgreRenderer
         
             mainViewport = renderWindow->OgreRenderWindow()->addViewport(dummyDefaultCamera);
             c_handler_->Initialize(framework_ ,mainViewport);
+            
+            textureStreamer_ = new TextureStreamer(this);
+            textureStreamer_->SetEnabled(framework_->Config()->Get(configData, "texture streaming").toBool());
+            textureStreamer_->SetBudget((size_t)std::max(framework_->Config()->Get(configData, "texture budget").toInt(), 0) * 1024 * 1024);
+            textureStreamer_->SetQualityLevel(texturequality_ == Texture_Low ? 1 : 0);
         }
 
         initialized_ = true;
@@ -363,8 +377,23 @@ namespace OgreRenderer
 
     void Renderer::SetTextureQuality(TextureQuality newquality)
     {
-        // We cannot effect the new setting immediately, so save only to config
         framework_->Config()->Set(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "texture quality", (int)newquality);
+        texturequality_ = newquality;
+        if (textureStreamer_)
+            textureStreamer_->SetQualityLevel(texturequality_ == Texture_Low ? 1 : 0);
+    }
+
+    int Renderer::GetTextureBudget() const
+    {
+        return textureStreamer_ ? (int)(textureStreamer_->Budget() / (1024 * 1024)) : 0;
+    }
+
+    void Renderer::SetTextureBudget(int megabytes)
+    {
+        megabytes = std::max(megabytes, 0);
+        framework_->Config()->Set(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "texture budget", megabytes);
+        if (textureStreamer_)
+            textureStreamer_->SetBudget((size_t)megabytes * 1024 * 1024);
     }
 
     QStringList Renderer::LoadPlugins(const std::string& plugin_filename)
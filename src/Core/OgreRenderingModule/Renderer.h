@@ -38,6 +38,7 @@ namespace OgreRenderer
     };
 
     class OgreLogListener;
+    class TextureStreamer;
 
     /// Ogre renderer
     /** Created by OgreRenderingModule. Implements the IRenderer.
@@ -156,9 +157,18 @@ namespace OgreRenderer
         /// Returns texture quality
         TextureQuality GetTextureQuality() const { return texturequality_; }
 
-        /// Sets texture quality. Note: changes need viewer restart to take effect
+        /// Sets texture quality. Streamed textures are reloaded at the new quality, other textures take it into use when they are next loaded
         void SetTextureQuality(TextureQuality newquality);
 
+        /// Returns the memory budget of the streamed textures in megabytes, 0 if unlimited
+        int GetTextureBudget() const;
+
+        /// Sets the memory budget of the streamed textures in megabytes, 0 for unlimited
+        void SetTextureBudget(int megabytes);
+
+        /// Returns the texture streamer, or null if headless
+        TextureStreamer *GetTextureStreamer() const { return textureStreamer_; }
+
         RenderWindow *GetRenderWindow() const { return renderWindow; }
 
     private slots:
@@ -249,6 +259,9 @@ namespace OgreRenderer
 
         /// Texture quality
         TextureQuality texturequality_;
+
+        /// Texture streamer, null if headless
+        TextureStreamer *textureStreamer_;
         
         /// Pixel buffer used with screen captures
         Ogre::uchar *capture_screen_pixel_data_;
@@ -137,9 +137,6 @@ void RendererSettingsWindow::TextureQualityChanged(int value)
     if (!renderer)
         return;
     renderer->SetTextureQuality((TextureQuality)value);
-    QLabel* restart_text = settings_widget_->findChild<QLabel*>("label_restartmessage");
-    if (restart_text)
-        restart_text->setText(tr("SettingsWidget", "Setting will take effect after viewer restart."));
 }
 
 } //~namespace OgreRenderer
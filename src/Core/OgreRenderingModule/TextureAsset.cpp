@@ -15,6 +15,8 @@
 #include <QFileInfo>
 
 #include "OgreRenderingModule.h"
+#include "Renderer.h"
+#include "TextureStreamer.h"
 #include <Ogre.h>
 
 #if defined(DIRECTX_ENABLED) && defined(WIN32)
@@ -27,6 +29,14 @@
 
 #include "LoggingFunctions.h"
 
+/// Returns the texture streamer of the renderer, or null if none.
+static OgreRenderer::TextureStreamer *GetTextureStreamer(AssetAPI *assetAPI)
+{
+    OgreRenderer::OgreRenderingModule *module = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>();
+    OgreRenderer::Renderer *renderer = module ? module->GetRenderer().get() : 0;
+    return renderer ? renderer->GetTextureStreamer() : 0;
+}
+
 TextureAsset::TextureAsset(AssetAPI *owner, const QString &type_, const QString &name_)
 :IAsset(owner, type_, name_)
 {
@@ -55,6 +65,11 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
     // We should never be here in headless mode.
     assert(!assetAPI->IsHeadless());
 
+    // Streamed loading. The texture is decoded on a worker thread and uploaded first at a low resolution.
+    OgreRenderer::TextureStreamer *streamer = GetTextureStreamer(assetAPI);
+    if (allowAsynchronous && streamer && streamer->Load(this, data, numBytes))
+        return true;
+
     // Asynchronous loading
     // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
     // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
@@ -86,6 +101,9 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
         // Load up the image as an Ogre CPU image object.
         Ogre::Image image;
         image.load(stream);
+        // Apply the texture quality setting
+        if (streamer)
+            OgreRenderer::TextureStreamer::Downscale(image, std::min(streamer->QualityLevel(), OgreRenderer::TextureStreamer::MaxLevel(image)));
 
         if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
         {
@@ -151,6 +169,45 @@ void TextureAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, cons
     assetAPI->AssetLoadFailed(assetRef);
 }
 
+void TextureAsset::SetStreamedImage(Ogre::Image *image, bool completeLoad)
+{
+    PROFILE(TextureAsset_SetStreamedImage);
+
+    if (image)
+    {
+        try
+        {
+            if (ogreTexture.isNull())
+            {
+                ogreAssetName = AssetAPI::SanitateAssetRef(this->Name().toStdString()).c_str();
+                ogreTexture = Ogre::TextureManager::getSingleton().loadImage(ogreAssetName.toStdString(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, *image);
+            }
+            else // Reload into the existing Ogre::Texture, so that the materials referring to it get the new image
+            {
+                ogreTexture->unload();
+                ogreTexture->loadImage(*image);
+            }
+        }
+        catch(Ogre::Exception &e)
+        {
+            LogError("TextureAsset::SetStreamedImage: Failed to create texture " + this->Name().toStdString() + ": " + std::string(e.what()));
+            image = 0;
+        }
+    }
+    else
+        LogError("TextureAsset::SetStreamedImage: Failed to decode texture " + this->Name());
+
+    if (!completeLoad)
+        return;
+    if (image && !ogreTexture.isNull())
+        assetAPI->AssetLoadCompleted(Name());
+    else
+    {
+        DoUnload();
+        assetAPI->AssetLoadFailed(Name());
+    }
+}
+
 /*
 void TextureAsset::RegenerateAllMipLevels()
 {
@@ -207,6 +264,10 @@ bool TextureAsset::SerializeTo(std::vector<u8> &data, const QString &serializati
 
 void TextureAsset::DoUnload()
 {
+    OgreRenderer::TextureStreamer *streamer = GetTextureStreamer(assetAPI);
+    if (streamer)
+        streamer->Remove(this);
+
     if (!ogreTexture.isNull())
         ogreAssetName = ogreTexture->getName().c_str();
 
@@ -32,6 +32,11 @@ public:
     /// Unload texture from ogre
     virtual void DoUnload();
 
+    /// Uploads an image decoded by TextureStreamer, reusing the Ogre texture so that the materials using it are updated.
+    /** @param image The decoded image, or null if decoding failed.
+        @param completeLoad Whether to complete the asset load, or fail it if image is null. */
+    void SetStreamedImage(Ogre::Image *image, bool completeLoad);
+
     /// Convert texture to QImage
     QImage ToQImage(size_t faceIndex = 0, size_t mipmapLevel = 0) const;
 
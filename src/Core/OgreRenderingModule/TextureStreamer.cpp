@@ -0,0 +1,459 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureStreamer.h"
+#include "TextureAsset.h"
+#include "Renderer.h"
+#include "OgreWorld.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+#include "Math/MathFunc.h"
+
+#include <Ogre.h>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <queue>
+
+#include "MemoryLeakCheck.h"
+
+namespace OgreRenderer
+{
+
+/// Maximum number of decoded textures uploaded per frame
+static const int cMaxUploadsPerFrame = 2;
+/// Maximum number of textures being decoded or waiting for upload
+static const uint cMaxPendingJobs = 8;
+/// Interval of the streaming updates in seconds
+static const f64 cUpdateInterval = 0.5;
+
+/// Returns the level at which the larger dimension of a texture is still at least the given size.
+static int LevelForSize(uint width, uint height, float size)
+{
+    uint dimension = std::max(width, height);
+    int level = 0;
+    while((float)(dimension >> (level + 1)) >= size && (dimension >> (level + 1)) > 0)
+        ++level;
+    return level;
+}
+
+TextureStreamer::TextureStreamer(Renderer *renderer) :
+    renderer_(renderer),
+    enabled_(true),
+    budgetBytes_(0),
+    qualityLevel_(0),
+    nextId_(0),
+    numPending_(0),
+    updateTimer_(0.0),
+    time_(0.0),
+    quit_(false)
+{
+    worker_ = boost::thread(boost::bind(&TextureStreamer::ThreadMain, this));
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        quit_ = true;
+        jobs_.clear();
+    }
+    jobAvailable_.notify_all();
+    worker_.join();
+}
+
+void TextureStreamer::SetQualityLevel(int level)
+{
+    qualityLevel_ = std::max(level, 0);
+    // Apply on the next update
+    updateTimer_ = cUpdateInterval;
+}
+
+bool TextureStreamer::Load(TextureAsset *asset, const u8 *data, size_t numBytes)
+{
+    if (!enabled_ || !asset || !data || !numBytes)
+        return false;
+
+    Remove(asset);
+
+    StreamedTexture &texture = textures_[asset];
+    texture.id = ++nextId_;
+    texture.ogreName = AssetAPI::SanitateAssetRef(asset->Name().toStdString());
+    texturesByName_[texture.ogreName] = asset;
+
+    // Decode from the disk source if it holds the same data, instead of keeping a copy of the data in memory
+    QString diskSource = asset->DiskSource();
+    if (!diskSource.isEmpty() && QFileInfo(diskSource).size() == (qint64)numBytes)
+        texture.diskSource = diskSource;
+    else
+        texture.data = boost::shared_ptr<std::vector<u8> >(new std::vector<u8>(data, data + numBytes));
+
+    QueueJob(asset, texture, -1);
+    return true;
+}
+
+void TextureStreamer::Remove(TextureAsset *asset)
+{
+    std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.find(asset);
+    if (iter == textures_.end())
+        return;
+    // Results of the jobs still running are discarded by their id
+    texturesByName_.erase(iter->second.ogreName);
+    textures_.erase(iter);
+}
+
+void TextureStreamer::Update(f64 frametime)
+{
+    PROFILE(TextureStreamer_Update);
+
+    UploadResults();
+
+    time_ += frametime;
+    updateTimer_ += frametime;
+    if (updateTimer_ < cUpdateInterval || textures_.empty())
+        return;
+    updateTimer_ = 0.0;
+
+    UpdateDemand();
+    UpdateDesiredLevels();
+    RequestLevels();
+}
+
+void TextureStreamer::UploadResults()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        uploads_.splice(uploads_.end(), results_);
+    }
+
+    for(int i = 0; i < cMaxUploadsPerFrame && !uploads_.empty(); ++i)
+    {
+        PROFILE(TextureStreamer_Upload);
+        Result &result = uploads_.front();
+        --numPending_;
+
+        std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.find(result.asset);
+        if (iter == textures_.end() || iter->second.id != result.id)
+        {
+            // The texture was removed or loaded again while decoding
+            uploads_.pop_front();
+            --i;
+            continue;
+        }
+
+        StreamedTexture &texture = iter->second;
+        texture.requestedLevel = -1;
+        bool completeLoad = texture.loadPending;
+        texture.loadPending = false;
+        if (result.success)
+        {
+            texture.width = result.width;
+            texture.height = result.height;
+            texture.format = result.format;
+            texture.maxLevel = result.maxLevel;
+            texture.residentLevel = result.level;
+            texture.desiredLevel = result.level;
+        }
+        const uint id = texture.id;
+
+        // Uploading may complete the asset load, which can load or unload textures, so look the texture up again afterwards
+        TextureAsset *asset = result.asset;
+        asset->SetStreamedImage(result.success ? &result.image : 0, completeLoad);
+        uploads_.pop_front();
+
+        // Stop streaming textures that can not be reduced, to not keep their data in memory
+        iter = textures_.find(asset);
+        if (iter != textures_.end() && iter->second.id == id && (!result.success || iter->second.maxLevel == 0))
+            Remove(asset);
+    }
+}
+
+void TextureStreamer::UpdateDemand()
+{
+    PROFILE(TextureStreamer_UpdateDemand);
+
+    for(std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+        iter->second.demand = 0.f;
+
+    OgreWorldPtr world = renderer_->GetActiveOgreWorld();
+    Ogre::Camera *camera = world ? world->LodCamera() : 0;
+    Ogre::Viewport *viewport = renderer_->MainViewport();
+    if (!camera || !viewport)
+        return;
+    const float viewportHeight = (float)viewport->getActualHeight();
+
+    Ogre::SceneManager::MovableObjectIterator objects = world->GetSceneManager()->getMovableObjectIterator(Ogre::EntityFactory::FACTORY_TYPE_NAME);
+    while(objects.hasMoreElements())
+    {
+        // Also the textures of the entities out of view are marked as used on entities, so that they are not streamed at full resolution
+        Ogre::Entity *entity = static_cast<Ogre::Entity *>(objects.getNext());
+        const bool inView = entity->isVisible() && entity->isInScene() && camera->isVisible(entity->getWorldBoundingBox(true));
+        const float pixels = inView ? OgreWorld::ScreenSize(camera, entity->getWorldBoundingSphere(true)) * viewportHeight : 0.f;
+        for(uint i = 0; i < entity->getNumSubEntities(); ++i)
+        {
+            const Ogre::MaterialPtr &material = entity->getSubEntity(i)->getMaterial();
+            Ogre::Technique *technique = material.isNull() ? 0 : material->getBestTechnique();
+            if (!technique)
+                continue;
+            Ogre::Technique::PassIterator passes = technique->getPassIterator();
+            while(passes.hasMoreElements())
+            {
+                Ogre::Pass::TextureUnitStateIterator units = passes.getNext()->getTextureUnitStateIterator();
+                while(units.hasMoreElements())
+                {
+                    std::map<std::string, TextureAsset *>::iterator name = texturesByName_.find(units.getNext()->getTextureName());
+                    if (name == texturesByName_.end())
+                        continue;
+                    StreamedTexture &texture = textures_[name->second];
+                    texture.seen = true;
+                    if (inView)
+                    {
+                        texture.demand = std::max(texture.demand, pixels);
+                        texture.lastSeenTime = time_;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TextureStreamer::UpdateDesiredLevels()
+{
+    PROFILE(TextureStreamer_UpdateDesiredLevels);
+
+    size_t totalBytes = 0;
+    // Priority for lowering the resolution when over budget, and the texture
+    std::priority_queue<std::pair<f64, TextureAsset *> > lowerFirst;
+    for(std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+    {
+        StreamedTexture &texture = iter->second;
+        if (!texture.width)
+            continue; // Not decoded yet
+
+        const int minLevel = std::min(qualityLevel_, texture.maxLevel);
+        int level;
+        if (texture.demand > 0.f)
+        {
+            level = LevelForSize(texture.width, texture.height, texture.demand);
+            // Do not decode again for lowering the resolution by one level, to not alternate at the level boundaries
+            if (texture.residentLevel >= 0 && level == texture.residentLevel + 1)
+                level = texture.residentLevel;
+        }
+        else if (!texture.seen)
+            level = minLevel; // Not used on entities, f.ex. sky or particles
+        else
+            level = texture.residentLevel >= 0 ? texture.residentLevel : texture.desiredLevel; // Out of view, keep
+        texture.desiredLevel = Clamp(level, minLevel, texture.maxLevel);
+        totalBytes += LevelBytes(texture, texture.desiredLevel);
+    }
+
+    if (!budgetBytes_ || totalBytes <= budgetBytes_)
+        return;
+
+    // Lower the textures out of view first, the least recently visible first, then the textures not used on entities,
+    // then the visible textures with the most texels per screen pixel.
+    for(std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+    {
+        const StreamedTexture &texture = iter->second;
+        if (texture.width && texture.desiredLevel < texture.maxLevel)
+        {
+            f64 priority;
+            if (texture.demand > 0.f)
+                priority = (f64)(std::max(texture.width, texture.height) >> texture.desiredLevel) / texture.demand;
+            else if (!texture.seen)
+                priority = 1e6;
+            else
+                priority = 1e9 + time_ - texture.lastSeenTime;
+            lowerFirst.push(std::make_pair(priority, iter->first));
+        }
+    }
+
+    while(totalBytes > budgetBytes_ && !lowerFirst.empty())
+    {
+        std::pair<f64, TextureAsset *> next = lowerFirst.top();
+        lowerFirst.pop();
+        StreamedTexture &texture = textures_[next.second];
+        totalBytes -= LevelBytes(texture, texture.desiredLevel) - LevelBytes(texture, texture.desiredLevel + 1);
+        ++texture.desiredLevel;
+        if (texture.desiredLevel < texture.maxLevel)
+            lowerFirst.push(std::make_pair(texture.demand > 0.f ? next.first * 0.5 : next.first, next.second));
+    }
+}
+
+void TextureStreamer::RequestLevels()
+{
+    // Free memory first by lowering resolutions, then raise the resolutions of the largest textures on screen
+    std::vector<std::pair<float, TextureAsset *> > requests;
+    for(std::map<TextureAsset *, StreamedTexture>::iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+    {
+        const StreamedTexture &texture = iter->second;
+        if (texture.residentLevel >= 0 && texture.requestedLevel < 0 && texture.desiredLevel != texture.residentLevel)
+            requests.push_back(std::make_pair(texture.desiredLevel > texture.residentLevel ? FLOAT_INF : texture.demand, iter->first));
+    }
+    std::sort(requests.begin(), requests.end());
+
+    for(std::vector<std::pair<float, TextureAsset *> >::reverse_iterator iter = requests.rbegin(); iter != requests.rend() && numPending_ < cMaxPendingJobs; ++iter)
+    {
+        StreamedTexture &texture = textures_[iter->second];
+        QueueJob(iter->second, texture, texture.desiredLevel);
+    }
+}
+
+void TextureStreamer::QueueJob(TextureAsset *asset, StreamedTexture &texture, int level)
+{
+    Job job;
+    job.asset = asset;
+    job.id = texture.id;
+    job.level = level;
+    job.qualityLevel = qualityLevel_;
+    job.diskSource = texture.diskSource;
+    job.data = texture.data;
+    texture.requestedLevel = level;
+    ++numPending_;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        jobs_.push_back(job);
+    }
+    jobAvailable_.notify_one();
+}
+
+TextureStreamer::Stats TextureStreamer::GetStats() const
+{
+    Stats stats;
+    stats.numPending = numPending_;
+    stats.budgetBytes = budgetBytes_;
+    for(std::map<TextureAsset *, StreamedTexture>::const_iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+    {
+        const StreamedTexture &texture = iter->second;
+        if (texture.residentLevel < 0)
+            continue;
+        ++stats.numTextures;
+        if (texture.residentLevel > 0)
+            ++stats.numReduced;
+        stats.residentBytes += LevelBytes(texture, texture.residentLevel);
+        stats.fullBytes += LevelBytes(texture, 0);
+    }
+    return stats;
+}
+
+size_t TextureStreamer::LevelBytes(const StreamedTexture &texture, int level)
+{
+    size_t width = std::max<size_t>(texture.width >> level, 1);
+    size_t height = std::max<size_t>(texture.height >> level, 1);
+    return Ogre::PixelUtil::getMemorySize(width, height, 1, texture.format) * 4 / 3;
+}
+
+int TextureStreamer::MaxLevel(const Ogre::Image &image)
+{
+    if (image.getDepth() > 1 || image.getNumFaces() > 1)
+        return 0;
+    int level = LevelForSize(image.getWidth(), image.getHeight(), (float)cMinSize);
+    if (Ogre::PixelUtil::isCompressed(image.getFormat()))
+        level = std::min(level, (int)image.getNumMipmaps());
+    return level;
+}
+
+bool TextureStreamer::Downscale(Ogre::Image &image, int levels)
+{
+    if (levels <= 0)
+        return true;
+    if (image.getDepth() > 1 || image.getNumFaces() > 1)
+        return false;
+
+    if (Ogre::PixelUtil::isCompressed(image.getFormat()))
+    {
+        // Compressed images can not be resampled, but the lower mipmaps can be used as is
+        if ((int)image.getNumMipmaps() < levels)
+            return false;
+        Ogre::PixelBox mipmap = image.getPixelBox(0, levels);
+        size_t numMipmaps = image.getNumMipmaps() - levels;
+        size_t size = Ogre::Image::calculateSize(numMipmaps, 1, mipmap.getWidth(), mipmap.getHeight(), 1, image.getFormat());
+        Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, size, Ogre::MEMCATEGORY_GENERAL);
+        memcpy(data, mipmap.data, size);
+        image.loadDynamicImage(data, mipmap.getWidth(), mipmap.getHeight(), 1, image.getFormat(), true, 1, numMipmaps);
+        return true;
+    }
+
+    // Halve one level at a time, so that the bilinear filter averages all the pixels
+    for(int i = 0; i < levels; ++i)
+        image.resize((Ogre::ushort)std::max<size_t>(image.getWidth() / 2, 1), (Ogre::ushort)std::max<size_t>(image.getHeight() / 2, 1), Ogre::Image::FILTER_BILINEAR);
+    return true;
+}
+
+void TextureStreamer::ThreadMain()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while(jobs_.empty() && !quit_)
+                jobAvailable_.wait(lock);
+            if (quit_)
+                return;
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        std::list<Result> result(1);
+        Decode(job, result.back());
+
+        boost::mutex::scoped_lock lock(mutex_);
+        results_.splice(results_.end(), result);
+    }
+}
+
+void TextureStreamer::Decode(const Job &job, Result &result)
+{
+    result.asset = job.asset;
+    result.id = job.id;
+
+    QByteArray fileData;
+    const u8 *data = 0;
+    size_t numBytes = 0;
+    if (job.data)
+    {
+        data = &(*job.data)[0];
+        numBytes = job.data->size();
+    }
+    else
+    {
+        QFile file(job.diskSource);
+        if (!file.open(QIODevice::ReadOnly))
+            return;
+        fileData = file.readAll();
+        data = (const u8 *)fileData.constData();
+        numBytes = fileData.size();
+    }
+    if (!numBytes)
+        return;
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void *)data, numBytes, false));
+#include "EnableMemoryLeakCheck.h"
+        result.image.load(stream);
+    }
+    catch(Ogre::Exception &)
+    {
+        return;
+    }
+
+    result.width = result.image.getWidth();
+    result.height = result.image.getHeight();
+    result.format = result.image.getFormat();
+    result.maxLevel = MaxLevel(result.image);
+
+    int level = job.level;
+    if (level < 0)
+        level = std::max(job.qualityLevel, LevelForSize(result.width, result.height, (float)cInitialSize));
+    level = std::min(level, result.maxLevel);
+    result.level = Downscale(result.image, level) ? level : 0;
+    result.success = true;
+}
+
+}
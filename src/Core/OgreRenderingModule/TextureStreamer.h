@@ -0,0 +1,221 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+
+#include <OgreImage.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <QString>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+class TextureAsset;
+
+namespace OgreRenderer
+{
+class Renderer;
+
+/// Streams the resolution of 2D texture assets by their on-screen size and a texture memory budget.
+/** A streamed texture is decoded on a worker thread and uploaded first at a low resolution. Twice a second, the textures used by the
+    entities in view of the active camera get a resolution matching their on-screen size. Textures that are not used on any entity,
+    f.ex. sky and particle textures, use the full resolution. When the textures would exceed the memory budget, the resolutions of
+    the textures out of view, and then of those with the most texels per screen pixel, are lowered.
+    Changing the resolution decodes the texture again from its asset data, and reloads it into the same Ogre texture, so that the
+    materials using it are updated. The texture quality setting of the renderer halves the highest resolution at decode time.
+
+    Resolutions are counted in levels, ie. halvings of the full resolution, like mipmap levels. Textures are not reduced below
+    cMinSize pixels, and block compressed textures only as far as they have mipmaps in their data.
+    Owned by Renderer, which creates it when not headless. */
+class OGRE_MODULE_API TextureStreamer
+{
+public:
+    /// Smallest texture width or height the textures are reduced to
+    static const uint cMinSize = 64;
+    /// Width or height the first upload of a texture is reduced to, if larger
+    static const uint cInitialSize = 128;
+
+    /// Texture streaming statistics.
+    struct Stats
+    {
+        Stats() : numTextures(0), numReduced(0), numPending(0), residentBytes(0), fullBytes(0), budgetBytes(0) {}
+
+        /// Number of streamed textures
+        uint numTextures;
+        /// Number of streamed textures currently below their full resolution
+        uint numReduced;
+        /// Number of textures being decoded or waiting for upload
+        uint numPending;
+        /// Estimated GPU memory used by the streamed textures, including mipmaps
+        size_t residentBytes;
+        /// Estimated GPU memory the streamed textures would use at full resolution
+        size_t fullBytes;
+        /// Memory budget of the streamed textures, 0 if unlimited
+        size_t budgetBytes;
+    };
+
+    explicit TextureStreamer(Renderer *renderer);
+    /// Stops the worker thread. Decodes not yet started are discarded.
+    ~TextureStreamer();
+
+    /// Sets whether textures loaded from now on are streamed. Enabled by default.
+    void SetEnabled(bool enabled) { enabled_ = enabled; }
+    bool IsEnabled() const { return enabled_; }
+
+    /// Sets the memory budget of the streamed textures in bytes, 0 for unlimited.
+    void SetBudget(size_t bytes) { budgetBytes_ = bytes; }
+    size_t Budget() const { return budgetBytes_; }
+
+    /// Sets the number of halvings applied to the full resolution of all textures, ie. 1 for Texture_Low and 0 for Texture_Normal.
+    /** Streamed textures are reloaded at the new quality during the next frames. */
+    void SetQualityLevel(int level);
+    int QualityLevel() const { return qualityLevel_; }
+
+    /// Starts loading a texture asset from data. The asset load completes when the first resolution has been uploaded.
+    /** Called by TextureAsset::DeserializeFromData. If the data is the content of the disk source of the asset,
+        the texture is decoded again from the disk source, otherwise a copy of the data is kept.
+        @return False if streaming is disabled, in which case the asset should load the texture by itself. */
+    bool Load(TextureAsset *texture, const u8 *data, size_t numBytes);
+
+    /// Stops streaming a texture. Called by TextureAsset when it is unloaded.
+    void Remove(TextureAsset *texture);
+
+    /// Uploads the decoded textures and adjusts the resolutions of the textures. Called each frame by OgreRenderingModule.
+    void Update(f64 frametime);
+
+    /// Returns the texture streaming statistics.
+    Stats GetStats() const;
+
+    /// Returns the number of halvings an image can be reduced by, down to cMinSize.
+    /** Cube maps, volume textures, and compressed images without mipmaps can not be reduced. */
+    static int MaxLevel(const Ogre::Image &image);
+
+    /// Halves the resolution of an image the given number of times, dropping the highest mipmaps of compressed images.
+    /** @return False if the image can not be reduced by the given number of levels, in which case it is left as is. */
+    static bool Downscale(Ogre::Image &image, int levels);
+
+private:
+    /// Texture to decode on the worker thread
+    struct Job
+    {
+        Job() : asset(0), id(0), level(0), qualityLevel(0) {}
+
+        TextureAsset *asset;
+        uint id;
+        /// Level to decode at, or -1 for the first upload
+        int level;
+        /// Quality level, applied to the first upload
+        int qualityLevel;
+        /// Disk source to read the data from, if data is null
+        QString diskSource;
+        boost::shared_ptr<std::vector<u8> > data;
+    };
+
+    /// Decoded texture
+    struct Result
+    {
+        Result() : asset(0), id(0), level(0), maxLevel(0), width(0), height(0), format(Ogre::PF_UNKNOWN), success(false) {}
+
+        TextureAsset *asset;
+        uint id;
+        /// Level the image was reduced by
+        int level;
+        int maxLevel;
+        /// Full resolution of the texture
+        uint width;
+        uint height;
+        Ogre::PixelFormat format;
+        bool success;
+        Ogre::Image image;
+    };
+
+    struct StreamedTexture
+    {
+        StreamedTexture() : id(0), maxLevel(0), width(0), height(0), format(Ogre::PF_UNKNOWN), residentLevel(-1), requestedLevel(-1),
+            desiredLevel(0), demand(0.f), seen(false), lastSeenTime(0.0), loadPending(true) {}
+
+        /// Unique id of the load, to discard the results of previous loads of the same asset
+        uint id;
+        /// Ogre texture name, for finding the texture from materials
+        std::string ogreName;
+        QString diskSource;
+        boost::shared_ptr<std::vector<u8> > data;
+        /// Lowest resolution level. Known after the first decode
+        int maxLevel;
+        /// Full resolution of the texture. Known after the first decode
+        uint width;
+        uint height;
+        Ogre::PixelFormat format;
+        /// Level of the uploaded texture, or -1 if not uploaded yet
+        int residentLevel;
+        /// Level being decoded, or -1 if none
+        int requestedLevel;
+        /// Level chosen by the last streaming update
+        int desiredLevel;
+        /// Largest on-screen height in pixels of the entities in view using the texture, 0 if out of view
+        float demand;
+        /// Has the texture been used on an entity
+        bool seen;
+        /// Time the texture was last in view
+        f64 lastSeenTime;
+        /// Whether the asset load completes with the next upload
+        bool loadPending;
+    };
+
+    /// Uploads at most cMaxUploadsPerFrame decoded textures.
+    void UploadResults();
+    /// Updates the on-screen size of the textures used by the visible entities of the active camera.
+    void UpdateDemand();
+    /// Chooses the levels of the textures by their demand and the budget.
+    void UpdateDesiredLevels();
+    /// Queues decodes of the textures whose level differs from the chosen level.
+    void RequestLevels();
+    /// Queues a decode of a texture.
+    void QueueJob(TextureAsset *asset, StreamedTexture &texture, int level);
+
+    /// Returns the estimated GPU memory use of a texture at a level, including mipmaps.
+    static size_t LevelBytes(const StreamedTexture &texture, int level);
+
+    /// Worker thread entry point.
+    void ThreadMain();
+    /// Decodes a texture in the calling thread.
+    static void Decode(const Job &job, Result &result);
+
+    Renderer *renderer_;
+    bool enabled_;
+    size_t budgetBytes_;
+    int qualityLevel_;
+    /// Streamed textures
+    std::map<TextureAsset *, StreamedTexture> textures_;
+    /// Streamed textures by Ogre texture name
+    std::map<std::string, TextureAsset *> texturesByName_;
+    /// Counter for unique load ids
+    uint nextId_;
+    /// Number of jobs queued and not yet uploaded
+    uint numPending_;
+    /// Decoded textures waiting for upload
+    std::list<Result> uploads_;
+    /// Time since the last streaming update
+    f64 updateTimer_;
+    /// Time since the creation of the streamer
+    f64 time_;
+
+    boost::thread worker_;
+    boost::mutex mutex_;
+    boost::condition_variable jobAvailable_;
+    /// Queued jobs. Protected by mutex_
+    std::list<Job> jobs_;
+    /// Finished results. Protected by mutex_
+    std::list<Result> results_;
+    /// Set when the worker thread should exit. Protected by mutex_
+    bool quit_;
+};
+
+}
@@ -0,0 +1,354 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#define BULLET_INTEROP
+#include "DebugOperatorNew.h"
+#include "CollisionMeshBaker.h"
+#include "CollisionShapeUtils.h"
+#include "ConvexHull.h"
+#include "btBulletDynamicsCommon.h"
+
+#include <BulletCollision/CollisionShapes/btOptimizedBvh.h>
+#include <QFile>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QCryptographicHash>
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace Physics
+{
+
+/// Identifier at the start of every cache file
+static const char cCacheMagic[4] = { 'T', 'C', 'M', 'B' };
+
+/// Cache file header. Files with a mismatching header are rebaked.
+struct CacheFileHeader
+{
+    char magic[4];
+    u32 cacheVersion;
+    u32 bulletVersion;
+    u32 pointerSize;
+    u32 bakeType;
+};
+
+static CacheFileHeader CurrentCacheFileHeader(CollisionMeshBaker::BakeType type)
+{
+    CacheFileHeader header;
+    memcpy(header.magic, cCacheMagic, sizeof header.magic);
+    header.cacheVersion = CollisionMeshBaker::cCacheVersion;
+    header.bulletVersion = (u32)btGetVersion();
+    header.pointerSize = (u32)sizeof(void*);
+    header.bakeType = (u32)type;
+    return header;
+}
+
+/// Frees a BVH that was deserialized in place into an aligned buffer
+static void FreeInPlaceBvh(btOptimizedBvh* bvh)
+{
+    if (bvh)
+    {
+        bvh->~btOptimizedBvh();
+        btAlignedFree(bvh);
+    }
+}
+
+template<typename T>
+static bool ReadValue(QFile& file, T& value)
+{
+    return file.read(reinterpret_cast<char*>(&value), sizeof value) == (qint64)sizeof value;
+}
+
+template<typename T>
+static bool WriteValue(QFile& file, const T& value)
+{
+    return file.write(reinterpret_cast<const char*>(&value), sizeof value) == (qint64)sizeof value;
+}
+
+static bool ReadPoints(QFile& file, std::vector<float3>& dest)
+{
+    u32 numPoints = 0;
+    if (!ReadValue(file, numPoints) || (qint64)numPoints * (qint64)sizeof(float3) > file.bytesAvailable())
+        return false;
+    dest.resize(numPoints);
+    return numPoints == 0 || file.read(reinterpret_cast<char*>(&dest[0]), numPoints * sizeof(float3)) == (qint64)(numPoints * sizeof(float3));
+}
+
+static bool WritePoints(QFile& file, const std::vector<float3>& points)
+{
+    if (!WriteValue(file, (u32)points.size()))
+        return false;
+    return points.empty() || file.write(reinterpret_cast<const char*>(&points[0]), points.size() * sizeof(float3)) == (qint64)(points.size() * sizeof(float3));
+}
+
+CollisionMeshBaker::CollisionMeshBaker(const QString& cacheDirectory) :
+    quit_(false)
+{
+    if (!cacheDirectory.isEmpty() && QDir().mkpath(cacheDirectory))
+    {
+        cacheDirectory_ = QDir::fromNativeSeparators(cacheDirectory);
+        if (!cacheDirectory_.endsWith('/'))
+            cacheDirectory_.append('/');
+    }
+
+    // Leave one core for the main thread
+    int numThreads = std::max((int)boost::thread::hardware_concurrency() - 1, 1);
+    for(int i = 0; i < numThreads; ++i)
+        workers_.create_thread(boost::bind(&CollisionMeshBaker::ThreadMain, this));
+}
+
+CollisionMeshBaker::~CollisionMeshBaker()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        quit_ = true;
+        jobs_.clear();
+    }
+    jobAvailable_.notify_all();
+    workers_.join_all();
+}
+
+void CollisionMeshBaker::BakeMeshFile(const QString& key, BakeType type, const QString& meshFile)
+{
+    Job job;
+    job.key = key;
+    job.type = type;
+    job.meshFile = meshFile;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        jobs_.push_back(job);
+    }
+    jobAvailable_.notify_one();
+}
+
+void CollisionMeshBaker::BakeTriangles(const QString& key, BakeType type, const std::vector<float3>& triangles)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        jobs_.push_back(Job());
+        jobs_.back().key = key;
+        jobs_.back().type = type;
+        jobs_.back().triangles = triangles;
+    }
+    jobAvailable_.notify_one();
+}
+
+std::vector<CollisionMeshBaker::Result> CollisionMeshBaker::TakeResults()
+{
+    std::vector<Result> results;
+    boost::mutex::scoped_lock lock(mutex_);
+    results.swap(results_);
+    return results;
+}
+
+void CollisionMeshBaker::ThreadMain()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while(jobs_.empty() && !quit_)
+                jobAvailable_.wait(lock);
+            if (quit_)
+                return;
+            // Swap instead of copying to avoid duplicating the triangle data
+            job.key = jobs_.front().key;
+            job.type = jobs_.front().type;
+            job.meshFile = jobs_.front().meshFile;
+            job.triangles.swap(jobs_.front().triangles);
+            jobs_.pop_front();
+        }
+
+        Result result = Process(job);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        results_.push_back(result);
+    }
+}
+
+CollisionMeshBaker::Result CollisionMeshBaker::Process(Job& job)
+{
+    Result result;
+    result.key = job.key;
+    result.mesh = BakedCollisionMeshPtr(new BakedCollisionMesh());
+    result.fromCache = false;
+
+    // Hash the source data, so that a changed mesh does not hit a stale cache entry
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QByteArray meshData;
+    if (!job.meshFile.isEmpty())
+    {
+        QFile file(job.meshFile);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            result.error = "Could not open mesh file " + job.meshFile.toStdString();
+            return result;
+        }
+        meshData = file.readAll();
+        hash.addData(meshData);
+    }
+    else if (!job.triangles.empty())
+        hash.addData(reinterpret_cast<const char*>(&job.triangles[0]), job.triangles.size() * sizeof(float3));
+
+    QString cacheFile;
+    if (!cacheDirectory_.isEmpty())
+    {
+        cacheFile = cacheDirectory_ + QString(hash.result().toHex()) + (job.type == BakeTriangleMesh ? ".trimesh" : ".convexhull");
+        if (LoadFromCache(cacheFile, job.type, *result.mesh))
+        {
+            result.fromCache = true;
+            return result;
+        }
+    }
+
+    if (!meshData.isEmpty())
+    {
+        result.error = GetTrianglesFromMeshData(reinterpret_cast<const u8*>(meshData.constData()), meshData.size(), job.triangles);
+        meshData.clear();
+        if (!result.error.empty())
+            return result;
+    }
+
+    Bake(job.type, job.triangles, *result.mesh, result.error);
+    if (result.error.empty() && !cacheFile.isEmpty())
+        SaveToCache(cacheFile, job.type, job.triangles, *result.mesh);
+
+    return result;
+}
+
+void CollisionMeshBaker::Bake(BakeType type, const std::vector<float3>& triangles, BakedCollisionMesh& dest, std::string& error)
+{
+    if (type == BakeConvexHulls)
+    {
+        boost::shared_ptr<ConvexHullSet> hullSet(new ConvexHullSet());
+        error = GenerateConvexHullSet(triangles, hullSet.get());
+        if (error.empty())
+            dest.convexHullSet = hullSet;
+        return;
+    }
+
+    if (triangles.size() < 3)
+    {
+        error = "Mesh had no triangles; aborting triangle mesh generation";
+        return;
+    }
+
+#include "DisableMemoryLeakCheck.h"
+    dest.triangleMesh = boost::shared_ptr<btTriangleMesh>(new btTriangleMesh());
+    GenerateTriangleMesh(triangles, dest.triangleMesh.get());
+
+    btVector3 aabbMin, aabbMax;
+    dest.triangleMesh->calculateAabbBruteForce(aabbMin, aabbMax);
+    dest.bvh = boost::shared_ptr<btOptimizedBvh>(new btOptimizedBvh());
+#include "EnableMemoryLeakCheck.h"
+    dest.bvh->build(dest.triangleMesh.get(), true, aabbMin, aabbMax);
+}
+
+bool CollisionMeshBaker::LoadFromCache(const QString& fileName, BakeType type, BakedCollisionMesh& dest)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    CacheFileHeader header;
+    CacheFileHeader current = CurrentCacheFileHeader(type);
+    if (!ReadValue(file, header) || memcmp(&header, &current, sizeof header) != 0)
+        return false;
+
+    if (type == BakeConvexHulls)
+    {
+        u32 numHulls = 0;
+        if (!ReadValue(file, numHulls))
+            return false;
+        boost::shared_ptr<ConvexHullSet> hullSet(new ConvexHullSet());
+        std::vector<float3> points;
+        for(u32 i = 0; i < numHulls; ++i)
+        {
+            ConvexHull hull;
+            if (!ReadValue(file, hull.position_) || !ReadPoints(file, points) || points.empty())
+                return false;
+#include "DisableMemoryLeakCheck.h"
+            hull.hull_ = boost::shared_ptr<btConvexHullShape>(new btConvexHullShape(&points[0].x, points.size(), sizeof(float3)));
+#include "EnableMemoryLeakCheck.h"
+            hullSet->hulls_.push_back(hull);
+        }
+        dest.convexHullSet = hullSet;
+        return true;
+    }
+
+    std::vector<float3> triangles;
+    u32 bvhSize = 0;
+    if (!ReadPoints(file, triangles) || triangles.size() < 3 || !ReadValue(file, bvhSize) || bvhSize == 0 || bvhSize > file.bytesAvailable())
+        return false;
+
+    // The BVH is deserialized in place, so the buffer is owned by the BVH from here on
+    void* buffer = btAlignedAlloc(bvhSize, 16);
+    if (file.read(static_cast<char*>(buffer), bvhSize) != (qint64)bvhSize)
+    {
+        btAlignedFree(buffer);
+        return false;
+    }
+    btOptimizedBvh* bvh = btOptimizedBvh::deSerializeInPlace(buffer, bvhSize, false);
+    if (!bvh)
+    {
+        btAlignedFree(buffer);
+        return false;
+    }
+
+    // Rebuild the triangle mesh in the same triangle order the BVH was built with
+#include "DisableMemoryLeakCheck.h"
+    dest.triangleMesh = boost::shared_ptr<btTriangleMesh>(new btTriangleMesh());
+#include "EnableMemoryLeakCheck.h"
+    GenerateTriangleMesh(triangles, dest.triangleMesh.get());
+    dest.bvh = boost::shared_ptr<btOptimizedBvh>(bvh, &FreeInPlaceBvh);
+    return true;
+}
+
+bool CollisionMeshBaker::SaveToCache(const QString& fileName, BakeType type, const std::vector<float3>& triangles, const BakedCollisionMesh& mesh)
+{
+    // Write to a temporary file first, so that a concurrent reader or a crash never leaves a partial cache file
+    QTemporaryFile file(fileName + ".XXXXXX");
+    file.setAutoRemove(true);
+    if (!file.open())
+        return false;
+
+    bool ok = WriteValue(file, CurrentCacheFileHeader(type));
+    if (type == BakeConvexHulls)
+    {
+        const std::vector<ConvexHull>& hulls = mesh.convexHullSet->hulls_;
+        ok = ok && WriteValue(file, (u32)hulls.size());
+        std::vector<float3> points;
+        for(uint i = 0; ok && i < hulls.size(); ++i)
+        {
+            const btConvexHullShape* shape = hulls[i].hull_.get();
+            points.resize(shape->getNumPoints());
+            for(int j = 0; j < shape->getNumPoints(); ++j)
+                points[j] = shape->getUnscaledPoints()[j];
+            ok = WriteValue(file, hulls[i].position_) && WritePoints(file, points);
+        }
+    }
+    else
+    {
+        unsigned bvhSize = mesh.bvh->calculateSerializeBufferSize();
+        void* buffer = btAlignedAlloc(bvhSize, 16);
+        ok = ok && WritePoints(file, triangles) && WriteValue(file, (u32)bvhSize) &&
+            mesh.bvh->serializeInPlace(buffer, bvhSize, false) &&
+            file.write(static_cast<const char*>(buffer), bvhSize) == (qint64)bvhSize;
+        btAlignedFree(buffer);
+    }
+
+    if (!ok || !file.flush())
+        return false;
+    file.close();
+
+    // If another job wrote the same cache file in the meantime, its contents are identical
+    QFile::remove(fileName);
+    if (!file.rename(fileName))
+        return false;
+    file.setAutoRemove(false);
+    return true;
+}
+
+}
@@ -0,0 +1,133 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreDefines.h"
+#include "CoreTypes.h"
+#include "PhysicsModuleApi.h"
+#include "Math/float3.h"
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <QString>
+#include <QByteArray>
+#include <list>
+#include <vector>
+#include <string>
+
+class btTriangleMesh;
+class btOptimizedBvh;
+
+namespace Physics
+{
+
+struct ConvexHullSet;
+
+/// Collision data baked from a mesh asset. Shared between all rigid bodies that use the same mesh.
+/** If baking failed, all the pointers are null. */
+struct BakedCollisionMesh
+{
+    /// Bullet triangle mesh. Null if the mesh was baked for convex hulls.
+    boost::shared_ptr<btTriangleMesh> triangleMesh;
+    /// Quantized BVH of the triangle mesh, to be set to each btBvhTriangleMeshShape created from the triangle mesh.
+    boost::shared_ptr<btOptimizedBvh> bvh;
+    /// Convex hull set. Null if the mesh was baked for a triangle mesh.
+    boost::shared_ptr<ConvexHullSet> convexHullSet;
+};
+
+typedef boost::shared_ptr<BakedCollisionMesh> BakedCollisionMeshPtr;
+
+/// Bakes collision shapes from mesh data on worker threads, and caches them to disk keyed by the mesh content hash.
+/** Reads Ogre binary mesh data directly, so no render mesh needs to be created for the collision shape.
+    The mesh reading, hashing and triangle mesh BVH building run in parallel, but convex hull generation is serialized,
+    as the StanHull library is not reentrant.
+    The disk cache is versioned; cache files written by another cache version, Bullet version or pointer size are rebaked. */
+class CollisionMeshBaker
+{
+public:
+    /// Kind of collision data to bake from a mesh
+    enum BakeType
+    {
+        BakeTriangleMesh = 0, ///< Triangle mesh with a BVH, for static mesh bodies
+        BakeConvexHulls ///< Convex hull set
+    };
+
+    /// Result of a finished bake job
+    struct Result
+    {
+        /// Key the job was queued with
+        QString key;
+        /// Baked mesh. Never null, but the contents are empty if baking failed
+        BakedCollisionMeshPtr mesh;
+        /// Error description, or empty if baking succeeded
+        std::string error;
+        /// Whether the result was loaded from the disk cache
+        bool fromCache;
+    };
+
+    /// Starts the worker threads.
+    /** @param cacheDirectory Directory for the baked shape cache, or empty to disable the disk cache */
+    explicit CollisionMeshBaker(const QString& cacheDirectory);
+
+    /// Stops the worker threads. Bake jobs not yet started are discarded.
+    ~CollisionMeshBaker();
+
+    /// Queues a mesh file for baking.
+    /** @param key Key the result will be returned with
+        @param type Kind of collision data to bake
+        @param meshFile Ogre binary mesh file to read on the worker thread */
+    void BakeMeshFile(const QString& key, BakeType type, const QString& meshFile);
+
+    /// Queues already extracted mesh triangles for baking.
+    /** @param key Key the result will be returned with
+        @param type Kind of collision data to bake
+        @param triangles Triangle vertices, 3 per triangle */
+    void BakeTriangles(const QString& key, BakeType type, const std::vector<float3>& triangles);
+
+    /// Returns the results of the bake jobs finished since the last call.
+    std::vector<Result> TakeResults();
+
+    /// Current disk cache format version. Increment when the format or the baking parameters change
+    static const u32 cCacheVersion = 1;
+
+private:
+    struct Job
+    {
+        QString key;
+        BakeType type;
+        QString meshFile;
+        std::vector<float3> triangles;
+    };
+
+    /// Worker thread entry point.
+    void ThreadMain();
+
+    /// Runs a bake job. Called in a worker thread.
+    Result Process(Job& job);
+
+    /// Bakes collision data from triangles.
+    static void Bake(BakeType type, const std::vector<float3>& triangles, BakedCollisionMesh& dest, std::string& error);
+
+    /// Loads baked collision data from a cache file. Returns false if the file does not exist or is stale.
+    static bool LoadFromCache(const QString& fileName, BakeType type, BakedCollisionMesh& dest);
+
+    /// Saves baked collision data to a cache file. Returns false on failure.
+    static bool SaveToCache(const QString& fileName, BakeType type, const std::vector<float3>& triangles, const BakedCollisionMesh& mesh);
+
+    /// Cache directory with trailing slash, or empty if disk caching is disabled
+    QString cacheDirectory_;
+
+    boost::thread_group workers_;
+    boost::mutex mutex_;
+    boost::condition_variable jobAvailable_;
+    /// Queued jobs. Protected by mutex_
+    std::list<Job> jobs_;
+    /// Finished results. Protected by mutex_
+    std::vector<Result> results_;
+    /// Set when the worker threads should exit. Protected by mutex_
+    bool quit_;
+};
+
+}
+
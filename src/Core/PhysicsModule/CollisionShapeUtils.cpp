@@ -11,16 +11,24 @@
 #include "hull.h"
 
 #include <Ogre.h>
+#include <boost/thread/mutex.hpp>
 
 namespace Physics
 {
 
+/// StanHull keeps its state in globals and function-static locals, so only one convex hull can be generated at a time
+static boost::mutex hullLibraryMutex;
+
 void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr)
 {
     std::vector<float3> triangles;
     GetTrianglesFromMesh(mesh, triangles);
-    
-    for(uint i = 0; i < triangles.size(); i += 3)
+    GenerateTriangleMesh(triangles, ptr);
+}
+
+void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr)
+{
+    for(uint i = 0; i + 2 < triangles.size(); i += 3)
         ptr->addTriangle(triangles[i], triangles[i+1], triangles[i+2]);
 }
 
@@ -28,11 +36,15 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
 {
     std::vector<float3> vertices;
     GetTrianglesFromMesh(mesh, vertices);
+    std::string error = GenerateConvexHullSet(vertices, ptr);
+    if (!error.empty())
+        LogError(error);
+}
+
+std::string GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr)
+{
     if (!vertices.size())
-    {
-        LogError("Mesh had no triangles; aborting convex hull generation");
-        return;
-    }
+        return "Mesh had no triangles; aborting convex hull generation";
     
     StanHull::HullDesc desc;
     desc.SetHullFlag(StanHull::QF_TRIANGLES);
@@ -41,15 +53,13 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     desc.mVertexStride = sizeof(float3);
     desc.mSkinWidth = 0.01f; // Hardcoded skin width
     
+    boost::mutex::scoped_lock lock(hullLibraryMutex);
     StanHull::HullLibrary lib;
     StanHull::HullResult result;
     lib.CreateConvexHull(desc, result);
 
     if (!result.mNumOutputVertices)
-    {
-        LogError("No vertices were generated; aborting convex hull generation");
-        return;
-    }
+        return "No vertices were generated; aborting convex hull generation";
     
     ConvexHull hull;
     hull.position_ = float3(0,0,0);
@@ -58,6 +68,7 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     ptr->hulls_.push_back(hull);
     
     lib.ReleaseResult(result);
+    return std::string();
 }
 
 void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest)
@@ -126,4 +137,280 @@ void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest)
     }
 }
 
+/// Ogre binary mesh chunk identifiers, see OgreMeshFileFormat.h
+enum MeshChunkId
+{
+    M_HEADER = 0x1000,
+    M_MESH = 0x3000,
+    M_SUBMESH = 0x4000,
+    M_SUBMESH_OPERATION = 0x4010,
+    M_GEOMETRY = 0x5000,
+    M_GEOMETRY_VERTEX_DECLARATION = 0x5100,
+    M_GEOMETRY_VERTEX_ELEMENT = 0x5110,
+    M_GEOMETRY_VERTEX_BUFFER = 0x5200,
+    M_GEOMETRY_VERTEX_BUFFER_DATA = 0x5210
+};
+
+/// Size of an Ogre binary mesh chunk header: chunk id (u16) and chunk size (u32)
+static const size_t cMeshChunkHeaderSize = 6;
+
+/// Sequential reader for Ogre binary mesh data. Once a read goes past the end of data, all subsequent reads fail.
+class MeshDataReader
+{
+public:
+    MeshDataReader(const u8* data, size_t numBytes) : pos_(data), end_(data + numBytes), ok_(true) {}
+    
+    bool Ok() const { return ok_; }
+    void Fail() { ok_ = false; }
+    bool AtEnd() const { return pos_ >= end_; }
+    const u8* Position() const { return pos_; }
+    
+    bool Skip(size_t numBytes)
+    {
+        if (!ok_ || (size_t)(end_ - pos_) < numBytes)
+            return (ok_ = false);
+        pos_ += numBytes;
+        return true;
+    }
+    
+    u16 ReadU16() { u16 value = 0; Read(&value, sizeof value); return value; }
+    u32 ReadU32() { u32 value = 0; Read(&value, sizeof value); return value; }
+    bool ReadBool() { u8 value = 0; Read(&value, sizeof value); return value != 0; }
+    
+    /// Reads a newline-terminated string
+    std::string ReadString()
+    {
+        const u8* start = pos_;
+        while(pos_ < end_ && *pos_ != '\n')
+            ++pos_;
+        std::string str((const char*)start, pos_ - start);
+        Skip(1);
+        return str;
+    }
+    
+    /// Reads a chunk header. Returns 0 at the end of data.
+    u16 ReadChunk(u32& chunkSize)
+    {
+        if (AtEnd())
+            return 0;
+        u16 id = ReadU16();
+        chunkSize = ReadU32();
+        return ok_ ? id : 0;
+    }
+    
+    /// Steps back over a chunk header that belongs to the parent level
+    void UnreadChunk() { pos_ -= cMeshChunkHeaderSize; }
+    
+    /// Skips the contents of a chunk whose header has just been read
+    void SkipChunk(u32 chunkSize)
+    {
+        if (chunkSize < cMeshChunkHeaderSize)
+            ok_ = false;
+        else
+            Skip(chunkSize - cMeshChunkHeaderSize);
+    }
+    
+private:
+    void Read(void* dest, size_t numBytes)
+    {
+        const u8* src = pos_;
+        if (Skip(numBytes))
+            memcpy(dest, src, numBytes);
+    }
+    
+    const u8* pos_;
+    const u8* end_;
+    bool ok_;
+};
+
+/// Vertex positions of an Ogre mesh geometry chunk. Points to the mesh data, which must outlive it
+struct MeshGeometryPositions
+{
+    MeshGeometryPositions() : vertexCount(0), data(0), stride(0) {}
+    
+    float3 Position(uint index) const
+    {
+        float3 pos;
+        memcpy(&pos, data + index * stride, sizeof pos);
+        return pos;
+    }
+    
+    uint vertexCount;
+    const u8* data;
+    uint stride;
+};
+
+static void ReadMeshGeometry(MeshDataReader& reader, MeshGeometryPositions& dest)
+{
+    const u16 VES_POSITION = 1;
+    const u16 VET_FLOAT3 = 2;
+    
+    dest = MeshGeometryPositions();
+    u32 vertexCount = reader.ReadU32();
+    int posSource = -1;
+    u16 posOffset = 0;
+    
+    u32 chunkSize;
+    while(u16 id = reader.ReadChunk(chunkSize))
+    {
+        if (id == M_GEOMETRY_VERTEX_DECLARATION)
+        {
+            while((id = reader.ReadChunk(chunkSize)) == M_GEOMETRY_VERTEX_ELEMENT)
+            {
+                u16 source = reader.ReadU16();
+                u16 type = reader.ReadU16();
+                u16 semantic = reader.ReadU16();
+                u16 offset = reader.ReadU16();
+                reader.ReadU16(); // Index
+                if (semantic == VES_POSITION && type == VET_FLOAT3)
+                {
+                    posSource = source;
+                    posOffset = offset;
+                }
+            }
+            if (id)
+                reader.UnreadChunk();
+        }
+        else if (id == M_GEOMETRY_VERTEX_BUFFER)
+        {
+            u16 bindIndex = reader.ReadU16();
+            u16 vertexSize = reader.ReadU16();
+            if (reader.ReadChunk(chunkSize) != M_GEOMETRY_VERTEX_BUFFER_DATA)
+            {
+                reader.Fail();
+                return;
+            }
+            const u8* bufferData = reader.Position();
+            if (!reader.Skip((size_t)vertexCount * vertexSize))
+                return;
+            if (bindIndex == posSource && posOffset + sizeof(float3) <= vertexSize)
+            {
+                dest.vertexCount = vertexCount;
+                dest.data = bufferData + posOffset;
+                dest.stride = vertexSize;
+            }
+        }
+        else
+        {
+            reader.UnreadChunk();
+            break;
+        }
+    }
+}
+
+std::string GetTrianglesFromMeshData(const u8* data, size_t numBytes, std::vector<float3>& dest)
+{
+    const u16 OT_TRIANGLE_LIST = 4;
+    const u16 OT_TRIANGLE_STRIP = 5;
+    const u16 OT_TRIANGLE_FAN = 6;
+    
+    dest.clear();
+    
+    MeshDataReader reader(data, numBytes);
+    u16 header = reader.ReadU16();
+    if (header != M_HEADER)
+        return (header == ((M_HEADER >> 8) | ((M_HEADER & 0xff) << 8))) ? "Byte-swapped mesh data is not supported" : "Data is not an Ogre binary mesh";
+    reader.ReadString(); // Serializer version
+    
+    MeshGeometryPositions sharedGeometry;
+    u32 chunkSize;
+    while(u16 id = reader.ReadChunk(chunkSize))
+    {
+        if (id != M_MESH)
+        {
+            reader.SkipChunk(chunkSize);
+            continue;
+        }
+        
+        reader.ReadBool(); // Skeletally animated
+        while((id = reader.ReadChunk(chunkSize)) != 0)
+        {
+            if (id == M_GEOMETRY)
+                ReadMeshGeometry(reader, sharedGeometry);
+            else if (id == M_SUBMESH)
+            {
+                reader.ReadString(); // Material name
+                bool useSharedVertices = reader.ReadBool();
+                u32 indexCount = reader.ReadU32();
+                bool indexes32Bit = reader.ReadBool();
+                const u8* indexData = reader.Position();
+                reader.Skip((size_t)indexCount * (indexes32Bit ? sizeof(u32) : sizeof(u16)));
+                
+                MeshGeometryPositions ownGeometry;
+                u16 operationType = OT_TRIANGLE_LIST;
+                while((id = reader.ReadChunk(chunkSize)) != 0)
+                {
+                    if (id == M_GEOMETRY && !useSharedVertices)
+                        ReadMeshGeometry(reader, ownGeometry);
+                    else if (id == M_SUBMESH_OPERATION)
+                        operationType = reader.ReadU16();
+                    else if (id > M_SUBMESH && id < M_GEOMETRY)
+                        reader.SkipChunk(chunkSize); // Bone assignments, texture aliases
+                    else
+                    {
+                        reader.UnreadChunk();
+                        break;
+                    }
+                }
+                if (!reader.Ok())
+                    break;
+                
+                const MeshGeometryPositions& geometry = useSharedVertices ? sharedGeometry : ownGeometry;
+                if (!geometry.data || operationType < OT_TRIANGLE_LIST || operationType > OT_TRIANGLE_FAN)
+                    continue;
+                
+                std::vector<u32> indices(indexCount);
+                for(u32 i = 0; i < indexCount; ++i)
+                {
+                    if (indexes32Bit)
+                        memcpy(&indices[i], indexData + i * sizeof(u32), sizeof(u32));
+                    else
+                    {
+                        u16 index;
+                        memcpy(&index, indexData + i * sizeof(u16), sizeof(u16));
+                        indices[i] = index;
+                    }
+                    if (indices[i] >= geometry.vertexCount)
+                        return "Mesh data has an out of range vertex index";
+                }
+                
+                for(u32 i = 2; i < indexCount; ++i)
+                {
+                    if (operationType == OT_TRIANGLE_LIST)
+                    {
+                        if (i % 3 != 2)
+                            continue;
+                        dest.push_back(geometry.Position(indices[i-2]));
+                        dest.push_back(geometry.Position(indices[i-1]));
+                    }
+                    else if (operationType == OT_TRIANGLE_STRIP)
+                    {
+                        // Keep winding consistent on every other strip triangle
+                        dest.push_back(geometry.Position(indices[(i & 1) ? i-1 : i-2]));
+                        dest.push_back(geometry.Position(indices[(i & 1) ? i-2 : i-1]));
+                    }
+                    else
+                    {
+                        dest.push_back(geometry.Position(indices[0]));
+                        dest.push_back(geometry.Position(indices[i-1]));
+                    }
+                    dest.push_back(geometry.Position(indices[i]));
+                }
+            }
+            else
+                reader.SkipChunk(chunkSize);
+            
+            if (!reader.Ok())
+                break;
+        }
+    }
+    
+    if (!reader.Ok())
+    {
+        dest.clear();
+        return "Mesh data is truncated or corrupt";
+    }
+    return std::string();
+}
+
 }
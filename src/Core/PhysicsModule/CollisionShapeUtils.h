@@ -4,8 +4,11 @@
 
 #include "CoreDefines.h"
 #include "PhysicsModuleApi.h"
+#include "CoreTypes.h"
 #include "Math/float3.h"
 
+#include <string>
+
 class btConvexHullShape;
 class btTriangleMesh;
 
@@ -19,8 +22,22 @@ namespace Physics
     struct ConvexHullSet;
 
     void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr);
+    void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr);
     void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest);
     void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr);
+    
+    /// Generates a convex hull set from triangle vertices. Does not log, so it is safe to call from worker threads.
+    /** @return Empty string on success, or error description */
+    std::string GenerateConvexHullSet(const std::vector<float3>& triangles, ConvexHullSet* ptr);
+    
+    /// Reads the triangles of an Ogre binary mesh (.mesh) directly from the file data, without using Ogre.
+    /** Only triangle list, strip and fan submeshes with float3 positions are read; other submeshes are skipped.
+        Does not log, so it is safe to call from worker threads.
+        @param data Mesh file data
+        @param numBytes Size of the data
+        @param dest Vector to receive the triangle vertices, 3 per triangle
+        @return Empty string on success, or error description */
+    std::string GetTrianglesFromMeshData(const u8* data, size_t numBytes, std::vector<float3>& dest);
 }
 
 
@@ -11,7 +11,7 @@
 #include "PhysicsUtils.h"
 #include "PhysicsWorld.h"
 #include "Profiler.h"
-#include "OgreMeshAsset.h"
+#include "IAsset.h"
 #include "OgreConversionUtils.h"
 #include "Entity.h"
 #include "Scene.h"
@@ -64,7 +64,9 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     heightField_(0),
     disconnected_(false),
     cachedShapeType_(-1),
-    cachedSize_(float3::zero)
+    cachedSize_(float3::zero),
+    pendingMotionStateIndex_(-1),
+    collisionEvents_(CollisionAll)
 {
     owner_ = framework->GetModule<PhysicsModule>();
     
@@ -320,7 +322,15 @@ void EC_RigidBody::CreateCollisionShape()
         if (triangleMesh_)
         {
             // Need to first create a bvhTriangleMeshShape, then a scaled version of it to allow for individual scaling.
-            childShape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, true);
+            // Use the prebaked BVH if there is one, instead of rebuilding it for each body
+            if (triangleMeshBvh_)
+            {
+                btBvhTriangleMeshShape* meshShape = new btBvhTriangleMeshShape(triangleMesh_.get(), true, false);
+                meshShape->setOptimizedBvh(triangleMeshBvh_.get());
+                childShape_ = meshShape;
+            }
+            else
+                childShape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, true);
             shape_ = new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape*>(childShape_), btVector3(1.0f, 1.0f, 1.0f));
         }
         break;
@@ -408,6 +418,8 @@ void EC_RigidBody::RemoveBody()
 {
     if ((body_) && (world_))
     {
+        world_->CancelMotionStateUpdate(this);
+        world_->ForgetCollisions(body_);
         world_->GetWorld()->removeRigidBody(body_);
         delete body_;
         body_ = 0;
@@ -430,9 +442,17 @@ void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
 {
     // Cannot modify server-authoritative physics object, rather get the transform changes through placeable attributes
-    if (!HasAuthority())
+    if (!HasAuthority() || !body_)
         return;
     
+    // Buffer the motion state; PhysicsWorld applies it once after the final substep of the frame
+    const btVector3& angular = body_->getAngularVelocity();
+    world_->QueueMotionStateUpdate(this, worldTrans.getOrigin(), worldTrans.getRotation(), body_->getLinearVelocity(),
+        float3(angular.x() * RADTODEG, angular.y() * RADTODEG, angular.z() * RADTODEG));
+}
+
+void EC_RigidBody::ApplyMotionState(const MotionStateUpdate& update)
+{
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable)
         return;
@@ -440,9 +460,8 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
     // Important: disconnect our own response to attribute changes to not create an endless loop!
     disconnected_ = true;
     
-    // Set transform
-    float3 position = worldTrans.getOrigin();
-    Quat orientation = worldTrans.getRotation();
+    float3 position = update.position;
+    Quat orientation = update.orientation;
     
     // Non-parented case
     if (placeable->parentRef.Get().IsEmpty())
@@ -457,8 +476,21 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
     {
         if (placeable->IsAttached())
         {
-            position = placeable->GetSceneNode()->convertWorldToLocalPosition(position);
-            orientation = placeable->GetSceneNode()->convertWorldToLocalOrientation(orientation);
+            EC_Placeable* parentPlaceable = placeable->ParentPlaceableComponent();
+            if (parentPlaceable && (placeable->parentBone.Get().isEmpty() || !placeable->GetSceneNode()))
+            {
+                // Convert into the parent's space with the cached world transform, without forcing a scene node update
+                Quat parentOrientation = parentPlaceable->WorldOrientation();
+                float3 parentScale = parentPlaceable->WorldScale();
+                float3 localPos = parentOrientation.Inverted() * (position - parentPlaceable->WorldPosition());
+                position = float3(localPos.x / parentScale.x, localPos.y / parentScale.y, localPos.z / parentScale.z);
+                orientation = parentOrientation.Inverted() * orientation;
+            }
+            else if (placeable->GetSceneNode())
+            {
+                position = placeable->GetSceneNode()->convertWorldToLocalPosition(position);
+                orientation = placeable->GetSceneNode()->convertWorldToLocalOrientation(orientation);
+            }
             
             Transform newTrans = placeable->transform.Get();
             newTrans.SetPos(position);
@@ -466,13 +498,13 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
             placeable->transform.Set(newTrans, AttributeChange::Default);
         }
     }
-    // Set linear & angular velocity
-    if (body_)
-    {
-        linearVelocity.Set(body_->getLinearVelocity(), AttributeChange::Default);
-        const btVector3& angular = body_->getAngularVelocity();
-        angularVelocity.Set(float3(angular.x() * RADTODEG, angular.y() * RADTODEG, angular.z() * RADTODEG), AttributeChange::Default);
-    }
+    
+    // Set linear & angular velocity. Only signal a change if the value actually differs, as bodies moving at a constant speed
+    // would otherwise spam attribute changes (and network updates) every frame
+    if (linearVelocity.Get() != update.linearVelocity)
+        linearVelocity.Set(update.linearVelocity, AttributeChange::Default);
+    if (angularVelocity.Get() != update.angularVelocity)
+        angularVelocity.Set(update.angularVelocity, AttributeChange::Default);
     
     disconnected_ = false;
 }
@@ -485,29 +517,53 @@ void EC_RigidBody::OnTerrainRegenerated()
 
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
-    OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
-    if (!meshAsset || !meshAsset->ogreMesh.get())
-        LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
-            asset->Name() + "\", but Ogre::Mesh pointer was null!");
-
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
-
-    if (mesh)
+    if (!asset || !owner_)
+        return;
+    
+    Physics::CollisionMeshBaker::BakeType bakeType;
+    if (shapeType.Get() == Shape_TriMesh)
+        bakeType = Physics::CollisionMeshBaker::BakeTriangleMesh;
+    else if (shapeType.Get() == Shape_ConvexHull)
+        bakeType = Physics::CollisionMeshBaker::BakeConvexHulls;
+    else
+        return;
+    
+    // The collision data is baked on worker threads. If it is not ready yet, retry when it is
+    Physics::BakedCollisionMeshPtr bakedMesh = owner_->GetCollisionMesh(asset.get(), bakeType);
+    if (!bakedMesh)
     {
-        if (shapeType.Get() == Shape_TriMesh)
-        {
-            triangleMesh_ = owner_->GetTriangleMeshFromOgreMesh(mesh);
-            CreateCollisionShape();
-        }
-        if (shapeType.Get() == Shape_ConvexHull)
-        {
-            convexHullSet_ = owner_->GetConvexHullSetFromOgreMesh(mesh);
-            CreateCollisionShape();
-        }
+        pendingCollisionMesh_ = asset;
+        connect(owner_, SIGNAL(CollisionMeshBaked(const QString&)), this, SLOT(OnCollisionMeshBaked(const QString&)), Qt::UniqueConnection);
+        return;
+    }
+    
+    pendingCollisionMesh_.reset();
+    if (bakeType == Physics::CollisionMeshBaker::BakeTriangleMesh)
+    {
+        triangleMesh_ = bakedMesh->triangleMesh;
+        triangleMeshBvh_ = bakedMesh->bvh;
+    }
+    else
+        convexHullSet_ = bakedMesh->convexHullSet;
+    CreateCollisionShape();
+    
+    cachedShapeType_ = shapeType.Get();
+    cachedSize_ = size.Get();
+}
 
-        cachedShapeType_ = shapeType.Get();
-        cachedSize_ = size.Get();
+void EC_RigidBody::OnCollisionMeshBaked(const QString& assetRef)
+{
+    AssetPtr asset = pendingCollisionMesh_.lock();
+    if (!asset)
+    {
+        disconnect(owner_, SIGNAL(CollisionMeshBaked(const QString&)), this, SLOT(OnCollisionMeshBaked(const QString&)));
+        return;
     }
+    if (asset->Name() != assetRef)
+        return;
+    
+    disconnect(owner_, SIGNAL(CollisionMeshBaked(const QString&)), this, SLOT(OnCollisionMeshBaked(const QString&)));
+    OnCollisionMeshAssetLoaded(asset);
 }
 
 void EC_RigidBody::OnAttributeUpdated(IAttribute* attribute)
@@ -907,7 +963,23 @@ void EC_RigidBody::UpdatePosRotFromPlaceable()
 
 void EC_RigidBody::EmitPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision)
 {
+    if (!(collisionEvents_ & (newCollision ? CollisionBegin : CollisionPersist)))
+        return;
+    if (receivers(SIGNAL(PhysicsCollision(Entity*, const float3&, const float3&, float, float, bool))) == 0)
+        return;
+    
     PROFILE(EC_RigidBody_EmitPhysicsCollision);
     emit PhysicsCollision(otherEntity, position, normal, distance, impulse, newCollision);
 }
 
+void EC_RigidBody::EmitPhysicsCollisionEnded(Entity* otherEntity)
+{
+    if (!(collisionEvents_ & CollisionEnd))
+        return;
+    if (receivers(SIGNAL(PhysicsCollisionEnded(Entity*))) == 0)
+        return;
+    
+    PROFILE(EC_RigidBody_EmitPhysicsCollisionEnded);
+    emit PhysicsCollisionEnded(otherEntity);
+}
+
@@ -16,6 +16,7 @@
 class btRigidBody;
 class btCollisionShape;
 class btTriangleMesh;
+class btOptimizedBvh;
 class btHeightfieldTerrainShape;
 
 class EC_Placeable;
@@ -26,6 +27,7 @@ namespace Physics
     class PhysicsModule;
     class PhysicsWorld;
     struct ConvexHullSet;
+    struct MotionStateUpdate;
 }
 
 /// Physics rigid body entity component
@@ -123,6 +125,7 @@ class PHYSICS_MODULE_API EC_RigidBody : public IComponent, public btMotionState
     Q_OBJECT
     COMPONENT_NAME("EC_RigidBody", 23)
     Q_ENUMS(ShapeType)
+    Q_ENUMS(CollisionEvent)
     
 public:
     /// Do not directly allocate new components using operator new, but use the factory-based SceneAPI::CreateComponent functions instead.
@@ -141,6 +144,21 @@ public:
         Shape_ConvexHull
     };
     
+    /// Collision event types, used as bit flags for filtering which collision signals the body emits
+    enum CollisionEvent
+    {
+        CollisionBegin = 1, ///< PhysicsCollision with newCollision == true
+        CollisionPersist = 2, ///< PhysicsCollision with newCollision == false
+        CollisionEnd = 4, ///< PhysicsCollisionEnded
+        CollisionAll = CollisionBegin | CollisionPersist | CollisionEnd
+    };
+    
+    /// Collision events this body emits signals for, as a combination of CollisionEvent flags. Default CollisionAll.
+    /** This is a local, non-replicated setting. Set for example to CollisionBegin | CollisionEnd if you are not interested in continuous contact. */
+    Q_PROPERTY(int collisionEvents READ GetCollisionEvents WRITE SetCollisionEvents)
+    int GetCollisionEvents() const { return collisionEvents_; }
+    void SetCollisionEvents(int events) { collisionEvents_ = events; }
+    
     /// Mass of the body. Set to 0 for static
     Q_PROPERTY(float mass READ getmass WRITE setmass);
     DEFINE_QPROPERTY_ATTRIBUTE(float, mass);
@@ -213,21 +231,25 @@ public:
     virtual void getWorldTransform(btTransform &worldTrans) const;
 
     /// btMotionState override. Called when Bullet wants to tell us the body's current transform
+    /** The transform is not written to the placeable immediately, but buffered in the PhysicsWorld and applied once per frame after the final substep. */
     virtual void setWorldTransform(const btTransform &worldTrans);
 
 signals:
     /// A physics collision has happened between this rigid body and another entity
-    /** If there are several contact points, the signal will be sent multiple times for each contact.
+    /** The signal is sent once per frame for each colliding entity, and carries the contact point with the strongest impulse.
         @param otherEntity The second entity
         @param position World position of collision
         @param normal World normal of collision
         @param distance Contact distance
         @param impulse Impulse applied to the objects to separate them
         @param newCollision True if same collision did not happen on the previous frame.
-        If collision has multiple contact points, newCollision can only be true for the first of them.
      */
     void PhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
+    /// This rigid body is no longer in contact with an entity it collided with on the previous frame
+    /** @param otherEntity The second entity */
+    void PhysicsCollisionEnded(Entity* otherEntity);
+    
 public slots:
 
     /// Set collision mesh from visible mesh. Also sets mass 0 (static) because trimeshes cannot move in Bullet
@@ -340,6 +362,9 @@ private slots:
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
+    /// Called when baked collision data of a mesh asset has become available.
+    void OnCollisionMeshBaked(const QString& assetRef);
+
 private:
     /// (Re)create the collisionshape
     void CreateCollisionShape();
@@ -376,9 +401,15 @@ private:
     /// Calculate mass, shape & static/dynamic-classification dependant properties
     void GetProperties(btVector3& localInertia, float& m, int& collisionFlags);
     
+    /// Write a buffered motion state to the placeable transform and the velocity attributes. Called from PhysicsWorld
+    void ApplyMotionState(const Physics::MotionStateUpdate& update);
+    
     /// Emit a physics collision. Called from PhysicsWorld
     void EmitPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
+    /// Emit the end of a physics collision. Called from PhysicsWorld
+    void EmitPhysicsCollisionEnded(Entity* otherEntity);
+    
     /// Placeable pointer
     boost::weak_ptr<EC_Placeable> placeable_;
     
@@ -411,6 +442,12 @@ private:
     /// Bullet triangle mesh
     boost::shared_ptr<btTriangleMesh> triangleMesh_;
     
+    /// BVH of the triangle mesh, shared by all bodies using the same mesh
+    boost::shared_ptr<btOptimizedBvh> triangleMeshBvh_;
+    
+    /// Collision mesh asset waiting for its collision data to be baked
+    AssetWeakPtr pendingCollisionMesh_;
+    
     /// Convex hull set
     boost::shared_ptr<Physics::ConvexHullSet> convexHullSet_;
     
@@ -419,6 +456,12 @@ private:
     
     /// Heightfield values, for the case the shape is a heightfield.
     std::vector<float> heightValues_;
+    
+    /// Index of this body's pending motion state update in the PhysicsWorld, or -1 if none
+    int pendingMotionStateIndex_;
+    
+    /// Collision events to emit signals for
+    int collisionEvents_;
 };
 
 
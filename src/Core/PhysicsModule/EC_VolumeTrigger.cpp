@@ -171,11 +171,6 @@ void EC_VolumeTrigger::UpdateSignals()
         return;
     
     connect(parent, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(CheckForRigidBody()), Qt::UniqueConnection);
-
-    Scene* scene = parent->ParentScene();
-    PhysicsWorld* world = scene->GetWorld<PhysicsWorld>().get();
-    if (world)
-        connect(world, SIGNAL(Updated(float)), this, SLOT(OnPhysicsUpdate()), Qt::UniqueConnection);
 }
 
 void EC_VolumeTrigger::CheckForRigidBody()
@@ -194,43 +189,12 @@ void EC_VolumeTrigger::CheckForRigidBody()
                 this, SLOT(OnPhysicsCollision(Entity*, const float3&, const float3&, float, float, bool)), Qt::UniqueConnection);
         }
     }
-}
-
-void EC_VolumeTrigger::OnPhysicsUpdate()
-{
-    PROFILE(EC_VolumeTrigger_OnPhysicsUpdate);
-    QMap<EntityWeakPtr, bool>::iterator i = entities_.begin();
-    while(i != entities_.end())
-    {
-        if (!i.value())
-        {
-            EntityPtr entity = i.key().lock();
-            bool active = true;
-            // inactive rigid bodies don't generate collisions, so before emitting EntityLeave -event, make sure the body is active.
-            if (entity)
-            {
-                boost::shared_ptr<EC_RigidBody> rigidbody = entity->GetComponent<EC_RigidBody>();
-                if (rigidbody)
-                    active = rigidbody->IsActive();
-            }
-            if (active)
-            {
-                i = entities_.erase(i);
-                
-                if (entity)
-                {
-                    emit entityLeave(entity.get());
-                    disconnect(entity.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
-                }
-                continue;
-            }
-        } else
-        {
-            // Age the internal bool from true to false to signal that this collision is now an old one.
-            entities_.insert(i.key(), false);
-        }
-        ++i;
-    }
+    
+    // Collision ends are taken from the physics world, so that they arrive regardless of the collisionEvents of the rigid body
+    Scene* scene = ParentScene();
+    boost::shared_ptr<PhysicsWorld> world = scene ? scene->GetWorld<PhysicsWorld>() : boost::shared_ptr<PhysicsWorld>();
+    if (world)
+        connect(world.get(), SIGNAL(PhysicsCollisionEnded(Entity*, Entity*)), this, SLOT(OnWorldCollisionEnded(Entity*, Entity*)), Qt::UniqueConnection);
 }
 
 void EC_VolumeTrigger::OnPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision)
@@ -246,19 +210,45 @@ void EC_VolumeTrigger::OnPhysicsCollision(Entity* otherEntity, const float3& pos
 
     // If byPivot attribute is enabled, we require the object pivot to enter the volume trigger area.
     // Otherwise, we react on each physics collision message (i.e. we accept if the volumetrigger and other entity just touch).
+    // An entity whose pivot has left the volume leaves, even if it still touches the volume.
     if (byPivot.Get() && !IsPivotInside(entity.get()))
+    {
+        OnPhysicsCollisionEnded(otherEntity);
         return;
+    }
 
-    if (newCollision)
+    // Make sure the entity isn't already inside the volume. Note: with byPivot, the entity may enter on a later frame of an ongoing collision
+    if (entities_.find(entity) == entities_.end())
     {
-        // make sure the entity isn't already inside the volume
-        if (entities_.find(entity) == entities_.end())
-        {
-            emit entityEnter(otherEntity);
-            connect(otherEntity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
-        }
+        entities_.insert(entity, true);
+        emit entityEnter(otherEntity);
+        connect(otherEntity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
+    }
+}
+
+void EC_VolumeTrigger::OnPhysicsCollisionEnded(Entity* otherEntity)
+{
+    PROFILE(EC_VolumeTrigger_OnPhysicsCollisionEnded);
+
+    assert(otherEntity && "Physics collision with no entity.");
+
+    EntityWeakPtr ptr = otherEntity->shared_from_this();
+    QMap<EntityWeakPtr, bool>::iterator i = entities_.find(ptr);
+    if (i != entities_.end())
+    {
+        entities_.erase(i);
+        emit entityLeave(otherEntity);
+        disconnect(otherEntity, SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
     }
-    entities_.insert(entity, true);
+}
+
+void EC_VolumeTrigger::OnWorldCollisionEnded(Entity* entityA, Entity* entityB)
+{
+    Entity* parent = ParentEntity();
+    if (entityA == parent && entityB)
+        OnPhysicsCollisionEnded(entityB);
+    else if (entityB == parent && entityA)
+        OnPhysicsCollisionEnded(entityA);
 }
 
 /** Called when the given entity is deleted from the scene. In that case, remove the Entity immediately from our tracking data structure (and signal listeners). */
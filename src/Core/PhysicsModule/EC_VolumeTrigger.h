@@ -57,6 +57,7 @@ Does not emit any actions.
 <b>Depends on the component RigitBody.</b>.
 
 @note If you use 'byPivot' -option or use IsPivotInside-function, the pivot point shouldn't be outside the mesh (or physics collision primitive) because physics collisions are used for efficiency even in this case.
+      With 'byPivot', an entity leaves when its pivot is found outside on a continuing collision, so keep CollisionPersist in the collisionEvents of the volume's rigid body.
 \todo If you add an entity to the 'interesting entities list', no signals may get send for that entity,
       and it may not show up in any list of entities contained in this volume trigger until that entity moves.
       Also if you enable/disable 'byPivot' option when entities are inside the volume, no signals may get send for those entities,
@@ -168,12 +169,15 @@ private slots:
     /// Check for rigid body component and connect to its signal
     void CheckForRigidBody();
 
-    /// Collisions have been processed for the scene the parent entity is in
-    void OnPhysicsUpdate();
-
     /// Called when physics collisions occurs.
     void OnPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
 
+    /// Called when a physics collision has ended.
+    void OnPhysicsCollisionEnded(Entity* otherEntity);
+
+    /// Called when the collision of any two entities in the physics world has ended. Handles the ones involving this volume.
+    void OnWorldCollisionEnded(Entity* entityA, Entity* entityB);
+
     /// Called when entity inside this volume is removed from the scene
     void OnEntityRemoved(Entity* entity);
 
@@ -182,8 +186,8 @@ private:
     boost::weak_ptr<EC_RigidBody> rigidbody_;
 
     /// Map of entities inside this volume. 
-    /** The value is used in physics update to see if the entity is still inside
-        this volume or if it left the volume during last physics update. */
+    /** Used as an ordered set, the value is always true. Entities are removed when their collision with this volume ends,
+        or with byPivot, when their pivot is no longer inside on a collision update. */
     QMap<EntityWeakPtr, bool> entities_;
 };
 
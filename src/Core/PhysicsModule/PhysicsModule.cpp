@@ -22,11 +22,16 @@
 #include "ConsoleAPI.h"
 #include "IComponentFactory.h"
 #include "QScriptEngineHelpers.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "IAsset.h"
+#include "OgreMeshAsset.h"
 
 #include <btBulletDynamicsCommon.h>
 
 #include <QtScript>
 #include <QTreeWidgetItem>
+#include <QFile>
 
 #include <Ogre.h>
 
@@ -35,6 +40,7 @@
 Q_DECLARE_METATYPE(Physics::PhysicsModule*);
 Q_DECLARE_METATYPE(Physics::PhysicsWorld*);
 Q_DECLARE_METATYPE(PhysicsRaycastResult*);
+Q_DECLARE_METATYPE(QVector<double>);
 
 namespace Physics
 {
@@ -42,7 +48,8 @@ namespace Physics
 PhysicsModule::PhysicsModule()
 :IModule("Physics"),
 defaultPhysicsUpdatePeriod_(1.0f / 60.0f),
-defaultMaxSubSteps_(6) // If fps is below 10, we start to slow down physics
+defaultMaxSubSteps_(6), // If fps is below 10, we start to slow down physics
+nextBakeId_(0)
 {
 }
 
@@ -62,6 +69,9 @@ void PhysicsModule::Initialize()
     
     connect(framework_->Scene(), SIGNAL(SceneAdded(const QString&)), this, SLOT(OnSceneAdded(const QString&)));
     connect(framework_->Scene(), SIGNAL(SceneRemoved(const QString&)), this, SLOT(OnSceneRemoved(const QString&)));
+    // Connect to the mesh assets when they are created, so that the cached collision data is dropped on reload before
+    // the rigid bodies, which connect to the Loaded signal later, ask for it again
+    connect(framework_->Asset(), SIGNAL(AssetCreated(AssetPtr)), this, SLOT(OnAssetCreated(AssetPtr)));
 
     framework_->Console()->RegisterCommand("physicsdebug",
         "Toggles drawing of physics debug geometry.",
@@ -91,10 +101,14 @@ void PhysicsModule::Initialize()
         if (ok && steps > 0)
             SetDefaultMaxSubSteps(steps);
     }
+    
+    AssetCache* assetCache = framework_->Asset()->GetAssetCache();
+    meshBaker_ = boost::shared_ptr<CollisionMeshBaker>(new CollisionMeshBaker(assetCache ? assetCache->CacheDirectory() + "collision/" : QString()));
 }
 
 void PhysicsModule::Uninitialize()
 {
+    meshBaker_.reset();
 }
 
 void PhysicsModule::ToggleDebugGeometry()
@@ -160,6 +174,29 @@ void PhysicsModule::AutoCollisionMesh()
 void PhysicsModule::Update(f64 frametime)
 {
     PROFILE(PhysicsModule_Update);
+    
+    if (meshBaker_ && !pendingBakes_.empty())
+    {
+        std::vector<CollisionMeshBaker::Result> results = meshBaker_->TakeResults();
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const CollisionMeshBaker::Result& result = results[i];
+            // Discard the results of the jobs whose asset was reloaded or unloaded in the meantime
+            std::map<uint, QString>::iterator job = bakeJobs_.find(result.key.toUInt());
+            if (job == bakeJobs_.end())
+                continue;
+            // The cache key is the bake type followed by the asset name
+            QString key = job->second;
+            QString assetRef = key.mid(2);
+            bakeJobs_.erase(job);
+            pendingBakes_.erase(key);
+            if (!result.error.empty())
+                LogError("PhysicsModule: Failed to bake collision mesh for asset \"" + assetRef + "\": " + QString::fromStdString(result.error));
+            bakedMeshes_[key] = result.mesh;
+            emit CollisionMeshBaked(assetRef);
+        }
+    }
+    
     // Loop all the physics worlds and update them.
     PhysicsWorldMap::iterator i = physicsWorlds_.begin();
     while(i != physicsWorlds_.end())
@@ -215,6 +252,7 @@ void PhysicsModule::OnScriptEngineCreated(QScriptEngine* engine)
     qScriptRegisterQObjectMetaType<Physics::PhysicsModule*>(engine);
     qScriptRegisterQObjectMetaType<Physics::PhysicsWorld*>(engine);
     qScriptRegisterQObjectMetaType<PhysicsRaycastResult*>(engine);
+    qScriptRegisterSequenceMetaType<QVector<double> >(engine);
 }
 
 boost::shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh)
@@ -259,6 +297,79 @@ boost::shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromOgreMesh(Ogr
     return ptr;
 }
 
+BakedCollisionMeshPtr PhysicsModule::GetCollisionMesh(IAsset* meshAsset, CollisionMeshBaker::BakeType type)
+{
+    if (!meshAsset || !meshBaker_)
+        return BakedCollisionMeshPtr();
+    
+    QString key = QString::number((int)type) + ":" + meshAsset->Name();
+    BakedCollisionMeshMap::const_iterator iter = bakedMeshes_.find(key);
+    if (iter != bakedMeshes_.end())
+        return iter->second;
+    if (pendingBakes_.find(key) != pendingBakes_.end())
+        return BakedCollisionMeshPtr();
+    
+    // Prefer reading the mesh file directly. If the asset has no disk source, fall back to extracting the triangles from the Ogre mesh
+    uint bakeId = nextBakeId_++;
+    QString jobKey = QString::number(bakeId);
+    QString diskSource = meshAsset->DiskSource();
+    if (!diskSource.isEmpty() && QFile::exists(diskSource))
+        meshBaker_->BakeMeshFile(jobKey, type, diskSource);
+    else
+    {
+        OgreMeshAsset* ogreMeshAsset = dynamic_cast<OgreMeshAsset*>(meshAsset);
+        if (!ogreMeshAsset || !ogreMeshAsset->ogreMesh.get())
+        {
+            LogError("PhysicsModule::GetCollisionMesh: Mesh asset \"" + meshAsset->Name() + "\" has no disk source or Ogre mesh to read the triangles from");
+            return BakedCollisionMeshPtr(new BakedCollisionMesh());
+        }
+        std::vector<float3> triangles;
+        GetTrianglesFromMesh(ogreMeshAsset->ogreMesh.get(), triangles);
+        meshBaker_->BakeTriangles(jobKey, type, triangles);
+    }
+    
+    bakeJobs_[bakeId] = key;
+    pendingBakes_[key] = bakeId;
+    return BakedCollisionMeshPtr();
+}
+
+void PhysicsModule::OnAssetCreated(AssetPtr asset)
+{
+    if (asset && asset->Type() == "OgreMesh")
+    {
+        connect(asset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnMeshAssetLoaded(AssetPtr)), Qt::UniqueConnection);
+        connect(asset.get(), SIGNAL(Unloaded(IAsset*)), this, SLOT(OnMeshAssetUnloaded(IAsset*)), Qt::UniqueConnection);
+    }
+}
+
+void PhysicsModule::OnMeshAssetLoaded(AssetPtr asset)
+{
+    if (asset)
+        ForgetCollisionMeshes(asset->Name());
+}
+
+void PhysicsModule::OnMeshAssetUnloaded(IAsset* asset)
+{
+    if (asset)
+        ForgetCollisionMeshes(asset->Name());
+}
+
+void PhysicsModule::ForgetCollisionMeshes(const QString& assetRef)
+{
+    const CollisionMeshBaker::BakeType types[] = { CollisionMeshBaker::BakeTriangleMesh, CollisionMeshBaker::BakeConvexHulls };
+    for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+    {
+        QString key = QString::number((int)types[i]) + ":" + assetRef;
+        bakedMeshes_.erase(key);
+        std::map<QString, uint>::iterator pending = pendingBakes_.find(key);
+        if (pending != pendingBakes_.end())
+        {
+            bakeJobs_.erase(pending->second);
+            pendingBakes_.erase(pending);
+        }
+    }
+}
+
 #ifdef PROFILING
 static QTreeWidgetItem *FindItemByName(QTreeWidgetItem *parent, const char *name)
 {
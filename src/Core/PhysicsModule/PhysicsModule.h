@@ -5,8 +5,10 @@
 #include "PhysicsModuleApi.h"
 #include "IModule.h"
 #include "SceneFwd.h"
+#include "AssetFwd.h"
+#include "CollisionMeshBaker.h"
 
-#include <set>
+#include <map>
 #include <QObject>
 
 namespace Ogre
@@ -52,6 +54,19 @@ public:
      */
     boost::shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
 
+    /// Get baked collision data for a mesh asset.
+    /** The mesh data is read directly from the asset's disk source, so no Ogre mesh is needed. Baking happens on worker threads,
+        and the results are cached to disk keyed by the mesh content hash. If the data is not ready yet, queues it for baking,
+        returns null and emits CollisionMeshBaked() once it is ready.
+        @param meshAsset Mesh asset
+        @param type Kind of collision data to bake */
+    BakedCollisionMeshPtr GetCollisionMesh(IAsset* meshAsset, CollisionMeshBaker::BakeType type);
+
+signals:
+    /// Baked collision data for a mesh asset has become available
+    /** @param assetRef Name of the mesh asset */
+    void CollisionMeshBaked(const QString& assetRef);
+
 public slots:
     /// Toggles physics debug geometry
     void ToggleDebugGeometry();
@@ -88,6 +103,12 @@ private slots:
     void OnSceneAdded(const QString &name);
     /// Scene is about to be removed
     void OnSceneRemoved(const QString &name);
+    /// Asset has been created. Starts tracking reloads and unloads of mesh assets
+    void OnAssetCreated(AssetPtr asset);
+    /// Mesh asset has been (re)loaded. Drops its baked collision data, which was baked from the previous data
+    void OnMeshAssetLoaded(AssetPtr asset);
+    /// Mesh asset has been unloaded. Drops its baked collision data
+    void OnMeshAssetUnloaded(IAsset* asset);
 
 private:
     typedef std::map<Scene*, boost::shared_ptr<Physics::PhysicsWorld> > PhysicsWorldMap;
@@ -102,8 +123,25 @@ private:
     /// Bullet convex hull sets generated from Ogre meshes
     ConvexHullSetMap convexHullSets_;
     
+    /// Handles baking of collision data from mesh assets
+    boost::shared_ptr<CollisionMeshBaker> meshBaker_;
+    
+    typedef std::map<QString, BakedCollisionMeshPtr> BakedCollisionMeshMap;
+    /// Baked collision data, keyed by bake type and asset name
+    BakedCollisionMeshMap bakedMeshes_;
+    
+    /// Drops the baked collision data of a mesh asset, and discards the results of its bake jobs in progress
+    void ForgetCollisionMeshes(const QString& assetRef);
+    
+    /// Bake jobs in progress, by bake id. The keys of the jobs are the bake ids
+    std::map<uint, QString> bakeJobs_;
+    /// Bake ids of the jobs in progress, by bake type and asset name
+    std::map<QString, uint> pendingBakes_;
+    
     float defaultPhysicsUpdatePeriod_;
     int defaultMaxSubSteps_;
+    /// Counter for bake ids
+    uint nextBakeId_;
 };
 
 #ifdef PROFILING
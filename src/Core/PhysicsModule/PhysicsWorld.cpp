@@ -7,14 +7,18 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "PhysicsUtils.h"
+#include "QueryWorkerPool.h"
 #include "Profiler.h"
 #include "Scene.h"
 #include "OgreWorld.h"
 #include "EC_RigidBody.h"
+#include "Entity.h"
 #include "LoggingFunctions.h"
 #include "Math/LineSegment.h"
+#include "Math/Ray.h"
 
 #include <Ogre.h>
+#include <algorithm>
 #include "MemoryLeakCheck.h"
 
 namespace Physics
@@ -25,6 +29,263 @@ void TickCallback(btDynamicsWorld *world, btScalar timeStep)
     static_cast<Physics::PhysicsWorld*>(world->getWorldUserInfo())->ProcessPostTick(timeStep);
 }
 
+/// Minimum amount of queries per chunk in batched queries. Batches smaller than two chunks are run serially on the calling thread
+static const size_t cMinQueriesPerThread = 64;
+
+/// Calls a query functor for one chunk of the query index range.
+template<typename Func>
+struct QueryChunkTask
+{
+    void operator()(size_t chunk) const
+    {
+        (*func)(chunk, chunk * chunkSize, std::min((chunk + 1) * chunkSize, numQueries));
+    }
+    
+    const Func* func;
+    size_t chunkSize;
+    size_t numQueries;
+};
+
+/// Run a query functor for the query index range [0, numQueries), split into contiguous chunks.
+/** The functor is called as func(chunkIndex, begin, end). The first chunk is run on the calling thread, the rest on the worker pool.
+    @return Number of chunks the range was split into */
+template<typename Func>
+size_t RunQueryChunks(QueryWorkerPool& pool, size_t numQueries, const Func& func)
+{
+    size_t numChunks = std::max(std::min(pool.Concurrency(), numQueries / cMinQueriesPerThread), (size_t)1);
+    QueryChunkTask<Func> task;
+    task.func = &func;
+    task.chunkSize = (numQueries + numChunks - 1) / numChunks;
+    task.numQueries = numQueries;
+    if (numChunks == 1)
+        task(0);
+    else
+        pool.Run(numChunks, task);
+    return numChunks;
+}
+
+/// Returns the entity of a Bullet collision object, or null if none
+static Entity* EntityFromCollisionObject(const btCollisionObject* object)
+{
+    EC_RigidBody* body = object ? static_cast<EC_RigidBody*>(object->getUserPointer()) : 0;
+    return body ? body->ParentEntity() : 0;
+}
+
+/// Broadphase tree policy that raytests the collision object of each leaf the ray passes through.
+/** Uses only the stateless static Bullet query functions, so it can be run on several threads simultaneously,
+    unlike btCollisionWorld::rayTest, which uses a persistent traversal stack in the broadphase. */
+struct RayLeafCollider : btDbvt::ICollide
+{
+    RayLeafCollider(const btTransform& from, const btTransform& to, btCollisionWorld::RayResultCallback& callback) :
+        from_(from), to_(to), callback_(callback)
+    {
+    }
+    
+    void Process(const btDbvtNode* leaf)
+    {
+        btBroadphaseProxy* proxy = static_cast<btBroadphaseProxy*>(leaf->data);
+        if (!callback_.needsCollision(proxy))
+            return;
+        btCollisionObject* object = static_cast<btCollisionObject*>(proxy->m_clientObject);
+        btCollisionWorld::rayTestSingle(from_, to_, object, object->getCollisionShape(), object->getWorldTransform(), callback_);
+    }
+    
+    const btTransform& from_;
+    const btTransform& to_;
+    btCollisionWorld::RayResultCallback& callback_;
+};
+
+/// Broadphase tree policy that sweeps a convex shape against the collision object of each leaf overlapping the swept volume.
+struct SweepLeafCollider : btDbvt::ICollide
+{
+    SweepLeafCollider(const btConvexShape* shape, const btTransform& from, const btTransform& to, btCollisionWorld::ConvexResultCallback& callback) :
+        shape_(shape), from_(from), to_(to), callback_(callback)
+    {
+    }
+    
+    void Process(const btDbvtNode* leaf)
+    {
+        btBroadphaseProxy* proxy = static_cast<btBroadphaseProxy*>(leaf->data);
+        if (!callback_.needsCollision(proxy))
+            return;
+        btCollisionObject* object = static_cast<btCollisionObject*>(proxy->m_clientObject);
+        btCollisionWorld::objectQuerySingle(shape_, from_, to_, object, object->getCollisionShape(), object->getWorldTransform(), callback_, 0.0f);
+    }
+    
+    const btConvexShape* shape_;
+    const btTransform& from_;
+    const btTransform& to_;
+    btCollisionWorld::ConvexResultCallback& callback_;
+};
+
+/// Sort predicate for ordering query hits by distance
+static bool QueryHitCloser(const PhysicsQueryHit& a, const PhysicsQueryHit& b)
+{
+    return a.distance < b.distance;
+}
+
+/// Raycasts a chunk of a ray batch.
+struct RaycastChunk
+{
+    void operator()(size_t chunk, size_t begin, size_t end) const
+    {
+        std::vector<PhysicsQueryHit>& hits = (*chunkHits)[chunk];
+        PhysicsQueryHit hit;
+        for(size_t i = begin; i < end; ++i)
+        {
+            const Ray& ray = (*rays)[i];
+            btVector3 from = ray.pos;
+            btVector3 to = ray.pos + maxDistance * ray.dir;
+            btTransform fromTrans(btQuaternion(0,0,0,1), from);
+            btTransform toTrans(btQuaternion(0,0,0,1), to);
+            hit.queryIndex = (int)i;
+            
+            if (!allHits)
+            {
+                btCollisionWorld::ClosestRayResultCallback callback(from, to);
+                callback.m_collisionFilterGroup = collisionGroup;
+                callback.m_collisionFilterMask = collisionMask;
+                RayLeafCollider collider(fromTrans, toTrans, callback);
+                btDbvt::rayTest(broadphase->m_sets[0].m_root, from, to, collider);
+                btDbvt::rayTest(broadphase->m_sets[1].m_root, from, to, collider);
+                
+                hit.entity = EntityFromCollisionObject(callback.m_collisionObject);
+                if (callback.hasHit() && hit.entity)
+                {
+                    hit.pos = callback.m_hitPointWorld;
+                    hit.normal = callback.m_hitNormalWorld;
+                    hit.distance = callback.m_closestHitFraction * maxDistance;
+                    hits.push_back(hit);
+                }
+            }
+            else
+            {
+                btCollisionWorld::AllHitsRayResultCallback callback(from, to);
+                callback.m_collisionFilterGroup = collisionGroup;
+                callback.m_collisionFilterMask = collisionMask;
+                RayLeafCollider collider(fromTrans, toTrans, callback);
+                btDbvt::rayTest(broadphase->m_sets[0].m_root, from, to, collider);
+                btDbvt::rayTest(broadphase->m_sets[1].m_root, from, to, collider);
+                
+                size_t firstHit = hits.size();
+                for(int j = 0; j < callback.m_collisionObjects.size(); ++j)
+                {
+                    hit.entity = EntityFromCollisionObject(callback.m_collisionObjects[j]);
+                    if (!hit.entity)
+                        continue;
+                    hit.pos = callback.m_hitPointWorld[j];
+                    hit.normal = callback.m_hitNormalWorld[j];
+                    hit.distance = callback.m_hitFractions[j] * maxDistance;
+                    hits.push_back(hit);
+                }
+                std::sort(hits.begin() + firstHit, hits.end(), &QueryHitCloser);
+            }
+        }
+    }
+    
+    btDbvtBroadphase* broadphase;
+    const std::vector<Ray>* rays;
+    std::vector<std::vector<PhysicsQueryHit> >* chunkHits;
+    float maxDistance;
+    bool allHits;
+    short collisionGroup;
+    short collisionMask;
+};
+
+/// Sweeps a convex shape for a chunk of a sweep batch.
+struct ConvexSweepChunk
+{
+    void operator()(size_t chunk, size_t begin, size_t end) const
+    {
+        std::vector<PhysicsQueryHit>& hits = (*chunkHits)[chunk];
+        PhysicsQueryHit hit;
+        for(size_t i = begin; i < end; ++i)
+        {
+            const Ray& sweep = (*sweeps)[i];
+            btTransform fromTrans(orientation, sweep.pos);
+            btTransform toTrans(orientation, sweep.pos + maxDistance * sweep.dir);
+            
+            btCollisionWorld::ClosestConvexResultCallback callback(fromTrans.getOrigin(), toTrans.getOrigin());
+            callback.m_collisionFilterGroup = collisionGroup;
+            callback.m_collisionFilterMask = collisionMask;
+            SweepLeafCollider collider(shape, fromTrans, toTrans, callback);
+            
+            // Find the broadphase leaves overlapping the whole swept volume
+            btVector3 sweptMin, sweptMax, toMin, toMax;
+            shape->getAabb(fromTrans, sweptMin, sweptMax);
+            shape->getAabb(toTrans, toMin, toMax);
+            sweptMin.setMin(toMin);
+            sweptMax.setMax(toMax);
+            btDbvtVolume volume = btDbvtVolume::FromMM(sweptMin, sweptMax);
+            broadphase->m_sets[0].collideTV(broadphase->m_sets[0].m_root, volume, collider);
+            broadphase->m_sets[1].collideTV(broadphase->m_sets[1].m_root, volume, collider);
+            
+            hit.queryIndex = (int)i;
+            hit.entity = EntityFromCollisionObject(callback.m_hitCollisionObject);
+            if (callback.hasHit() && hit.entity)
+            {
+                hit.pos = callback.m_hitPointWorld;
+                hit.normal = callback.m_hitNormalWorld;
+                hit.distance = callback.m_closestHitFraction * maxDistance;
+                hits.push_back(hit);
+            }
+        }
+    }
+    
+    btDbvtBroadphase* broadphase;
+    const btConvexShape* shape;
+    btQuaternion orientation;
+    const std::vector<Ray>* sweeps;
+    std::vector<std::vector<PhysicsQueryHit> >* chunkHits;
+    float maxDistance;
+    short collisionGroup;
+    short collisionMask;
+};
+
+/// Contact callback that collects the objects overlapping the queried object.
+struct OverlapResultCallback : btCollisionWorld::ContactResultCallback
+{
+    virtual btScalar addSingleResult(btManifoldPoint& cp, const btCollisionObject* colObj0, int partId0, int index0, const btCollisionObject* colObj1, int partId1, int index1)
+    {
+        // Contact points are reported up to the contact breaking threshold, accept only actual penetrations
+        if (cp.getDistance() <= 0.0f)
+            objects.insert(colObj1);
+        return 0.0f;
+    }
+    
+    std::set<const btCollisionObject*> objects;
+};
+
+/// Converts flat script query data (origin x,y,z, direction x,y,z per query) to rays
+static std::vector<Ray> RaysFromScriptArray(const QVector<double>& data)
+{
+    std::vector<Ray> rays(data.size() / 6);
+    for(size_t i = 0; i < rays.size(); ++i)
+    {
+        const double* d = data.constData() + i * 6;
+        rays[i].pos = float3((float)d[0], (float)d[1], (float)d[2]);
+        rays[i].dir = float3((float)d[3], (float)d[4], (float)d[5]).Normalized();
+    }
+    return rays;
+}
+
+/// Converts query hits to flat script data (query index, entity id, distance, position x,y,z, normal x,y,z per hit)
+static QVector<double> HitsToScriptArray(const std::vector<PhysicsQueryHit>& hits)
+{
+    QVector<double> data(hits.size() * 9);
+    double* d = data.data();
+    for(size_t i = 0; i < hits.size(); ++i, d += 9)
+    {
+        const PhysicsQueryHit& hit = hits[i];
+        d[0] = hit.queryIndex;
+        d[1] = hit.entity->Id();
+        d[2] = hit.distance;
+        d[3] = hit.pos.x; d[4] = hit.pos.y; d[5] = hit.pos.z;
+        d[6] = hit.normal.x; d[7] = hit.normal.y; d[8] = hit.normal.z;
+    }
+    return data;
+}
+
 PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
     scene_(scene),
     collisionConfiguration_(0),
@@ -34,12 +295,15 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
     world_(0),
     physicsUpdatePeriod_(1.0f / 60.0f),
     maxSubSteps_(6), // If fps is below 10, we start to slow down physics
+    simulatedTime_(0.0f),
+    numDispatchedCollisions_(0),
     isClient_(isClient),
     runPhysics_(true),
     drawDebugGeometry_(false),
     drawDebugManuallySet_(false),
     debugDrawMode_(0),
-    cachedOgreWorld_(0)
+    cachedOgreWorld_(0),
+    queryWorkers_(new QueryWorkerPool())
 {
     collisionConfiguration_ = new btDefaultCollisionConfiguration();
     collisionDispatcher_ = new btCollisionDispatcher(collisionConfiguration_);
@@ -52,6 +316,9 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
 
 PhysicsWorld::~PhysicsWorld()
 {
+    delete queryWorkers_;
+    queryWorkers_ = 0;
+    
     delete world_;
     world_ = 0;
     
@@ -106,11 +373,23 @@ void PhysicsWorld::Simulate(f64 frametime)
     
     emit AboutToUpdate((float)frametime);
     
+    simulatedTime_ = 0.0f;
     {
         PROFILE(Bullet_stepSimulation); ///\note Do not delete or rename this PROFILE() block. The DebugStats profiler uses this string as a label to know where to inject the Bullet internal profiling data.
         world_->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
     }
     
+    // Now that all substeps are done, write the final motion states of the moving bodies to their placeables,
+    // then report the frame's collisions
+    ApplyMotionStateUpdates();
+    DispatchCollisions();
+    
+    if (simulatedTime_ > 0.0f)
+    {
+        PROFILE(PhysicsWorld_Simulate_FrameUpdated);
+        emit FrameUpdated(simulatedTime_);
+    }
+    
     // Automatically enable debug geometry if at least one debug-enabled rigidbody. Automatically disable if no debug-enabled rigidbodies
     // However, do not do this if user has used the physicsdebug console command
     if (!drawDebugManuallySet_)
@@ -128,14 +407,12 @@ void PhysicsWorld::Simulate(f64 frametime)
 void PhysicsWorld::ProcessPostTick(float substeptime)
 {
     PROFILE(PhysicsWorld_ProcessPostTick);
-    // Check contacts and send collision signals for them
+    // Check contacts and accumulate them to this frame's collision reports. The signals are sent once per frame in DispatchCollisions()
     int numManifolds = collisionDispatcher_->getNumManifolds();
     
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > currentCollisions;
-    
     if (numManifolds > 0)
     {
-        PROFILE(PhysicsWorld_SendCollisions);
+        PROFILE(PhysicsWorld_AccumulateCollisions);
         
         for(int i = 0; i < numManifolds; ++i)
         {
@@ -146,7 +423,7 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
             
             btCollisionObject* objectA = static_cast<btCollisionObject*>(contactManifold->getBody0());
             btCollisionObject* objectB = static_cast<btCollisionObject*>(contactManifold->getBody1());
-            std::pair<btCollisionObject*, btCollisionObject*> objectPair;
+            CollisionObjectPair objectPair;
             if (objectA < objectB)
                 objectPair = std::make_pair(objectA, objectB);
             else
@@ -162,45 +439,42 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
                 continue;
             }
             // Also, both bodies should have valid parent entities
-            Entity* entityA = bodyA->ParentEntity();
-            Entity* entityB = bodyB->ParentEntity();
-            if (!entityA || !entityB)
+            if (!bodyA->ParentEntity() || !bodyB->ParentEntity())
             {
                 LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
                 continue;
             }
-            // Check that at least one of the bodies is active
+            
+            // If both bodies are sleeping, no collision is reported, but the pair is still considered to be in contact,
+            // so that it does not end now and begin anew when the bodies wake up
             if (!objectA->isActive() && !objectB->isActive())
+            {
+                if (previousCollisions_.Find(objectPair))
+                    currentCollisions_.FindOrCreate(objectPair);
                 continue;
+            }
             
-            bool newCollision = previousCollisions_.find(objectPair) == previousCollisions_.end();
+            // Find the strongest contact point of the manifold
+            int strongest = 0;
+            for(int j = 1; j < numContacts; ++j)
+                if (contactManifold->getContactPoint(j).m_appliedImpulse > contactManifold->getContactPoint(strongest).m_appliedImpulse)
+                    strongest = j;
+            btManifoldPoint& point = contactManifold->getContactPoint(strongest);
             
-            for(int j = 0; j < numContacts; ++j)
+            // Keep the strongest contact over all the substeps of the frame
+            CollisionReport& report = currentCollisions_.FindOrCreate(objectPair);
+            if (!report.hasContact || point.m_appliedImpulse > report.impulse)
             {
-                btManifoldPoint& point = contactManifold->getContactPoint(j);
-                
-                float3 position = point.m_positionWorldOnB;
-                float3 normal = point.m_normalWorldOnB;
-                float distance = point.m_distance1;
-                float impulse = point.m_appliedImpulse;
-                
-                {
-                    PROFILE(PhysicsWorld_emit_PhysicsCollision);
-                    emit PhysicsCollision(entityA, entityB, position, normal, distance, impulse, newCollision);
-                }
-                bodyA->EmitPhysicsCollision(entityB, position, normal, distance, impulse, newCollision);
-                bodyB->EmitPhysicsCollision(entityA, position, normal, distance, impulse, newCollision);
-                
-                // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
-                // (for example play a sound -> avoid multiple sounds being played)
-                newCollision = false;
+                report.position = point.m_positionWorldOnB;
+                report.normal = point.m_normalWorldOnB;
+                report.distance = point.m_distance1;
+                report.impulse = point.m_appliedImpulse;
+                report.hasContact = true;
             }
-            
-            currentCollisions.insert(objectPair);
         }
     }
     
-    previousCollisions_ = currentCollisions;
+    simulatedTime_ += substeptime;
     
     {
         PROFILE(PhysicsWorld_ProcessPostTick_Updated);
@@ -208,6 +482,230 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
     }
 }
 
+void PhysicsWorld::DispatchCollisions()
+{
+    PROFILE(PhysicsWorld_DispatchCollisions);
+    
+    bool worldHasReceivers = receivers(SIGNAL(PhysicsCollision(Entity*, Entity*, const float3&, const float3&, float, float, bool))) > 0;
+    bool worldHasEndReceivers = receivers(SIGNAL(PhysicsCollisionEnded(Entity*, Entity*))) > 0;
+    
+    // Note: the signal handlers may remove rigidbodies, which cancels their reports. Therefore index the vectors on each iteration and check for holes
+    for(size_t i = 0; i < currentCollisions_.reports.size(); ++i)
+    {
+        // From now on, a removal of either body ends the pair with a signal
+        numDispatchedCollisions_ = i + 1;
+        CollisionReport report = currentCollisions_.reports[i];
+        if (!report.objects.first || !report.hasContact)
+            continue;
+        
+        EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(report.objects.first->getUserPointer());
+        EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(report.objects.second->getUserPointer());
+        Entity* entityA = bodyA->ParentEntity();
+        Entity* entityB = bodyB->ParentEntity();
+        if (!entityA || !entityB)
+            continue;
+        
+        bool newCollision = previousCollisions_.Find(report.objects) == 0;
+        
+        if (worldHasReceivers)
+        {
+            PROFILE(PhysicsWorld_emit_PhysicsCollision);
+            emit PhysicsCollision(entityA, entityB, report.position, report.normal, report.distance, report.impulse, newCollision);
+        }
+        // Re-check for cancellation after each signal, the receivers may have removed either body
+        if (currentCollisions_.reports[i].objects.first)
+            bodyA->EmitPhysicsCollision(entityB, report.position, report.normal, report.distance, report.impulse, newCollision);
+        if (currentCollisions_.reports[i].objects.first)
+            bodyB->EmitPhysicsCollision(entityA, report.position, report.normal, report.distance, report.impulse, newCollision);
+    }
+    
+    numDispatchedCollisions_ = currentCollisions_.reports.size();
+    
+    // Pairs that were colliding on the previous frame, but are not anymore
+    for(size_t i = 0; i < previousCollisions_.reports.size(); ++i)
+    {
+        CollisionObjectPair objects = previousCollisions_.reports[i].objects;
+        if (!objects.first || currentCollisions_.Find(objects))
+            continue;
+        
+        EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objects.first->getUserPointer());
+        EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objects.second->getUserPointer());
+        Entity* entityA = bodyA->ParentEntity();
+        Entity* entityB = bodyB->ParentEntity();
+        if (!entityA || !entityB)
+            continue;
+        
+        if (worldHasEndReceivers)
+            emit PhysicsCollisionEnded(entityA, entityB);
+        if (previousCollisions_.reports[i].objects.first)
+            bodyA->EmitPhysicsCollisionEnded(entityB);
+        if (previousCollisions_.reports[i].objects.first)
+            bodyB->EmitPhysicsCollisionEnded(entityA);
+    }
+    
+    // This frame's collisions become the previous frame's. Swap to reuse the allocated memory
+    previousCollisions_.Swap(currentCollisions_);
+    currentCollisions_.Clear();
+    numDispatchedCollisions_ = 0;
+}
+
+void PhysicsWorld::ForgetCollisions(btCollisionObject* object)
+{
+    // The pairs known to the listeners are the previous frame's, and this frame's already signaled ones if the body is removed
+    // by a handler in DispatchCollisions()
+    const size_t first = endingCollisions_.size();
+    for(size_t i = 0; i < previousCollisions_.reports.size(); ++i)
+    {
+        const CollisionObjectPair& objects = previousCollisions_.reports[i].objects;
+        if (objects.first == object || objects.second == object)
+            endingCollisions_.push_back(objects);
+    }
+    for(size_t i = 0; i < numDispatchedCollisions_ && i < currentCollisions_.reports.size(); ++i)
+    {
+        const CollisionReport& report = currentCollisions_.reports[i];
+        if (report.hasContact && (report.objects.first == object || report.objects.second == object) && !previousCollisions_.Find(report.objects))
+            endingCollisions_.push_back(report.objects);
+    }
+    // If the body is removed by a handler of an outer call, take over the outer call's pending pairs of the body,
+    // as the body is deleted when this returns
+    for(size_t i = 0; i < first; ++i)
+    {
+        CollisionObjectPair objects = endingCollisions_[i];
+        if (objects.first == object || objects.second == object)
+        {
+            endingCollisions_[i] = CollisionObjectPair(0, 0);
+            endingCollisions_.push_back(objects);
+        }
+    }
+    
+    currentCollisions_.Remove(object);
+    previousCollisions_.Remove(object);
+    
+    for(size_t i = first; i < endingCollisions_.size(); ++i)
+        EmitCollisionEnded(i);
+    endingCollisions_.resize(first);
+}
+
+void PhysicsWorld::EmitCollisionEnded(size_t index)
+{
+    CollisionObjectPair objects = endingCollisions_[index];
+    if (!objects.first)
+        return;
+    
+    EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objects.first->getUserPointer());
+    EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objects.second->getUserPointer());
+    Entity* entityA = bodyA ? bodyA->ParentEntity() : 0;
+    Entity* entityB = bodyB ? bodyB->ParentEntity() : 0;
+    // A body of an entity being destroyed no longer has a parent entity. EC_VolumeTrigger handles that through Entity::EntityRemoved
+    if (!entityA || !entityB)
+        return;
+    
+    if (receivers(SIGNAL(PhysicsCollisionEnded(Entity*, Entity*))) > 0)
+        emit PhysicsCollisionEnded(entityA, entityB);
+    // The handlers may remove either body, which takes over the pair
+    if (endingCollisions_[index].first)
+        bodyA->EmitPhysicsCollisionEnded(entityB);
+    if (endingCollisions_[index].first)
+        bodyB->EmitPhysicsCollisionEnded(entityA);
+}
+
+CollisionReport* CollisionReportList::Find(const CollisionObjectPair& objects)
+{
+    boost::unordered_map<CollisionObjectPair, size_t>::const_iterator iter = indices.find(objects);
+    return iter != indices.end() ? &reports[iter->second] : 0;
+}
+
+CollisionReport& CollisionReportList::FindOrCreate(const CollisionObjectPair& objects)
+{
+    CollisionReport* existing = Find(objects);
+    if (existing)
+        return *existing;
+    
+    indices[objects] = reports.size();
+    reports.push_back(CollisionReport());
+    CollisionReport& report = reports.back();
+    report.objects = objects;
+    report.distance = 0.0f;
+    report.impulse = 0.0f;
+    report.hasContact = false;
+    return report;
+}
+
+void CollisionReportList::Remove(btCollisionObject* object)
+{
+    for(size_t i = 0; i < reports.size(); ++i)
+    {
+        CollisionObjectPair& objects = reports[i].objects;
+        if (objects.first == object || objects.second == object)
+        {
+            indices.erase(objects);
+            objects = CollisionObjectPair(0, 0);
+        }
+    }
+}
+
+void CollisionReportList::Swap(CollisionReportList& other)
+{
+    reports.swap(other.reports);
+    indices.swap(other.indices);
+}
+
+void CollisionReportList::Clear()
+{
+    reports.clear();
+    indices.clear();
+}
+
+void PhysicsWorld::QueueMotionStateUpdate(EC_RigidBody* body, const float3& position, const Quat& orientation, const float3& linearVelocity, const float3& angularVelocity)
+{
+    MotionStateUpdate* update;
+    if (body->pendingMotionStateIndex_ >= 0)
+        update = &pendingMotionStates_[body->pendingMotionStateIndex_];
+    else
+    {
+        body->pendingMotionStateIndex_ = (int)pendingMotionStates_.size();
+        pendingMotionStates_.push_back(MotionStateUpdate());
+        update = &pendingMotionStates_.back();
+        update->body = body;
+    }
+    
+    update->position = position;
+    update->orientation = orientation;
+    update->linearVelocity = linearVelocity;
+    update->angularVelocity = angularVelocity;
+}
+
+void PhysicsWorld::CancelMotionStateUpdate(EC_RigidBody* body)
+{
+    if (body->pendingMotionStateIndex_ < 0)
+        return;
+    
+    // Leave a hole instead of erasing, so that the indices of the other pending bodies stay valid
+    pendingMotionStates_[body->pendingMotionStateIndex_].body = 0;
+    body->pendingMotionStateIndex_ = -1;
+}
+
+void PhysicsWorld::ApplyMotionStateUpdates()
+{
+    if (pendingMotionStates_.empty())
+        return;
+    
+    PROFILE(PhysicsWorld_ApplyMotionStateUpdates);
+    
+    // Note: the attribute change signals emitted here may cause rigidbodies to be removed, which cancels their updates.
+    // Therefore index the vector on each iteration and check for holes
+    for(size_t i = 0; i < pendingMotionStates_.size(); ++i)
+    {
+        MotionStateUpdate update = pendingMotionStates_[i];
+        if (!update.body)
+            continue;
+        update.body->pendingMotionStateIndex_ = -1;
+        update.body->ApplyMotionState(update);
+    }
+    
+    pendingMotionStates_.clear();
+}
+
 PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup, int collisionmask)
 {
     PROFILE(PhysicsWorld_Raycast);
@@ -241,6 +739,123 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
     return &result;
 }
 
+void PhysicsWorld::RaycastBatch(const std::vector<Ray>& rays, float maxDistance, std::vector<PhysicsQueryHit>& hits, bool allHits, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_RaycastBatch);
+    
+    hits.clear();
+    if (rays.empty())
+        return;
+    
+    std::vector<std::vector<PhysicsQueryHit> > chunkHits(queryWorkers_->Concurrency());
+    RaycastChunk func;
+    func.broadphase = static_cast<btDbvtBroadphase*>(broadphase_);
+    func.rays = &rays;
+    func.chunkHits = &chunkHits;
+    func.maxDistance = maxDistance;
+    func.allHits = allHits;
+    func.collisionGroup = (short)collisiongroup;
+    func.collisionMask = (short)collisionmask;
+    size_t numChunks = RunQueryChunks(*queryWorkers_, rays.size(), func);
+    
+    for(size_t i = 0; i < numChunks; ++i)
+        hits.insert(hits.end(), chunkHits[i].begin(), chunkHits[i].end());
+}
+
+void PhysicsWorld::SphereSweepBatch(const std::vector<Ray>& sweeps, float radius, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_SphereSweepBatch);
+    btSphereShape shape(radius);
+    ConvexSweepBatch(&shape, Quat::identity, sweeps, maxDistance, hits, collisiongroup, collisionmask);
+}
+
+void PhysicsWorld::BoxSweepBatch(const std::vector<Ray>& sweeps, const float3& halfExtents, const Quat& orientation, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_BoxSweepBatch);
+    btBoxShape shape(halfExtents);
+    ConvexSweepBatch(&shape, orientation, sweeps, maxDistance, hits, collisiongroup, collisionmask);
+}
+
+void PhysicsWorld::ConvexSweepBatch(const btConvexShape* shape, const Quat& orientation, const std::vector<Ray>& sweeps, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup, int collisionmask)
+{
+    hits.clear();
+    if (sweeps.empty())
+        return;
+    
+    std::vector<std::vector<PhysicsQueryHit> > chunkHits(queryWorkers_->Concurrency());
+    ConvexSweepChunk func;
+    func.broadphase = static_cast<btDbvtBroadphase*>(broadphase_);
+    func.shape = shape;
+    func.orientation = orientation;
+    func.sweeps = &sweeps;
+    func.chunkHits = &chunkHits;
+    func.maxDistance = maxDistance;
+    func.collisionGroup = (short)collisiongroup;
+    func.collisionMask = (short)collisionmask;
+    size_t numChunks = RunQueryChunks(*queryWorkers_, sweeps.size(), func);
+    
+    for(size_t i = 0; i < numChunks; ++i)
+        hits.insert(hits.end(), chunkHits[i].begin(), chunkHits[i].end());
+}
+
+QVector<double> PhysicsWorld::RaycastBatch(const QVector<double>& rays, float maxdistance, bool allHits, int collisiongroup, int collisionmask)
+{
+    std::vector<PhysicsQueryHit> hits;
+    RaycastBatch(RaysFromScriptArray(rays), maxdistance, hits, allHits, collisiongroup, collisionmask);
+    return HitsToScriptArray(hits);
+}
+
+QVector<double> PhysicsWorld::SphereSweepBatch(const QVector<double>& sweeps, float radius, float maxdistance, int collisiongroup, int collisionmask)
+{
+    std::vector<PhysicsQueryHit> hits;
+    SphereSweepBatch(RaysFromScriptArray(sweeps), radius, maxdistance, hits, collisiongroup, collisionmask);
+    return HitsToScriptArray(hits);
+}
+
+QVector<double> PhysicsWorld::BoxSweepBatch(const QVector<double>& sweeps, const float3& halfExtents, const Quat& orientation, float maxdistance, int collisiongroup, int collisionmask)
+{
+    std::vector<PhysicsQueryHit> hits;
+    BoxSweepBatch(RaysFromScriptArray(sweeps), halfExtents, orientation, maxdistance, hits, collisiongroup, collisionmask);
+    return HitsToScriptArray(hits);
+}
+
+QList<Entity*> PhysicsWorld::OverlapSphere(const float3& center, float radius, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_OverlapSphere);
+    btSphereShape shape(radius);
+    return OverlapShape(&shape, btTransform(btQuaternion(0,0,0,1), center), collisiongroup, collisionmask);
+}
+
+QList<Entity*> PhysicsWorld::OverlapBox(const float3& center, const float3& halfExtents, const Quat& orientation, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_OverlapBox);
+    btBoxShape shape(halfExtents);
+    return OverlapShape(&shape, btTransform(orientation, center), collisiongroup, collisionmask);
+}
+
+QList<Entity*> PhysicsWorld::OverlapShape(btCollisionShape* shape, const btTransform& transform, int collisiongroup, int collisionmask)
+{
+    // Note: the narrowphase of contactTest uses the collision dispatcher's shared memory pools, so unlike the ray and sweep batches,
+    // overlap tests are always run on the calling thread
+    btCollisionObject queryObject;
+    queryObject.setCollisionShape(shape);
+    queryObject.setWorldTransform(transform);
+    
+    OverlapResultCallback callback;
+    callback.m_collisionFilterGroup = (short)collisiongroup;
+    callback.m_collisionFilterMask = (short)collisionmask;
+    world_->contactTest(&queryObject, callback);
+    
+    QList<Entity*> entities;
+    for(std::set<const btCollisionObject*>::const_iterator iter = callback.objects.begin(); iter != callback.objects.end(); ++iter)
+    {
+        Entity* entity = EntityFromCollisionObject(*iter);
+        if (entity)
+            entities.push_back(entity);
+    }
+    return entities;
+}
+
 void PhysicsWorld::SetDrawDebugGeometry(bool enable)
 {
     if (scene_.expired() || !scene_.lock()->ViewEnabled() || drawDebugGeometry_ == enable)
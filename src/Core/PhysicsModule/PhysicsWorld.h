@@ -6,15 +6,19 @@
 #include "SceneFwd.h"
 #include "PhysicsModuleApi.h"
 #include "Math/float3.h"
+#include "Math/Quat.h"
 #include "Math/MathFwd.h"
 
 #include <LinearMath/btIDebugDraw.h>
 
 #include <set>
+#include <vector>
 #include <QObject>
 #include <QVector>
+#include <QList>
 
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_map.hpp>
 
 class btCollisionConfiguration;
 class btBroadphaseInterface;
@@ -22,6 +26,9 @@ class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btDispatcher;
 class btCollisionObject;
+class btCollisionShape;
+class btConvexShape;
+class btTransform;
 class EC_RigidBody;
 class Transform;
 class OgreWorld;
@@ -51,6 +58,75 @@ namespace Physics
 {
 
 class PhysicsModule;
+class QueryWorkerPool;
+
+/// Motion state of a rigid body as reported by Bullet, buffered until the simulation step has finished.
+struct MotionStateUpdate
+{
+    /// The rigid body. Null if the update was cancelled (body removed) while pending
+    EC_RigidBody* body;
+    /// World position
+    float3 position;
+    /// World orientation
+    Quat orientation;
+    /// Linear velocity
+    float3 linearVelocity;
+    /// Angular velocity, in degrees / sec
+    float3 angularVelocity;
+};
+
+/// A hit of a batched physics query (raycast or shape sweep).
+struct PhysicsQueryHit
+{
+    /// Index of the ray or sweep in the query batch
+    int queryIndex;
+    /// The entity that was hit
+    Entity* entity;
+    /// World position of the hit
+    float3 pos;
+    /// World normal of the hit
+    float3 normal;
+    /// Distance from the query origin. For sweeps, the distance the shape travelled before the hit
+    float distance;
+};
+
+/// An ordered pair of colliding Bullet objects. The object with the lower address is always first.
+typedef std::pair<btCollisionObject*, btCollisionObject*> CollisionObjectPair;
+
+/// Collision of an object pair aggregated over all substeps of a frame. Only the strongest contact point is retained.
+struct CollisionReport
+{
+    /// The colliding objects. Both are null if the report was cancelled (body removed) while pending
+    CollisionObjectPair objects;
+    /// World position of the strongest contact
+    float3 position;
+    /// World normal of the strongest contact
+    float3 normal;
+    /// Contact distance of the strongest contact
+    float distance;
+    /// Impulse applied at the strongest contact
+    float impulse;
+    /// False if the pair was only carried over without contact data, because both objects are sleeping
+    bool hasContact;
+};
+
+/// A flat list of collision reports with a hash index by object pair.
+struct CollisionReportList
+{
+    std::vector<CollisionReport> reports;
+    boost::unordered_map<CollisionObjectPair, size_t> indices;
+    
+    /// Return the report of an object pair, or null if the pair has no report
+    CollisionReport* Find(const CollisionObjectPair& objects);
+    /// Return the report of an object pair, creating an empty report if necessary
+    CollisionReport& FindOrCreate(const CollisionObjectPair& objects);
+    /// Remove all reports involving the given object. Leaves holes in the report vector, so that iteration by index can continue
+    void Remove(btCollisionObject* object);
+    /// Exchange contents with another list
+    void Swap(CollisionReportList& other);
+    /// Remove all reports
+    void Clear();
+};
 
 /// A physics world that encapsulates a Bullet physics world
 class PHYSICS_MODULE_API PhysicsWorld : public QObject, public btIDebugDraw, public boost::enable_shared_from_this<PhysicsWorld>
@@ -91,9 +167,41 @@ public:
     /// IDebugDraw override
     virtual int getDebugMode() const { return debugDrawMode_; }
     
-    /// Returns the set of collisions that occurred during the previous frame.
-    /// \important Use this function only for debugging, the availability of this set data structure is not guaranteed in the future.
-    const std::set<std::pair<btCollisionObject*, btCollisionObject*> > &PreviousFrameCollisions() const { return previousCollisions_; }
+    /// Raycast a batch of rays to the world.
+    /** Large batches are split to the persistent worker threads of the world. Must not be called during the simulation step.
+        @param rays Rays to cast. The directions must be normalized
+        @param maxDistance Length of each ray
+        @param hits [out] Receives the hits ordered by query index. If allHits is false, contains at most one (the closest) hit per ray,
+               otherwise all hits of each ray sorted by distance. Rays that hit nothing produce no entries.
+        @param allHits Whether to return all hits, or only the closest
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set. */
+    void RaycastBatch(const std::vector<Ray>& rays, float maxDistance, std::vector<PhysicsQueryHit>& hits, bool allHits = false, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Sweep a sphere along a batch of rays, returning the closest hit of each.
+    /** Large batches are split to the persistent worker threads of the world. Must not be called during the simulation step.
+        @param sweeps Start positions and normalized directions of the sweeps
+        @param radius Sphere radius
+        @param maxDistance Length of each sweep
+        @param hits [out] Receives the hits ordered by query index. Sweeps that hit nothing produce no entries.
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set. */
+    void SphereSweepBatch(const std::vector<Ray>& sweeps, float radius, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Sweep an oriented box along a batch of rays, returning the closest hit of each.
+    /** Large batches are split to the persistent worker threads of the world. Must not be called during the simulation step.
+        @param sweeps Start positions and normalized directions of the sweeps
+        @param halfExtents Box half size
+        @param orientation Box world orientation
+        @param maxDistance Length of each sweep
+        @param hits [out] Receives the hits ordered by query index. Sweeps that hit nothing produce no entries.
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set. */
+    void BoxSweepBatch(const std::vector<Ray>& sweeps, const float3& halfExtents, const Quat& orientation, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Returns the collisions that occurred during the previous frame. Cancelled reports have null objects.
+    /// \important Use this function only for debugging, the availability of this data structure is not guaranteed in the future.
+    const std::vector<CollisionReport> &PreviousFrameCollisions() const { return previousCollisions_.reports; }
 
 public slots:
     /// Set physics update period (= length of each simulation step.) By default 1/60th of a second.
@@ -123,6 +231,49 @@ public slots:
         @return result PhysicsRaycastResult structure */
     PhysicsRaycastResult* Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup = -1, int collisionmask = -1);
     
+    /// Raycast a batch of rays to the world. Script-friendly version which takes and returns flat number arrays.
+    /** @param rays 6 numbers per ray: origin x,y,z and direction x,y,z. Directions will be normalized automatically
+        @param maxdistance Length of each ray
+        @param allHits Whether to return all hits, or only the closest of each ray
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set.
+        @return 9 numbers per hit: ray index, entity id, distance, position x,y,z, normal x,y,z */
+    QVector<double> RaycastBatch(const QVector<double>& rays, float maxdistance, bool allHits = false, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Sweep a sphere along a batch of rays. Script-friendly version which takes and returns flat number arrays.
+    /** @param sweeps 6 numbers per sweep: start x,y,z and direction x,y,z. Directions will be normalized automatically
+        @param radius Sphere radius
+        @param maxdistance Length of each sweep
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set.
+        @return 9 numbers per hit: sweep index, entity id, distance, position x,y,z, normal x,y,z */
+    QVector<double> SphereSweepBatch(const QVector<double>& sweeps, float radius, float maxdistance, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Sweep an oriented box along a batch of rays. Script-friendly version which takes and returns flat number arrays.
+    /** @param sweeps 6 numbers per sweep: start x,y,z and direction x,y,z. Directions will be normalized automatically
+        @param halfExtents Box half size
+        @param orientation Box world orientation
+        @param maxdistance Length of each sweep
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set.
+        @return 9 numbers per hit: sweep index, entity id, distance, position x,y,z, normal x,y,z */
+    QVector<double> BoxSweepBatch(const QVector<double>& sweeps, const float3& halfExtents, const Quat& orientation, float maxdistance, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Return the entities whose collision shapes overlap a sphere.
+    /** @param center World position of the sphere
+        @param radius Sphere radius
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set. */
+    QList<Entity*> OverlapSphere(const float3& center, float radius, int collisiongroup = -1, int collisionmask = -1);
+    
+    /// Return the entities whose collision shapes overlap an oriented box.
+    /** @param center World position of the box
+        @param halfExtents Box half size
+        @param orientation Box world orientation
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set. */
+    QList<Entity*> OverlapBox(const float3& center, const float3& halfExtents, const Quat& orientation, int collisiongroup = -1, int collisionmask = -1);
+    
     /// Return gravity
     float3 GetGravity() const;
     
@@ -147,25 +298,36 @@ public slots:
 signals:
     /// A physics collision has happened between two entities. 
     /** Note: both rigidbodies participating in the collision will also emit a signal separately. 
-        Also, if there are several contact points, the signal will be sent multiple times for each contact.
+        The signal is sent once per frame for each colliding pair, after all simulation substeps, and carries the contact point
+        with the strongest impulse.
         @param entityA The first entity
         @param entityB The second entity
         @param position World position of collision
         @param normal World normal of collision
         @param distance Contact distance
         @param impulse Impulse applied to the objects to separate them
-        @param newCollision True if same collision did not happen on the previous frame.
-                If collision has multiple contact points, newCollision can only be true for the first of them. */
+        @param newCollision True if same collision did not happen on the previous frame. */
     void PhysicsCollision(Entity* entityA, Entity* entityB, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
+    /// Two entities that were colliding on the previous frame are no longer in contact.
+    /** @param entityA The first entity
+        @param entityB The second entity */
+    void PhysicsCollisionEnded(Entity* entityA, Entity* entityB);
+    
     /// Emitted before the simulation steps. Note: emitted only once per frame, not before each substep.
     /** @param frametime Length of simulation steps */
     void AboutToUpdate(float frametime);
     
     /// Emitted after each simulation step
-    /** @param frametime Length of simulation step */
+    /** The placeables of the moving rigid bodies are updated once per frame, after the last step.
+        @param frametime Length of simulation step */
     void Updated(float frametime);
     
+    /// Emitted after the simulation steps of a frame, once the placeables of the rigid bodies have been updated and the collisions signalled.
+    /** Not emitted on frames where no simulation step was taken.
+        @param simulatedTime Total length of the simulation steps taken on this frame */
+    void FrameUpdated(float simulatedTime);
+    
 private:
     /// Bullet collision config
     btCollisionConfiguration* collisionConfiguration_;
@@ -182,6 +344,8 @@ private:
     float physicsUpdatePeriod_;
     /// Maximum amount of physics simulation substeps to run on a frame
     int maxSubSteps_;
+    /// Simulated time accumulated over the substeps of the current frame
+    float simulatedTime_;
     
     /// Client scene flag
     bool isClient_;
@@ -189,12 +353,50 @@ private:
     /// Parent scene
     SceneWeakPtr scene_;
     
-    /// Previous frame's collisions. We store these to know whether the collision was new or "ongoing"
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > previousCollisions_;
+    /// This frame's collisions, accumulated over the substeps
+    CollisionReportList currentCollisions_;
+    
+    /// Previous frame's collisions. We store these to know whether the collision was new, "ongoing" or ended
+    CollisionReportList previousCollisions_;
+    
+    /// Number of this frame's collisions already signaled by DispatchCollisions()
+    size_t numDispatchedCollisions_;
+    
+    /// Pairs of removed bodies waiting for their collision end signals. Used as a stack by nested ForgetCollisions() calls
+    std::vector<CollisionObjectPair> endingCollisions_;
+    
+    /// Send the collision signals for this frame's collisions, and the collision end signals for the pairs no longer in contact
+    void DispatchCollisions();
+    
+    /// Forget all collisions of a Bullet object. Called when the body is removed
+    /** The pairs the listeners know to be in contact get their collision end signals, as if the bodies had separated. */
+    void ForgetCollisions(btCollisionObject* object);
+    
+    /// Send the collision end signals of a pair in endingCollisions_
+    void EmitCollisionEnded(size_t index);
+    
+    /// Sweep a convex shape along a batch of rays, returning the closest hit of each
+    void ConvexSweepBatch(const btConvexShape* shape, const Quat& orientation, const std::vector<Ray>& sweeps, float maxDistance, std::vector<PhysicsQueryHit>& hits, int collisiongroup, int collisionmask);
+    
+    /// Return the entities whose collision shapes overlap a shape at the given transform
+    QList<Entity*> OverlapShape(btCollisionShape* shape, const btTransform& transform, int collisiongroup, int collisionmask);
     
     /// Draw physics debug geometry, if debug drawing enabled
     void DrawDebugGeometry();
     
+    /// Buffer a motion state update of a rigid body. Called by EC_RigidBody::setWorldTransform.
+    /** If the body already has a pending update from an earlier substep, it is overwritten, so that each body is written to at most once per frame. */
+    void QueueMotionStateUpdate(EC_RigidBody* body, const float3& position, const Quat& orientation, const float3& linearVelocity, const float3& angularVelocity);
+    
+    /// Drop the pending motion state update of a rigid body, if any. Called when the Bullet body is removed.
+    void CancelMotionStateUpdate(EC_RigidBody* body);
+    
+    /// Write all buffered motion state updates to the rigid bodies' placeables. Called once per frame after the final substep.
+    void ApplyMotionStateUpdates();
+    
+    /// Motion state updates received from Bullet during the current frame, one per moving body
+    std::vector<MotionStateUpdate> pendingMotionStates_;
+    
     /// Debug geometry enabled flag
     bool drawDebugGeometry_;
     
@@ -210,6 +412,9 @@ private:
     /// Cached OgreWorld pointer for drawing debug geometry
     OgreWorld* cachedOgreWorld_;
     
+    /// Worker threads for the batched queries
+    QueryWorkerPool* queryWorkers_;
+    
     /// Debug draw-enabled rigidbodies. Note: these pointers are never dereferenced, it is just used for counting
     std::set<EC_RigidBody*> debugRigidBodies_;
 };
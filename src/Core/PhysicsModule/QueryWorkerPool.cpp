@@ -0,0 +1,98 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "QueryWorkerPool.h"
+
+#include <boost/bind.hpp>
+#include <algorithm>
+#include "MemoryLeakCheck.h"
+
+namespace Physics
+{
+
+QueryWorkerPool::QueryWorkerPool() :
+    numThreads_(std::max(boost::thread::hardware_concurrency(), 1u) - 1),
+    nextTask_(0),
+    numTasks_(0),
+    numUnfinished_(0),
+    quit_(false)
+{
+}
+
+QueryWorkerPool::~QueryWorkerPool()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        quit_ = true;
+    }
+    workAvailable_.notify_all();
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+        workers_[i]->join();
+        delete workers_[i];
+    }
+}
+
+void QueryWorkerPool::Run(size_t numTasks, const boost::function<void(size_t)>& task)
+{
+    if (numTasks == 0)
+        return;
+    // Single tasks are not worth waking the workers for
+    if (numTasks == 1 || numThreads_ == 0)
+    {
+        for(size_t i = 0; i < numTasks; ++i)
+            task(i);
+        return;
+    }
+
+    if (workers_.empty())
+        for(size_t i = 0; i < numThreads_; ++i)
+            workers_.push_back(new boost::thread(boost::bind(&QueryWorkerPool::WorkerMain, this)));
+
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        task_ = task;
+        nextTask_ = 1;
+        numTasks_ = numTasks;
+        numUnfinished_ = numTasks;
+    }
+    workAvailable_.notify_all();
+
+    task(0);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    --numUnfinished_;
+    RunTasks(lock);
+    while(numUnfinished_ > 0)
+        workDone_.wait(lock);
+    task_.clear();
+}
+
+void QueryWorkerPool::RunTasks(boost::mutex::scoped_lock& lock)
+{
+    while(nextTask_ < numTasks_)
+    {
+        size_t index = nextTask_++;
+        lock.unlock();
+        task_(index);
+        lock.lock();
+        if (--numUnfinished_ == 0)
+            workDone_.notify_all();
+    }
+}
+
+void QueryWorkerPool::WorkerMain()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    for(;;)
+    {
+        while(nextTask_ >= numTasks_ && !quit_)
+            workAvailable_.wait(lock);
+        if (quit_)
+            return;
+        RunTasks(lock);
+    }
+}
+
+}
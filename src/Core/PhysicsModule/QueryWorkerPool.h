@@ -0,0 +1,57 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <vector>
+
+namespace Physics
+{
+
+/// Persistent worker threads for splitting batched physics queries.
+/** The threads are started on the first Run call that has work for them, and are kept waiting between the calls,
+    so that a batch does not pay for creating and joining threads. Owned by PhysicsWorld. */
+class QueryWorkerPool
+{
+public:
+    QueryWorkerPool();
+    /// Stops and joins the worker threads.
+    ~QueryWorkerPool();
+
+    /// Returns the number of tasks that can run at the same time, ie. the worker threads and the calling thread.
+    size_t Concurrency() const { return numThreads_ + 1; }
+
+    /// Runs task(i) for each i in [0, numTasks), and returns when all have been run.
+    /** The calling thread runs task 0 and then helps the workers with the rest. Must not be called from several threads at the same time. */
+    void Run(size_t numTasks, const boost::function<void(size_t)>& task);
+
+private:
+    /// Worker thread entry point.
+    void WorkerMain();
+    /// Runs the remaining tasks of the current batch. The lock is held between the tasks.
+    void RunTasks(boost::mutex::scoped_lock& lock);
+
+    /// Number of worker threads to start
+    size_t numThreads_;
+    std::vector<boost::thread*> workers_;
+
+    boost::mutex mutex_;
+    boost::condition_variable workAvailable_;
+    boost::condition_variable workDone_;
+    /// Task of the current batch. Protected by mutex_
+    boost::function<void(size_t)> task_;
+    /// Next task index to run, and the number of tasks in the batch. Protected by mutex_
+    size_t nextTask_;
+    size_t numTasks_;
+    /// Number of tasks of the batch not yet finished. Protected by mutex_
+    size_t numUnfinished_;
+    /// Set when the worker threads should exit. Protected by mutex_
+    bool quit_;
+};
+
+}
@@ -14,6 +14,9 @@
 #include "LoggingFunctions.h"
 
 #include <QDomDocument>
+#include <QHash>
+
+#include <algorithm>
 
 #include <kNet/DataSerializer.h>
 #include <kNet/DataDeserializer.h>
@@ -42,6 +45,9 @@ Entity::~Entity()
         i->second->SetParentEntity(0);
    
     components_.clear();
+    componentIndex_.clear();
+    typeNameIndex_.clear();
+    firstOfType_.clear();
     qDeleteAll(actions_);
 }
 
@@ -60,9 +66,11 @@ void Entity::ChangeComponentId(component_id_t old_id, component_id_t new_id)
         RemoveComponentById(new_id, AttributeChange::LocalOnly);
     }
     
+    RemoveFromComponentIndex(old_comp.get());
     old_comp->SetNewId(new_id);
     components_.erase(old_id);
     components_[new_id] = old_comp;
+    AddToComponentIndex(old_comp);
 }
 
 void Entity::AddComponent(const ComponentPtr &component, AttributeChange::Type change)
@@ -118,6 +126,7 @@ void Entity::AddComponent(component_id_t id, const ComponentPtr &component, Attr
         component->SetNewId(id);
         component->SetParentEntity(this);
         components_[id] = component;
+        AddToComponentIndex(component);
         
         if (change != AttributeChange::Disconnected)
             emit ComponentAdded(component.get(), change == AttributeChange::Default ? component->UpdateMode() : change);
@@ -155,6 +164,7 @@ void Entity::RemoveComponent(const ComponentPtr &component, AttributeChange::Typ
                 scene_->EmitComponentRemoved(this, iter->second.get(), change);
 
             iter->second->SetParentEntity(0);
+            RemoveFromComponentIndex(iter->second.get());
             components_.erase(iter);
         }
         else
@@ -331,47 +341,114 @@ ComponentPtr Entity::GetComponentById(entity_id_t id) const
         return ComponentPtr();
 }
 
-ComponentPtr Entity::GetComponent(const QString &type_name) const
+void Entity::AddToComponentIndex(const ComponentPtr &component)
 {
-    for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        if (i->second->TypeName() == type_name)
-            return i->second;
+    ComponentIndexEntry entry;
+    entry.typeId = component->TypeId();
+    entry.id = component->Id();
+    entry.component = component;
+    
+    // The first component of a type also adds the type to the type name index
+    if (FindFirstOfType(entry.typeId) == componentIndex_.end())
+    {
+        TypeNameIndexEntry typeEntry(qHash(component->TypeName()), entry.typeId);
+        typeNameIndex_.insert(std::upper_bound(typeNameIndex_.begin(), typeNameIndex_.end(), typeEntry), typeEntry);
+    }
+    componentIndex_.insert(std::upper_bound(componentIndex_.begin(), componentIndex_.end(), entry), entry);
+    
+    ComponentPtr &first = firstOfType_[entry.typeId];
+    if (!first || entry.id < first->Id())
+        first = component;
+}
 
-    return ComponentPtr();
+void Entity::RemoveFromComponentIndex(IComponent *component)
+{
+    // The component is still at its place in the index, as its ID is changed only after it has been removed
+    ComponentIndexEntry key;
+    key.typeId = component->TypeId();
+    key.id = component->Id();
+    ComponentIndex::iterator i = std::lower_bound(componentIndex_.begin(), componentIndex_.end(), key);
+    if (i == componentIndex_.end() || i->component.get() != component)
+        return;
+    componentIndex_.erase(i);
+    
+    // The last component of a type also removes the type from the type name index
+    ComponentIndex::const_iterator first = FindFirstOfType(key.typeId);
+    if (first != componentIndex_.end())
+        firstOfType_[key.typeId] = first->component;
+    else
+    {
+        firstOfType_.erase(key.typeId);
+        TypeNameIndexEntry typeEntry(qHash(component->TypeName()), key.typeId);
+        TypeNameIndex::iterator j = std::lower_bound(typeNameIndex_.begin(), typeNameIndex_.end(), typeEntry);
+        if (j != typeNameIndex_.end() && *j == typeEntry)
+            typeNameIndex_.erase(j);
+    }
 }
 
-ComponentPtr Entity::GetComponent(u32 typeId) const
+Entity::ComponentIndex::const_iterator Entity::FindFirstOfType(u32 typeId) const
 {
-    for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        if (i->second->TypeId() == typeId)
-            return i->second;
+    // The entries of a type are sorted by component ID, so the first entry has the lowest ID
+    ComponentIndexEntry key;
+    key.typeId = typeId;
+    key.id = 0;
+    ComponentIndex::const_iterator first = std::lower_bound(componentIndex_.begin(), componentIndex_.end(), key);
+    return (first != componentIndex_.end() && first->typeId == typeId) ? first : componentIndex_.end();
+}
 
-    return ComponentPtr();
+Entity::ComponentIndex::const_iterator Entity::FindFirstOfTypeName(const QString &type_name) const
+{
+    // Find the type ID by the type name hash, then the components by the type ID. Only the type names of
+    // the types whose hash matches are compared
+    const uint hash = qHash(type_name);
+    TypeNameIndex::const_iterator i = std::lower_bound(typeNameIndex_.begin(), typeNameIndex_.end(), TypeNameIndexEntry(hash, 0));
+    for (; i != typeNameIndex_.end() && i->first == hash; ++i)
+    {
+        ComponentIndex::const_iterator first = FindFirstOfType(i->second);
+        if (first != componentIndex_.end() && first->component->TypeName() == type_name)
+            return first;
+    }
+    return componentIndex_.end();
+}
+
+ComponentPtr Entity::GetComponent(const QString &type_name) const
+{
+    ComponentIndex::const_iterator i = FindFirstOfTypeName(type_name);
+    return i != componentIndex_.end() ? i->component : ComponentPtr();
+}
+
+ComponentPtr Entity::GetComponent(u32 typeId) const
+{
+    boost::unordered_map<u32, ComponentPtr>::const_iterator i = firstOfType_.find(typeId);
+    return i != firstOfType_.end() ? i->second : ComponentPtr();
 }
 
 Entity::ComponentVector Entity::GetComponents(const QString &type_name) const
 {
     ComponentVector ret;
-    for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        if (i->second->TypeName() == type_name)
-            ret.push_back(i->second);
+    ComponentIndex::const_iterator i = FindFirstOfTypeName(type_name);
+    if (i != componentIndex_.end())
+        for (const u32 typeId = i->typeId; i != componentIndex_.end() && i->typeId == typeId; ++i)
+            ret.push_back(i->component);
     return ret;
 }
 
 ComponentPtr Entity::GetComponent(const QString &type_name, const QString& name) const
 {
-    for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        if (i->second->TypeName() == type_name && i->second->Name() == name)
-            return i->second;
+    ComponentIndex::const_iterator i = FindFirstOfTypeName(type_name);
+    if (i != componentIndex_.end())
+        for (const u32 typeId = i->typeId; i != componentIndex_.end() && i->typeId == typeId; ++i)
+            if (i->component->Name() == name)
+                return i->component;
 
     return ComponentPtr();
 }
 
 ComponentPtr Entity::GetComponent(u32 typeId, const QString& name) const
 {
-    for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-        if (i->second->TypeId() == typeId && i->second->Name() == name)
-            return i->second;
+    for (ComponentIndex::const_iterator i = FindFirstOfType(typeId); i != componentIndex_.end() && i->typeId == typeId; ++i)
+        if (i->component->Name() == name)
+            return i->component;
 
     return ComponentPtr();
 }
@@ -383,9 +460,12 @@ QObjectList Entity::GetComponentsRaw(const QString &type_name) const
         for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
             ret.push_back(i->second.get());
     else
-        for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
-            if (i->second->TypeName() == type_name)
-                ret.push_back(i->second.get());
+    {
+        ComponentIndex::const_iterator i = FindFirstOfTypeName(type_name);
+        if (i != componentIndex_.end())
+            for (const u32 typeId = i->typeId; i != componentIndex_.end() && i->typeId == typeId; ++i)
+                ret.push_back(i->component.get());
+    }
     return ret;
 }
 
@@ -10,6 +10,7 @@
 #include "UniqueIdGenerator.h"
 
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <kNetFwd.h>
 
@@ -129,7 +130,9 @@ public slots:
     /// Returns a component by ID. This is the fastest way to query, as the components are stored in a map by id.
     ComponentPtr GetComponentById(component_id_t id) const;
     /// Returns a component with type 'type_name' or empty pointer if component was not found
-    /** If there are several components with the specified type, returns the first component found (arbitrary).
+    /** If there are several components with the specified type, returns the one with the lowest component ID.
+        The lookups by type ID, including GetComponent<T>(), are hash lookups. Lookups by type name first find the type ID
+        from an index sorted by type name hash, so querying by type ID is somewhat faster than by type name.
         @param type_name type of the component */
     ComponentPtr GetComponent(const QString &type_name) const;
     /// This is an overloaded function.
@@ -392,8 +395,37 @@ private:
     /// Emit a entity deletion signal. Called from Scene
     void EmitEntityRemoved(AttributeChange::Type change);
 
+    /// Entry of the component lookup index.
+    struct ComponentIndexEntry
+    {
+        u32 typeId;
+        component_id_t id;
+        ComponentPtr component;
+
+        bool operator <(const ComponentIndexEntry &rhs) const { return typeId < rhs.typeId || (typeId == rhs.typeId && id < rhs.id); }
+    };
+    typedef std::vector<ComponentIndexEntry> ComponentIndex;
+    /// qHash of a component type name, and the type ID.
+    typedef std::pair<uint, u32> TypeNameIndexEntry;
+    typedef std::vector<TypeNameIndexEntry> TypeNameIndex;
+
+    /// Adds a component to the lookup index.
+    void AddToComponentIndex(const ComponentPtr &component);
+
+    /// Removes a component from the lookup index.
+    void RemoveFromComponentIndex(IComponent *component);
+
+    /// Returns the first lookup index entry of a component type, or componentIndex_.end() if there are no components of the type.
+    ComponentIndex::const_iterator FindFirstOfType(u32 typeId) const;
+
+    /// Returns the first lookup index entry of a component type name, or componentIndex_.end() if there are no components of the type.
+    ComponentIndex::const_iterator FindFirstOfTypeName(const QString &type_name) const;
+
     UniqueIdGenerator idGenerator_; ///< Component ID generator
     ComponentMap components_; ///< a list of all components
+    ComponentIndex componentIndex_; ///< Components sorted by type ID and component ID. Mirrors components_
+    TypeNameIndex typeNameIndex_; ///< Component types of componentIndex_ sorted by type name hash, for lookups by type name
+    boost::unordered_map<u32, ComponentPtr> firstOfType_; ///< Component with the lowest ID of each type, for constant-time lookups by type ID
     entity_id_t id_; ///< Unique id for this entity
     Framework* framework_; ///< Pointer to framework
     Scene* scene_; ///< Pointer to scene
@@ -3,7 +3,7 @@
 template <class T>
 boost::shared_ptr<T> Entity::GetComponent() const
 {
-    return boost::dynamic_pointer_cast<T>(GetComponent(T::TypeNameStatic()));
+    return boost::dynamic_pointer_cast<T>(GetComponent(T::TypeIdStatic()));
 }
 
 template <class T>
@@ -22,7 +22,7 @@ std::vector<boost::shared_ptr<T> > Entity::GetComponents() const
 template <class T>
 boost::shared_ptr<T> Entity::GetComponent(const QString& name) const
 {
-    return boost::dynamic_pointer_cast<T>(GetComponent(T::TypeNameStatic(), name));
+    return boost::dynamic_pointer_cast<T>(GetComponent(T::TypeIdStatic(), name));
 }
 
 template<typename T>
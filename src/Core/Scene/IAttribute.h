@@ -139,7 +139,8 @@ public:
         @param owner Owner component.
         @param name Name. */
     Attribute(IComponent* owner, const char* name) :
-        IAttribute(owner, name)
+        IAttribute(owner, name),
+        storage(&value)
     {
     }
 
@@ -149,21 +150,35 @@ public:
         @param val Value. */
     Attribute(IComponent* owner, const char* name, const T &val) :
         IAttribute(owner, name),
-        value(val)
+        value(val),
+        storage(&value)
     {
     }
 
     /// Returns attribute's value.
-    const T &Get() const { return value; }
+    const T &Get() const { return *storage; }
 
     /** Sets attribute's value.
         @param value New value.
         @param change Change type. */
     void Set(const T &value, AttributeChange::Type change)
     {
-        this->value = value;
+        *storage = value;
         Changed(change);
     }
+
+    /// Moves the value out of the attribute to external storage, f.ex. an array holding the values of all components of a type.
+    /** The attribute remains the API to the value. The current value is copied to the new storage, which must stay valid
+        until the storage is changed again. Does not signal a change.
+        @param newStorage Storage for the value, or null to move the value back to the attribute. */
+    void BindStorage(T *newStorage)
+    {
+        T *target = newStorage ? newStorage : &value;
+        if (target == storage)
+            return;
+        *target = *storage;
+        storage = target;
+    }
     
     /// IAttribute override
     virtual IAttribute* Clone() const
@@ -215,7 +230,8 @@ public:
     virtual void FromScriptValue(const QScriptValue &value, AttributeChange::Type change);
 
 private:
-    T value; ///< Attribute's value.
+    T value; ///< Attribute's value, unless bound to external storage.
+    T *storage; ///< Where the value is stored, either value or the storage set with BindStorage().
 };
 
 static const u32 cAttributeNone = 0;
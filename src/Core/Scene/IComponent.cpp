@@ -358,8 +358,12 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
     if (change == AttributeChange::Disconnected)
         return; // No signals
     
-    // Trigger scenemanager signal
+    // If the scene journals attribute changes, both signals are deferred to the journal flush
     Scene* scene = ParentScene();
+    if (scene && scene->JournalAttributeChange(this, attribute, change))
+        return;
+
+    // Trigger scenemanager signal
     if (scene)
         scene->EmitAttributeChanged(this, attribute, change);
     
@@ -230,7 +230,10 @@ public slots:
         OnAttributeChanged signal of this component.
 
         This function is called by IAttribute::Changed whenever the value in that
-        attribute is changed. */
+        attribute is changed.
+
+        @note If the parent scene has its attribute change journal enabled, the signals are not emitted
+        immediately, but once per changed attribute when the scene flushes the journal. See Scene::SetAttributeChangeJournalEnabled(). */
     void EmitAttributeChanged(IAttribute* attribute, AttributeChange::Type change);
 
     /// This is an overloaded function.
@@ -352,6 +355,7 @@ protected:
 private:
     friend class ::IAttribute;
     friend class Entity;
+    friend class Scene;
     
     /// Set component id. Called by Entity
     void SetNewId(component_id_t newId);
@@ -12,6 +12,7 @@
 #include "EC_Name.h"
 #include "AttributeMetadata.h"
 #include "ChangeRequest.h"
+#include "TransformHierarchy.h"
 
 #include "Framework.h"
 #include "AssetAPI.h"
@@ -24,6 +25,7 @@
 #include <QFile>
 #include <QDir>
 #include <QTextStream>
+#include <QScriptContext>
 
 #include <kNet/DataDeserializer.h>
 #include <kNet/DataSerializer.h>
@@ -31,6 +33,7 @@
 #include <boost/regex.hpp>
 
 #include <utility>
+#include <algorithm>
 #include "MemoryLeakCheck.h"
 
 using namespace kNet;
@@ -39,13 +42,18 @@ Scene::Scene(const QString &name, Framework *framework, bool viewEnabled, bool a
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    journalEnabled_(false),
+    flushingJournal_(false),
+    batchDepth_(0)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled_ = viewEnabled;
 
     // Connect to frame update to handle signalling entities created on this frame
     connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
+    // Connect to post frame update to flush the attribute change journal after all logic updates
+    connect(framework->Frame(), SIGNAL(PostFrameUpdate(float)), this, SLOT(OnPostFrameUpdate(float)));
 }
 
 Scene::~Scene()
@@ -95,6 +103,9 @@ EntityPtr Scene::CreateEntity(entity_id_t id, const QStringList &components, Att
     }
 
     EntityPtr entity = EntityPtr(new Entity(framework_, id, this));
+    // In a batch, record the creation first so that adding the components is not signalled
+    if (batchDepth_ > 0)
+        RecordBatchCreatedEntity(entity.get(), change);
     for(size_t i=0 ; i<(size_t)components.size() ; ++i)
     {
         ComponentPtr newComp = framework_->Scene()->CreateComponentByName(this, components[i]);
@@ -107,7 +118,8 @@ EntityPtr Scene::CreateEntity(entity_id_t id, const QStringList &components, Att
     entities_[entity->Id()] = entity;
 
     // Remember the creation and signal at end of frame if EmitEntityCreated() not called for this entity manually
-    entitiesCreatedThisFrame_.push_back(std::make_pair(EntityWeakPtr(entity), change));
+    if (batchDepth_ == 0)
+        entitiesCreatedThisFrame_.push_back(std::make_pair(EntityWeakPtr(entity), change));
 
     return entity;
 }
@@ -170,6 +182,13 @@ void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
     entities_[new_id] = old_entity;
 }
 
+TransformHierarchyPtr Scene::GetTransformHierarchy()
+{
+    if (!transformHierarchy_)
+        transformHierarchy_ = TransformHierarchyPtr(new TransformHierarchy());
+    return transformHierarchy_;
+}
+
 void Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
 {
     EntityMap::iterator it = entities_.find(id);
@@ -255,12 +274,19 @@ void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+    if (batchDepth_ > 0)
+    {
+        // Components of entities created in the batch are signalled when the batch is committed, before the entity creation
+        if (!IsCreatedInBatch(entity))
+            batchAddedComponents_.push_back(std::make_pair(ComponentWeakPtr(comp->shared_from_this()), change));
+        return;
+    }
     emit ComponentAdded(entity, comp, change);
 }
 
 void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
-    if (change == AttributeChange::Disconnected)
+    if (change == AttributeChange::Disconnected || IsCreatedInBatch(entity))
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
@@ -276,10 +302,254 @@ void Scene::EmitAttributeChanged(IComponent* comp, IAttribute* attribute, Attrib
     emit AttributeChanged(comp, attribute, change);
 }
 
+void Scene::SetAttributeChangeJournalEnabled(bool enabled)
+{
+    if (!enabled)
+        FlushAttributeChanges();
+    journalEnabled_ = enabled;
+}
+
+bool Scene::JournalAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
+{
+    if ((!journalEnabled_ && batchDepth_ == 0) || flushingJournal_ || interpolating_)
+        return false;
+    if ((!comp) || (!attribute) || (change == AttributeChange::Disconnected))
+        return true;
+    if (change == AttributeChange::Default)
+        change = comp->UpdateMode();
+    
+    std::pair<IComponent*, u8> key(comp, attribute->Index());
+    boost::unordered_map<std::pair<IComponent*, u8>, size_t>::iterator i = changeJournalIndices_.find(key);
+    if (i != changeJournalIndices_.end())
+    {
+        AttributeChangeRecord &record = changeJournal_[i->second];
+        // If the earlier component has expired, the address has been reused: overwrite the stale record
+        if (record.comp.expired())
+        {
+            record.comp = comp->shared_from_this();
+            record.change = change;
+        }
+        else if (change == AttributeChange::Replicate)
+            record.change = change;
+        return true;
+    }
+    
+    AttributeChangeRecord record;
+    record.comp = comp->shared_from_this();
+    record.index = key.second;
+    record.change = change;
+    changeJournalIndices_[key] = changeJournal_.size();
+    changeJournal_.push_back(record);
+    return true;
+}
+
+void Scene::FlushAttributeChanges()
+{
+    if (changeJournal_.empty() || flushingJournal_ || batchDepth_ > 0)
+        return;
+    
+    PROFILE(Scene_FlushAttributeChanges);
+    
+    // Take the journal, so that it stays consistent even if a listener disables it or triggers another flush
+    AttributeChangeRecordList changes;
+    changes.swap(changeJournal_);
+    changeJournalIndices_.clear();
+    
+    // The changes signalled on the scene level, for AttributeChangesFlushed
+    AttributeChangeRecordList sceneChanges;
+    if (journalEnabled_)
+        sceneChanges.reserve(changes.size());
+    
+    flushingJournal_ = true;
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        ComponentPtr comp = changes[i].comp.lock();
+        if (!comp || comp->ParentScene() != this)
+            continue;
+        const AttributeVector &attributes = comp->Attributes();
+        if (changes[i].index >= attributes.size() || !attributes[changes[i].index])
+            continue; // Dynamic attribute has been removed
+        IAttribute *attribute = attributes[changes[i].index];
+        // Signal in the same order as IComponent::EmitAttributeChanged: the scene first, then the component
+        if (!IsCommittedInBatch(comp->ParentEntity()))
+        {
+            emit AttributeChanged(comp.get(), attribute, changes[i].change);
+            if (journalEnabled_)
+                sceneChanges.push_back(changes[i]);
+        }
+        emit comp->AttributeChanged(attribute, changes[i].change);
+    }
+    if (!sceneChanges.empty())
+        emit AttributeChangesFlushed(sceneChanges);
+    flushingJournal_ = false;
+}
+
+Scene::BatchOwner Scene::CallingBatchOwner() const
+{
+    // engine() is the calling script engine, or null when called from C++
+    QScriptEngine *scriptEngine = engine();
+    if (!scriptEngine)
+        return BatchOwner(0, 0);
+
+    // Scripts sharing an engine are evaluated in a scope object of their own, which the functions of the script have
+    // in their scope chain. The data of the scope object is the script instance.
+    for(QScriptContext *caller = context(); caller; caller = caller->parentContext())
+    {
+        QScriptValueList scopes = caller->scopeChain();
+        for(int i = 0; i < scopes.size(); ++i)
+        {
+            QObject *script = scopes[i].data().toQObject();
+            if (script)
+                return BatchOwner(scriptEngine, script);
+        }
+    }
+    return BatchOwner(scriptEngine, 0);
+}
+
+void Scene::BeginBatch()
+{
+    BeginBatchInternal(CallingBatchOwner());
+}
+
+void Scene::EndBatch()
+{
+    EndBatchInternal(CallingBatchOwner());
+}
+
+int Scene::EndScriptBatches(QScriptEngine *engine, QObject *script)
+{
+    if (!engine)
+        return 0;
+    const BatchOwner owner(engine, script);
+    int numEnded = (int)std::count(batchOwners_.begin(), batchOwners_.end(), owner);
+    for(int i = 0; i < numEnded; ++i)
+        EndBatchInternal(owner);
+    return numEnded;
+}
+
+void Scene::BeginBatchInternal(const BatchOwner &owner)
+{
+    batchOwners_.push_back(owner);
+    ++batchDepth_;
+}
+
+void Scene::EndBatchInternal(const BatchOwner &owner)
+{
+    std::vector<BatchOwner>::reverse_iterator i = std::find(batchOwners_.rbegin(), batchOwners_.rend(), owner);
+    if (i == batchOwners_.rend())
+    {
+        LogWarning("Scene::EndBatch: No batch in progress.");
+        return;
+    }
+    batchOwners_.erase((i + 1).base());
+    if (--batchDepth_ > 0)
+        return;
+    CommitBatch();
+}
+
+void Scene::CommitBatch()
+{
+    PROFILE(Scene_CommitBatch);
+    
+    // Take the batch state, as the listeners may begin new batches
+    std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > created;
+    created.swap(batchCreatedEntities_);
+    batchCreatedIndices_.clear();
+    std::vector<std::pair<ComponentWeakPtr, AttributeChange::Type> > addedComponents;
+    addedComponents.swap(batchAddedComponents_);
+    
+    for(size_t i = 0; i < addedComponents.size(); ++i)
+    {
+        ComponentPtr comp = addedComponents[i].first.lock();
+        Entity *entity = comp ? comp->ParentEntity() : 0;
+        if (entity)
+            emit ComponentAdded(entity, comp.get(), addedComponents[i].second);
+    }
+    
+    // Signal the components of the created entities, as listeners such as the script modules set up components on ComponentAdded
+    for(size_t i = 0; i < created.size(); ++i)
+    {
+        EntityPtr entity = created[i].first.lock();
+        if (!entity)
+            continue;
+        committedEntities_.insert(entity.get());
+        AttributeChange::Type change = created[i].second;
+        if (change == AttributeChange::Disconnected)
+            continue;
+        std::vector<ComponentPtr> components;
+        for(Entity::ComponentMap::const_iterator iter = entity->Components().begin(); iter != entity->Components().end(); ++iter)
+            components.push_back(iter->second);
+        for(size_t j = 0; j < components.size(); ++j)
+        {
+            // The listeners may remove the component or the entity
+            IComponent *comp = components[j].get();
+            if (comp->ParentEntity() != entity.get())
+                continue;
+            AttributeChange::Type compChange = change == AttributeChange::LocalOnly ? change : comp->UpdateMode();
+            if (compChange != AttributeChange::Disconnected)
+                emit ComponentAdded(entity.get(), comp, compChange);
+        }
+    }
+    
+    QList<Entity *> replicated;
+    QList<Entity *> localOnly;
+    for(size_t i = 0; i < created.size(); ++i)
+    {
+        Entity *entity = created[i].first.lock().get();
+        if (!entity)
+            continue;
+        AttributeChange::Type change = created[i].second;
+        if (change == AttributeChange::Disconnected)
+            continue;
+        if (change == AttributeChange::LocalOnly)
+            localOnly.append(entity);
+        else
+            replicated.append(entity);
+    }
+    
+    if (!replicated.isEmpty())
+        emit EntitiesCreated(replicated, AttributeChange::Replicate);
+    if (!localOnly.isEmpty())
+        emit EntitiesCreated(localOnly, AttributeChange::LocalOnly);
+    
+    // The above signals may have caused entities to be removed, so check each entity again
+    for(size_t i = 0; i < created.size(); ++i)
+    {
+        Entity *entity = created[i].first.lock().get();
+        AttributeChange::Type change = created[i].second;
+        if (!entity || change == AttributeChange::Disconnected)
+            continue;
+        emit EntityCreated(entity, change == AttributeChange::LocalOnly ? change : AttributeChange::Replicate);
+    }
+    
+    FlushAttributeChanges();
+    committedEntities_.clear();
+}
+
+bool Scene::IsCreatedInBatch(Entity* entity) const
+{
+    boost::unordered_map<Entity*, size_t>::const_iterator i = batchCreatedIndices_.find(entity);
+    return i != batchCreatedIndices_.end() && batchCreatedEntities_[i->second].first.lock().get() == entity;
+}
+
+void Scene::RecordBatchCreatedEntity(Entity* entity, AttributeChange::Type change)
+{
+    boost::unordered_map<Entity*, size_t>::iterator i = batchCreatedIndices_.find(entity);
+    if (i != batchCreatedIndices_.end())
+    {
+        // Either the creation is signalled manually with another change type, or the address has been reused by a new entity
+        batchCreatedEntities_[i->second] = std::make_pair(EntityWeakPtr(entity->shared_from_this()), change);
+        return;
+    }
+    batchCreatedIndices_[entity] = batchCreatedEntities_.size();
+    batchCreatedEntities_.push_back(std::make_pair(EntityWeakPtr(entity->shared_from_this()), change));
+}
+
 void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
     // "Stealth" addition (disconnected changetype) is not supported. Always signal.
-    if ((!comp) || (!attribute))
+    // Attributes added to entities created in a batch are signalled with the entity creation.
+    if ((!comp) || (!attribute) || IsCreatedInBatch(comp->ParentEntity()))
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
@@ -289,7 +559,7 @@ void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, Attribut
 void Scene::EmitAttributeRemoved(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
     // "Stealth" removal (disconnected changetype) is not supported. Always signal.
-    if ((!comp) || (!attribute))
+    if ((!comp) || (!attribute) || IsCreatedInBatch(comp->ParentEntity()))
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
@@ -298,16 +568,27 @@ void Scene::EmitAttributeRemoved(IComponent* comp, IAttribute* attribute, Attrib
 
 void Scene::EmitEntityCreated(Entity *entity, AttributeChange::Type change)
 {
-    // Remove from the create signalling queue
-    for (unsigned i = 0; i < entitiesCreatedThisFrame_.size(); ++i)
+    // Remove from the create signalling queue. Entities created in a batch are not queued
+    if (!IsCreatedInBatch(entity))
     {
-        if (entitiesCreatedThisFrame_[i].first.lock().get() == entity)
+        for (unsigned i = 0; i < entitiesCreatedThisFrame_.size(); ++i)
         {
-            entitiesCreatedThisFrame_.erase(entitiesCreatedThisFrame_.begin() + i);
-            break;
+            if (entitiesCreatedThisFrame_[i].first.lock().get() == entity)
+            {
+                entitiesCreatedThisFrame_.erase(entitiesCreatedThisFrame_.begin() + i);
+                break;
+            }
         }
     }
     
+    // In a batch, signal at commit with the latest change type
+    if (batchDepth_ > 0)
+    {
+        if (entity)
+            RecordBatchCreatedEntity(entity, change);
+        return;
+    }
+    
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -583,6 +864,9 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
         return QList<Entity*>();
     }
 
+    // Signal the entities and their components only once everything has been created
+    SceneBatchGuard batch(this);
+
     QDomElement ent_elem = scene_elem.firstChildElement("entity");
     while(!ent_elem.isNull())
     {
@@ -651,6 +935,8 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
         }
     }
     
+    batch.End();
+    
     // The above signals may have caused scripts to remove entities. Return those that still exist.
     QList<Entity *> ret;
     for(unsigned i = 0; i < entities.size(); ++i)
@@ -688,6 +974,9 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
     std::vector<EntityWeakPtr> entities;
     assert(data);
     assert(numBytes > 0);
+    
+    // Signal the entities and their components only once everything has been created
+    SceneBatchGuard batch(this);
     try
     {
         DataDeserializer source(data, numBytes);
@@ -755,7 +1044,7 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
     }
     catch(...)
     {
-        // Note: if exception happens, no change signals are emitted
+        // Note: if exception happens, no change signals are emitted for the components
         return QList<Entity *>();
     }
 
@@ -773,6 +1062,8 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
         }
     }
     
+    batch.End();
+    
     // The above signals may have caused scripts to remove entities. Return those that still exist.
     QList<Entity *> ret;
     for(unsigned i = 0; i < entities.size(); ++i)
@@ -794,6 +1085,9 @@ QList<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool us
         return ret;
     }
 
+    // Signal the entities and their components only once everything has been created
+    SceneBatchGuard batch(this);
+
     foreach(EntityDesc e, desc.entities)
     {
         entity_id_t id;
@@ -868,6 +1162,8 @@ QList<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool us
             i->second->ComponentChanged(change);
     }
 
+    batch.End();
+
     return ret;
 }
 
@@ -1363,4 +1659,40 @@ void Scene::OnUpdated(float frameTime)
     }
     
     entitiesCreatedThisFrame_.clear();
+
+    // Resolve the placeable world transforms changed since the last frame in one pass, instead of on each query
+    if (transformHierarchy_)
+        transformHierarchy_->UpdateWorldTransforms();
+}
+
+void Scene::OnPostFrameUpdate(float /*frameTime*/)
+{
+    if (batchDepth_ > 0)
+    {
+        LogWarning("Scene::OnPostFrameUpdate: " + QString::number(batchDepth_) + " batch(es) still in progress in scene \"" + name_ +
+            "\" at the end of the frame, committing. Every BeginBatch() must be matched with an EndBatch().");
+        batchOwners_.clear();
+        batchDepth_ = 0;
+        CommitBatch();
+    }
+    FlushAttributeChanges();
+}
+
+SceneBatchGuard::SceneBatchGuard(Scene *scene) :
+    scene_(scene)
+{
+    if (scene_)
+        scene_->BeginBatchInternal(BatchOwner(0, 0));
+}
+
+SceneBatchGuard::~SceneBatchGuard()
+{
+    End();
+}
+
+void SceneBatchGuard::End()
+{
+    if (scene_)
+        scene_->EndBatchInternal(BatchOwner(0, 0));
+    scene_ = 0;
 }
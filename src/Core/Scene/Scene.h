@@ -13,13 +13,18 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QScriptable>
 
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
 class Framework;
 class SceneAPI;
+class SceneBatchGuard;
 class UserConnection;
 class QDomDocument;
+class QScriptEngine;
 
 /// Container for an ongoing attribute interpolation
 struct AttributeInterpolation
@@ -34,6 +39,19 @@ struct AttributeInterpolation
     float length;
 };
 
+/// An attribute change recorded in the scene's attribute change journal.
+/** @see Scene::SetAttributeChangeJournalEnabled */
+struct AttributeChangeRecord
+{
+    AttributeChangeRecord() : index(0), change(AttributeChange::Default) {}
+    /// Changed component. May have expired by the time the journal is flushed
+    ComponentWeakPtr comp;
+    /// Index of the changed attribute in the component
+    u8 index;
+    /// Change signalling mode. If the attribute changed several times, Replicate takes precedence over LocalOnly
+    AttributeChange::Type change;
+};
+
 /// A collection of entities which form an observable world.
 /** Acts as a factory for all entities.
     Has subsystem-specific worlds, such as rendering and physics, as dynamic properties.
@@ -41,7 +59,7 @@ struct AttributeInterpolation
     To create, access and remove scenes, see SceneAPI.
 
     \ingroup Scene_group */
-class Scene : public QObject, public boost::enable_shared_from_this<Scene>
+class Scene : public QObject, public QScriptable, public boost::enable_shared_from_this<Scene>
 {
     Q_OBJECT
     Q_PROPERTY(QString name READ Name)
@@ -94,7 +112,18 @@ public:
         @param old_id Old id of the existing entity
         @param new_id New id to set */
     void ChangeEntityId(entity_id_t old_id, entity_id_t new_id);
-    
+
+    /// Returns the transform hierarchy of the scene, creating it on first use.
+    /** Used by EC_Placeable to cache the world transforms of the placeables. See TransformHierarchy. */
+    TransformHierarchyPtr GetTransformHierarchy();
+
+    /// Ends the batches begun by a script that are still in progress. Called when a script is unloaded.
+    /** @param engine Script engine of the script
+        @param script Script instance, if the engine is shared by several scripts. The instance is the data of the scope
+               object the script is evaluated in. Null for a script that has an engine of its own.
+        @return Number of batches ended */
+    int EndScriptBatches(QScriptEngine *engine, QObject *script = 0);
+
 public slots:
     /// Creates new entity that contains the specified components.
     /** Entities should never be created directly, but instead created with this function.
@@ -241,6 +270,54 @@ public slots:
         @param change Change signalling mode */
     void EmitAttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
 
+    /// Enables or disables the attribute change journal.
+    /** By default attribute changes are signalled immediately, once per change. When the journal is enabled, changes
+        are instead recorded as (component, attribute index, change type) and duplicates within a frame are coalesced.
+        The journal is flushed once per frame on FrameAPI::PostFrameUpdate, or when FlushAttributeChanges() is called:
+        the scene emits AttributeChanged() and the component IComponent::AttributeChanged once per changed attribute,
+        after which the scene emits a single AttributeChangesFlushed() signal for the whole flush.
+        Changes made during attribute interpolation, or by the listeners while the journal is being flushed, are signalled immediately.
+        Disabling the journal flushes it. */
+    void SetAttributeChangeJournalEnabled(bool enabled);
+
+    /// Returns whether the attribute change journal is enabled.
+    bool IsAttributeChangeJournalEnabled() const { return journalEnabled_; }
+
+    /// Signals and clears the attribute changes recorded in the journal.
+    /** Does nothing while a batch is in progress; the journal is then flushed when the batch is committed. */
+    void FlushAttributeChanges();
+
+    /// Begins a batch of scene edits, for bulk creation or editing of content.
+    /** Until the matching EndBatch(), scene signals are not emitted for the intermediate steps:
+        - Entity creations are not signalled, and neither are the components and attributes added to the created entities.
+        - Components added are signalled at commit, both those of the created entities and those added to existing entities.
+        - Attribute changes are recorded to the attribute change journal, as if it was enabled, and coalesced.
+        Batches can be nested; the outermost EndBatch() commits. Every BeginBatch() must be matched with an EndBatch().
+        Entity, component and attribute removals are signalled immediately.
+        Batches still in progress at the end of the frame are committed, and the batches begun by a script are ended
+        when the script is unloaded, with a warning. From C++, use SceneBatchGuard instead. */
+    void BeginBatch();
+
+    /// Ends a batch of scene edits. If this ends the outermost batch, commits it.
+    /** At commit, signals the components added to existing entities and then the components of the created entities
+        with ComponentAdded, then the created entities with one EntitiesCreated signal per change type followed by
+        EntityCreated for each entity, and finally flushes the attribute changes. The scene-level attribute change signals are not emitted for the created entities. */
+    void EndBatch();
+
+    /// Returns whether a batch of scene edits is in progress.
+    bool IsInBatch() const { return batchDepth_ > 0; }
+
+    /// Returns whether the entity has been created in the batch that is being committed.
+    /** Listeners that handle EntitiesCreated can use this to ignore the EntityCreated signals that follow it. */
+    bool IsCommittedInBatch(Entity* entity) const { return committedEntities_.find(entity) != committedEntities_.end(); }
+
+    /// Records an attribute change to the journal. Called by IComponent.
+    /** @param comp Component pointer
+        @param attribute Attribute pointer
+        @param change Change signalling mode
+        @return True if the change was journaled, false if it should be signalled immediately */
+    bool JournalAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
+
     /// Emits notification of an attribute having been created. Called by IComponent's with dynamic structure
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -402,6 +479,12 @@ signals:
     /** Network synchronization managers should connect to this. */
     void AttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
 
+    /// Signal when the attribute change journal has been flushed
+    /** Emitted after AttributeChanged has been emitted for each of the journaled changes, when the attribute change journal is enabled.
+        Listeners that only need to know the changed attributes once per frame can connect to this instead of AttributeChanged.
+        @param changes Coalesced changes, in the order they were first recorded. Check that the components have not expired. */
+    void AttributeChangesFlushed(const AttributeChangeRecordList& changes);
+
     /// Signal when an attribute of a component has been added (dynamic structure components only)
     /** Network synchronization managers should connect to this. */
     void AttributeAdded(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
@@ -422,6 +505,11 @@ signals:
     /** @note Entity::IsTemporary() information might not be accurate yet, as it depends on the method that was used to create the entity. */
     void EntityCreated(Entity* entity, AttributeChange::Type change);
 
+    /// Signal when a batch of scene edits creating entities has been committed
+    /** Emitted once per change type, before EntityCreated is emitted for each of the entities.
+        @see BeginBatch, IsCommittedInBatch */
+    void EntitiesCreated(const QList<Entity *> &entities, AttributeChange::Type change);
+
     /// Signal when an entity deleted
     void EntityRemoved(Entity* entity, AttributeChange::Type change);
 
@@ -452,10 +540,14 @@ signals:
 private slots:
     /// Handle frame update. Signal this frame's entity creations.
     void OnUpdated(float frameTime);
+
+    /// Handle post frame update. Flush the attribute change journal.
+    void OnPostFrameUpdate(float frameTime);
     
 private:
     Q_DISABLE_COPY(Scene);
     friend class ::SceneAPI;
+    friend class ::SceneBatchGuard;
     
     /// Constructor.
     /** @param name Name of the scene.
@@ -473,4 +565,59 @@ private:
     bool authority_; ///< Authority -flag
     std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
+    bool journalEnabled_; ///< Attribute change journal enabled -flag.
+    bool flushingJournal_; ///< Currently flushing the attribute change journal -flag.
+    AttributeChangeRecordList changeJournal_; ///< Journaled attribute changes since the last flush.
+    /// Index of each journaled (component, attribute index) pair in changeJournal_, for coalescing.
+    boost::unordered_map<std::pair<IComponent*, u8>, size_t> changeJournalIndices_;
+    int batchDepth_; ///< Nesting depth of the batch in progress, 0 if none.
+    /// Script engine and script instance, if the engine is shared, that began a batch. Both null for C++.
+    typedef std::pair<QScriptEngine*, QObject*> BatchOwner;
+    std::vector<BatchOwner> batchOwners_; ///< Owner of each nested batch in progress.
+    std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > batchCreatedEntities_; ///< Entities created in the batch in progress.
+    boost::unordered_map<Entity*, size_t> batchCreatedIndices_; ///< Index of each entity in batchCreatedEntities_.
+    /// Components added to existing entities in the batch in progress.
+    std::vector<std::pair<ComponentWeakPtr, AttributeChange::Type> > batchAddedComponents_;
+    /// Entities created in the batch being committed. Their attribute changes are not signalled on the scene level.
+    boost::unordered_set<Entity*> committedEntities_;
+
+    /// Cached placeable world transforms, created on first use.
+    TransformHierarchyPtr transformHierarchy_;
+
+    /// Returns whether the entity has been created in the batch in progress.
+    bool IsCreatedInBatch(Entity* entity) const;
+
+    /// Records an entity creation to the batch in progress.
+    void RecordBatchCreatedEntity(Entity* entity, AttributeChange::Type change);
+
+    /// Returns the script that is calling BeginBatch or EndBatch, or null owner for C++.
+    BatchOwner CallingBatchOwner() const;
+
+    /// Begins a batch on behalf of a script, or C++ if the owner is null.
+    void BeginBatchInternal(const BatchOwner &owner);
+
+    /// Ends the innermost batch begun by a script, or C++ if the owner is null. Commits if no batches remain.
+    void EndBatchInternal(const BatchOwner &owner);
+
+    /// Signals the entities, components and attribute changes of the batch that has ended.
+    void CommitBatch();
+};
+
+/// Begins a batch of scene edits on construction, and ends it on destruction.
+/** Ends the batch even if an exception is thrown while it is in progress. See Scene::BeginBatch(). */
+class SceneBatchGuard
+{
+public:
+    /// Begins a batch in the scene.
+    explicit SceneBatchGuard(Scene *scene);
+
+    /// Ends the batch, unless already ended with End().
+    ~SceneBatchGuard();
+
+    /// Ends the batch before the guard goes out of scope.
+    void End();
+
+private:
+    Q_DISABLE_COPY(SceneBatchGuard);
+    Scene *scene_; ///< Scene of the batch, or null if the batch has been ended.
 };
@@ -43,5 +43,12 @@ typedef boost::shared_ptr<IComponent> ComponentPtr;
 typedef boost::weak_ptr<IComponent> ComponentWeakPtr;
 typedef boost::shared_ptr<IComponentFactory> ComponentFactoryPtr;
 typedef std::vector<IAttribute*> AttributeVector;
+
+struct AttributeChangeRecord;
+typedef std::vector<AttributeChangeRecord> AttributeChangeRecordList;
 typedef std::map<QString, ScenePtr> SceneMap;
 
+class TransformHierarchy;
+typedef boost::shared_ptr<TransformHierarchy> TransformHierarchyPtr;
+typedef boost::weak_ptr<TransformHierarchy> TransformHierarchyWeakPtr;
+
@@ -0,0 +1,239 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TransformHierarchy.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+TransformHierarchy::TransformHierarchy() :
+    numDirty_(0),
+    numNodes_(0)
+{
+}
+
+TransformHierarchy::~TransformHierarchy()
+{
+    for(size_t i = 0; i < localTransforms_.size(); ++i)
+        delete[] localTransforms_[i];
+}
+
+TransformHierarchy::NodeId TransformHierarchy::CreateNode()
+{
+    NodeId node;
+    if (!freeNodes_.empty())
+    {
+        node = freeNodes_.back();
+        freeNodes_.pop_back();
+    }
+    else
+    {
+        node = (NodeId)alive_.size();
+        if (node / cChunkSize >= localTransforms_.size())
+            localTransforms_.push_back(new Transform[cChunkSize]);
+        localRot_.push_back(Quat::identity);
+        localScale_.push_back(float3::one);
+        worldPos_.push_back(float3::zero);
+        worldRot_.push_back(Quat::identity);
+        worldScale_.push_back(float3::one);
+        world_.push_back(float3x4::identity);
+        parent_.push_back(NoNode);
+        firstChild_.push_back(NoNode);
+        nextSibling_.push_back(NoNode);
+        prevSibling_.push_back(NoNode);
+        dirty_.push_back(0);
+        alive_.push_back(0);
+    }
+
+    LocalTransformStorage(node) = Transform();
+    localRot_[node] = Quat::identity;
+    localScale_[node] = float3::one;
+    worldPos_[node] = float3::zero;
+    worldRot_[node] = Quat::identity;
+    worldScale_[node] = float3::one;
+    world_[node] = float3x4::identity;
+    parent_[node] = NoNode;
+    firstChild_[node] = NoNode;
+    nextSibling_[node] = NoNode;
+    prevSibling_[node] = NoNode;
+    dirty_[node] = 0;
+    alive_[node] = 1;
+    ++numNodes_;
+    return node;
+}
+
+void TransformHierarchy::DestroyNode(NodeId node)
+{
+    if (!IsValid(node))
+        return;
+
+    // Move the children to the root
+    NodeId child = firstChild_[node];
+    while(child != NoNode)
+    {
+        NodeId next = nextSibling_[child];
+        parent_[child] = NoNode;
+        prevSibling_[child] = NoNode;
+        nextSibling_[child] = NoNode;
+        MarkDirty(child);
+        child = next;
+    }
+    firstChild_[node] = NoNode;
+
+    Unlink(node);
+    if (dirty_[node])
+    {
+        dirty_[node] = 0;
+        --numDirty_;
+    }
+    alive_[node] = 0;
+    freeNodes_.push_back(node);
+    --numNodes_;
+}
+
+bool TransformHierarchy::SetParent(NodeId node, NodeId parent)
+{
+    if (!IsValid(node))
+        return false;
+    if (parent != NoNode && !IsValid(parent))
+        parent = NoNode;
+    if (parent_[node] == parent)
+        return true;
+
+    // Refuse cyclic parenting
+    for(NodeId ancestor = parent; ancestor != NoNode; ancestor = parent_[ancestor])
+        if (ancestor == node)
+            return false;
+
+    Unlink(node);
+    parent_[node] = parent;
+    if (parent != NoNode)
+    {
+        nextSibling_[node] = firstChild_[parent];
+        if (firstChild_[parent] != NoNode)
+            prevSibling_[firstChild_[parent]] = node;
+        firstChild_[parent] = node;
+    }
+    MarkDirty(node);
+    return true;
+}
+
+TransformHierarchy::NodeId TransformHierarchy::Parent(NodeId node) const
+{
+    return IsValid(node) ? parent_[node] : NoNode;
+}
+
+void TransformHierarchy::SetLocalTransform(NodeId node, const Transform &transform)
+{
+    if (!IsValid(node))
+        return;
+    LocalTransformStorage(node) = transform;
+    LocalTransformChanged(node);
+}
+
+void TransformHierarchy::LocalTransformChanged(NodeId node)
+{
+    if (!IsValid(node))
+        return;
+    const Transform &transform = LocalTransformStorage(node);
+    // An invalid orientation keeps the previous one, like the Ogre scene node does
+    Quat orientation = transform.Orientation();
+    if (orientation.IsFinite())
+        localRot_[node] = orientation;
+    // Same clamping as EC_Placeable does for the Ogre scene node, which does not accept zero scale
+    localScale_[node] = float3(std::max(transform.scale.x, 0.0000001f), std::max(transform.scale.y, 0.0000001f),
+        std::max(transform.scale.z, 0.0000001f));
+    MarkDirty(node);
+}
+
+float3x4 TransformHierarchy::LocalTransform(NodeId node) const
+{
+    if (!IsValid(node))
+        return float3x4::identity;
+    const float3 &pos = localTransforms_[node / cChunkSize][node % cChunkSize].pos;
+    return float3x4::FromTRS(pos.IsFinite() ? pos : float3::zero, localRot_[node], localScale_[node]);
+}
+
+void TransformHierarchy::UpdateWorldTransforms()
+{
+    if (!numDirty_)
+        return;
+
+    PROFILE(TransformHierarchy_UpdateWorldTransforms);
+
+    // Each dirty chain is resolved from its closest clean ancestor, so every dirty node is computed once, after its parent.
+    // The nodes are visited in storage order, so the local transforms are read linearly.
+    for(NodeId node = 0; node < alive_.size() && numDirty_; ++node)
+        if (alive_[node] && dirty_[node])
+            UpdateDirtyChain(node);
+}
+
+void TransformHierarchy::UpdateDirtyChain(NodeId node)
+{
+    stack_.clear();
+    for(NodeId n = node; n != NoNode && dirty_[n]; n = parent_[n])
+        stack_.push_back(n);
+    while(!stack_.empty())
+    {
+        NodeId n = stack_.back();
+        stack_.pop_back();
+        NodeId parent = parent_[n];
+        // An invalid position is treated as zero
+        float3 localPos = LocalTransformStorage(n).pos;
+        if (!localPos.IsFinite())
+            localPos = float3::zero;
+        if (parent != NoNode)
+        {
+            // Same as Ogre::Node::_updateFromParent with orientation and scale inheritance
+            worldRot_[n] = worldRot_[parent] * localRot_[n];
+            worldScale_[n] = worldScale_[parent].Mul(localScale_[n]);
+            worldPos_[n] = worldRot_[parent].Transform(worldScale_[parent].Mul(localPos)) + worldPos_[parent];
+        }
+        else
+        {
+            worldRot_[n] = localRot_[n];
+            worldScale_[n] = localScale_[n];
+            worldPos_[n] = localPos;
+        }
+        world_[n] = float3x4::FromTRS(worldPos_[n], worldRot_[n], worldScale_[n]);
+        dirty_[n] = 0;
+        --numDirty_;
+    }
+}
+
+void TransformHierarchy::Unlink(NodeId node)
+{
+    NodeId parent = parent_[node];
+    if (prevSibling_[node] != NoNode)
+        nextSibling_[prevSibling_[node]] = nextSibling_[node];
+    else if (parent != NoNode)
+        firstChild_[parent] = nextSibling_[node];
+    if (nextSibling_[node] != NoNode)
+        prevSibling_[nextSibling_[node]] = prevSibling_[node];
+    parent_[node] = NoNode;
+    prevSibling_[node] = NoNode;
+    nextSibling_[node] = NoNode;
+}
+
+void TransformHierarchy::MarkDirty(NodeId node)
+{
+    if (dirty_[node])
+        return;
+
+    stack_.clear();
+    stack_.push_back(node);
+    while(!stack_.empty())
+    {
+        NodeId n = stack_.back();
+        stack_.pop_back();
+        dirty_[n] = 1;
+        ++numDirty_;
+        for(NodeId child = firstChild_[n]; child != NoNode; child = nextSibling_[child])
+            if (!dirty_[child])
+                stack_.push_back(child);
+    }
+}
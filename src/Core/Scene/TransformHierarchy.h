@@ -0,0 +1,145 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Math/float3.h"
+#include "Math/float3x4.h"
+#include "Math/Quat.h"
+#include "Transform.h"
+
+#include <vector>
+
+/// Lightweight transform hierarchy that caches the world transforms of EC_Placeable components.
+/** Each placeable has a node. The nodes are stored contiguously in struct-of-arrays layout and addressed by index.
+    Changing the local transform or the parent of a node marks the node and its descendants dirty; the world transform
+    of a dirty node is recomputed on demand from its closest clean ancestor downwards, so that moving a node is
+    O(number of descendants not yet dirty) and reading a world transform is O(number of dirty ancestors).
+    UpdateWorldTransforms() recomputes all dirty nodes in one pass, and is called by Scene once per frame.
+
+    The local transforms are stored in fixed-size chunks, which keeps their addresses stable as nodes are added. EC_Placeable
+    binds its transform attribute to this storage with Attribute::BindStorage(), so the attribute is a view over the hierarchy,
+    and the world transform pass reads the transforms of all placeables from contiguous memory instead of the components.
+
+    Transforms are concatenated like Ogre scene nodes do, ie. the derived scale is the componentwise product of the
+    scales along the chain, so the results match EC_Placeable's scene node also for non-uniformly scaled parents.
+    Without an Ogre world, f.ex. on a server run with --headless --norender, the hierarchy is the only source of
+    placeable world transforms.
+    Not thread-safe. Owned by Scene, see Scene::GetTransformHierarchy().
+    \ingroup Scene_group */
+class TransformHierarchy
+{
+public:
+    typedef u32 NodeId;
+
+    /// Invalid node ID, also used as the parent ID of the nodes at the root.
+    static const NodeId NoNode = 0xFFFFFFFF;
+
+    TransformHierarchy();
+    ~TransformHierarchy();
+
+    /// Creates a node at the root, with an identity transform.
+    NodeId CreateNode();
+
+    /// Destroys a node. Its children are moved to the root, keeping their local transforms.
+    void DestroyNode(NodeId node);
+
+    /// Sets the parent of a node.
+    /** @param parent New parent, or NoNode to move the node to the root
+        @return False if the parent is the node itself or one of its descendants, in which case the parent is not changed */
+    bool SetParent(NodeId node, NodeId parent);
+
+    /// Returns the parent of a node, or NoNode if the node is at the root.
+    NodeId Parent(NodeId node) const;
+
+    /// Sets the local->parent transform of a node, and marks the node and its descendants dirty.
+    void SetLocalTransform(NodeId node, const Transform &transform);
+
+    /// Returns the storage of the local->parent transform of a node. The address stays valid until the node is destroyed.
+    /** After writing to the storage directly, call LocalTransformChanged(). The node must be valid. */
+    Transform &LocalTransformStorage(NodeId node) { return localTransforms_[node / cChunkSize][node % cChunkSize]; }
+
+    /// Marks the node and its descendants dirty after its local transform storage has been written to.
+    void LocalTransformChanged(NodeId node);
+
+    /// Returns the local->parent transform of a node.
+    float3x4 LocalTransform(NodeId node) const;
+
+    /// Returns the local->world transform of a node, recomputing it and the transforms of its dirty ancestors if necessary.
+    float3x4 WorldTransform(NodeId node) { return Update(node) ? world_[node] : float3x4::identity; }
+
+    /// Returns the world position of a node, recomputing it if necessary.
+    float3 WorldPosition(NodeId node) { return Update(node) ? worldPos_[node] : float3::zero; }
+
+    /// Returns the world orientation of a node, recomputing it if necessary.
+    Quat WorldOrientation(NodeId node) { return Update(node) ? worldRot_[node] : Quat::identity; }
+
+    /// Returns the world scale of a node, recomputing it if necessary.
+    float3 WorldScale(NodeId node) { return Update(node) ? worldScale_[node] : float3::one; }
+
+    /// Recomputes the world transforms of all dirty nodes, parents before their children.
+    void UpdateWorldTransforms();
+
+    /// Returns the number of live nodes.
+    uint NumNodes() const { return numNodes_; }
+
+private:
+    /// Number of local transforms in a storage chunk
+    static const uint cChunkSize = 256;
+
+    TransformHierarchy(const TransformHierarchy &);
+    void operator =(const TransformHierarchy &);
+
+    /// Returns whether the node ID refers to a live node.
+    bool IsValid(NodeId node) const { return node < alive_.size() && alive_[node]; }
+
+    /// Recomputes the world transform of a node and its dirty ancestors. Returns false if the node is not valid.
+    bool Update(NodeId node)
+    {
+        if (!IsValid(node))
+            return false;
+        if (dirty_[node])
+            UpdateDirtyChain(node);
+        return true;
+    }
+
+    /// Recomputes the world transforms of a dirty node and its dirty ancestors, from the closest clean ancestor downwards.
+    void UpdateDirtyChain(NodeId node);
+
+    /// Unlinks a node from the child list of its parent.
+    void Unlink(NodeId node);
+
+    /// Marks a node and its descendants dirty. Subtrees that are already dirty are skipped, as their descendants are dirty too.
+    void MarkDirty(NodeId node);
+
+    /// Local->parent transforms by node, in chunks of cChunkSize
+    std::vector<Transform*> localTransforms_;
+    /// Orientation of the local transform by node, converted from the Euler angles of the transform
+    std::vector<Quat> localRot_;
+    /// Scale of the local transform by node, clamped above zero
+    std::vector<float3> localScale_;
+    /// Cached world transforms by node, valid when the node is not dirty
+    std::vector<float3> worldPos_;
+    std::vector<Quat> worldRot_;
+    std::vector<float3> worldScale_;
+    std::vector<float3x4> world_;
+    /// Parent by node
+    std::vector<NodeId> parent_;
+    /// First child by node
+    std::vector<NodeId> firstChild_;
+    /// Next sibling by node
+    std::vector<NodeId> nextSibling_;
+    /// Previous sibling by node
+    std::vector<NodeId> prevSibling_;
+    /// Dirty flag by node. Invariant: the descendants of a dirty node are dirty.
+    std::vector<u8> dirty_;
+    /// Live flag by node
+    std::vector<u8> alive_;
+    /// Destroyed node IDs for reuse
+    std::vector<NodeId> freeNodes_;
+    /// Scratch stack for the traversals
+    std::vector<NodeId> stack_;
+    /// Number of dirty live nodes
+    uint numDirty_;
+    uint numNodes_;
+};
@@ -249,6 +249,8 @@ QList<Entity *> SceneImporter::Import(const QString &filename, const QString &in
         LogInfo("Creating entities");
 
         Quat rot = worldtransform.Orientation();
+        // Signal the created entities and their components only once the whole hierarchy has been created
+        SceneBatchGuard batch(scene_.get());
         ProcessNodeForCreation(ret, node_elem, worldtransform.pos, rot, worldtransform.scale, change, prefix, flipyz, replace);
     }
     catch(Exception& e)
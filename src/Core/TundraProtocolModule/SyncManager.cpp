@@ -134,6 +134,8 @@ void SyncManager::RegisterToScene(ScenePtr scene)
         SLOT( OnComponentRemoved(Entity*, IComponent*, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( EntityCreated(Entity*, AttributeChange::Type) ),
         SLOT( OnEntityCreated(Entity*, AttributeChange::Type) ));
+    connect(sceneptr, SIGNAL( EntitiesCreated(const QList<Entity *> &, AttributeChange::Type) ),
+        SLOT( OnEntitiesCreated(const QList<Entity *> &, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( EntityRemoved(Entity*, AttributeChange::Type) ),
         SLOT( OnEntityRemoved(Entity*, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( ActionTriggered(Entity *, const QString &, const QStringList &, EntityAction::ExecTypeField) ),
@@ -363,6 +365,10 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
         return;
     if ((change != AttributeChange::Replicate) || (entity->IsLocal()))
         return;
+    // Entities created in a scene batch have already been handled in OnEntitiesCreated
+    ScenePtr scene = scene_.lock();
+    if (scene && scene->IsCommittedInBatch(entity))
+        return;
 
     if (owner_->IsServer())
     {
@@ -386,6 +392,42 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
     }
 }
 
+void SyncManager::OnEntitiesCreated(const QList<Entity *> &entities, AttributeChange::Type change)
+{
+    if (change != AttributeChange::Replicate)
+        return;
+    
+    PROFILE(SyncManager_OnEntitiesCreated);
+    
+    if (owner_->IsServer())
+    {
+        UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+        {
+            if (!(*i)->syncState)
+                continue;
+            SceneSyncState &syncState = *(*i)->syncState;
+            foreach(Entity *entity, entities)
+            {
+                if (entity->IsLocal())
+                    continue;
+                syncState.MarkEntityDirty(entity->Id());
+                if (syncState.entities[entity->Id()].removed)
+                {
+                    LogWarning("An entity with ID " + QString::number(entity->Id()) + " is queued to be deleted, but a new entity \"" + 
+                        entity->Name() + "\" is to be added to the scene!");
+                }
+            }
+        }
+    }
+    else
+    {
+        foreach(Entity *entity, entities)
+            if (!entity->IsLocal())
+                server_syncstate_.MarkEntityDirty(entity->Id());
+    }
+}
+
 void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
 {
     assert(entity);
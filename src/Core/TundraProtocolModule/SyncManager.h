@@ -78,6 +78,9 @@ private slots:
     
     /// Trigger sync of entity creation
     void OnEntityCreated(Entity* entity, AttributeChange::Type change);
+
+    /// Trigger sync of entities created in a scene batch
+    void OnEntitiesCreated(const QList<Entity *> &entities, AttributeChange::Type change);
     
     /// Trigger sync of entity removal
     void OnEntityRemoved(Entity* entity, AttributeChange::Type change);
@@ -320,21 +320,15 @@ void EC_HoveringText::Redraw()
 
 void EC_HoveringText::UpdateSignals()
 {
-    disconnect(this, SLOT(OnAttributeUpdated(IComponent *, IAttribute *)));
+    // Listen to our own attribute changes rather than the scene's, as the scene does not signal
+    // individual changes when its attribute change journal is enabled
     if(ParentEntity())
-    {
-        Scene *scene = ParentEntity()->ParentScene();
-        if(scene)
-        connect(scene, SIGNAL(AttributeChanged(IComponent*, IAttribute*, AttributeChange::Type)),
-                this, SLOT(OnAttributeUpdated(IComponent*, IAttribute*))); 
-    }
+        connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)),
+                this, SLOT(OnAttributeUpdated(IAttribute*)), Qt::UniqueConnection);
 }
 
-void EC_HoveringText::OnAttributeUpdated(IComponent *component, IAttribute *attribute)
+void EC_HoveringText::OnAttributeUpdated(IAttribute *attribute)
 {
-    if(component != this)
-        return;
-
     if(font.Name() == attribute->Name() || fontSize.Name() == attribute->Name())
     {
         SetFont(QFont(font.Get(), fontSize.Get()));
@@ -205,7 +205,7 @@ private slots:
     void UpdateSignals();
 
     /// Handles attribute updates.
-    void OnAttributeUpdated(IComponent *component, IAttribute *attribute);
+    void OnAttributeUpdated(IAttribute *attribute);
 
 private:
     
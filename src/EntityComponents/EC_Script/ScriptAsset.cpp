@@ -3,6 +3,7 @@
 #include <boost/regex.hpp>
 #include <QList>
 #include <QDir>
+#include <QScriptEngine>
 #include "MemoryLeakCheck.h"
 
 #include "ScriptAsset.h"
@@ -16,6 +17,10 @@ ScriptAsset::~ScriptAsset()
 void ScriptAsset::DoUnload()
 {
     scriptContent = "";
+    program = QScriptProgram();
+    syntaxValid = false;
+    syntaxError = "";
+    syntaxErrorLine = 0;
     references.clear();
 }
 
@@ -24,6 +29,13 @@ bool ScriptAsset::DeserializeFromData(const u8 *data, size_t numBytes, const boo
     QByteArray arr((const char *)data, numBytes);
     scriptContent = arr;
 
+    // Check the syntax and create the program once here, instead of in every script instance that runs this asset
+    QScriptSyntaxCheckResult syntaxResult = QScriptEngine::checkSyntax(scriptContent);
+    syntaxValid = syntaxResult.state() == QScriptSyntaxCheckResult::Valid;
+    syntaxError = syntaxValid ? "" : syntaxResult.errorMessage();
+    syntaxErrorLine = syntaxValid ? 0 : syntaxResult.errorLineNumber();
+    program = QScriptProgram(scriptContent, Name());
+
     ParseReferences();
     assetAPI->AssetLoadCompleted(Name());
     return true;
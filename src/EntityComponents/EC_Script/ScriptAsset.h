@@ -5,12 +5,16 @@
 #include <boost/shared_ptr.hpp>
 #include "IAsset.h"
 
+#include <QScriptProgram>
+
 class ScriptAsset : public IAsset
 {
     Q_OBJECT;
 public:
     ScriptAsset(AssetAPI *owner, const QString &type_, const QString &name_) :
-        IAsset(owner, type_, name_)
+        IAsset(owner, type_, name_),
+        syntaxValid(false),
+        syntaxErrorLine(0)
     {
     }
 
@@ -35,6 +39,19 @@ public:
 
     QString scriptContent;
 
+    /// The script content compiled into a program on load, shared by all the script instances that run this asset.
+    /** Each script engine compiles the program once, instead of once per evaluation. */
+    QScriptProgram program;
+
+    /// Whether the syntax of the script content was valid on load. Script instances use this instead of checking the syntax again.
+    bool syntaxValid;
+
+    /// The syntax error message, if the syntax was not valid.
+    QString syntaxError;
+
+    /// The line of the syntax error, if the syntax was not valid.
+    int syntaxErrorLine;
+
     bool IsLoaded() const;
 
 private slots:
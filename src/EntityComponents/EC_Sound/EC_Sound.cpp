@@ -34,11 +34,24 @@ EC_Sound::EC_Sound(Scene* scene):
     playOnLoad(this, "Play on load", false),
     loopSound(this, "Loop sound", false),
     soundGain(this, "Sound gain", 1.0f),
-    spatial(this, "Spatial", true)
+    spatial(this, "Spatial", true),
+    streaming(this, "Streaming", SoundChannel::StreamAuto),
+    priority(this, "Priority", 0)
 {
     static AttributeMetadata metaData("", "0", "1", "0.1");
     soundGain.SetMetadata(&metaData);
 
+    static AttributeMetadata streamingMetadata;
+    static bool metadataInitialized = false;
+    if (!metadataInitialized)
+    {
+        streamingMetadata.enums[SoundChannel::StreamAuto] = "Auto";
+        streamingMetadata.enums[SoundChannel::StreamAlways] = "Always";
+        streamingMetadata.enums[SoundChannel::StreamNever] = "Never";
+        metadataInitialized = true;
+    }
+    streaming.SetMetadata(&streamingMetadata);
+
     connect(this, SIGNAL(ParentEntitySet()), SLOT(UpdateSignals()));
     connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), SLOT(OnAttributeUpdated(IAttribute*)));
 }
@@ -153,7 +166,8 @@ void EC_Sound::PlaySound()
 
     if (placeable && spatial.Get() && soundListenerExists)
     {
-        soundChannel = GetFramework()->Audio()->PlaySound3D(placeable->WorldPosition(), audioAsset, SoundChannel::Triggered);
+        soundChannel = GetFramework()->Audio()->PlaySound3D(placeable->WorldPosition(), audioAsset, SoundChannel::Triggered,
+            SoundChannelPtr(), (SoundChannel::StreamingMode)streaming.Get());
         if (soundChannel)
             soundChannel->SetRange(soundInnerRadius.Get(), soundOuterRadius.Get(), 2.0f);
         
@@ -165,7 +179,8 @@ void EC_Sound::PlaySound()
     }
     else // Play back sound as a nonpositional sound, if no EC_Placeable was found or if spatial was not set.
     {
-        soundChannel = GetFramework()->Audio()->PlaySound(audioAsset, SoundChannel::Ambient);
+        soundChannel = GetFramework()->Audio()->PlaySound(audioAsset, SoundChannel::Ambient, SoundChannelPtr(),
+            (SoundChannel::StreamingMode)streaming.Get());
         disconnect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(ConstantPositionUpdate()));
     }
 
@@ -173,6 +188,7 @@ void EC_Sound::PlaySound()
     {
         soundChannel->SetGain(soundGain.Get());
         soundChannel->SetLooped(loopSound.Get());
+        soundChannel->SetPriority(priority.Get());
     }
 }
 
@@ -190,9 +206,16 @@ void EC_Sound::UpdateSoundSettings()
         soundChannel->SetGain(soundGain.Get());
         soundChannel->SetLooped(loopSound.Get());
         soundChannel->SetRange(soundInnerRadius.Get(), soundOuterRadius.Get(), 2.0f);
+        soundChannel->SetPriority(priority.Get());
     }
 }
 
+void EC_Sound::SeekSound(float seconds)
+{
+    if (soundChannel)
+        soundChannel->Seek(seconds);
+}
+
 EntityPtr EC_Sound::GetActiveSoundListener()
 {
 #ifdef _DEBUG
@@ -46,6 +46,13 @@ UpdateSoundSettings() to apply those changes into the Audio API.
 <div>If true, the audio source is played back as a spatial (3D) sound source. This requires a 
 EC_Placeable component to be present in the same entity as this EC_Sound component. Otherwise,
 the sound is played back as a nonspatial audio clip.</div> 
+<li>enum: streaming
+<div>Whether the sound is decoded in the background while it plays, instead of being decoded fully when loaded.
+Auto streams Ogg Vorbis files that are larger than the audio streaming threshold, Always streams all Ogg Vorbis files,
+and Never decodes all files fully. Takes effect when the sound is played.</div> 
+<li>int: priority
+<div>When there are more sounds playing than the audio system mixes, the sounds with higher priority are mixed before
+more audible sounds with lower priority.</div> 
 </ul>
 
 <b>Exposes the following scriptable functions:</b>
@@ -53,6 +60,7 @@ the sound is played back as a nonspatial audio clip.</div>
 <li>"PlaySound": Starts playing the sound.
 <li>"StopSound": Stops playing the sound.
 <li>"UpdateSoundSettings": Refreshes all sound attributes.
+<li>"SeekSound": Moves the playback position of the sound.
 </ul>
 
 <b>Reacts on the following actions:</b>
@@ -107,6 +115,14 @@ public:
     Q_PROPERTY(bool spatial READ getspatial WRITE setspatial);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, spatial);
 
+    /// Whether the sound is streamed, see SoundChannel::StreamingMode.
+    Q_PROPERTY(int streaming READ getstreaming WRITE setstreaming);
+    DEFINE_QPROPERTY_ATTRIBUTE(int, streaming);
+
+    /// Priority for being mixed when there are more sounds playing than the audio system mixes.
+    Q_PROPERTY(int priority READ getpriority WRITE setpriority);
+    DEFINE_QPROPERTY_ATTRIBUTE(int, priority);
+
 public slots:
     /// Starts playing the sound.
     void PlaySound();
@@ -117,6 +133,10 @@ public slots:
     /// Updates all sound attributes.
     void UpdateSoundSettings();
 
+    /// Moves the playback position of the sound.
+    /** @param seconds Time from the start of the sound */
+    void SeekSound(float seconds);
+
     /// Finds from the current scene the SoundListener that is currently active, or null if no SoundListener is active.
     EntityPtr GetActiveSoundListener();
 